@@ -0,0 +1,285 @@
+#!/usr/bin/env python3
+"""
+tc_quic端到端吞吐/精度测试
+在一台主机上建两个网络命名空间，用veth经tc_quic转发，内置UDP发包端/收包端，
+扫描帧大小和发送速率，报告实际pps、Gbps、单向时延相对脚本时延的误差、丢包率相对脚本丢包率的误差
+只需root权限，不需要外部网络和其他依赖
+"""
+
+import argparse
+import json
+import os
+import shutil
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+from typing import Dict, List
+
+NS_A, NS_B = 'tcq_a', 'tcq_b'              # 发包端 / 收包端命名空间
+VETH_A, VETH_B = 'tcq_a', 'tcq_b'          # 命名空间内的veth（宿主侧为 *_h，交给tc_quic）
+IP_A, IP_B = '10.77.0.1', '10.77.0.2'
+PORT = 9777
+HDR = struct.Struct('!QQ')                 # 负载头：序号、发送时间（CLOCK_REALTIME纳秒）
+L2_OVERHEAD = 14 + 20 + 8                  # 以太网 + IPv4 + UDP头
+SO_TIMESTAMPNS = getattr(socket, 'SO_TIMESTAMPNS', 35)
+
+
+def sh(cmd: str, check: bool = True) -> subprocess.CompletedProcess:
+    """执行一条shell命令（失败时check=True抛出）"""
+    return subprocess.run(cmd, shell=True, check=check, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+
+
+# --------------- 发包端 / 收包端（在命名空间内以 --role 运行本文件） ---------------
+def run_blaster(size: int, mbps: float, duration: float) -> None:
+    """
+    按帧大小和速率发送UDP包（mbps<=0表示尽力发送）
+
+    按时间补发欠下的包，每轮最多补一小批，避免调度延迟后突发过大
+    """
+    payload = max(size - L2_OVERHEAD, HDR.size)
+    pad = b'\0' * (payload - HDR.size)
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, 4 << 20)
+    s.connect((IP_B, PORT))
+    pps = mbps * 1e6 / 8 / size if mbps > 0 else 0
+    seq = 0
+    blocked = 0
+    t0 = time.time()
+    end = t0 + duration
+    while True:
+        now = time.time()
+        if now >= end:
+            break
+        due = int((now - t0) * pps) + 1 if pps > 0 else seq + 64
+        burst = min(due - seq, 64)
+        if burst <= 0:
+            time.sleep(max(0.0, min(0.0005, seq / pps - (now - t0))))
+            continue
+        for _ in range(burst):
+            try:
+                s.send(HDR.pack(seq, time.time_ns()) + pad)
+                seq += 1
+            except BlockingIOError:
+                blocked += 1
+            except OSError:             # ENOBUFS：发送队列满，计入blocked，不算已发送
+                blocked += 1
+    print(json.dumps({'sent': seq, 'elapsed': time.time() - t0, 'blocked': blocked}), flush=True)
+
+
+def run_sink(idle: float) -> None:
+    """
+    接收UDP包，直到idle秒内没有新包（第一个包到达前最多等30秒）
+
+    单向时延 = 内核接收时间戳（SO_TIMESTAMPNS） - 负载中的发送时间，两个命名空间共用同一个时钟
+    """
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    try:
+        s.setsockopt(socket.SOL_SOCKET, getattr(socket, 'SO_RCVBUFFORCE', 33), 64 << 20)
+    except OSError:
+        s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 64 << 20)
+    s.setsockopt(socket.SOL_SOCKET, SO_TIMESTAMPNS, 1)
+    s.bind(('0.0.0.0', PORT))
+    print('ready', flush=True)
+    s.settimeout(30)
+    received = 0
+    max_seq = -1
+    reordered = 0
+    delays: List[int] = []
+    first = last = 0.0
+    while True:
+        try:
+            data, anc, _, _ = s.recvmsg(2048, 64)
+        except socket.timeout:
+            break
+        if len(data) < HDR.size:
+            continue
+        seq, sent_ns = HDR.unpack_from(data)
+        rx_ns = time.time_ns()
+        for level, kind, value in anc:
+            if level == socket.SOL_SOCKET and kind == SO_TIMESTAMPNS:
+                sec, nsec = struct.unpack('qq', value[:16])
+                rx_ns = sec * 1000000000 + nsec
+        now = time.time()
+        if received == 0:
+            first = now
+            s.settimeout(idle)
+        last = now
+        received += 1
+        if seq < max_seq:
+            reordered += 1
+        max_seq = max(max_seq, seq)
+        delays.append(rx_ns - sent_ns)
+    delays.sort()
+    result: Dict = {'received': received, 'reordered': reordered, 'span': last - first}
+    if delays:
+        pick = lambda q: delays[min(len(delays) - 1, int(len(delays) * q))] / 1000.0
+        result.update({'delay_min_us': delays[0] / 1000.0, 'delay_p50_us': pick(0.5),
+                       'delay_p99_us': pick(0.99), 'delay_max_us': delays[-1] / 1000.0})
+    print(json.dumps(result), flush=True)
+
+
+# --------------- 测试编排 ---------------
+class NetnsHarness:
+    """命名空间拓扑 + 一组扫描点"""
+
+    def __init__(self, args: argparse.Namespace):
+        self.args = args
+        self.workdir = tempfile.mkdtemp(prefix='tcq_harness_')
+        self.self_path = os.path.abspath(__file__)
+
+    def setup(self) -> None:
+        """建两个命名空间和两对veth，宿主侧交给tc_quic；静态邻居表，避免ARP经过仿真链路被丢"""
+        self.teardown()
+        for ns, veth, ip in ((NS_A, VETH_A, IP_A), (NS_B, VETH_B, IP_B)):
+            sh(f'ip netns add {ns}')
+            sh(f'ip link add {veth} type veth peer name {veth}_h')
+            sh(f'ip link set {veth} netns {ns}')
+            sh(f'ip -n {ns} addr add {ip}/24 dev {veth}')
+            sh(f'ip netns exec {ns} sysctl -qw net.ipv6.conf.all.disable_ipv6=1', check=False)
+            sh(f'ip -n {ns} link set {veth} up')
+            sh(f'ip -n {ns} link set lo up')
+            sh(f'ip link set {veth}_h up')
+        mac_a = sh(f'ip -n {NS_A} -br link show {VETH_A}').stdout.split()[2]
+        mac_b = sh(f'ip -n {NS_B} -br link show {VETH_B}').stdout.split()[2]
+        sh(f'ip -n {NS_A} neigh replace {IP_B} lladdr {mac_b} dev {VETH_A} nud permanent')
+        sh(f'ip -n {NS_B} neigh replace {IP_A} lladdr {mac_a} dev {VETH_B} nud permanent')
+
+    def teardown(self) -> None:
+        """删除命名空间（veth随之删除）"""
+        for ns in (NS_A, NS_B):
+            sh(f'ip netns del {ns}', check=False)
+
+    def role(self, ns: str, *role_args: str) -> subprocess.Popen:
+        """在命名空间内以指定角色运行本文件"""
+        cmd = ['ip', 'netns', 'exec', ns, sys.executable, self.self_path, '--role'] + list(role_args)
+        return subprocess.Popen(cmd, stdout=subprocess.PIPE, text=True)
+
+    def start_emulator(self, tag: str, total_ms: int) -> (subprocess.Popen, str):
+        """写单事件脚本，启动tc_quic，等到仿真开始"""
+        a = self.args
+        script = os.path.join(self.workdir, f'{tag}.txt')
+        with open(script, 'w') as f:
+            f.write(f'0 {total_ms} {a.bw} {a.delay} {a.loss} harness\n')
+        log = os.path.join(self.workdir, f'{tag}.log')
+        cmd = [a.bin, f'--io={a.io}', f'--srceth={VETH_A}_h', f'--dsteth={VETH_B}_h',
+               f'--script={script}', f'--total_time={total_ms}'] + a.extra.split()
+        proc = subprocess.Popen(cmd, stdout=open(log, 'w'), stderr=subprocess.STDOUT)
+        deadline = time.time() + 10
+        while time.time() < deadline:
+            if proc.poll() is not None:
+                break
+            with open(log, errors='replace') as f:
+                if '网络仿真开始' in f.read():
+                    return proc, log
+            time.sleep(0.05)
+        proc.kill()
+        raise RuntimeError(f'tc_quic未能启动，见 {log}')
+
+    def run_point(self, size: int, load: float) -> Dict:
+        """一个扫描点：tc_quic + 收包端 + 发包端，返回测量结果"""
+        a = self.args
+        tag = f'{size}_{"max" if load <= 0 else int(load)}'
+        idle = 1.0 + a.delay / 1000.0
+        total_ms = int((a.duration + idle + 2) * 1000)
+        emu, log = self.start_emulator(tag, total_ms)
+        try:
+            sink = self.role(NS_B, 'sink', '--idle', str(idle))
+            if sink.stdout.readline().strip() != 'ready':
+                raise RuntimeError('收包端未能启动')
+            blast = self.role(NS_A, 'blast', '--size', str(size), '--mbps', str(load),
+                              '--duration', str(a.duration))
+            tx = json.loads(blast.communicate()[0])
+            rx = json.loads(sink.communicate()[0])
+        finally:
+            emu.wait(timeout=total_ms / 1000.0 + 10)
+        with open(log, errors='replace') as f:
+            verdict = [l.strip() for l in f if l.startswith('结论')]
+        r = {'size': size, 'offered_mbps': load, **tx, **rx, 'verdict': verdict[-1] if verdict else ''}
+        r['tx_pps'] = tx['sent'] / tx['elapsed'] if tx['elapsed'] > 0 else 0
+        r['rx_pps'] = rx['received'] / tx['elapsed'] if tx['elapsed'] > 0 else 0
+        r['rx_gbps'] = r['rx_pps'] * size * 8 / 1e9
+        r['loss_permille'] = (1 - rx['received'] / tx['sent']) * 1000 if tx['sent'] > 0 else 0
+        return r
+
+    def sweep(self) -> List[Dict]:
+        """按帧大小 × 发送速率扫描，逐行打印"""
+        a = self.args
+        one_way_us = a.delay * 1000 / 2
+        print(f'脚本: 带宽 {a.bw} Mbps, 时延 {a.delay} ms（单向 {one_way_us / 1000:.1f} ms）, 丢包 {a.loss}‰, io={a.io}')
+        print(f'{"帧大小":>6} {"发送速率":>9} {"发送pps":>10} {"接收pps":>10} {"接收Gbps":>8} '
+              f'{"时延p50(ms)":>11} {"p99(ms)":>8} {"误差(ms)":>9} {"丢包(‰)":>8} {"误差(‰)":>8}  结论')
+        results = []
+        for size in a.sizes:
+            for load in a.loads:
+                r = self.run_point(size, load)
+                results.append(r)
+                p50 = r.get('delay_p50_us')
+                p99 = r.get('delay_p99_us')
+                fmt = lambda v: f'{v / 1000:.3f}' if v is not None else '-'
+                err = fmt(p50 - one_way_us) if p50 is not None else '-'
+                print(f'{size:>6} {("max" if load <= 0 else f"{load:g}M"):>9} {r["tx_pps"]:>10.0f} {r["rx_pps"]:>10.0f} '
+                      f'{r["rx_gbps"]:>8.3f} {fmt(p50):>11} {fmt(p99):>8} {err:>9} '
+                      f'{r["loss_permille"]:>8.2f} {r["loss_permille"] - a.loss:>8.2f}  {r["verdict"]}', flush=True)
+        return results
+
+
+def parse_list(text: str, conv) -> list:
+    return [conv(x) for x in text.split(',') if x]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='tc_quic端到端吞吐/精度测试（网络命名空间 + veth，需要root）')
+    parser.add_argument('--bin', default='./tc_quic', help='tc_quic可执行文件')
+    parser.add_argument('--io', default='packet', choices=['packet', 'tap', 'uring'],
+                        help='tc_quic后端（tap/uring需要brctl建网桥）')
+    parser.add_argument('--sizes', default='64,512,1500', help='以太网帧大小（字节，逗号分隔）')
+    parser.add_argument('--loads', default='100,1000,max', help='发送速率（Mbps，max=尽力发送，逗号分隔）')
+    parser.add_argument('--duration', type=float, default=3.0, help='每个扫描点的发送时长（秒）')
+    parser.add_argument('--bw', type=int, default=0, help='脚本带宽（Mbps，0=不限速）')
+    parser.add_argument('--delay', type=int, default=20, help='脚本时延（ms，与脚本文件相同：往返，每个方向一半）')
+    parser.add_argument('--loss', type=int, default=0, help='脚本丢包率（‰，每个方向）')
+    parser.add_argument('--extra', default='', help='传给tc_quic的其他参数（如 "--ring_mb=64 --tx_slack=50"）')
+    parser.add_argument('--json', help='把全部结果写入JSON文件')
+    parser.add_argument('--keep', action='store_true', help='结束后保留命名空间和tc_quic日志')
+    parser.add_argument('--role', choices=['blast', 'sink'], help=argparse.SUPPRESS)
+    parser.add_argument('--size', type=int, default=1500, help=argparse.SUPPRESS)
+    parser.add_argument('--mbps', type=float, default=0, help=argparse.SUPPRESS)
+    parser.add_argument('--idle', type=float, default=1.0, help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.role == 'blast':
+        run_blaster(args.size, args.mbps, args.duration)
+        return
+    if args.role == 'sink':
+        run_sink(args.idle)
+        return
+
+    if os.geteuid() != 0:
+        sys.exit('需要root权限（创建网络命名空间）')
+    if not os.access(args.bin, os.X_OK):
+        sys.exit(f'找不到tc_quic: {args.bin}')
+    if args.io != 'packet' and shutil.which('brctl') is None:
+        sys.exit(f'--io={args.io} 需要brctl')
+    args.sizes = parse_list(args.sizes, int)
+    args.loads = parse_list(args.loads, lambda x: 0.0 if x == 'max' else float(x))
+
+    harness = NetnsHarness(args)
+    harness.setup()
+    try:
+        results = harness.sweep()
+        if args.json:
+            with open(args.json, 'w') as f:
+                json.dump(results, f, ensure_ascii=False, indent=2)
+    finally:
+        if args.keep:
+            print(f'命名空间 {NS_A}/{NS_B} 已保留，tc_quic日志在 {harness.workdir}')
+        else:
+            harness.teardown()
+            shutil.rmtree(harness.workdir, ignore_errors=True)
+
+
+if __name__ == '__main__':
+    main()
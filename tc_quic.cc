@@ -24,25 +24,240 @@
 #include <fstream>
 #include <memory>
 #include <functional>
+#include <tuple>
+#include <algorithm>
 #include "tc_quic.hh"
 #include <random>
+#include <cmath>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/perf_event.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <cerrno>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
 //#include "ring_buffer.hh"
 using namespace std;   
 
 
 
+// --------------- ScenarioModel 类实现 ---------------
+/**
+ * @brief 默认模型：Network_Scenario_Generator.py中的四个拥塞等级，步长10秒，平均每个等级停留400秒
+ */
+ScenarioModel::ScenarioModel()
+    : default_trans(true), seed(std::random_device{}()), step_ms(10000), start_level(0),
+      cur_level(0), next_start_ms(0), step_in_phase(0), phase_count(0),
+      base_bw(0), base_delay(0), base_loss(0)
+{
+    levels.push_back({"normal", "正常网络", 100, 120, 50, 100, 0, 1, 0.05, 400000});
+    levels.push_back({"low", "低拥塞", 90, 100, 100, 200, 1, 10, 0.1, 400000});
+    levels.push_back({"medium", "中拥塞", 80, 90, 200, 400, 10, 50, 0.15, 400000});
+    levels.push_back({"high", "高拥塞", 70, 80, 400, 600, 50, 200, 0.2, 400000});
+    trans.assign(levels.size(), std::vector<double>(levels.size(), 1.0));
+}
+
+int ScenarioModel::findLevel(const std::string& name) const {
+    for (size_t i = 0; i < levels.size(); i++) {
+        if (levels[i].name == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 从模型描述文件加载
+ * @param filename 模型文件名
+ * @return bool 是否加载成功
+ * @details 文件格式（#开头为注释，未出现的项使用默认值）：
+ *          seed <种子>
+ *          step_ms <步长ms>
+ *          start <起始等级>
+ *          level <名称> <带宽min> <带宽max> <时延min> <时延max> <丢包min> <丢包max> <波动幅度> <平均停留ms> [显示名]
+ *          trans <从等级> <到等级> <权重>
+ *          出现任何level行时替换全部默认等级；未给出trans时离开某等级后等概率去往其他等级
+ */
+bool ScenarioModel::loadFromFile(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        LOGE("model") << "无法打开模型文件: " << filename;
+        return false;
+    }
+
+    std::string line, start_name;
+    int line_num = 0;
+    bool custom_levels = false;
+    std::vector<std::tuple<std::string, std::string, double>> trans_lines;
+
+    while (std::getline(file, line)) {
+        line_num++;
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+
+        std::istringstream iss(line);
+        std::string key;
+        iss >> key;
+        bool ok = true;
+        if (key == "seed") {
+            ok = static_cast<bool>(iss >> seed);
+        } else if (key == "step_ms") {
+            ok = static_cast<bool>(iss >> step_ms) && step_ms >= 1;
+        } else if (key == "start") {
+            ok = static_cast<bool>(iss >> start_name);
+        } else if (key == "level") {
+            CongestionLevel lv;
+            if (iss >> lv.name >> lv.bw_min >> lv.bw_max >> lv.delay_min >> lv.delay_max
+                    >> lv.loss_min >> lv.loss_max >> lv.fluctuation >> lv.dwell_ms && lv.dwell_ms > 0) {
+                if (!(iss >> lv.label)) {
+                    lv.label = lv.name;
+                }
+                if (!custom_levels) {
+                    levels.clear();
+                    custom_levels = true;
+                }
+                levels.push_back(lv);
+            } else {
+                ok = false;
+            }
+        } else if (key == "trans") {
+            std::string from, to;
+            double weight;
+            if (iss >> from >> to >> weight && weight >= 0) {
+                trans_lines.emplace_back(from, to, weight);
+            } else {
+                ok = false;
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            LOGE("model") << "模型文件第 " << line_num << " 行格式错误: " << line;
+            return false;
+        }
+    }
+
+    // 转移权重：默认等概率去往其他等级，trans行覆盖对应项
+    trans.assign(levels.size(), std::vector<double>(levels.size(), 1.0));
+    default_trans = trans_lines.empty();
+    if (!default_trans) {
+        for (auto& row : trans) {
+            std::fill(row.begin(), row.end(), 0.0);
+        }
+    }
+    for (auto& t : trans_lines) {
+        int from = findLevel(std::get<0>(t));
+        int to = findLevel(std::get<1>(t));
+        if (from < 0 || to < 0) {
+            LOGE("model") << "模型文件中未知的等级: " << std::get<0>(t) << " -> " << std::get<1>(t);
+            return false;
+        }
+        trans[from][to] = std::get<2>(t);
+    }
+
+    start_level = 0;
+    if (!start_name.empty()) {
+        start_level = findLevel(start_name);
+        if (start_level < 0) {
+            LOGE("model") << "模型文件中未知的起始等级: " << start_name;
+            return false;
+        }
+    }
+
+    LOGI("model") << "加载模型文件: " << filename << "（" << levels.size() << " 个等级，步长 "
+                  << step_ms << " ms，种子 " << seed << "）";
+    return true;
+}
+
+void ScenarioModel::reset() {
+    rng.seed(seed);
+    next_start_ms = 0;
+    phase_count = 0;
+    enterLevel(start_level);
+}
+
+/**
+ * @brief 进入一个等级：在范围内随机取基准值（同generate_phase）
+ */
+void ScenarioModel::enterLevel(int level) {
+    const CongestionLevel& lv = levels[level];
+    cur_level = level;
+    step_in_phase = 0;
+    phase_count++;
+    base_bw = std::uniform_real_distribution<double>(lv.bw_min, lv.bw_max)(rng);
+    base_delay = std::uniform_real_distribution<double>(lv.delay_min, lv.delay_max)(rng);
+    base_loss = std::uniform_real_distribution<double>(lv.loss_min, lv.loss_max)(rng);
+}
+
+/**
+ * @brief 在基准值附近波动并限制在范围内（同generate_random_value）
+ */
+double ScenarioModel::fluctuate(double base, double lo, double hi, double fluctuation) {
+    double amount = base * fluctuation;
+    double value = base + std::uniform_real_distribution<double>(-amount, amount)(rng);
+    return std::max(lo, std::min(value, hi));
+}
+
+/**
+ * @brief 生成下一个事件（步长step_ms），必要时先按马尔可夫链切换等级
+ * @return NetworkEvent 只有等级切换后的第一步打印详情
+ */
+NetworkEvent ScenarioModel::next() {
+    if (step_in_phase > 0) {
+        // 每步以step_ms/dwell_ms的概率离开当前等级
+        double leave = (double)step_ms / levels[cur_level].dwell_ms;
+        if (std::uniform_real_distribution<double>(0, 1)(rng) < leave) {
+            std::vector<double> weights = trans[cur_level];
+            if (default_trans) {
+                weights[cur_level] = 0;   // 默认转移：不回到自身
+            }
+            double total = 0;
+            for (double w : weights) {
+                total += w;
+            }
+            if (total > 0) {
+                std::discrete_distribution<int> pick(weights.begin(), weights.end());
+                enterLevel(pick(rng));
+            }
+        }
+    }
+
+    const CongestionLevel& lv = levels[cur_level];
+    int64_t bw = (int64_t)fluctuate(base_bw, lv.bw_min, lv.bw_max, lv.fluctuation);
+    int64_t delay = (int64_t)fluctuate(base_delay, lv.delay_min, lv.delay_max, lv.fluctuation);
+    int loss = (int)fluctuate(base_loss, lv.loss_min, lv.loss_max, lv.fluctuation);
+    step_in_phase++;
+
+    std::string desc = "阶段" + std::to_string(phase_count) + ": " + lv.label;
+    NetworkEvent ev(next_start_ms, step_ms, bw, delay, loss, desc, step_in_phase == 1);
+    next_start_ms += step_ms;
+    return ev;
+}
+
 // --------------- NetworkSimulator 类实现 ---------------
-NetworkSimulator::NetworkSimulator(TapInterface* t0, TapInterface* t1) 
-    : tap0(t0), tap1(t1), running(false), paused(false), total_duration_ms(0) 
+NetworkSimulator::NetworkSimulator(TapInterface* t0, TapInterface* t1, bool reset_link, int segment) 
+    : tap0(t0), tap1(t1), running(false), paused(false), total_duration_ms(0),
+      start_at_us(0), handoff_us(0), predecessor(nullptr), keep_link(false),
+      begun(false), events_done(0), begin_us(0), switch_us(0), segment(segment)
 {
-    // 设置初始参数为无限制
-    tap0->set_bw(0);
-    tap0->set_delay_ms(0);
-    tap0->set_loss(0);
-    
-    tap1->set_bw(0);
-    tap1->set_delay_ms(0);
-    tap1->set_loss(0);
+    if (segment >= 0) {
+        tag = "[" + tap0->get_hop(segment)->get_name() + "]";
+    }
+    // 设置初始参数为无限制（守护进程预先加载下一次运行时不能打断正在进行的运行）
+    if (reset_link) {
+        applyEvent(NetworkEvent());
+    }
 }
 
 NetworkSimulator::~NetworkSimulator() {
@@ -58,10 +273,124 @@ void NetworkSimulator::addEvent(int64_t start_time_ms, int64_t duration_ms,
     event_queue.push(NetworkEvent(start_time_ms, duration_ms, bandwidth, delay_ms, loss_rate, desc));
 }
 
+void NetworkSimulator::addEvent(const NetworkEvent& ev) {
+    event_queue.push(ev);
+}
+
+/**
+ * @brief 把事件参数设置到两个方向（时延按RTT的一半分到每个方向，换算成微秒）
+ * @param ev 事件（默认构造的事件表示无限制）
+ * @note 路径段只设置带宽/时延/丢包/重复/损坏/缓冲；路径段按tap0→tap1的顺序编号，反方向经过的顺序相反
+ */
+void NetworkSimulator::applyEvent(const NetworkEvent& ev) {
+    if (segment >= 0) {
+        PathHop* hops[2] = {tap0->get_hop(segment), tap1->get_hop(tap1->hop_count() - 1 - segment)};
+        for (PathHop* hop : hops) {
+            hop->set_bw(ev.bandwidth);
+            hop->set_delay_ms(ev.delay_ms * 1000 / 2);
+            hop->set_loss(ev.loss);
+            hop->set_dup(ev.dup);
+            hop->set_corrupt(ev.corrupt);
+            hop->set_stealth(ev.stealth);
+            hop->set_buffer(ev.buffer_ms * 1000);
+        }
+        return;
+    }
+    // TODO(bannos)：这里考虑是否只设置tap0的参数，还是两个都设置
+    TapInterface* taps[2] = {tap0, tap1};
+    for (TapInterface* tap : taps) {
+        tap->set_bw(ev.bandwidth);
+        tap->set_delay_ms(ev.delay_ms * 1000 / 2);
+        tap->set_loss(ev.loss);
+        tap->set_dup(ev.dup);
+        tap->set_corrupt(ev.corrupt);
+        tap->set_stealth(ev.stealth);
+        tap->set_outage(ev.outage, ev.outage_period_ms * 1000, ev.outage_len_ms * 1000);
+        tap->set_cross_traffic(ev.xt_model, ev.xt_rate, ev.xt_flows, ev.xt_qlim_ms * 1000);
+        tap->set_buffer(ev.buffer_ms * 1000);
+        tap->set_aqm(ev.aqm, ev.ecn_thresh_us, ev.aqm_target_ms * 1000);
+    }
+}
+
+/**
+ * @brief 设置交接时间：到达后本次运行直接结束，链路保持最后一个事件的参数，由下一次运行覆盖
+ * @param stop_us epoch微秒（替换先前设置的交接时间）
+ */
+void NetworkSimulator::setHandoff(int64_t stop_us) {
+    handoff_us = stop_us;
+}
+
+bool NetworkSimulator::handedOff(int64_t now_us) const {
+    int64_t h = handoff_us;
+    return h > 0 && now_us >= h;
+}
+
+/**
+ * @brief 脚本中最后一个事件的结束时间（START未指定总时长时使用）
+ * @return int64_t 毫秒（使用模型时为0）
+ */
+int64_t NetworkSimulator::getScriptEnd() const {
+    auto events = event_queue;
+    int64_t end = 0;
+    while (!events.empty()) {
+        const NetworkEvent& ev = events.top();
+        end = std::max(end, ev.start_time_ms + ev.duration_ms);
+        events.pop();
+    }
+    return end;
+}
+
+/**
+ * @brief 估计每个方向在途字节数的峰值：带宽 ×（单向时延 + 瓶颈缓冲时长），取所有事件的最大值
+ * @return int64_t 字节（有不限速的事件、使用模型或没有事件时为-1，由调用者取默认值）
+ */
+int64_t NetworkSimulator::getPeakInflight() const {
+    if (model) {
+        return -1;
+    }
+    auto events = event_queue;
+    int64_t peak = -1;
+    while (!events.empty()) {
+        const NetworkEvent& ev = events.top();
+        if (ev.bandwidth <= 0) {
+            return -1;  // 不限速时在途帧只受发送方限制
+        }
+        int64_t queue_ms = ev.buffer_ms > 0 ? ev.buffer_ms : POOL_QUEUE_ALLOW_MS;
+        int64_t bytes = (int64_t)(ev.bandwidth * 125000.0 * (ev.delay_ms / 2.0 + queue_ms) / 1000.0);
+        peak = std::max(peak, bytes);
+        events.pop();
+    }
+    return peak;
+}
+
 void NetworkSimulator::setTotalDuration(int64_t duration_ms) {
     total_duration_ms = duration_ms;
 }
 
+void NetworkSimulator::setModel(std::unique_ptr<ScenarioModel> m) {
+    model = std::move(m);
+}
+
+/**
+ * @brief 取下一个事件：设置了模型时由模型生成（不会耗尽），否则从事件队列中弹出
+ * @param events 事件队列副本
+ * @param ev 输出：下一个事件
+ * @return bool false=没有更多事件
+ */
+bool NetworkSimulator::nextEvent(std::priority_queue<NetworkEvent, std::vector<NetworkEvent>,
+                                 std::greater<NetworkEvent>>& events, NetworkEvent& ev) {
+    if (model) {
+        ev = model->next();
+        return true;
+    }
+    if (events.empty()) {
+        return false;
+    }
+    ev = events.top();
+    events.pop();
+    return true;
+}
+
 void NetworkSimulator::start() {
     if (running) return;
     
@@ -90,80 +419,177 @@ void NetworkSimulator::stop() {
 }
 
 void NetworkSimulator::runSimulation() {
-    cout << "\n========== 网络仿真开始 ==========" << endl;
-    cout << "总时长: " << total_duration_ms << " ms" << endl;
-    cout << "事件数: " << event_queue.size() << endl;
-    cout << "==================================" << endl;
+    // 定时开始：守护进程提前创建并启动运行，开始时刻不受线程创建和脚本解析的影响
+    while (running && start_at_us > 0 && !handedOff(tap0->get_us())) {
+        int64_t left = start_at_us - tap0->get_us();
+        if (left <= 0) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(left < 10000 ? left : 10000));
+    }
+    // 等被接替的运行退出（它在交接时间直接返回），两次运行不会同时修改链路参数，中间也没有无限制的空档
+    while (running && predecessor && predecessor->isRunning()) {
+        std::this_thread::yield();
+    }
+    if (!running || handedOff(tap0->get_us())) {
+        LOGI("sim") << "[运行取消] 开始前被停止或被下一次运行替换";
+        running = false;
+        return;
+    }
+    begin_us = tap0->get_us();
+    switch_us = start_at_us > 0 ? begin_us - start_at_us : 0;
+    SloSnapshot slo_base0 = tap0->slo_snapshot();
+    SloSnapshot slo_base1 = tap1->slo_snapshot();
+    begun = true;
+
+    if (segment >= 0) {
+        LOGI("sim") << tag << " 路径段场景开始，事件数: " << event_queue.size();
+    } else {
+        LogLine banner(LL_INFO, "sim");
+        banner << "\n========== 网络仿真开始 ==========\n总时长: " << total_duration_ms << " ms\n";
+        if (model) {
+            banner << "事件来源: 马尔可夫模型（步长 " << model->getStepMs() << " ms）\n";
+        } else {
+            banner << "事件数: " << event_queue.size() << "\n";
+        }
+        banner << "==================================";
+    }
     
-    // 创建事件队列的副本用于处理
+    // 创建事件队列的副本用于处理（模型则回到起始状态，逐步生成）
     auto events = event_queue;
+    if (model) {
+        model->reset();
+    }
+    NetworkEvent next_event;
+    bool has_next = nextEvent(events, next_event);
     std::unique_ptr<NetworkEvent> current_event(nullptr);
     int64_t event_end_time = 0;
     int event_counter = 0;
     
     int64_t start_time = tap0->get_ms();
-    int64_t last_print_time = start_time;
+    int64_t last_print_time = 0;
     
-    while (running && (tap0->get_ms() - start_time) < total_duration_ms) {
+    while (running && (tap0->get_ms() - start_time) < total_duration_ms && !handedOff(tap0->get_us())) {
         // 处理暂停
         while (paused && running) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
         
         int64_t current_time = tap0->get_ms() - start_time;
+        bool next_due = has_next && current_time >= next_event.start_time_ms;
         
         // 检查当前事件是否结束
         if (current_event && current_time >= event_end_time) {
-            cout << "[事件结束][" << current_time << "ms] " 
-                 << current_event->description << endl;
-            
-            // 恢复为默认参数（无限制）
-            tap0->set_bw(0);
-            tap0->set_delay_ms(0);
-            tap0->set_loss(0);
+            if (current_event->verbose) {
+                LOGI("sim") << tag << "[事件结束][" << current_time << "ms] " << current_event->description;
+            }
             
-            tap1->set_bw(0);
-            tap1->set_delay_ms(0);
-            tap1->set_loss(0);
+            // 恢复为默认参数（无限制）；下一个事件紧接着开始时直接由它覆盖，避免出现不限速的空档
+            if (!next_due) {
+                applyEvent(NetworkEvent());
+            }
             
             current_event.reset(nullptr);
         }
         
         // 检查是否有新事件开始
-        if (!events.empty() && current_time >= events.top().start_time_ms) {
-            current_event = std::make_unique<NetworkEvent>(events.top());
-            events.pop();
+        while (next_due) {
+            current_event = std::make_unique<NetworkEvent>(next_event);
+            has_next = nextEvent(events, next_event);
+            // 落后多个步长时（细粒度模型）连续取出所有已到期的事件，只应用最后一个
+            next_due = has_next && current_time >= next_event.start_time_ms;
             
             event_end_time = current_event->start_time_ms + current_event->duration_ms;
             event_counter++;
+            events_done = event_counter;
             
-            cout << "\n[事件开始 #" << event_counter << "][" << current_time << "ms] " 
-                 << current_event->description << endl;
-            cout << "  带宽: " << current_event->bandwidth << " bps" << endl;
-            cout << "  延迟: " << current_event->delay_ms << " ms" << endl;
-            cout << "  丢包: " << current_event->loss << "‰" << endl;
-            cout << "  持续时间: " << current_event->duration_ms << " ms" << endl;
+            if (current_event->verbose) {
+                LogLine msg(LL_INFO, "sim");  // 一个事件的参数作为一条日志
+                msg << "\n" << tag << "[事件开始 #" << event_counter << "][" << current_time << "ms] "
+                    << current_event->description << "\n";
+                msg << "  带宽: " << current_event->bandwidth << " bps\n";
+                msg << "  延迟: " << current_event->delay_ms << " ms\n";
+                msg << "  丢包: " << current_event->loss << "‰\n";
+                if (current_event->outage != OUTAGE_NONE) {
+                    msg << "  链路中断: " << (current_event->outage == OUTAGE_HOLD ? "保留队列" : "清空队列");
+                    if (current_event->outage_period_ms > 0) {
+                        msg << "，每 " << current_event->outage_period_ms << " ms中断 "
+                            << current_event->outage_len_ms << " ms";
+                    }
+                    msg << "\n";
+                }
+                if (current_event->xt_model != XT_NONE) {
+                    const char *names[] = {"none", "cbr", "poisson", "pareto", "aimd"};
+                    msg << "  背景流量: " << names[current_event->xt_model];
+                    if (current_event->xt_model == XT_AIMD) {
+                        msg << " " << current_event->xt_flows << " 条流";
+                    } else {
+                        msg << " " << current_event->xt_rate << " Mbps";
+                    }
+                    msg << "，缓冲 " << current_event->xt_qlim_ms << " ms\n";
+                }
+                if (current_event->buffer_ms > 0) {
+                    msg << "  瓶颈缓冲: " << current_event->buffer_ms << " ms\n";
+                }
+                if (current_event->aqm == AQM_STEP) {
+                    msg << "  ECN: step，阈值 " << current_event->ecn_thresh_us << " us\n";
+                } else if (current_event->aqm == AQM_DUALQ) {
+                    msg << "  ECN: dualq，L队列阈值 " << current_event->ecn_thresh_us << " us，C队列目标 "
+                        << current_event->aqm_target_ms << " ms\n";
+                }
+                if (current_event->dup || current_event->corrupt || current_event->stealth) {
+                    msg << "  重复/损坏/隐蔽损坏: " << current_event->dup << "‰ / "
+                        << current_event->corrupt << "‰ / " << current_event->stealth << "‰\n";
+                }
+                msg << "  持续时间: " << current_event->duration_ms << " ms";
+            }
+            if (next_due) {
+                continue;
+            }
             
             // 应用事件参数
-            // TODO(bannos)：这里考虑是否只设置tap0的参数，还是两个都设置
-            tap0->set_bw(current_event->bandwidth);
-            tap0->set_delay_ms(current_event->delay_ms * 1000 / 2);
-            tap0->set_loss(current_event->loss);
-            
-            tap1->set_bw(current_event->bandwidth);
-            tap1->set_delay_ms(current_event->delay_ms * 1000 / 2);
-            tap1->set_loss(current_event->loss);
+            applyEvent(*current_event);
         }
         
-        // 显示进度（每5秒一次）
-        if (current_time - last_print_time >= 5000) {
+        // 显示进度（每5秒一次，路径段的统计随最后一跳一起打印）
+        if (segment < 0 && current_time - last_print_time >= 5000) {
             float progress = (float)current_time / total_duration_ms * 100;
-            cout << "进度: " << fixed << setprecision(1) << progress << "% (" 
-                 << current_time << " ms / " << total_duration_ms << " ms)" << endl;
+            LOGI("sim") << "进度: " << fixed << setprecision(1) << progress << "% ("
+                        << current_time << " ms / " << total_duration_ms << " ms)";
             last_print_time = current_time;
+            tap0->print_stats();
+            tap1->print_stats();
+            tap0->print_prof();
+            tap1->print_prof();
+            tap0->print_quic();
+            tap1->print_quic();
         }
         
-        std::this_thread::sleep_for(std::chrono::milliseconds(10)); // 10ms检查间隔
+        // 检查间隔10ms；下一个事件边界更近时（如1ms步长的模型）睡到边界为止
+        int64_t wait_ms = 10;
+        if (has_next && next_event.start_time_ms - current_time < wait_ms) {
+            wait_ms = next_event.start_time_ms - current_time;
+        }
+        if (current_event && event_end_time - current_time < wait_ms) {
+            wait_ms = event_end_time - current_time;
+        }
+        // 设置了交接时间时按微秒睡到交接时刻，切换延迟不受1ms粒度限制
+        int64_t wait_us = (wait_ms < 1 ? 1 : wait_ms) * 1000;
+        int64_t handoff = handoff_us;
+        if (handoff > 0 && handoff - tap0->get_us() < wait_us) {
+            wait_us = handoff - tap0->get_us();
+        }
+        if (wait_us > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+        }
+    }
+    
+    // 交接：链路保持当前参数，由下一次运行在同一时刻覆盖
+    if (running && handedOff(tap0->get_us())) {
+        LOGI("sim") << "[交接][" << tap0->get_ms() - start_time << "ms] 处理事件 " << event_counter
+                    << " 个，交给下一次运行";
+        running = false;
+        return;
     }
     
     // 仿真结束
@@ -171,488 +597,6410 @@ void NetworkSimulator::runSimulation() {
         current_event.reset(nullptr);
     }
     
-    // 设置链路断开（将带宽设为极低，延迟设为极大，丢包设为100%）
-    tap0->set_bw(0.01);  // 1 bps，几乎无法通信
-    tap0->set_delay_ms(10000 * 1000);  // 10秒延迟
-    tap0->set_loss(1000);  // 100%丢包
-    
-    tap1->set_bw(0.01);
-    tap1->set_delay_ms(10000 * 1000);
-    tap1->set_loss(1000);
+    // 路径段：恢复为无限制，在途的帧照常交给下一段；链路断开由最后一跳的场景负责
+    if (segment >= 0) {
+        applyEvent(NetworkEvent());
+        LOGI("sim") << tag << " 路径段场景结束，处理事件: " << event_counter << " 个";
+        running = false;
+        return;
+    }
+
+    // 单次运行：设置链路断开，新到的帧在入口丢弃，队列中的帧清空；守护进程：恢复为无限制，链路保持可用
+    NetworkEvent disconnect;
+    if (!keep_link) {
+        disconnect.outage = OUTAGE_FLUSH;
+    }
+    applyEvent(disconnect);
     
-    cout << "\n========== 网络仿真结束 ==========" << endl;
-    cout << "总时长: " << total_duration_ms << " ms" << endl;
-    cout << "处理事件: " << event_counter << " 个" << endl;
-    cout << "链路已断开（带宽1bps，延迟10s，丢包100%）" << endl;
-    cout << "==================================" << endl;
+    LOGI("sim") << "\n========== 网络仿真结束 ==========\n总时长: " << total_duration_ms << " ms\n"
+                << "处理事件: " << event_counter << " 个\n"
+                << (keep_link ? "链路已恢复为无限制" : "链路已断开（入口丢弃，不再缓存）");
+    tap0->print_stats();
+    tap1->print_stats();
+    tap0->print_tx_timing();
+    tap1->print_tx_timing();
+    tap0->print_ecn_flows();
+    tap1->print_ecn_flows();
+    tap0->print_prof();
+    tap1->print_prof();
+    tap0->print_quic();
+    tap1->print_quic();
+    bool within0 = tap0->print_slo_verdict(slo_base0);
+    bool within1 = tap1->print_slo_verdict(slo_base1);
+    LOGI("sim") << (within0 && within1 ? "结论: 仿真在容差内"
+                                       : "结论: 仿真器过载，结果中的额外时延/丢包有一部分来自仿真器而不是脚本中的链路")
+                << "\n==================================";
     
     running = false;
 }
 
-// --------------- 宏定义 ---------------
-#define BUFFER_SIZE 1500        // 以太网MTU默认值（最大帧大小）
-#define SYSTEM(A) system(A)     // 封装system调用（执行系统命令）
-
-// --------------- 解析脚本文件函数 ---------------
+// --------------- IoUring 类实现 ---------------
 /**
- * @brief 从脚本文件加载网络事件
- * @param filename 脚本文件名
- * @param simulator 网络仿真器
- * @return bool 是否成功加载
+ * @brief 创建io_uring实例并映射提交/完成队列
+ * @param entries 提交队列深度
+ * @param cq_entries 完成队列深度（须能容纳所有在途请求）
+ * @return int 0=成功，-1=内核不支持或资源不足
  */
-bool loadScriptFromFile(const std::string& filename, NetworkSimulator& simulator) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        std::cerr << "无法打开脚本文件: " << filename << std::endl;
-        return false;
+int IoUring::init(unsigned entries, unsigned cq_entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    int fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(fd < 0)
+    {
+        return -1;
     }
-    
-    std::string line;
-    int line_num = 0;
-    int event_count = 0;
-    
-    std::cout << "加载脚本文件: " << filename << std::endl;
-    
-    while (std::getline(file, line)) {
-        line_num++;
-        
-        // 去除行首尾的空格
-        size_t start = line.find_first_not_of(" \t");
-        if (start == std::string::npos) {
-            // 空行，跳过
-            continue;
-        }
-        
-        // 跳过注释行
-        if (line[start] == '#') {
-            continue;
-        }
-        
-        std::istringstream iss(line);
-        int64_t start_time, duration, bandwidth, delay;
-        int loss;
-        std::string description;
-        
-        if (iss >> start_time >> duration >> bandwidth >> delay >> loss) {
-            // 读取剩余部分作为描述
-            std::getline(iss >> std::ws, description);
-            
-            simulator.addEvent(start_time, duration, bandwidth, delay, loss, description);
-            event_count++;
-            std::cout << "  事件" << event_count << ": " << start_time / 1000 << "s开始, " 
-                      << duration / 1000 << "s, " << bandwidth << "Mbps, " 
-                      << delay << "ms延迟, " << loss << "‰丢包" << std::endl;
-        } else {
-            std::cerr << "脚本文件第 " << line_num << " 行格式错误: " << line << std::endl;
+    ring_fd = fd;
+
+    sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap && cq_map_size > sq_map_size)
+    {
+        sq_map_size = cq_map_size;
+    }
+
+    sq_ptr = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_SQ_RING);
+    if(sq_ptr == MAP_FAILED)
+    {
+        sq_ptr = nullptr;
+        close_ring();
+        return -1;
+    }
+    if(single_mmap)
+    {
+        cq_ptr = sq_ptr;
+        cq_map_size = 0;    // 与提交队列共用一次映射
+    }
+    else
+    {
+        cq_ptr = mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_CQ_RING);
+        if(cq_ptr == MAP_FAILED)
+        {
+            cq_ptr = nullptr;
+            close_ring();
+            return -1;
         }
     }
-    
-    file.close();
-    std::cout << "成功加载 " << event_count << " 个事件" << std::endl;
-    return event_count > 0;
+    sqes_map_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqe_ptr = mmap(nullptr, sqes_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_SQES);
+    if(sqe_ptr == MAP_FAILED)
+    {
+        close_ring();
+        return -1;
+    }
+    sqes = static_cast<struct io_uring_sqe *>(sqe_ptr);
+
+    uint8_t *sq = static_cast<uint8_t *>(sq_ptr);
+    uint8_t *cq = static_cast<uint8_t *>(cq_ptr);
+    sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+    sq_entries = p.sq_entries;
+    sq_local_tail = *sq_tail;
+    to_submit = 0;
+    return 0;
 }
 
-// --------------- TapInterface类实现（保持不变，除了新增方法）---------------
-/**
- * @brief TapInterface构造函数
- * @param tap_name TAP接口名（如tap0）
- * @param br_name 桥接接口名（如aif）
- * @param eth_name 物理网卡名（如eth2_h）
- * @param delay_time 初始延迟（毫秒）
- * @param bandwidth 初始带宽（bps）
- * @details 初始化参数 + 清理旧的桥接配置（防止残留）
- */
-TapInterface::TapInterface(const char *tap_name, const char *br_name, const char *eth_name, int64_t delay_time = 200,int64_t bandwidth = 100)
+void IoUring::close_ring()
 {
-    // 初始化成员变量
-    this->delay_ms = delay_time;
-    this->tap_name = tap_name;
-    this->br_name = br_name;
-    this->eth_name = eth_name;
-    this->tap_fd = -1;          // 初始化为无效fd
-    this->bandwidth = bandwidth;
-    this->pre_time = 0;         // 上一个包发送时间初始化为0
-    this->packet_cnt = 0;       // 数据包计数初始化为0
-    this->Bloss = 0;        // 丢包率初始化为0（关闭丢包）
-
-    // --------------- 清理旧的桥接配置 ---------------
-    // 1. 关闭旧桥接接口
-    string iptables_cmd ="ifconfig " + this->br_name + " down";
-    cout << "iptables:: " << iptables_cmd << endl;
-    SYSTEM (iptables_cmd.c_str());
-    iptables_cmd.clear();
-
-    // 2. 从桥接接口删除旧TAP接口
-    iptables_cmd = "brctl delif " + this->br_name + " " + this->tap_name;
-    cout << "iptables:: " << iptables_cmd << endl;
-    SYSTEM (iptables_cmd.c_str());
-    iptables_cmd.clear();
+    if(sqes != nullptr)
+        munmap(sqes, sqes_map_size);
+    if(cq_ptr != nullptr && cq_map_size > 0)
+        munmap(cq_ptr, cq_map_size);
+    if(sq_ptr != nullptr)
+        munmap(sq_ptr, sq_map_size);
+    if(ring_fd >= 0)
+        close(ring_fd);
+    sqes = nullptr;
+    cq_ptr = nullptr;
+    sq_ptr = nullptr;
+    ring_fd = -1;
+}
 
-    // 3. 删除旧桥接接口
-    iptables_cmd = "brctl delbr " + this->br_name;
-    cout << "iptables:: " << iptables_cmd << endl;
-    SYSTEM (iptables_cmd.c_str());    
-    iptables_cmd.clear();
+int IoUring::register_buffer(void *addr, size_t len)
+{
+    struct iovec iov;
+    iov.iov_base = addr;
+    iov.iov_len = len;
+    return syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, &iov, 1);
 }
 
-/**
- * @brief 获取当前时间戳（毫秒级）
- * @return int64_t 从epoch到现在的毫秒数
- */
-int64_t TapInterface::get_ms()
+struct io_uring_sqe *IoUring::get_sqe()
 {
-    auto now = std::chrono::high_resolution_clock::now();
-    // 获取时间戳，毫秒表示
-    auto ms = std::chrono::time_point_cast<std::chrono::milliseconds>(now);
-    auto ms_count = ms.time_since_epoch().count();
-    return ms_count;
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if(sq_local_tail - head >= sq_entries)
+    {
+        return nullptr;
+    }
+    unsigned idx = sq_local_tail & *sq_mask;
+    sq_array[idx] = idx;
+    sq_local_tail++;
+    to_submit++;
+    struct io_uring_sqe *sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
 }
 
+int IoUring::submit()
+{
+    if(to_submit == 0)
+    {
+        return 0;
+    }
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    syscall(__NR_io_uring_enter, ring_fd, to_submit, 0, 0, nullptr, 0);
+    // 内核未消费完的请求留在队列中，下次一并提交
+    to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    return 1;
+}
+
+struct io_uring_cqe *IoUring::peek_cqe()
+{
+    unsigned head = *cq_head;
+    if(head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return nullptr;
+    }
+    return &cqes[head & *cq_mask];
+}
+
+void IoUring::cqe_seen()
+{
+    __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// --------------- Clock 类实现 ---------------
+#define TSC_SHIFT 40                // TSC周期 → 微秒的定点位数
+#define TSC_CALIBRATE_US 50000      // TSC校准时长
+
+static int64_t realtime_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int64_t mono_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int64_t Clock::mono_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+ClockSource Clock::source = CLK_MONOTONIC;
+int64_t Clock::mono_base_us = Clock::mono_us();
+int64_t Clock::epoch_base_us = realtime_us();
+uint64_t Clock::tsc_base = 0;
+int64_t Clock::tsc_base_us = 0;
+uint64_t Clock::tsc_mult = 0;
+double Clock::tsc_hz = 0;
+
 /**
- * @brief 获取当前时间戳（微秒级）
- * @return int64_t 从epoch到现在的微秒数
- * @note 流量控制需要更高精度，因此主要使用微秒级时间戳
+ * @brief 当前时间（微秒）
+ * @details CLOCK_MONOTONIC走vDSO（约20ns）；TSC只有一条rdtsc和一次乘法
  */
-int64_t TapInterface::get_us()
+int64_t Clock::now_us()
+{
+#if defined(__x86_64__)
+    if(source == CLK_TSC)
+    {
+        return tsc_base_us + (int64_t)(((unsigned __int128)(__rdtsc() - tsc_base) * tsc_mult) >> TSC_SHIFT);
+    }
+#endif
+    return mono_us() - mono_base_us + epoch_base_us;
+}
+
+int64_t Clock::from_epoch_us(int64_t epoch_us)
 {
-    auto now = std::chrono::high_resolution_clock::now();
-    auto now_us = std::chrono::time_point_cast<std::chrono::microseconds>(now);
-    auto value = now_us.time_since_epoch().count();
-    return value;
+    return epoch_us - (realtime_us() - now_us());
 }
 
 /**
- * @brief TapInterface析构函数
- * @details 关闭文件描述符 + 释放链表所有节点（防止内存泄漏）
+ * @brief CPU是否提供invariant TSC（频率恒定，不受变频和C状态影响，各核同步）
  */
-TapInterface::~TapInterface()
+bool Clock::tsc_invariant()
 {
-    close(tap_fd);
-    close(epoll_fd);
-    for(head; head != nullptr; head = head->next)
+#if defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+    if(__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
     {
-        freeNode(head, dst_fd);
+        return false;
     }
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1u << 8)) != 0;
+#else
+    return false;
+#endif
 }
 
 /**
- * @brief 调试函数：打印数据包的十六进制内容
- * @param data 数据包二进制数据
- * @param size 数据包大小
- * @note 每8个字节换行，便于查看
+ * @brief 选择时钟源（须在转发线程启动前调用）
+ * @param src 时钟源
+ * @return bool false=TSC不可用（非x86_64或没有invariant TSC），继续使用CLOCK_MONOTONIC
+ * @details TSC对照CLOCK_MONOTONIC校准TSC_CALIBRATE_US，切换时与当前时间衔接，时间戳不会跳变
  */
-void TapInterface::printData(const unsigned char* data, size_t size) {
-    for (size_t i = 0; i < size; ++i) {
-        std::cout << std::hex << std::setw(2) << std::setfill('0') << "0x" << static_cast<int>(data[i]) << " ";
-        if ((i + 1) % 8 == 0)
-            std::cout << std::endl;
+bool Clock::select(ClockSource src)
+{
+    if(src != CLK_TSC)
+    {
+        source = CLK_MONOTONIC;
+        return true;
     }
-    std::cout << std::dec;  // Reset to decimal format if needed
+#if defined(__x86_64__)
+    if(!tsc_invariant())
+    {
+        return false;
+    }
+    // 两端都用前后两次monotonic读数夹住rdtsc，被调度出去（间隔过大）时重读
+    auto sample = [](int64_t *m, uint64_t *t) {
+        for(int i = 0; i < 100; i++)
+        {
+            int64_t a = mono_ns();
+            *t = __rdtsc();
+            int64_t b = mono_ns();
+            *m = (a + b) / 2;
+            if(b - a <= 1000)
+            {
+                break;
+            }
+        }
+    };
+    int64_t m0, m1;
+    uint64_t t0, t1;
+    sample(&m0, &t0);
+    std::this_thread::sleep_for(std::chrono::microseconds(TSC_CALIBRATE_US));
+    sample(&m1, &t1);
+    tsc_hz = (double)(t1 - t0) * 1e9 / (m1 - m0);
+    tsc_mult = (uint64_t)(1e6 / tsc_hz * (double)((uint64_t)1 << TSC_SHIFT));
+    tsc_base_us = now_us();
+    tsc_base = __rdtsc();
+    source = CLK_TSC;
+    return true;
+#else
+    return false;
+#endif
 }
 
+// --------------- StageProfiler 类实现 ---------------
 /**
- * @brief 随机丢包判断函数
- * @param chance 丢包概率（千分比，如10=1%）
- * @return bool true=丢包，false=不丢包
- * @note 使用mt19937随机数生成器，范围1-10000（精度更高）
+ * @brief 阶段计时用的时间戳：x86上为rdtsc（参考周期，约几纳秒），其他平台退化为CLOCK_MONOTONIC纳秒
  */
-bool TapInterface::chance_in_a_thousand(int chance) {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> distr(1, 1000);
-    return distr(gen) <= chance;
-};
+static inline uint64_t prof_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
 
 /**
- * @brief 从TAP接口读取数据包（epoll监听）
- * @return int epoll_wait返回的事件数（-1=失败，0=无事件，>0=事件数）
- * @details 1. 监听TAP接口可读事件 2. 读取数据包 3. 计算发送时间 4. 加入链表缓存
+ * @brief 打开一个只统计调用线程的硬件计数器
+ * @param config PERF_COUNT_HW_*
+ * @param group_fd 事件组leader（-1=本事件为leader，创建时先不启用）
+ * @param user_only true=不统计内核态（perf_event_paranoid限制时使用）
+ * @return int fd（-1=失败）
  */
-int TapInterface::tap_read()
+static int perf_counter_open(uint64_t config, int group_fd, bool user_only)
 {
-    int timeout = 0;           // epoll_wait超时时间（0=非阻塞）
-    int64_t send_time;         // 数据包计划发送时间（微秒）
-    // 监听epoll事件：无超时（非阻塞）
-    int eNum = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
-    if(eNum == -1)             // epoll_wait失败
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.disabled = group_fd == -1;
+    attr.exclude_kernel = user_only;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+StageProfiler::StageProfiler(uint32_t sample_every)
+    : sample_every(sample_every > 0 ? sample_every : 1), opened(false), armed(false), loop_work(0),
+      sample_mark(0), depth(0), last_tsc(0), samples(0), pmu_ok(false), last_rx(0), snap_samples(0)
+{
+    for(int k = 0; k < PROF_COUNTERS; k++)
     {
-        cout << "epoll wait" << endl;
-        return -1;
+        perf_fds[k] = -1;
+        last_pmu[k] = 0;
+        pmu_cost[k] = 0;
+    }
+    stack[0] = -1;
+    for(int s = 0; s < PROF_STAGES; s++)
+    {
+        iter_tsc[s] = 0;
+        iter_pmu_tsc[s] = 0;
+        tsc[s] = 0;
+        pmu_tsc[s] = 0;
+        snap_tsc[s] = 0;
+        snap_pmu_tsc[s] = 0;
+        for(int k = 0; k < PROF_COUNTERS; k++)
+        {
+            iter_pmu[s][k] = 0;
+            pmu[s][k] = 0;
+            snap_pmu[s][k] = 0;
+        }
     }
+}
 
-    // 遍历所有触发的事件
-    for(int i = 0; i < eNum; i++)
+StageProfiler::~StageProfiler()
+{
+    for(int k = PROF_COUNTERS - 1; k >= 0; k--)
     {
-        // 仅处理TAP接口的可读事件
-        if(events[i].data.fd == tap_fd)
+        if(perf_fds[k] >= 0)
+            close(perf_fds[k]);
+    }
+}
+
+const char *StageProfiler::stage_name(int stage)
+{
+    static const char *names[PROF_STAGES] = {"poll", "read", "pace", "enqueue", "scan", "loss", "write"};
+    return stage >= 0 && stage < PROF_STAGES ? names[stage] : "?";
+}
+
+/**
+ * @brief 在转发线程上打开cycles/instructions/cache-misses事件组，并校准一次组读取本身的计数
+ * @details 先尝试同时统计内核态（write/epoll等系统调用的开销也在其中），被perf_event_paranoid拒绝时只统计用户态；
+ *          都失败时（无PMU、容器中被禁止）只保留TSC计时
+ */
+void StageProfiler::open_counters()
+{
+    opened = true;
+    static const uint64_t configs[PROF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+    };
+    bool user_only = false;
+    for(int attempt = 0; attempt < 2 && perf_fds[PROF_COUNTERS - 1] < 0; attempt++)
+    {
+        user_only = attempt == 1;
+        for(int k = 0; k < PROF_COUNTERS; k++)
         {
-            if(events[i].events & EPOLLIN) // 可读事件
+            perf_fds[k] = perf_counter_open(configs[k], k == 0 ? -1 : perf_fds[0], user_only);
+            if(perf_fds[k] < 0)
             {
-                uint8_t *data = new uint8_t[1522];  // 分配数据包缓冲区（1522=以太网最大帧大小+VLAN标签）
-                uint32_t size = read(tap_fd, data,1522);    // 从TAP接口读取数据
-                // 调试：打印数据包大小/内容
-                //cout << "size: " << size << endl;
-                //printData(data, size);
-                if(size == -1) // 读取失败
-                {
-                    cout << "Error reading from tap_fd" << endl;
-                }
-
-                // --------------- 解析MAC帧类型 ---------------
-                // MAC帧头部第12-13字节是帧类型（如0x0800=IP，0x0806=ARP）
-                uint16_t* mac_type_ptr = reinterpret_cast<uint16_t*>(data + 12);
-                uint16_t mac_type = ntohs(*mac_type_ptr); // 网络字节序转主机字节序
-                int64_t time_now = get_us();
-
-                // --------------- 带宽限制计算 ---------------
-                // debug
-                // if(tap_name == "tap0") {
-                //     if(delay_ms > 0)
-                //     {
-                //         cout << tap_name << " --- " << "当前设置延迟：" << delay_ms << " ms" << endl;
-                //     }
-                //     else {
-                //         cout << tap_name << " --- " << "未设置延迟" << endl;
-                //     }
-                // }
-
-                if(bandwidth > 0)
-                {
-                    // if(tap_name == "tap0")
-                    //     cout << tap_name << " --- " << "带宽限制：" << bandwidth << endl;
-                    packet_cnt++;
-                    if(packet_cnt%1000 == 0)
-                    {
-                        //cout << NodeCount << endl;
-                        //cout << "Packet count: " << packet_cnt << endl;
-                        // delete data;
-                        // continue;
-                    }
-                    // 计算发送时间：上一个包发送时间 + 本包传输耗时（size/(带宽/8)）即传输时延
-                    // 带宽单位是bps，除以8转换为Bps（字节/秒）
-                    send_time = pre_time + (size*1.0/(bandwidth*1.0/8.0));
-                    // double transmission_time_us = (size * 8.0 * 1000000.0) / bandwidth;
-                    // send_time = pre_time + static_cast<int64_t>(transmission_time_us);
-
-                    // cout << "pre_time: " << pre_time << " -- send_time: " << send_time << " -- delay_ms: " << delay_ms << endl;
-                    
-                    if(send_time < time_now)
-                    {
-                        send_time = time_now;
-                    }
-                    pre_time = send_time;                // 更新上一个包发送时间
-                    
-                    
-
-                    send_time = send_time + delay_ms;    // 叠加延迟时间
-                    
-                    //cout << "send_time: " << send_time << " time_now: " << time_now << endl;
-                }
-                else // 关闭带宽限制：仅叠加延迟
-                {
-                    // if(tap_name == "tap0")
-                    //     cout << tap_name << " --- " << "未设置带宽限制，bandwidth is " << bandwidth << endl;
-                    send_time = time_now + delay_ms;
-                }
-                
-                // --------------- 限流检查 ---------------
-                if(NodeCount > MAX_PACKET_SIZE) // 超过最大缓存数，丢弃数据包
-                {
-                    //cout << "NodeCount: " << NodeCount << endl;
-                    delete data;
-                    return -1;
-                }
-                else // 加入链表缓存
+                for(int j = k - 1; j >= 0; j--)
                 {
-                    addNode(data,send_time,dst_fd,size,get_us(),mac_type);
+                    close(perf_fds[j]);
+                    perf_fds[j] = -1;
                 }
-
+                break;
             }
         }
     }
-    return eNum;
+    if(perf_fds[0] < 0)
+    {
+        LOGW("prof") << "perf_event_open失败（" << strerror(errno) << "），阶段剖析只有TSC周期";
+        return;
+    }
+    ioctl(perf_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    // 相邻两次组读取之间的最小增量即读取本身的计数，之后每个间隔扣除一次
+    uint64_t a[PROF_COUNTERS], b[PROF_COUNTERS];
+    for(int k = 0; k < PROF_COUNTERS; k++)
+        pmu_cost[k] = UINT64_MAX;
+    read_counters(a);
+    for(int i = 0; i < 16; i++)
+    {
+        read_counters(b);
+        for(int k = 0; k < PROF_COUNTERS; k++)
+        {
+            pmu_cost[k] = std::min(pmu_cost[k], b[k] - a[k]);
+            a[k] = b[k];
+        }
+    }
+    pmu_ok.store(true, std::memory_order_relaxed);
+    LOGI("prof") << "阶段剖析: perf事件组已打开（" << (user_only ? "只统计用户态" : "含内核态")
+                 << "，每" << sample_every << "帧采样一轮）";
+}
+
+void StageProfiler::read_counters(uint64_t v[PROF_COUNTERS])
+{
+    struct {
+        uint64_t nr;
+        uint64_t values[PROF_COUNTERS];
+    } buf;
+    if(read(perf_fds[0], &buf, sizeof(buf)) != (ssize_t)sizeof(buf))
+    {
+        memset(&buf, 0, sizeof(buf));
+    }
+    for(int k = 0; k < PROF_COUNTERS; k++)
+        v[k] = buf.values[k];
 }
 
 /**
- * @brief 重写释放节点函数（核心：发送数据包 + 丢包控制）
- * @param node 待释放的节点
- * @param dst_fd 目标TAP接口fd
- * @details 1. 按丢包率判断是否发送 2. 发送数据包 3. 释放内存
+ * @brief 把上次切换以来的间隔计入栈顶阶段；采样轮中还读一次计数器组，并把读取本身的耗时排除在TSC间隔之外
+ * @param t 本次切换的TSC读数
  */
-void TapInterface::freeNode(Node *node, int dst_fd) 
+inline void StageProfiler::charge(uint64_t t)
 {
-    if(node->data != nullptr) 
+    int stage = stack[depth];
+    if(stage >= 0)
+    {
+        iter_tsc[stage] += t - last_tsc;
+    }
+    if(armed)
     {
-        if(Bloss > 0) // 开启丢包
+        uint64_t v[PROF_COUNTERS];
+        read_counters(v);
+        if(stage >= 0)
         {
-            // if(tap_name == "tap0")
-            //     cout << tap_name << " --- " << "当前已设置丢包：" << Bloss << endl;
-            // 仅对tap0生效 + 随机丢包
-            if(chance_in_a_thousand(Bloss))
-            {
-                // cout << tap_name << " --- " << "Dropped packet" << endl; // 丢包日志
-            }
-            else // 不丢包：发送数据包到目标TAP接口
+            iter_pmu_tsc[stage] += t - last_tsc;
+            for(int k = 0; k < PROF_COUNTERS; k++)
             {
-                write(dst_fd, node->data, node->size);
+                uint64_t d = v[k] - last_pmu[k];
+                iter_pmu[stage][k] += d > pmu_cost[k] ? d - pmu_cost[k] : 0;
             }
         }
-        else // 关闭丢包：直接发送
-        {
-            // if(tap_name == "tap0")
-            //     cout << tap_name << " --- " << "未设置丢包" << endl;
-            write(dst_fd, node->data, node->size);
-        }
-        delete node->data; // 释放数据包内存
+        for(int k = 0; k < PROF_COUNTERS; k++)
+            last_pmu[k] = v[k];
+        t = prof_ticks();
     }
-    NodeCount--;
+    last_tsc = t;
 }
 
-/**
- * @brief 主动发送超时的数据包（调用checkAndFreeNode释放节点）
- * @details 核心逻辑：检查链表中达到发送时间的节点，释放（发送）它们
- */
-void TapInterface::tap_write()
+inline void StageProfiler::enter(int stage)
 {
-    int64_t time = get_us();
-    checkAndFreeNode(time, dst_fd);
+    charge(prof_ticks());
+    if(depth < PROF_DEPTH)
+    {
+        depth++;
+    }
+    stack[depth] = stage;
+}
+
+inline void StageProfiler::leave()
+{
+    charge(prof_ticks());
+    if(depth > 0)
+    {
+        depth--;
+    }
 }
 
 /**
- * @brief 设置目标TAP接口fd（转发目标）
- * @param fd 目标TAP接口的文件描述符
+ * @brief 一轮转发循环开始：距上次采样已处理sample_every帧时，本轮采样硬件计数器
+ * @param work 本方向累计处理的帧数（收 + 发 + 丢弃）
  */
-void TapInterface::set_dstap(int fd)
+void StageProfiler::begin_loop(uint64_t work)
 {
-    this->dst_fd = fd; 
+    if(!opened)
+    {
+        open_counters();
+    }
+    loop_work = work;
+    armed = perf_fds[0] >= 0 && work - sample_mark >= sample_every;
+    if(armed)
+    {
+        read_counters(last_pmu);
+    }
+    last_tsc = prof_ticks();
 }
 
 /**
- * @brief 获取当前TAP接口的fd
- * @return int TAP接口文件描述符
+ * @brief 一轮结束：本轮处理了帧才把各阶段的累计并入总计，空转轮询的开销不摊到帧上
+ * @param work 本方向累计处理的帧数
  */
-int TapInterface::get_tap()
+void StageProfiler::end_loop(uint64_t work)
 {
-    return this->tap_fd;
+    bool busy = work != loop_work;
+    for(int s = 0; s < PROF_STAGES; s++)
+    {
+        if(busy && iter_tsc[s] != 0)
+        {
+            stat_add(tsc[s], iter_tsc[s]);
+        }
+        iter_tsc[s] = 0;
+    }
+    if(!armed)
+    {
+        return;
+    }
+    armed = false;
+    if(!busy)
+    {
+        memset(iter_pmu_tsc, 0, sizeof(iter_pmu_tsc));
+        memset(iter_pmu, 0, sizeof(iter_pmu));
+        return;     // 下一轮重新采样
+    }
+    sample_mark = work;
+    for(int s = 0; s < PROF_STAGES; s++)
+    {
+        stat_add(pmu_tsc[s], iter_pmu_tsc[s]);
+        iter_pmu_tsc[s] = 0;
+        for(int k = 0; k < PROF_COUNTERS; k++)
+        {
+            stat_add(pmu[s][k], iter_pmu[s][k]);
+            iter_pmu[s][k] = 0;
+        }
+    }
+    stat_add(samples, 1);
 }
 
 /**
- * @brief 创建并配置TAP接口
- * @return int TAP接口fd（-1=失败，>0=成功）
- * @details 1. 创建epoll实例 2. 打开TUN/TAP设备 3. 配置TAP接口 4. 创建桥接 5. 将TAP/物理网卡加入桥接
+ * @brief 打印自上次以来各阶段的每帧开销
+ * @param name 方向（接口名）
+ * @param rx_packets 本方向累计接收帧数（每帧开销的分母）
+ * @details cyc/pkt为TSC周期（全部有帧处理的轮）；IPC = instructions / cycles（采样轮）；
+ *          miss/pkt按采样轮中每TSC周期的cache miss数折算到该阶段的全部周期
  */
-int TapInterface::tap_open()
+void StageProfiler::report(const std::string& name, uint64_t rx_packets)
 {
-    char tapname[14];    // TAP接口名缓冲区
-    int i, fd,err;
+    uint64_t pkts = rx_packets - last_rx;
+    if(pkts == 0)
+    {
+        return;
+    }
+    last_rx = rx_packets;
+    uint64_t n_samples = samples.load(std::memory_order_relaxed);
+    bool with_pmu = pmu_ok.load(std::memory_order_relaxed);
 
-    // 1. 创建epoll实例（参数1：忽略，仅需大于0）
-    epoll_fd = epoll_create(1);
-    if(epoll_fd == -1)
+    LogLine line(LL_INFO, name.c_str());
+    line << "[" << name << "] 阶段剖析: " << pkts << " pkts";
+    if(with_pmu)
+        line << "，" << n_samples - snap_samples << "轮采样";
+    else
+        line << "，无硬件计数器";
+    snap_samples = n_samples;
+    double total = 0;
+    for(int s = 0; s < PROF_STAGES; s++)
     {
-        cout << "Error creating epoll instance" << endl;
-        return -1;
+        uint64_t t = tsc[s].load(std::memory_order_relaxed);
+        uint64_t pt = pmu_tsc[s].load(std::memory_order_relaxed);
+        uint64_t c[PROF_COUNTERS];
+        for(int k = 0; k < PROF_COUNTERS; k++)
+        {
+            c[k] = pmu[s][k].load(std::memory_order_relaxed);
+        }
+        uint64_t dt = t - snap_tsc[s];
+        uint64_t dpt = pt - snap_pmu_tsc[s];
+        uint64_t dcyc = c[0] - snap_pmu[s][0];
+        uint64_t dins = c[1] - snap_pmu[s][1];
+        uint64_t dmiss = c[2] - snap_pmu[s][2];
+        snap_tsc[s] = t;
+        snap_pmu_tsc[s] = pt;
+        for(int k = 0; k < PROF_COUNTERS; k++)
+        {
+            snap_pmu[s][k] = c[k];
+        }
+        if(dt == 0)
+        {
+            continue;
+        }
+        double per_pkt = (double)dt / pkts;
+        total += per_pkt;
+        line << "\n    " << std::left << std::setw(8) << stage_name(s) << std::right << fixed << setprecision(1)
+             << std::setw(9) << per_pkt << " cyc/pkt";
+        if(with_pmu && dpt > 0 && dcyc > 0)
+        {
+            line << "  IPC " << setprecision(2) << (double)dins / dcyc
+                 << "  miss " << setprecision(3) << (double)dmiss / dpt * dt / pkts << "/pkt";
+        }
     }
-    event.events = EPOLLIN;    // 监听可读事件
-    event.data.fd = epoll_fd;  // 绑定epoll fd
+    line << "\n    " << std::left << std::setw(8) << "total" << std::right << setprecision(1)
+         << std::setw(9) << total << " cyc/pkt";
+}
 
-    // 2. 打开TUN/TAP设备（Linux内核虚拟网络设备）
-    struct ifreq ifr;          // 网络接口请求结构体
-    if ((fd = open("/dev/net/tun", O_RDWR)) < 0)
+// --------------- CaptureRing / PcapWriter 类实现 ---------------
+/**
+ * @brief 分配定长槽
+ * @param slots 槽数（向上取2的幂）
+ * @param snaplen 每个槽可保存的帧字节数
+ * @return bool 是否成功
+ */
+bool CaptureRing::init(uint32_t slots, uint32_t snaplen)
+{
+    uint32_t n = 1;
+    while(n < slots)
     {
-        return fd;
+        n <<= 1;
     }
-    memset(&ifr, 0, sizeof(ifr)); // 初始化结构体
-    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;    // 配置为TAP模式（二层以太网接口）+ 无数据包信息头（IFF_NO_PI）
-    if ((err = ioctl(fd, TUNSETIFF, (void *) &ifr)) < 0)    // 设置TUN/TAP接口参数
+    this->mask = n - 1;
+    this->snaplen = snaplen;
+    this->stride = (sizeof(CaptureRecord) + snaplen + 7) & ~7u;
+    mem.assign(static_cast<size_t>(n) * stride, 0);
+    return true;
+}
+
+/**
+ * @brief 生产者：拷贝描述符和帧的前snaplen字节（转发线程调用）
+ * @return bool false=环满，记录被丢弃
+ */
+bool CaptureRing::push(const uint8_t *data, uint32_t size, int64_t timesample, int64_t sendtime,
+                       int64_t emit_time, uint8_t reason, uint16_t segs, uint16_t lost_segs)
+{
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if(h - cached_tail > mask)
     {
-        close(fd);
-        return err;
+        cached_tail = tail.load(std::memory_order_acquire);
+        if(h - cached_tail > mask)
+        {
+            stat_add(overruns, 1);
+            return false;
+        }
     }
+    CaptureRecord *rec = reinterpret_cast<CaptureRecord *>(&mem[static_cast<size_t>(h & mask) * stride]);
+    rec->timesample = timesample;
+    rec->sendtime = sendtime;
+    rec->emit_time = emit_time;
+    rec->orig_len = size;
+    rec->cap_len = size < snaplen ? size : snaplen;
+    rec->segs = segs;
+    rec->lost_segs = lost_segs;
+    rec->reason = reason;
+    memcpy(rec + 1, data, rec->cap_len);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
 
-    // 3. 设置非阻塞模式
-    if (fcntl (fd, F_SETFL, O_NDELAY) > 0)
-        cout << "fcntl problem" << endl;
+/**
+ * @brief 消费者：取最早的记录（写盘线程调用）
+ * @return const CaptureRecord* nullptr=环空
+ */
+const CaptureRecord *CaptureRing::front()
+{
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if(t == cached_head)
+    {
+        cached_head = head.load(std::memory_order_acquire);
+        if(t == cached_head)
+        {
+            return nullptr;
+        }
+    }
+    return reinterpret_cast<const CaptureRecord *>(&mem[static_cast<size_t>(t & mask) * stride]);
+}
 
-    // 4. 设置进程为fd的属主（接收信号）
-    if (fcntl (fd, F_SETOWN, getpid ()) > 0)
-        cout << "fcntl problem" << endl;
+void CaptureRing::pop()
+{
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
 
-    // 5. 配置成功：初始化TAP接口
-	if( fd > 0 ) 
-    {
-        tap_fd = fd;                              // 保存TAP fd
-        tap_name = ifr.ifr_name;                  // 保存TAP接口名（内核分配，如tap0）
+#define CAPTURE_RING_SLOTS 8192         // 每个方向的描述符槽数
+#define CAPTURE_BATCH_BYTES (256 << 10) // 写盘批量大小
+#define CAPTURE_FLUSH_US 100000         // 空闲时最长100ms落盘一次
 
-        // --------------- 配置桥接 ---------------
-        // 5.1 启用TAP接口
-        string iptables_cmd = "ip link set dev " + this->tap_name + " up"; 
-        cout << "iptables:: " << iptables_cmd << endl;
-        SYSTEM (iptables_cmd.c_str());    
-        iptables_cmd.clear();
+PcapWriter::PcapWriter()
+{
+    this->snaplen = 0;
+    this->rotate_bytes = 0;
+    this->file_bytes = 0;
+    this->file_index = 0;
+    this->fp = nullptr;
+    this->running = false;
+}
 
-        // 5.2 创建桥接接口
-        iptables_cmd = "brctl addbr " + this->br_name;
-        cout << "iptables:: " << iptables_cmd << endl;
-        SYSTEM (iptables_cmd.c_str());    
-        iptables_cmd.clear();
+PcapWriter::~PcapWriter()
+{
+    close();
+}
 
-        // 5.3 将TAP接口加入桥接
+/**
+ * @brief 创建各方向的描述符环，打开第一个文件并启动写盘线程
+ * @param path 输出文件名
+ * @param snaplen 每帧最多保存的字节数
+ * @param rotate_mb 单个文件大小上限（MB，0=不轮转），轮转文件依次命名为path.1、path.2...
+ * @param if_names 各方向的接口名（顺序即pcapng接口号）
+ * @return bool 是否成功
+ */
+bool PcapWriter::open(const std::string& path, uint32_t snaplen, uint32_t rotate_mb,
+                      const std::vector<std::string>& if_names)
+{
+    this->path = path;
+    this->snaplen = snaplen;
+    this->rotate_bytes = static_cast<uint64_t>(rotate_mb) << 20;
+    this->if_names = if_names;
+    for(size_t i = 0; i < if_names.size(); i++)
+    {
+        std::unique_ptr<CaptureRing> ring(new CaptureRing());
+        ring->init(CAPTURE_RING_SLOTS, snaplen);
+        rings.push_back(std::move(ring));
+    }
+    if(!open_file())
+    {
+        return false;
+    }
+    running = true;
+    writer = std::thread(&PcapWriter::writer_loop, this);
+    LogLine line(LL_INFO, "pcap");
+    line << "抓包: " << path << "（截断长度 " << snaplen << " B";
+    if(rotate_mb > 0)
+    {
+        line << "，每 " << rotate_mb << " MB轮转";
+    }
+    line << "）";
+    return true;
+}
+
+/**
+ * @brief 停止写盘线程，写完环中剩余的记录并关闭文件
+ */
+void PcapWriter::close()
+{
+    if(running.exchange(false))
+    {
+        writer.join();
+    }
+    if(fp != nullptr)
+    {
+        flush_batch();
+        fclose(fp);
+        fp = nullptr;
+    }
+}
+
+/**
+ * @brief 打开下一个输出文件并写入节头块和接口描述块
+ */
+bool PcapWriter::open_file()
+{
+    std::string name = file_index == 0 ? path : path + "." + std::to_string(file_index);
+    fp = fopen(name.c_str(), "wb");
+    if(fp == nullptr)
+    {
+        LOGE("pcap") << "无法创建抓包文件 " << name << ": " << strerror(errno);
+        return false;
+    }
+    file_bytes = 0;
+    append_headers();
+    return true;
+}
+
+/**
+ * @brief 追加一段数据
+ */
+static void pcapng_put(std::vector<uint8_t>& buf, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    buf.insert(buf.end(), p, p + len);
+}
+
+static void pcapng_put32(std::vector<uint8_t>& buf, uint32_t v)
+{
+    pcapng_put(buf, &v, 4);
+}
+
+/**
+ * @brief 追加一个选项（code + length + value，补齐到4字节）
+ */
+static void pcapng_option(std::vector<uint8_t>& buf, uint16_t code, const void *value, uint16_t len)
+{
+    pcapng_put(buf, &code, 2);
+    pcapng_put(buf, &len, 2);
+    pcapng_put(buf, value, len);
+    buf.insert(buf.end(), (4 - len % 4) % 4, 0);
+}
+
+/**
+ * @brief 回填块总长度（块头第二个字段和块尾）
+ */
+static void pcapng_close_block(std::vector<uint8_t>& buf, size_t start)
+{
+    uint32_t len = buf.size() - start + 4;
+    memcpy(&buf[start + 4], &len, 4);
+    pcapng_put32(buf, len);
+}
+
+/**
+ * @brief 节头块（SHB）+ 每个方向一个接口描述块（IDB，以太网，微秒时间戳）
+ */
+void PcapWriter::append_headers()
+{
+    size_t start = batch.size();
+    pcapng_put32(batch, 0x0A0D0D0A);        // SHB
+    pcapng_put32(batch, 0);
+    pcapng_put32(batch, 0x1A2B3C4D);        // 字节序标记
+    uint16_t version[2] = {1, 0};
+    pcapng_put(batch, version, 4);
+    int64_t section_len = -1;
+    pcapng_put(batch, &section_len, 8);
+    const char appl[] = "tc_quic";
+    pcapng_option(batch, 4, appl, sizeof(appl) - 1);   // shb_userappl
+    pcapng_option(batch, 0, nullptr, 0);
+    pcapng_close_block(batch, start);
+
+    for(const std::string& name : if_names)
+    {
+        start = batch.size();
+        pcapng_put32(batch, 1);             // IDB
+        pcapng_put32(batch, 0);
+        uint16_t linktype[2] = {1, 0};      // LINKTYPE_ETHERNET
+        pcapng_put(batch, linktype, 4);
+        pcapng_put32(batch, snaplen);
+        pcapng_option(batch, 2, name.data(), name.size());  // if_name
+        uint8_t tsresol = 6;
+        pcapng_option(batch, 9, &tsresol, 1);               // if_tsresol：微秒
+        pcapng_option(batch, 0, nullptr, 0);
+        pcapng_close_block(batch, start);
+    }
+}
+
+/**
+ * @brief 一条记录 → 增强包块（EPB）
+ * @details 注释格式：fwd|dup|corrupt|stealth|drop=loss|drop=queue_full|drop=tx_fail|drop=outage|drop=shed|drop=aqm timesample=.. sendtime=.. emit=.. held=..us
+ *          GSO超帧另加 segs=N lost=K；epb_flags标记出方向（转发）或入方向（丢弃）
+ */
+void PcapWriter::append_record(int if_id, const CaptureRecord *rec)
+{
+    static const char *reason_names[] = {
+        "fwd", "dup", "corrupt", "stealth", "drop=loss", "drop=queue_full", "drop=tx_fail", "drop=outage",
+        "drop=shed", "drop=aqm"
+    };
+    size_t start = batch.size();
+    pcapng_put32(batch, 6);                 // EPB
+    pcapng_put32(batch, 0);
+    pcapng_put32(batch, if_id);
+    uint64_t ts = rec->emit_time;
+    pcapng_put32(batch, ts >> 32);
+    pcapng_put32(batch, ts & 0xffffffff);
+    pcapng_put32(batch, rec->cap_len);
+    pcapng_put32(batch, rec->orig_len);
+    pcapng_put(batch, rec + 1, rec->cap_len);
+    batch.insert(batch.end(), (4 - rec->cap_len % 4) % 4, 0);
+
+    char comment[256];
+    int len = snprintf(comment, sizeof(comment), "%s timesample=%lld sendtime=%lld emit=%lld held=%lldus",
+                       rec->reason < sizeof(reason_names) / sizeof(reason_names[0]) ? reason_names[rec->reason] : "?",
+                       (long long)rec->timesample, (long long)rec->sendtime, (long long)rec->emit_time,
+                       (long long)(rec->emit_time - rec->timesample));
+    if(rec->segs > 1 && len < (int)sizeof(comment))
+    {
+        len += snprintf(comment + len, sizeof(comment) - len, " segs=%u lost=%u", rec->segs, rec->lost_segs);
+    }
+    if(len >= (int)sizeof(comment))
+    {
+        len = sizeof(comment) - 1;
+    }
+    pcapng_option(batch, 1, comment, len);  // opt_comment
+    uint32_t flags = rec->reason <= CAP_STEALTH ? 2 : 1;   // 2=出方向，1=入方向
+    pcapng_option(batch, 2, &flags, 4);     // epb_flags
+    pcapng_option(batch, 0, nullptr, 0);
+    pcapng_close_block(batch, start);
+}
+
+/**
+ * @brief 把批量缓冲写入文件
+ */
+void PcapWriter::flush_batch()
+{
+    if(batch.empty() || fp == nullptr)
+    {
+        return;
+    }
+    fwrite(batch.data(), 1, batch.size(), fp);
+    fflush(fp);
+    file_bytes += batch.size();
+    batch.clear();
+}
+
+/**
+ * @brief 写盘线程：每次取各环中发送时间最早的记录（按时间顺序合并两个方向），
+ *        攒够一批或空闲时落盘，超过文件大小上限时轮转
+ */
+void PcapWriter::writer_loop()
+{
+    auto now_us = []() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    };
+    int64_t last_flush = now_us();
+    bool stopping = false;
+    while(true)
+    {
+        if(!running.load(std::memory_order_relaxed))
+        {
+            stopping = true;    // 停止后先把环中剩余的记录写完
+        }
+
+        int best = -1;
+        const CaptureRecord *best_rec = nullptr;
+        for(size_t i = 0; i < rings.size(); i++)
+        {
+            const CaptureRecord *rec = rings[i]->front();
+            if(rec != nullptr && (best_rec == nullptr || rec->emit_time < best_rec->emit_time))
+            {
+                best = i;
+                best_rec = rec;
+            }
+        }
+
+        if(best_rec == nullptr)
+        {
+            if(!batch.empty() && (stopping || now_us() - last_flush >= CAPTURE_FLUSH_US))
+            {
+                flush_batch();
+                last_flush = now_us();
+            }
+            if(stopping)
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        append_record(best, best_rec);
+        rings[best]->pop();
+
+        if(rotate_bytes > 0 && file_bytes + batch.size() >= rotate_bytes)
+        {
+            flush_batch();
+            fclose(fp);
+            file_index++;
+            if(!open_file())
+            {
+                break;
+            }
+        }
+        else if(batch.size() >= CAPTURE_BATCH_BYTES)
+        {
+            flush_batch();
+            last_flush = now_us();
+        }
+    }
+}
+
+// --------------- LogRing / Logger 类实现 ---------------
+/**
+ * @brief 生产者：拷贝一条日志（所属线程调用）
+ * @return bool false=环满（由调用者决定等待还是丢弃）
+ */
+bool LogRing::push(uint8_t level, const char *src, const char *text, size_t len, int64_t time_us)
+{
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if(h - cached_tail >= LOG_RING_SLOTS)
+    {
+        cached_tail = tail.load(std::memory_order_acquire);
+        if(h - cached_tail >= LOG_RING_SLOTS)
+        {
+            return false;
+        }
+    }
+    LogRecord *rec = &slots[h % LOG_RING_SLOTS];
+    rec->time_us = time_us;
+    rec->len = len < LOG_TEXT_MAX ? len : LOG_TEXT_MAX;
+    rec->level = level;
+    rec->thread = id;
+    strncpy(rec->src, src, sizeof(rec->src));
+    memcpy(rec->text, text, rec->len);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * @brief 消费者：取最早的日志（写日志线程调用）
+ * @return const LogRecord* nullptr=环空
+ */
+const LogRecord *LogRing::front()
+{
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if(t == cached_head)
+    {
+        cached_head = head.load(std::memory_order_acquire);
+        if(t == cached_head)
+        {
+            return nullptr;
+        }
+    }
+    return &slots[t % LOG_RING_SLOTS];
+}
+
+void LogRing::pop()
+{
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void LogRing::drop()
+{
+    stat_add(overruns, 1);
+}
+
+#define LOG_IDLE_US 1000        // 没有日志时写日志线程的休眠时间
+
+static thread_local bool log_nonblocking = false;   // 本线程环满时丢弃日志（转发线程）
+
+/**
+ * @brief 线程退出时交还日志环
+ */
+struct LogRingOwner {
+    LogRing *ring = nullptr;
+    ~LogRingOwner()
+    {
+        if(ring != nullptr)
+        {
+            ring->owner.store(false, std::memory_order_release);
+        }
+    }
+};
+
+Logger& Logger::instance()
+{
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+{
+    for(int i = 0; i < LOG_MAX_THREADS; i++)
+    {
+        rings[i] = nullptr;
+    }
+    this->ring_count = 0;
+    this->min_level = LL_INFO;
+    this->running = false;
+    this->idle = true;
+    this->fp = nullptr;
+    this->binary = false;
+}
+
+Logger::~Logger()
+{
+    stop();
+    for(int i = 0; i < LOG_MAX_THREADS; i++)
+    {
+        delete rings[i].load();
+    }
+}
+
+/**
+ * @brief 启动写日志线程
+ * @param level 运行时最低等级
+ * @param path 日志文件（空=只输出控制台）
+ * @param binary 文件格式：false=每行一个JSON对象，true=二进制记录
+ * @return bool false=无法创建日志文件
+ * @details 二进制记录格式（小端）：time_us(8) level(1) thread(1) len(2) src(12) text(len)
+ */
+bool Logger::start(LogLevel level, const std::string& path, bool binary)
+{
+    this->min_level = level;
+    this->binary = binary;
+    if(!path.empty())
+    {
+        fp = fopen(path.c_str(), binary ? "wb" : "w");
+        if(fp == nullptr)
+        {
+            cerr << "无法创建日志文件: " << path << endl;
+            return false;
+        }
+    }
+    running = true;
+    writer = std::thread(&Logger::writer_loop, this);
+    return true;
+}
+
+/**
+ * @brief 输出剩余日志后停止写日志线程；之后的日志同步写控制台
+ */
+void Logger::stop()
+{
+    if(running.exchange(false))
+    {
+        writer.join();
+    }
+    if(fp != nullptr)
+    {
+        fclose(fp);
+        fp = nullptr;
+    }
+}
+
+/**
+ * @brief 等待各线程已提交的日志全部输出（用于在直接写控制台之前保持先后顺序）
+ */
+void Logger::flush()
+{
+    while(running.load(std::memory_order_relaxed))
+    {
+        bool empty = idle.load(std::memory_order_acquire);
+        int n = ring_count.load(std::memory_order_acquire);
+        for(int i = 0; i < n && empty; i++)
+        {
+            LogRing *ring = rings[i].load(std::memory_order_acquire);
+            empty = ring == nullptr || ring->empty();
+        }
+        if(empty)
+        {
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(LOG_IDLE_US));
+    }
+}
+
+/**
+ * @brief 当前线程的日志环：首次调用时接管一个空闲的环，没有则新建
+ * @return LogRing* nullptr=环已用完（该线程的日志同步输出）
+ */
+LogRing *Logger::thread_ring()
+{
+    static thread_local LogRingOwner owner;
+    if(owner.ring != nullptr)
+    {
+        return owner.ring;
+    }
+    int n = ring_count.load(std::memory_order_acquire);
+    for(int i = 0; i < n; i++)
+    {
+        LogRing *ring = rings[i].load(std::memory_order_acquire);
+        bool expected = false;
+        if(ring != nullptr && ring->owner.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+            owner.ring = ring;
+            return ring;
+        }
+    }
+    int idx = ring_count.fetch_add(1, std::memory_order_acq_rel);
+    if(idx >= LOG_MAX_THREADS)
+    {
+        ring_count.fetch_sub(1, std::memory_order_acq_rel);
+        return nullptr;
+    }
+    LogRing *ring = new LogRing();
+    ring->id = idx;
+    ring->owner = true;
+    rings[idx].store(ring, std::memory_order_release);
+    owner.ring = ring;
+    return ring;
+}
+
+/**
+ * @brief 当前线程的日志不能等待：环满时直接丢弃（转发线程启动时调用）
+ */
+void Logger::set_nonblocking()
+{
+    log_nonblocking = true;
+}
+
+/**
+ * @brief 提交一条日志（任意线程调用，不做I/O）
+ * @details 环满时转发线程丢弃日志，其他线程（仿真/脚本解析）等写日志线程腾出空间，不丢失控制台输出
+ */
+void Logger::submit(LogLevel level, const char *src, const std::string& text)
+{
+    if(!enabled(level))
+    {
+        return;
+    }
+    LogRing *ring = running.load(std::memory_order_relaxed) ? thread_ring() : nullptr;
+    if(ring == nullptr)
+    {
+        output_console(level, text.data(), text.size());  // 未启动：同步输出
+        return;
+    }
+    int64_t now = Clock::now_us();
+    while(!ring->push(level, src, text.data(), text.size(), now))
+    {
+        if(log_nonblocking || !running.load(std::memory_order_relaxed))
+        {
+            ring->drop();
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+/**
+ * @brief 控制台：人类可读格式，WARN/ERROR写stderr
+ */
+void Logger::output_console(uint8_t level, const char *text, size_t len)
+{
+    std::ostream& out = level >= LL_WARN ? cerr : cout;
+    out.write(text, len);
+    out.put('\n');
+    if(!running.load(std::memory_order_relaxed))
+    {
+        out.flush();
+    }
+}
+
+/**
+ * @brief 输出一条日志到控制台和日志文件
+ */
+void Logger::output(const LogRecord *rec)
+{
+    output_console(rec->level, rec->text, rec->len);
+    if(fp == nullptr)
+    {
+        return;
+    }
+    char src[sizeof(rec->src) + 1];
+    memcpy(src, rec->src, sizeof(rec->src));
+    src[sizeof(rec->src)] = 0;
+    if(binary)
+    {
+        fwrite(&rec->time_us, sizeof(rec->time_us), 1, fp);
+        fwrite(&rec->level, 1, 1, fp);
+        fwrite(&rec->thread, 1, 1, fp);
+        fwrite(&rec->len, sizeof(rec->len), 1, fp);
+        fwrite(rec->src, sizeof(rec->src), 1, fp);
+        fwrite(rec->text, 1, rec->len, fp);
+        return;
+    }
+    static const char *level_names[] = {"debug", "info", "warn", "error"};
+    fprintf(fp, "{\"ts_us\":%lld,\"level\":\"%s\",\"thread\":%u,\"src\":\"%s\",\"msg\":\"",
+            (long long)rec->time_us, level_names[rec->level & 3], rec->thread, src);
+    for(uint16_t i = 0; i < rec->len; i++)
+    {
+        unsigned char c = rec->text[i];
+        if(c == '"' || c == '\\')
+        {
+            fputc('\\', fp);
+            fputc(c, fp);
+        }
+        else if(c == '\n')
+        {
+            fputs("\\n", fp);
+        }
+        else if(c < 0x20)
+        {
+            fprintf(fp, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, fp);
+        }
+    }
+    fputs("\"}\n", fp);
+}
+
+/**
+ * @brief 写日志线程：每次取各环中最早的日志（按时间顺序合并各线程），环全空时刷新输出并短暂休眠
+ */
+void Logger::writer_loop()
+{
+    bool stopping = false;
+    while(true)
+    {
+        if(!running.load(std::memory_order_relaxed))
+        {
+            stopping = true;    // 停止后先把环中剩余的日志写完
+        }
+
+        LogRing *best = nullptr;
+        const LogRecord *best_rec = nullptr;
+        int n = ring_count.load(std::memory_order_acquire);
+        for(int i = 0; i < n; i++)
+        {
+            LogRing *ring = rings[i].load(std::memory_order_acquire);
+            const LogRecord *rec = ring != nullptr ? ring->front() : nullptr;
+            if(rec != nullptr && (best_rec == nullptr || rec->time_us < best_rec->time_us))
+            {
+                best = ring;
+                best_rec = rec;
+            }
+        }
+
+        if(best_rec == nullptr)
+        {
+            if(!idle.load(std::memory_order_relaxed))
+            {
+                cout.flush();
+                cerr.flush();
+                if(fp != nullptr)
+                {
+                    fflush(fp);
+                }
+                idle.store(true, std::memory_order_release);
+            }
+            if(stopping)
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(LOG_IDLE_US));
+            continue;
+        }
+
+        idle.store(false, std::memory_order_relaxed);
+        output(best_rec);
+        best->pop();
+    }
+    uint64_t lost = 0;
+    for(int i = 0; i < ring_count.load(); i++)
+    {
+        LogRing *ring = rings[i].load();
+        lost += ring != nullptr ? ring->get_overruns() : 0;
+    }
+    if(lost > 0)
+    {
+        cerr << "日志环满丢弃 " << lost << " 条" << endl;
+    }
+}
+
+/**
+ * @brief 开始一条日志：复用线程本地的格式化缓冲
+ */
+static std::ostringstream& log_stream()
+{
+    static thread_local std::ostringstream os;
+    os.str(std::string());
+    os.clear();
+    os.flags(std::ios_base::dec);
+    os.precision(6);
+    return os;
+}
+
+LogLine::LogLine(LogLevel level, const char *src) : level(level), src(src), os(log_stream())
+{
+}
+
+LogLine::~LogLine()
+{
+    Logger::instance().submit(level, src, os.str());
+}
+
+// --------------- 宏定义 ---------------
+#define BUFFER_SIZE 1500        // 以太网MTU默认值（最大帧大小）
+#define SYSTEM(A) system(A)     // 封装system调用（执行系统命令）
+
+// --------------- 解析脚本文件函数 ---------------
+/**
+ * @brief 解析事件的可选参数（key=value，写在丢包率之后、描述之前）
+ * @param ev 待设置的事件
+ * @param token 形如dup=5的参数
+ * @return bool false=未知参数或数值错误
+ */
+bool parseEventOption(NetworkEvent& ev, const std::string& token) {
+    size_t eq = token.find('=');
+    std::string key = token.substr(0, eq);
+    std::string value = token.substr(eq + 1);
+    char *end = nullptr;
+    long long v = strtoll(value.c_str(), &end, 10);
+    if (key == "outage") {
+        if (value == "flush") {
+            ev.outage = OUTAGE_FLUSH;
+        } else if (value == "hold") {
+            ev.outage = OUTAGE_HOLD;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    if (key == "ecn") {
+        const char *names[] = {"off", "step", "dualq"};
+        for (int i = 0; i <= AQM_DUALQ; i++) {
+            if (value == names[i]) {
+                ev.aqm = i;
+                return true;
+            }
+        }
+        return false;
+    }
+    if (key == "xt") {
+        const char *names[] = {"none", "cbr", "poisson", "pareto", "aimd"};
+        for (int i = 0; i <= XT_AIMD; i++) {
+            if (value == names[i]) {
+                ev.xt_model = i;
+                return true;
+            }
+        }
+        return false;
+    }
+    if (value.empty() || *end != '\0' || v < 0) {
+        return false;
+    }
+    if (key == "dup") {
+        ev.dup = v;
+    } else if (key == "corrupt") {
+        ev.corrupt = v;
+    } else if (key == "stealth") {
+        ev.stealth = v;
+    } else if (key == "xt_rate") {
+        ev.xt_rate = v;
+    } else if (key == "xt_flows") {
+        ev.xt_flows = v;
+    } else if (key == "xt_qlim") {
+        ev.xt_qlim_ms = v;
+    } else if (key == "buf") {
+        ev.buffer_ms = v;
+    } else if (key == "ecn_thresh") {
+        ev.ecn_thresh_us = v;
+    } else if (key == "aqm_target") {
+        ev.aqm_target_ms = v;
+    } else if (key == "outage_period" || key == "outage_len") {
+        (key == "outage_period" ? ev.outage_period_ms : ev.outage_len_ms) = v;
+        if (ev.outage == OUTAGE_NONE) {
+            ev.outage = OUTAGE_HOLD;    // 只给周期/时长时默认保留队列（如切换间隙：在途的帧稍后送达）
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief 从输入流加载网络事件（脚本文件或控制连接上发来的脚本）
+ * @param file 输入流
+ * @param simulator 网络仿真器
+ * @return bool 是否成功加载
+ */
+bool loadScript(std::istream& file, NetworkSimulator& simulator) {
+    std::string line;
+    int line_num = 0;
+    int event_count = 0;
+    
+    while (std::getline(file, line)) {
+        line_num++;
+        
+        // 去除行首尾的空格
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos) {
+            // 空行，跳过
+            continue;
+        }
+        
+        // 跳过注释行
+        if (line[start] == '#') {
+            continue;
+        }
+        
+        std::istringstream iss(line);
+        int64_t start_time, duration, bandwidth, delay;
+        int loss;
+        std::string description;
+        
+        if (iss >> start_time >> duration >> bandwidth >> delay >> loss) {
+            NetworkEvent ev(start_time, duration, bandwidth, delay, loss);
+
+            // 可选参数：key=value（如 dup=5 corrupt=1 stealth=1），遇到第一个不含=的词即为描述
+            bool options_ok = true;
+            std::string token;
+            std::streampos pos = iss.tellg();
+            while (iss >> token) {
+                if (token.find('=') == std::string::npos) {
+                    iss.clear();
+                    iss.seekg(pos);
+                    break;
+                }
+                if (!parseEventOption(ev, token)) {
+                    options_ok = false;
+                    break;
+                }
+                pos = iss.tellg();
+            }
+            if (!options_ok) {
+                LOGW("script") << "脚本文件第 " << line_num << " 行参数错误: " << token;
+                continue;
+            }
+            iss.clear();
+
+            // 读取剩余部分作为描述
+            std::getline(iss >> std::ws, description);
+            ev.description = description;
+            
+            simulator.addEvent(ev);
+            event_count++;
+            LOGI("script") << "  事件" << event_count << ": " << start_time / 1000 << "s开始, "
+                           << duration / 1000 << "s, " << bandwidth << "Mbps, "
+                           << delay << "ms延迟, " << loss << "‰丢包";
+        } else {
+            LOGW("script") << "脚本文件第 " << line_num << " 行格式错误: " << line;
+        }
+    }
+    
+    LOGI("script") << "成功加载 " << event_count << " 个事件";
+    return event_count > 0;
+}
+
+/**
+ * @brief 从脚本文件加载网络事件
+ * @param filename 脚本文件名
+ * @param simulator 网络仿真器
+ * @return bool 是否成功加载
+ */
+bool loadScriptFromFile(const std::string& filename, NetworkSimulator& simulator) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        LOGE("script") << "无法打开脚本文件: " << filename;
+        return false;
+    }
+    LOGI("script") << "加载脚本文件: " << filename;
+    return loadScript(file, simulator);
+}
+
+// --------------- 守护进程 ---------------
+ScenarioDaemon::ScenarioDaemon(TapInterface* t0, TapInterface* t1)
+    : tap0(t0), tap1(t1), listen_fd(-1), shutdown(false)
+{
+}
+
+ScenarioDaemon::~ScenarioDaemon()
+{
+    stopRuns();
+    for (Client& c : clients) {
+        close(c.fd);
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(sock_path.c_str());
+    }
+}
+
+/**
+ * @brief 创建并监听控制套接字（已存在的同名文件先删除）
+ * @param path 套接字路径
+ * @return bool 是否成功
+ */
+bool ScenarioDaemon::open(const std::string& path)
+{
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOGE("daemon") << "控制套接字路径过长: " << path;
+        return false;
+    }
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        LOGE("daemon") << "socket(AF_UNIX): " << strerror(errno);
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 || listen(listen_fd, 4) < 0) {
+        LOGE("daemon") << "bind/listen " << path << ": " << strerror(errno);
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+    sock_path = path;
+    LOGI("daemon") << "守护进程控制套接字: " << path;
+    return true;
+}
+
+/**
+ * @brief 同时等待新连接和各连接上的命令，直到收到SHUTDOWN
+ * @note 一个连接空闲或只发了半行不阻塞其他连接；命令本身（如DRAIN）仍在本线程中依次执行
+ */
+void ScenarioDaemon::serve()
+{
+    std::vector<struct pollfd> pfds;
+    while (!shutdown) {
+        pfds.assign(1, {listen_fd, POLLIN, 0});
+        for (const Client& c : clients) {
+            pfds.push_back({c.fd, POLLIN, 0});
+        }
+        if (poll(pfds.data(), pfds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("daemon") << "poll: " << strerror(errno);
+            return;
+        }
+        // 从后往前处理，关闭的连接直接从clients中移除，不影响前面的下标
+        for (size_t i = pfds.size() - 1; i >= 1 && !shutdown; i--) {
+            if (pfds[i].revents != 0 && !serveClient(clients[i - 1])) {
+                close(clients[i - 1].fd);
+                clients.erase(clients.begin() + (i - 1));
+            }
+        }
+        if (!shutdown && (pfds[0].revents & POLLIN) != 0) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                clients.push_back({fd, std::string(), std::string(), false});
+            } else if (errno != EINTR && errno != ECONNABORTED) {
+                LOGE("daemon") << "accept: " << strerror(errno);
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * @brief 读取一个连接上已到达的数据，按行执行命令，每条命令回复一行；SCRIPT与END之间的行作为脚本内容
+ * @param c 控制连接
+ * @return bool false=对端已关闭或出错，由调用者关闭连接
+ */
+bool ScenarioDaemon::serveClient(Client& c)
+{
+    char chunk[4096];
+    ssize_t n = read(c.fd, chunk, sizeof(chunk));
+    if (n <= 0) {
+        return n < 0 && errno == EINTR;
+    }
+    c.buf.append(chunk, n);
+    size_t eol;
+    while (!shutdown && (eol = c.buf.find('\n')) != std::string::npos) {
+        std::string line = c.buf.substr(0, eol);
+        c.buf.erase(0, eol + 1);
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        std::string reply;
+        if (c.in_script) {
+            if (line != "END") {
+                c.script += line + "\n";
+                continue;
+            }
+            c.in_script = false;
+            std::istringstream in(c.script);
+            std::unique_ptr<NetworkSimulator> sim(new NetworkSimulator(tap0, tap1, false));
+            bool ok = loadScript(in, *sim);
+            reply = stage(std::move(sim), ok);
+            c.script.clear();
+        } else {
+            std::istringstream iss(line);
+            std::string cmd, args;
+            iss >> cmd;
+            std::getline(iss >> std::ws, args);
+            if (cmd.empty()) {
+                continue;
+            }
+            if (cmd == "SCRIPT") {
+                c.in_script = true;
+                continue;
+            }
+            reply = handleCommand(cmd, args);
+        }
+        reply += "\n";
+        if (send(c.fd, reply.data(), reply.size(), MSG_NOSIGNAL | MSG_DONTWAIT) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 执行一条命令
+ * @param cmd 命令名
+ * @param args 其余参数
+ * @return std::string 回复（不含换行）
+ */
+std::string ScenarioDaemon::handleCommand(const std::string& cmd, const std::string& args)
+{
+    reap();
+    if (cmd == "LOAD") {
+        std::unique_ptr<NetworkSimulator> sim(new NetworkSimulator(tap0, tap1, false));
+        bool ok = loadScriptFromFile(args, *sim);
+        return stage(std::move(sim), ok);
+    }
+    if (cmd == "MODEL") {
+        std::unique_ptr<NetworkSimulator> sim(new NetworkSimulator(tap0, tap1, false));
+        std::unique_ptr<ScenarioModel> model(new ScenarioModel());
+        bool ok = model->loadFromFile(args);
+        sim->setModel(std::move(model));
+        return stage(std::move(sim), ok);
+    }
+    if (cmd == "START") {
+        return start(args);
+    }
+    if (cmd == "STOP") {
+        stopRuns();
+        return "OK stopped";
+    }
+    if (cmd == "DRAIN") {
+        int64_t timeout_ms = args.empty() ? 5000 : atoll(args.c_str());
+        return drain(timeout_ms);
+    }
+    if (cmd == "STATUS") {
+        return status();
+    }
+    if (cmd == "SHUTDOWN") {
+        stopRuns();
+        shutdown = true;
+        return "OK shutdown";
+    }
+    return "ERR 未知命令: " + cmd;
+}
+
+/**
+ * @brief 保存加载好的运行，等待START（替换先前加载但未开始的运行）
+ */
+std::string ScenarioDaemon::stage(std::unique_ptr<NetworkSimulator> sim, bool ok)
+{
+    if (!ok) {
+        return "ERR 场景加载失败";
+    }
+    staged = std::move(sim);
+    std::ostringstream out;
+    out << "OK loaded script_end_ms=" << staged->getScriptEnd();
+    return out.str();
+}
+
+/**
+ * @brief 按时开始已加载的运行
+ * @param args [总时长ms] [at=<epoch毫秒>|in=<毫秒>]，总时长省略时为脚本最后一个事件的结束时间
+ * @details 运行在命令返回前就已创建好线程，睡到开始时间后才应用第一个事件；
+ *          已有运行在进行时，它在同一时刻交接（保持最后的参数直接退出），新运行等它退出后立即接上，
+ *          中间没有恢复为无限制的空档。尚未开始的运行被新的START替换
+ */
+std::string ScenarioDaemon::start(const std::string& args)
+{
+    if (!staged) {
+        return "ERR 没有已加载的场景";
+    }
+    int64_t now = tap0->get_us();
+    int64_t total_ms = 0, start_us = now;
+    std::istringstream iss(args);
+    std::string token;
+    while (iss >> token) {
+        if (token.compare(0, 3, "at=") == 0) {
+            start_us = Clock::from_epoch_us(atoll(token.c_str() + 3) * 1000);
+        } else if (token.compare(0, 3, "in=") == 0) {
+            start_us = now + atoll(token.c_str() + 3) * 1000;
+        } else {
+            total_ms = atoll(token.c_str());
+        }
+    }
+    if (total_ms <= 0) {
+        total_ms = staged->getScriptEnd();
+    }
+    if (total_ms <= 0) {
+        return "ERR 需要指定总时长";
+    }
+    if (start_us < now) {
+        start_us = now;
+    }
+
+    if (current && !current->hasBegun()) {
+        current->stop();        // 还在等开始时间：直接取消，由它原来要接替的运行继续到新的交接时间
+        current.reset();
+    } else if (current) {
+        previous = std::move(current);  // current已开始，先前的previous必然已经退出
+    }
+    if (previous) {
+        previous->setHandoff(start_us);
+    }
+    staged->setTotalDuration(total_ms);
+    staged->setStartTime(start_us);
+    staged->setKeepLink(true);
+    staged->setPredecessor(previous.get());
+    staged->start();
+    current = std::move(staged);
+
+    std::ostringstream out;
+    out << "OK start_us=" << start_us << " total_ms=" << total_ms;
+    return out.str();
+}
+
+/**
+ * @brief 结束全部运行（先结束被接替的运行，后者开始前会等它退出）
+ */
+void ScenarioDaemon::stopRuns()
+{
+    if (previous) {
+        previous->stop();
+    }
+    if (current) {
+        current->stop();
+    }
+}
+
+/**
+ * @brief 结束当前运行，关闭入口，等两个方向已缓存的帧按计划时间发完后重新打开入口
+ * @param timeout_ms 最长等待时间
+ */
+std::string ScenarioDaemon::drain(int64_t timeout_ms)
+{
+    stopRuns();
+    tap0->set_ingress(false);
+    tap1->set_ingress(false);
+    int64_t begin = tap0->get_us();
+    bool drained = false;
+    while (tap0->get_us() - begin < timeout_ms * 1000) {
+        if (tap0->get_backlog() == 0 && tap1->get_backlog() == 0) {
+            drained = true;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    tap0->set_ingress(true);
+    tap1->set_ingress(true);
+    std::ostringstream out;
+    if (drained) {
+        out << "OK drained_ms=" << (tap0->get_us() - begin) / 1000;
+    } else {
+        out << "ERR 排空超时 backlog=" << tap0->get_backlog() << "/" << tap1->get_backlog();
+    }
+    return out.str();
+}
+
+/**
+ * @brief 当前运行状态（idle/pending/running）、进度、切换延迟、队列长度和各方向转发统计
+ */
+std::string ScenarioDaemon::status()
+{
+    std::ostringstream out;
+    const char *state = "idle";
+    if (current && current->isRunning()) {
+        state = current->hasBegun() ? "running" : "pending";
+    }
+    out << "OK state=" << state;
+    if (current && current->hasBegun()) {
+        out << " elapsed_ms=" << (tap0->get_us() - current->getBeginUs()) / 1000
+            << " total_ms=" << current->getTotalDuration()
+            << " events=" << current->getEventCount()
+            << " switch_us=" << current->getSwitchUs();
+    }
+    out << " backlog=" << tap0->get_backlog() << "/" << tap1->get_backlog();
+    TapInterface* taps[2] = {tap0, tap1};
+    for (TapInterface* tap : taps) {
+        const TapStats& st = tap->get_stats();
+        out << " " << tap->get_tap_name()
+            << ":rx=" << st.rx_packets.load(std::memory_order_relaxed)
+            << ",tx=" << st.tx_packets.load(std::memory_order_relaxed)
+            << ",drop=" << st.drops.load(std::memory_order_relaxed)
+            << ",late=" << st.slo_late.load(std::memory_order_relaxed)
+            << ",shed=" << st.shed.load(std::memory_order_relaxed)
+            << ",overloaded=" << (tap->is_overloaded() ? 1 : 0);
+    }
+    return out.str();
+}
+
+/**
+ * @brief current开始（或被取消）后不再访问previous，此时可以释放
+ */
+void ScenarioDaemon::reap()
+{
+    if (previous && !previous->isRunning() && (!current || current->hasBegun() || !current->isRunning())) {
+        previous.reset();
+    }
+}
+
+// --------------- TapInterface类实现（保持不变，除了新增方法）---------------
+/**
+ * @brief TapInterface构造函数
+ * @param tap_name TAP接口名（如tap0）
+ * @param br_name 桥接接口名（如aif）
+ * @param eth_name 物理网卡名（如eth2_h）
+ * @param delay_time 初始延迟（毫秒）
+ * @param bandwidth 初始带宽（bps）
+ * @details 初始化参数 + 清理旧的桥接配置（防止残留）
+ */
+TapInterface::TapInterface(const char *tap_name, const char *br_name, const char *eth_name, int64_t delay_time = 200,int64_t bandwidth = 100)
+{
+    // 初始化成员变量
+    this->delay_ms = delay_time;
+    this->tap_name = tap_name;
+    this->br_name = br_name;
+    this->eth_name = eth_name;
+    this->tap_fd = -1;          // 初始化为无效fd
+    this->bandwidth = bandwidth;
+    this->pre_time = 0;         // 上一个包发送时间初始化为0
+    this->packet_cnt = 0;       // 数据包计数初始化为0
+    this->Bloss = 0;        // 丢包率初始化为0（关闭丢包）
+    this->Bdup = 0;
+    this->Bcorrupt = 0;
+    this->Bstealth = 0;
+    this->epoll_fd = -1;
+    this->dst_fd = -1;
+    this->io_mode = IO_TAP;     // 默认TAP + 网桥
+    this->peer = nullptr;
+    this->ring_mb = 64;
+    this->ring = nullptr;
+    this->ring_size = 0;
+    this->rx_block_size = 0;
+    this->rx_block_nr = 0;
+    this->rx_cur = 0;
+    this->tx_ring = nullptr;
+    this->tx_frame_size = 0;
+    this->tx_frame_nr = 0;
+    this->tx_cur = 0;
+    this->tx_pending = 0;
+    this->uring_pool = nullptr;
+    this->uring_buf_size = 2048;
+    this->shm = nullptr;
+    this->shm_port = 0;
+    this->shm_in = nullptr;
+    this->shm_out = nullptr;
+    this->shm_in_desc = nullptr;
+    this->shm_out_desc = nullptr;
+    this->shm_rd = 0;
+    this->shm_tail = 0;
+    this->shm_reclaim = 0;
+    this->shm_posted = 0;
+    this->offload = false;
+    this->vnet_hdr_len = 0;
+    this->rx_buf_size = MAX_FRAME_SIZE;
+    this->rng.seed(std::random_device{}());
+    this->capture_ring = nullptr;
+    this->fault_sample_us = 0;
+    this->outage_mode = OUTAGE_NONE;
+    this->outage_period_us = 0;
+    this->outage_len_us = 0;
+    this->outage_start_us = 0;
+    this->outage_was_down = false;
+    this->link_up_us = 0;
+    this->xt_model = XT_NONE;
+    this->xt_rate = 0;
+    this->xt_flows = 1;
+    this->xt_qlim_us = 100000;
+    this->xt_cur_model = XT_NONE;
+    this->xt_last_us = 0;
+    this->xt_credit = 0;
+    this->xt_on = false;
+    this->xt_phase_end_us = 0;
+    this->xt_cwnd = 0;
+    this->xt_last_cut_us = 0;
+    this->stats_last_xt = 0;
+    this->bq_head = nullptr;
+    this->bq_tail = nullptr;
+    this->bq_bytes = 0;
+    this->buffer_us = 0;
+    this->aqm_mode = AQM_NONE;
+    this->ecn_thresh_us = 1000;
+    this->aqm_target_us = 15000;
+    this->lq_head = nullptr;
+    this->lq_tail = nullptr;
+    this->lq_bytes = 0;
+    this->pi2_p = 0.0;
+    this->pi2_prev_qdelay = 0;
+    this->pi2_last_us = 0;
+    this->ecn_flows.reset(new EcnFlow[ECN_FLOW_SLOTS]);
+    this->ecn_flow_overflow = 0;
+    this->tx_slack = 0;
+    this->prof = nullptr;
+    this->quic = nullptr;
+    this->rr = nullptr;
+    this->loop_us = 0;
+    this->slo_us = 1000;
+    this->shed_late = false;
+    this->overloaded = false;
+    this->overload_last_us = 0;
+    this->stopping = false;
+    this->ingress_open = true;
+    this->backlog = 0;
+    this->profile_gen = 1;
+    this->pipeline_gen = 0;
+    this->pipeline = nullptr;   // 转发线程第一次循环时选择
+    this->rx_scratch.resize(MAX_FRAME_SIZE);    // 中断期间入口丢弃的帧读到这里（开启卸载时扩大到超帧大小）
+    this->uring_pool_size = 0;
+    this->uring_rx_posted = 0;
+    this->stats_last_us = 0;
+    this->stats_last_rx = 0;
+    this->stats_last_tx = 0;
+
+    // --------------- 清理旧的桥接配置 ---------------
+    // 1. 关闭旧桥接接口
+    string iptables_cmd ="ifconfig " + this->br_name + " down";
+    cout << "iptables:: " << iptables_cmd << endl;
+    SYSTEM (iptables_cmd.c_str());
+    iptables_cmd.clear();
+
+    // 2. 从桥接接口删除旧TAP接口
+    iptables_cmd = "brctl delif " + this->br_name + " " + this->tap_name;
+    cout << "iptables:: " << iptables_cmd << endl;
+    SYSTEM (iptables_cmd.c_str());
+    iptables_cmd.clear();
+
+    // 3. 删除旧桥接接口
+    iptables_cmd = "brctl delbr " + this->br_name;
+    cout << "iptables:: " << iptables_cmd << endl;
+    SYSTEM (iptables_cmd.c_str());    
+    iptables_cmd.clear();
+}
+
+/**
+ * @brief 获取当前时间戳（毫秒级）
+ * @return int64_t 从epoch到现在的毫秒数（单调时钟，见Clock）
+ */
+int64_t TapInterface::get_ms()
+{
+    return Clock::now_us() / 1000;
+}
+
+/**
+ * @brief 获取当前时间戳（微秒级）
+ * @return int64_t 从epoch到现在的微秒数（单调时钟，见Clock）
+ * @note 流量控制需要更高精度，因此主要使用微秒级时间戳
+ */
+int64_t TapInterface::get_us()
+{
+    return Clock::now_us();
+}
+
+/**
+ * @brief TapInterface析构函数
+ * @details 关闭文件描述符 + 释放链表所有节点（防止内存泄漏）
+ */
+TapInterface::~TapInterface()
+{
+    // 先释放节点（节点可能引用接收环内存），再解除映射、关闭fd；路径段、瓶颈队列和时延线中未传输的帧直接释放
+    // （不再发送：对端接口可能已先析构并解除了发送环映射）
+    hops.clear();
+    while(bq_head != nullptr)
+    {
+        Node *next = bq_head->next;
+        release_node(bq_head);
+        bq_head = next;
+    }
+    while(lq_head != nullptr)
+    {
+        Node *next = lq_head->next;
+        release_node(lq_head);
+        lq_head = next;
+    }
+    while(head != nullptr)
+    {
+        Node *next = head->next;
+        release_node(head);
+        head = next;
+    }
+    tail = nullptr;
+    if(ring != nullptr)
+    {
+        munmap(ring, ring_size);
+    }
+    uring.close_ring();     // 先销毁io_uring（取消在途请求），再释放注册缓冲池
+    if(uring_pool != nullptr)
+    {
+        munmap(uring_pool, uring_pool_size);
+    }
+    close(tap_fd);
+    close(epoll_fd);
+}
+
+/**
+ * @brief 调试函数：打印数据包的十六进制内容
+ * @param data 数据包二进制数据
+ * @param size 数据包大小
+ * @note 每8个字节换行，便于查看
+ */
+void TapInterface::printData(const unsigned char* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        std::cout << std::hex << std::setw(2) << std::setfill('0') << "0x" << static_cast<int>(data[i]) << " ";
+        if ((i + 1) % 8 == 0)
+            std::cout << std::endl;
+    }
+    std::cout << std::dec;  // Reset to decimal format if needed
+}
+
+/**
+ * @brief 随机丢包判断函数
+ * @param chance 丢包概率（千分比，如10=1%）
+ * @return bool true=丢包，false=不丢包
+ * @note 使用mt19937随机数生成器，范围1-1000
+ */
+bool TapInterface::chance_in_a_thousand(int chance) {
+    // 生成器在构造时播种一次：GSO超帧每个分段都要判断一次，不能每次都读random_device
+    std::uniform_int_distribution<> distr(1, 1000);
+    return distr(rng) <= chance;
+};
+
+// --------------- 帧解析与校验和 ---------------
+/**
+ * @brief 把64位累加和折叠成16位反码和
+ */
+static inline uint32_t csum_fold64(uint64_t sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    uint32_t s = static_cast<uint32_t>(sum);
+    s = (s & 0xffff) + (s >> 16);
+    s = (s & 0xffff) + (s >> 16);
+    return s;
+}
+
+/**
+ * @brief 累加不足一个向量的尾部（按主机字节序的32位/16位字，奇数字节补在低位）
+ */
+static inline uint64_t csum_tail(uint64_t sum, const uint8_t *data, size_t len)
+{
+    while(len >= 4)
+    {
+        uint32_t w;
+        memcpy(&w, data, 4);
+        sum += w;
+        data += 4;
+        len -= 4;
+    }
+    if(len >= 2)
+    {
+        uint16_t w;
+        memcpy(&w, data, 2);
+        sum += w;
+        data += 2;
+        len -= 2;
+    }
+    if(len)
+    {
+        sum += data[0];
+    }
+    return sum;
+}
+
+/**
+ * @brief 标量反码和：按主机字节序累加32位字到64位累加器
+ * @return uint32_t 16位反码和（主机字节序的字，由调用者转换）
+ * @note 反码和与字节序无关（RFC 1071），按小端字累加后交换两个字节即得到大端字的和
+ */
+static uint32_t csum_scalar(const uint8_t *data, size_t len)
+{
+    return csum_fold64(csum_tail(0, data, len));
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * @brief SSE2反码和：每次16字节，32位字零扩展到两个64位通道累加
+ */
+__attribute__((target("sse2")))
+static uint32_t csum_sse2(const uint8_t *data, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    while(len >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+        data += 16;
+        len -= 16;
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), acc);
+    uint64_t sum = csum_fold64(lanes[0]) + static_cast<uint64_t>(csum_fold64(lanes[1]));
+    return csum_fold64(csum_tail(sum, data, len));
+}
+
+/**
+ * @brief AVX2反码和：每次64字节（两路32字节并行累加），32位字零扩展到64位通道
+ */
+__attribute__((target("avx2")))
+static uint32_t csum_avx2(const uint8_t *data, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    while(len >= 64)
+    {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+        data += 64;
+        len -= 64;
+    }
+    if(len >= 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+        data += 32;
+        len -= 32;
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), _mm256_add_epi64(acc0, acc1));
+    // 每个通道最多累加len/8个32位字，不会溢出；先分别折叠再合并
+    uint64_t sum = 0;
+    for(int i = 0; i < 4; i++)
+    {
+        sum += csum_fold64(lanes[i]);
+    }
+    return csum_fold64(csum_tail(sum, data, len));
+}
+#endif
+
+typedef uint32_t (*CsumKernel)(const uint8_t *data, size_t len);
+
+/**
+ * @brief 按CPU特性选择反码和内核（AVX2 > SSE2 > 标量）
+ * @param name 输出：内核名称（可为nullptr）
+ */
+static CsumKernel csum_select(const char **name)
+{
+    CsumKernel kernel = csum_scalar;
+    const char *kname = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+    {
+        kernel = csum_avx2;
+        kname = "avx2";
+    }
+    else if(__builtin_cpu_supports("sse2"))
+    {
+        kernel = csum_sse2;
+        kname = "sse2";
+    }
+#endif
+    if(name != nullptr)
+    {
+        *name = kname;
+    }
+    return kernel;
+}
+
+static const CsumKernel csum_kernel = csum_select(nullptr);   // 启动时选择一次
+
+/**
+ * @brief 按16位大端字累加反码和
+ * @param sum 已有的部分和
+ * @param data 数据（起始位置相对校验范围为偶数偏移）
+ * @param len 长度（奇数时最后一个字节补在高位）
+ * @return uint32_t 新的部分和（未折叠，由csum_fold折叠）
+ */
+static uint32_t csum_add(uint32_t sum, const uint8_t *data, size_t len)
+{
+    uint32_t s = csum_kernel(data, len);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    s = __builtin_bswap16(static_cast<uint16_t>(s));
+#endif
+    return sum + s;
+}
+
+/**
+ * @brief 折叠并取反，得到16位校验和（主机字节序）
+ */
+static uint16_t csum_fold(uint32_t sum)
+{
+    while(sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+}
+
+/**
+ * @brief 解析以太网帧的L3/L4位置（IPv4/IPv6，无VLAN、无IPv6扩展头）
+ * @param frame 以太网帧
+ * @param size 帧大小
+ * @param l4_off 输出：L4头相对帧起始的偏移
+ * @param l4_len 输出：L4头 + 负载长度（取自IP头）
+ * @param proto 输出：L4协议号
+ * @return bool false=不是可解析的IP帧
+ */
+static bool l3l4_parse(const uint8_t *frame, uint32_t size, uint32_t *l4_off, uint32_t *l4_len, uint8_t *proto)
+{
+    if(size < 14)
+    {
+        return false;
+    }
+    uint16_t eth_type = (frame[12] << 8) | frame[13];
+    const uint8_t *ip = frame + 14;
+    uint32_t ip_len = size - 14;
+
+    if(eth_type == 0x0800 && ip_len >= 20)
+    {
+        uint32_t ihl = (ip[0] & 0x0f) * 4;
+        uint32_t tot_len = (ip[2] << 8) | ip[3];
+        if(ihl < 20 || tot_len > ip_len || tot_len < ihl)
+        {
+            return false;
+        }
+        *proto = ip[9];
+        *l4_off = 14 + ihl;
+        *l4_len = tot_len - ihl;
+        return true;
+    }
+    if(eth_type == 0x86dd && ip_len >= 40)
+    {
+        uint32_t payload_len = (ip[4] << 8) | ip[5];
+        if(payload_len + 40 > ip_len)
+        {
+            return false;
+        }
+        *proto = ip[6];
+        *l4_off = 14 + 40;
+        *l4_len = payload_len;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief 解析帧的五元组并计算哈希（按流统计共用）
+ * @param frame 以太网帧
+ * @param size 帧大小
+ * @param key 输出：五元组（未用的字节清零，可整体比较）
+ * @param l4_off 输出：L4头相对帧起始的偏移
+ * @param l4_len 输出：L4头 + 负载长度
+ * @return uint32_t FNV-1a哈希（非零；0=不是可解析的IP帧）
+ */
+static uint32_t flow_key_parse(const uint8_t *frame, uint32_t size, FlowKey *key, uint32_t *l4_off, uint32_t *l4_len)
+{
+    uint8_t proto;
+    if(!l3l4_parse(frame, size, l4_off, l4_len, &proto))
+    {
+        return 0;
+    }
+    memset(key, 0, sizeof(*key));
+    const uint8_t *ip = frame + 14;
+    key->family = (ip[0] >> 4) == 4 ? 4 : 6;
+    key->proto = proto;
+    if(key->family == 4)
+    {
+        memcpy(key->src, ip + 12, 4);
+        memcpy(key->dst, ip + 16, 4);
+    }
+    else
+    {
+        memcpy(key->src, ip + 8, 16);
+        memcpy(key->dst, ip + 24, 16);
+    }
+    if((proto == IPPROTO_UDP || proto == IPPROTO_TCP) && *l4_len >= 4)
+    {
+        const uint8_t *l4 = frame + *l4_off;
+        key->sport = (l4[0] << 8) | l4[1];
+        key->dport = (l4[2] << 8) | l4[3];
+    }
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(key);
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < sizeof(*key); i++)
+    {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h != 0 ? h : 1;  // 0保留给空槽
+}
+
+/**
+ * @brief 在开放寻址的流表中查找五元组，insert=true时首次出现的流占用一个空槽
+ * @param table 流表（F带有std::atomic<uint32_t> hash和FlowKey key）
+ * @param slots 槽数
+ * @param h flow_key_parse返回的哈希
+ * @param key 五元组
+ * @param insert 没有找到时是否占用空槽
+ * @return F* 槽（未找到/不插入/探测FLOW_PROBES次没有空槽时nullptr）
+ * @note 只由转发线程调用：先写五元组，再以release写入hash，打印线程acquire读到hash后五元组已完整
+ */
+template<class F> static F *flow_slot(F *table, int slots, uint32_t h, const FlowKey& key, bool insert)
+{
+    for(int k = 0; k < FLOW_PROBES; k++)
+    {
+        F& f = table[(h + k) % slots];
+        uint32_t cur = f.hash.load(std::memory_order_relaxed);
+        if(cur == 0)
+        {
+            if(!insert)
+            {
+                return nullptr;
+            }
+            f.key = key;
+            f.hash.store(h, std::memory_order_release);
+            return &f;
+        }
+        if(cur == h && memcmp(&f.key, &key, sizeof(key)) == 0)
+        {
+            return &f;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * @brief 五元组的可读形式（udp 10.0.0.1:443 -> 10.0.0.2:5000，IPv6地址加方括号）
+ */
+static std::string flow_key_str(const FlowKey& key)
+{
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    int af = key.family == 4 ? AF_INET : AF_INET6;
+    inet_ntop(af, key.src, src, sizeof(src));
+    inet_ntop(af, key.dst, dst, sizeof(dst));
+    std::ostringstream os;
+    if(key.proto == IPPROTO_TCP || key.proto == IPPROTO_UDP)
+    {
+        const char *lb = key.family == 6 ? "[" : "", *rb = key.family == 6 ? "]" : "";
+        os << (key.proto == IPPROTO_TCP ? "tcp " : "udp ") << lb << src << rb << ":" << key.sport
+           << " -> " << lb << dst << rb << ":" << key.dport;
+    }
+    else
+    {
+        os << "proto " << (int)key.proto << " " << src << " -> " << dst;
+    }
+    return os.str();
+}
+
+// --------------- QUIC被动观测 ---------------
+QuicObserver::QuicObserver() : flows(new QuicFlow[QUIC_FLOW_SLOTS]), overflow(0)
+{
+}
+
+/**
+ * @brief 观测一个发出的帧（只窥视UDP负载的头部，不解密）
+ * @param frame 以太网帧
+ * @param size 帧大小
+ * @param now 观测时间（微秒，取帧的计划发送时间，不含转发线程的调度抖动）
+ * @details 长头（0b11xxxxxx，版本号非0）：五元组首次出现时占用槽位；
+ *          短头（0b01xxxxxx）：只在已跟踪的连接上观测自旋位（0x20）与Q/L位（0x10/0x08）
+ */
+inline void QuicObserver::observe(const uint8_t *frame, uint32_t size, int64_t now)
+{
+    FlowKey key;
+    uint32_t l4_off, l4_len;
+    uint32_t h = flow_key_parse(frame, size, &key, &l4_off, &l4_len);
+    if(h == 0 || key.proto != IPPROTO_UDP || l4_len < 8 + 1 || l4_off + l4_len > size)
+    {
+        return;
+    }
+    datagram(h, key, frame + l4_off + 8, l4_len - 8, now);
+}
+
+/**
+ * @brief 观测整帧发出的UDP GSO超帧：每个分段的负载是一个独立的QUIC数据报，从hdr_len + i*gso_size开始
+ * @param frame 超帧（以太网帧）
+ * @param size 超帧大小
+ * @param hdr_len 协议头长度（以太网 + IP + UDP）
+ * @param gso_size 每段负载长度（最后一段可能更短）
+ * @param now 观测时间（超帧的计划发送时间，各段相同）
+ */
+void QuicObserver::observe_gso(const uint8_t *frame, uint32_t size, uint32_t hdr_len, uint32_t gso_size, int64_t now)
+{
+    FlowKey key;
+    uint32_t l4_off, l4_len;
+    uint32_t h = flow_key_parse(frame, size, &key, &l4_off, &l4_len);
+    if(h == 0 || key.proto != IPPROTO_UDP || gso_size == 0 || hdr_len != l4_off + 8)
+    {
+        return;
+    }
+    for(uint32_t off = hdr_len; off < size; off += gso_size)
+    {
+        datagram(h, key, frame + off, size - off < gso_size ? size - off : gso_size, now);
+    }
+}
+
+/**
+ * @brief 观测一个UDP负载（长头建立跟踪，短头累计自旋位/丢包位）
+ * @param h 五元组哈希
+ * @param key 五元组
+ * @param quic UDP负载
+ * @param len 负载长度（>0）
+ * @param now 观测时间
+ */
+inline void QuicObserver::datagram(uint32_t h, const FlowKey& key, const uint8_t *quic, uint32_t len, int64_t now)
+{
+    uint8_t b0 = quic[0];
+    if((b0 & 0xc0) == 0xc0)     // 长头：确认是QUIC（版本协商包的版本号为0，不据此建立跟踪）
+    {
+        if(len >= 5 && (quic[1] | quic[2] | quic[3] | quic[4]) != 0 &&
+           flow_slot(flows.get(), QUIC_FLOW_SLOTS, h, key, true) == nullptr)
+        {
+            overflow.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    if((b0 & 0xc0) != 0x40)     // 不是带固定位的短头
+    {
+        return;
+    }
+    QuicFlow *f = flow_slot(flows.get(), QUIC_FLOW_SLOTS, h, key, false);
+    if(f == nullptr)
+    {
+        return;
+    }
+    stat_add(f->packets, 1);
+
+    uint8_t spin = (b0 >> 5) & 1;
+    if(f->spin_edge_us == 0)
+    {
+        f->spin = spin;
+        f->spin_edge_us = -1;   // 第一个短头包：只记录自旋位，尚无边沿
+    }
+    else if(spin != f->spin)
+    {
+        f->spin = spin;
+        if(f->spin_edge_us > 0 && now > f->spin_edge_us)
+        {
+            int64_t rtt = now - f->spin_edge_us;
+            stat_add(f->rtt_samples, 1);
+            stat_add(f->rtt_sum_us, rtt);
+            if((uint64_t)rtt < f->rtt_min_us.load(std::memory_order_relaxed))
+                f->rtt_min_us.store(rtt, std::memory_order_relaxed);
+            int k = 64 - __builtin_clzll((uint64_t)rtt);
+            stat_add(f->rtt_hist[k < QUIC_RTT_BUCKETS ? k : QUIC_RTT_BUCKETS - 1], 1);
+        }
+        f->spin_edge_us = now;
+    }
+
+    uint8_t q = (b0 >> 4) & 1;
+    if(q != f->q)
+    {
+        if(f->q_started)    // 刚结束的是一个完整的半周期
+        {
+            stat_add(f->q_periods, 1);
+            stat_add(f->q_seen, f->q_run);
+            if(f->q_run < QUIC_SQUARE_PERIOD)
+                stat_add(f->q_lost, QUIC_SQUARE_PERIOD - f->q_run);
+        }
+        f->q_started = f->packets.load(std::memory_order_relaxed) > 1;
+        f->q = q;
+        f->q_run = 0;
+    }
+    f->q_run++;
+    if(b0 & 0x08)
+    {
+        stat_add(f->l_marks, 1);
+    }
+}
+
+/**
+ * @brief 自旋位RTT直方图的分位数（按所在桶的上界报告）
+ * @param permille 分位（千分比）
+ */
+static int64_t quic_rtt_quantile(const uint64_t *hist, uint64_t total, int permille)
+{
+    uint64_t need = (total * permille + 999) / 1000, acc = 0;
+    for(int k = 0; k < QUIC_RTT_BUCKETS; k++)
+    {
+        acc += hist[k];
+        if(acc >= need && acc > 0)
+        {
+            return (int64_t)1 << k;
+        }
+    }
+    return (int64_t)1 << (QUIC_RTT_BUCKETS - 1);
+}
+
+/**
+ * @brief 打印本方向包数最多的QUIC_TOP_FLOWS个连接
+ * @details 自旋位RTT：样本数、最小/平均、p50/p90（桶上界）；
+ *          Q/L位只在半周期的平均长度接近QUIC_SQUARE_PERIOD（端点协商了loss bits）时报告，否则这两位被头部保护随机化
+ */
+void QuicObserver::report(const std::string& name)
+{
+    std::vector<std::pair<uint64_t, const QuicFlow *>> top;
+    for(int i = 0; i < QUIC_FLOW_SLOTS; i++)
+    {
+        const QuicFlow& f = flows[i];
+        if(f.hash.load(std::memory_order_acquire) == 0)
+            continue;
+        top.push_back(std::make_pair(f.packets.load(std::memory_order_relaxed), &f));
+    }
+    if(top.empty())
+    {
+        return;
+    }
+    std::sort(top.begin(), top.end(),
+              [](const std::pair<uint64_t, const QuicFlow *>& a, const std::pair<uint64_t, const QuicFlow *>& b) {
+                  return a.first > b.first;
+              });
+    LogLine line(LL_INFO, name.c_str());
+    line << "[" << name << "] QUIC: " << top.size() << "个连接";
+    uint64_t lost = overflow.load(std::memory_order_relaxed);
+    if(lost > 0)
+    {
+        line << "（" << lost << "个长头包因槽位用尽未跟踪）";
+    }
+    for(size_t i = 0; i < top.size() && i < (size_t)QUIC_TOP_FLOWS; i++)
+    {
+        const QuicFlow *f = top[i].second;
+        line << "\n    " << flow_key_str(f->key) << "  pkts: " << top[i].first;
+        uint64_t hist[QUIC_RTT_BUCKETS];
+        uint64_t n = 0;
+        for(int k = 0; k < QUIC_RTT_BUCKETS; k++)
+        {
+            hist[k] = f->rtt_hist[k].load(std::memory_order_relaxed);
+            n += hist[k];
+        }
+        if(n > 0)
+        {
+            line << ", spin rtt: " << n << "个样本 min " << fixed << setprecision(1)
+                 << f->rtt_min_us.load(std::memory_order_relaxed) / 1000.0 << "ms avg "
+                 << f->rtt_sum_us.load(std::memory_order_relaxed) / 1000.0 / f->rtt_samples.load(std::memory_order_relaxed)
+                 << "ms p50<=" << quic_rtt_quantile(hist, n, 500) / 1000.0
+                 << "ms p90<=" << quic_rtt_quantile(hist, n, 900) / 1000.0 << "ms";
+        }
+        else
+        {
+            line << ", spin rtt: 无样本";
+        }
+        uint64_t periods = f->q_periods.load(std::memory_order_relaxed);
+        uint64_t seen = f->q_seen.load(std::memory_order_relaxed);
+        if(periods > 0 && seen >= periods * QUIC_SQUARE_PERIOD / 2)
+        {
+            uint64_t q_lost = f->q_lost.load(std::memory_order_relaxed);
+            line << ", Q丢包 " << q_lost << "/" << seen + q_lost << " (" << setprecision(2)
+                 << q_lost * 100.0 / (seen + q_lost) << "%), L " << f->l_marks.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// --------------- 损伤决策录制/回放 ---------------
+bool RrRing::push(const RrRecord& rec)
+{
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if(h - cached_tail >= RR_RING_SLOTS)
+    {
+        cached_tail = tail.load(std::memory_order_acquire);
+        if(h - cached_tail >= RR_RING_SLOTS)
+        {
+            return false;
+        }
+    }
+    slots[h & (RR_RING_SLOTS - 1)] = rec;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+const RrRecord *RrRing::front()
+{
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if(t == cached_head)
+    {
+        cached_head = head.load(std::memory_order_acquire);
+        if(t == cached_head)
+        {
+            return nullptr;
+        }
+    }
+    return &slots[t & (RR_RING_SLOTS - 1)];
+}
+
+void RrRing::pop()
+{
+    tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+static const char RR_MAGIC[8] = {'T', 'C', 'Q', 'R', 'R', 0, 0, 0};
+
+DecisionLog::DecisionLog()
+{
+    this->fp = nullptr;
+    this->replay = false;
+    this->records = 0;
+    this->running = false;
+}
+
+DecisionLog::~DecisionLog()
+{
+    close();
+}
+
+/**
+ * @brief 打开决策日志：录制时创建文件写入文件头，回放时检查文件头；然后启动后台线程
+ * @param path 文件名
+ * @param replay true=回放，false=录制
+ * @return bool 是否成功
+ */
+bool DecisionLog::open(const std::string& path, bool replay)
+{
+    this->path = path;
+    this->replay = replay;
+    fp = fopen(path.c_str(), replay ? "rb" : "wb");
+    if(fp == nullptr)
+    {
+        LOGE("rr") << "无法打开决策日志 " << path << ": " << strerror(errno);
+        return false;
+    }
+    RrFileHeader hdr;
+    if(replay)
+    {
+        if(fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, RR_MAGIC, sizeof(RR_MAGIC)) != 0 ||
+           hdr.version != 1 || hdr.record_size != sizeof(RrRecord))
+        {
+            LOGE("rr") << path << " 不是决策日志（或格式版本不同）";
+            fclose(fp);
+            fp = nullptr;
+            return false;
+        }
+    }
+    else
+    {
+        memcpy(hdr.magic, RR_MAGIC, sizeof(RR_MAGIC));
+        hdr.version = 1;
+        hdr.record_size = sizeof(RrRecord);
+        fwrite(&hdr, sizeof(hdr), 1, fp);
+    }
+    for(int i = 0; i < 2; i++)
+    {
+        rings[i].reset(new RrRing());
+    }
+    running = true;
+    worker = replay ? std::thread(&DecisionLog::reader_loop, this) : std::thread(&DecisionLog::writer_loop, this);
+    LOGI("rr") << (replay ? "回放决策日志: " : "录制决策日志: ") << path;
+    return true;
+}
+
+/**
+ * @brief 停止后台线程并关闭文件
+ */
+void DecisionLog::close()
+{
+    if(running.exchange(false))
+    {
+        worker.join();
+    }
+    if(fp != nullptr)
+    {
+        fclose(fp);
+        fp = nullptr;
+        LOGI("rr") << (replay ? "决策日志已读出 " : "决策日志已写入 ") << records << " 条: " << path;
+    }
+}
+
+/**
+ * @brief 写盘线程：从两个方向的环中取记录攒成一批写入，空闲时每100ms落盘一次；停止后写完剩余的记录
+ */
+void DecisionLog::writer_loop()
+{
+    std::vector<RrRecord> batch;
+    batch.reserve(RR_BATCH);
+    auto last_flush = std::chrono::steady_clock::now();
+    bool stopping = false;
+    while(true)
+    {
+        if(!running.load(std::memory_order_relaxed))
+        {
+            stopping = true;
+        }
+        bool got = false;
+        for(int i = 0; i < 2; i++)
+        {
+            const RrRecord *rec;
+            while(batch.size() < RR_BATCH && (rec = rings[i]->front()) != nullptr)
+            {
+                batch.push_back(*rec);
+                rings[i]->pop();
+                got = true;
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+        if(!batch.empty() && (batch.size() >= RR_BATCH || !got || stopping ||
+                              now - last_flush >= std::chrono::milliseconds(100)))
+        {
+            fwrite(batch.data(), sizeof(RrRecord), batch.size(), fp);
+            fflush(fp);
+            records += batch.size();
+            batch.clear();
+            last_flush = now;
+        }
+        if(!got)
+        {
+            if(stopping)
+            {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+/**
+ * @brief 读盘线程：两个方向各自按批读取文件中本方向的记录放入环中；一个方向的环满时只暂停该方向
+ *        （预读量即环的大小），另一个方向照常读取，不会因对端方向的帧数比录制时少而停顿
+ */
+void DecisionLog::reader_loop()
+{
+    std::vector<RrRecord> batch[2] = {std::vector<RrRecord>(RR_BATCH), std::vector<RrRecord>(RR_BATCH)};
+    off_t off[2] = {(off_t)sizeof(RrFileHeader), (off_t)sizeof(RrFileHeader)};
+    size_t pos[2] = {0, 0}, cnt[2] = {0, 0};
+    bool eof[2] = {false, false};
+    int fd = fileno(fp);
+    while(running.load(std::memory_order_relaxed) && !(eof[0] && pos[0] == cnt[0] && eof[1] && pos[1] == cnt[1]))
+    {
+        bool progress = false;
+        for(int d = 0; d < 2; d++)
+        {
+            if(pos[d] == cnt[d] && !eof[d])
+            {
+                ssize_t n = pread(fd, batch[d].data(), RR_BATCH * sizeof(RrRecord), off[d]);
+                cnt[d] = n > 0 ? n / sizeof(RrRecord) : 0;
+                pos[d] = 0;
+                off[d] += cnt[d] * sizeof(RrRecord);
+                eof[d] = cnt[d] < RR_BATCH;     // 读到文件末尾：之后的帧照常抽签
+                progress = true;
+            }
+            for(; pos[d] < cnt[d]; pos[d]++)
+            {
+                const RrRecord& r = batch[d][pos[d]];
+                if((r.dir & 1) != d)
+                {
+                    continue;
+                }
+                if(!rings[d]->push(r))
+                {
+                    break;
+                }
+                records++;
+                progress = true;
+            }
+        }
+        if(!progress)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+DecisionTrack::DecisionTrack(RrRing *ring, bool replay, uint8_t dir)
+    : ring(ring), replay(replay), dir(dir), flows(new RrFlow[RR_FLOW_SLOTS]), next_id(1), other_idx(0)
+{
+    if(replay)
+    {
+        windows.reset(new Window[RR_FLOW_SLOTS + 1]);
+    }
+}
+
+/**
+ * @brief 给一帧分配流编号和帧序号（录制与回放的两次运行中按相同规则分配）
+ * @param rec 输出：idx/flow/dir
+ * @return bool false=新流且流表已满（不录制/回放）
+ * @note 流编号按流首次出现的顺序分配，前RR_FLOW_SLOTS个流一定能编号，与流表中的哈希冲突无关
+ */
+bool DecisionTrack::next(const uint8_t *frame, uint32_t size, RrRecord *rec)
+{
+    FlowKey key;
+    uint32_t l4_off, l4_len;
+    uint32_t h = flow_key_parse(frame, size, &key, &l4_off, &l4_len);
+    rec->dir = dir;
+    if(h == 0)
+    {
+        rec->flow = 0;
+        rec->idx = other_idx++;
+        return true;
+    }
+    bool insert = next_id <= RR_FLOW_SLOTS;
+    RrFlow *f = flow_slot(flows.get(), RR_FLOW_SLOTS, h, key, insert);
+    for(int k = FLOW_PROBES; f == nullptr && k < RR_FLOW_SLOTS; k++)
+    {
+        // 探测FLOW_PROBES次未命中时继续线性探测整个表：否则能否编号取决于各流哈希（临时端口）是否冲突，两次运行可能不同
+        RrFlow& cur = flows[(h + k) % RR_FLOW_SLOTS];
+        uint32_t ch = cur.hash.load(std::memory_order_relaxed);
+        if(ch == 0)
+        {
+            if(!insert)
+            {
+                break;
+            }
+            cur.key = key;
+            cur.hash.store(h, std::memory_order_relaxed);
+            f = &cur;
+        }
+        else if(ch == h && memcmp(&cur.key, &key, sizeof(key)) == 0)
+        {
+            f = &cur;
+        }
+    }
+    if(f == nullptr)
+    {
+        return false;
+    }
+    if(f->id == 0)
+    {
+        f->id = next_id++;
+    }
+    rec->flow = f->id;
+    rec->idx = f->next_idx++;
+    return true;
+}
+
+/**
+ * @brief 回放：从环中取出决策放入对应流的窗口，直到want所属流的窗口中有序号不小于want的决策（每次最多RR_PULL_MAX条）
+ * @param want 当前帧的流编号和帧序号
+ * @param evicted 输出：累加被挤出的决策数
+ * @note 按需取出：各流与录制时同步时窗口不会满；某个流在本次运行中落后超过RR_FLOW_WINDOW帧或提前结束时，
+ *       挤出它最早的决策，不阻塞环中其他流的决策
+ */
+void DecisionTrack::pull(const RrRecord& want, uint64_t *evicted)
+{
+    const Window& mine = windows[want.flow];
+    const RrRecord *r;
+    for(uint32_t n = 0; n < RR_PULL_MAX && (mine.head == mine.tail || mine.rec[(mine.tail - 1) % RR_FLOW_WINDOW].idx < want.idx) &&
+                        (r = ring->front()) != nullptr; n++)
+    {
+        if(r->flow <= RR_FLOW_SLOTS)
+        {
+            Window& w = windows[r->flow];
+            if(w.tail - w.head == RR_FLOW_WINDOW)
+            {
+                // 当前帧所属流的窗口中都是序号更小、find会跳过的决策，不计入挤出
+                if(r->flow != want.flow)
+                {
+                    (*evicted)++;
+                }
+                w.head++;
+            }
+            w.rec[w.tail++ % RR_FLOW_WINDOW] = *r;
+        }
+        ring->pop();
+    }
+}
+
+/**
+ * @brief 回放：查找rec中（流编号, 帧序号）的决策
+ * @param rec 输入流编号和帧序号，找到时填写fate/delay_us/version
+ * @param evicted 输出：累加本次取决策时被挤出的决策数
+ * @return bool false=没有（录制时该帧在流表满之后/日志已读完/已被窗口挤出）
+ * @note 序号比当前帧小的决策对应录制时存在、本次运行中没有出现的帧，直接跳过
+ */
+bool DecisionTrack::find(RrRecord *rec, uint64_t *evicted)
+{
+    pull(*rec, evicted);
+    Window& w = windows[rec->flow];
+    while(w.head != w.tail && w.rec[w.head % RR_FLOW_WINDOW].idx < rec->idx)
+    {
+        w.head++;
+    }
+    if(w.head == w.tail || w.rec[w.head % RR_FLOW_WINDOW].idx != rec->idx)
+    {
+        return false;
+    }
+    *rec = w.rec[w.head++ % RR_FLOW_WINDOW];
+    return true;
+}
+
+/**
+ * @brief 补全帧中UDP/TCP校验和（IPv4/IPv6，无VLAN、无IPv6扩展头）
+ * @param frame 以太网帧
+ * @param size 帧大小
+ * @note veth等接口开启了发送校验和卸载，AF_PACKET收到的帧可能只带伪首部部分和（TP_STATUS_CSUMNOTREADY），
+ *       原样转发后接收端会因校验和错误丢弃，因此在入队前补全；GSO超帧软件分段后也用它计算每段的校验和
+ */
+static void l4_checksum_fill(uint8_t *frame, uint32_t size)
+{
+    uint32_t l4_off, l4_len;
+    uint8_t proto;
+    if(!l3l4_parse(frame, size, &l4_off, &l4_len, &proto))
+    {
+        return;
+    }
+
+    uint32_t check_off;
+    if(proto == IPPROTO_UDP && l4_len >= 8)
+        check_off = 6;
+    else if(proto == IPPROTO_TCP && l4_len >= 20)
+        check_off = 16;
+    else
+        return;
+
+    uint8_t *ip = frame + 14;
+    uint8_t *l4 = frame + l4_off;
+    uint32_t sum;
+    if(ip[0] >> 4 == 4)
+        sum = csum_add(0, ip + 12, 8);      // 源/目的地址
+    else
+        sum = csum_add(0, ip + 8, 32);
+    sum += proto + l4_len;  // 伪首部：协议号 + L4长度
+    l4[check_off] = 0;
+    l4[check_off + 1] = 0;
+    uint16_t check = csum_fold(csum_add(sum, l4, l4_len));
+    if(proto == IPPROTO_UDP && check == 0)
+    {
+        check = 0xffff;
+    }
+    l4[check_off] = check >> 8;
+    l4[check_off + 1] = check & 0xff;
+}
+
+/**
+ * @brief 在帧的L4负载中随机翻转一个比特
+ * @param frame 以太网帧
+ * @param size 帧大小
+ * @param stealth true=翻转后重新计算UDP/TCP校验和（IP头不动，无需修正），接收端协议栈无法发现，
+ *        只能由QUIC的AEAD认证发现；false=校验和保持不变，由接收端UDP/TCP校验和发现并丢弃
+ * @param vh 帧前的virtio_net_hdr（未开启卸载时为nullptr）
+ * @param rng 随机数生成器
+ * @return bool false=帧中没有可翻转的负载
+ * @note 带NEEDS_CSUM标志的帧由对端内核补全校验和：隐蔽损坏直接翻转即可；普通损坏需要先补全校验和并清除标志，
+ *       否则内核会按损坏后的数据计算校验和，损坏变成隐蔽的
+ */
+static bool frame_corrupt(uint8_t *frame, uint32_t size, bool stealth, struct virtio_net_hdr *vh, std::mt19937 &rng)
+{
+    uint32_t l4_off, l4_len;
+    uint8_t proto;
+    uint32_t begin = 14, end = size;    // 无法解析时在IP负载范围内翻转
+    bool parsed = l3l4_parse(frame, size, &l4_off, &l4_len, &proto);
+    if(parsed)
+    {
+        uint32_t l4_hdr = 0;
+        if(proto == IPPROTO_UDP)
+            l4_hdr = 8;
+        else if(proto == IPPROTO_TCP && l4_len >= 20)
+            l4_hdr = (frame[l4_off + 12] >> 4) * 4;
+        begin = l4_off + l4_hdr;
+        end = l4_off + l4_len;
+    }
+    if(begin >= end)
+    {
+        return false;
+    }
+
+    bool needs_csum = vh != nullptr && (vh->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM);
+    if(!stealth && needs_csum)
+    {
+        l4_checksum_fill(frame, size);
+        vh->flags &= ~VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        needs_csum = false;
+    }
+
+    std::uniform_int_distribution<uint32_t> distr(0, (end - begin) * 8 - 1);
+    uint32_t bit = distr(rng);
+    frame[begin + bit / 8] ^= 1 << (bit % 8);
+
+    if(stealth && !needs_csum && parsed)
+    {
+        // IPv4上UDP校验和为0表示未启用，保持不变
+        bool udp_nocsum = proto == IPPROTO_UDP && (frame[14] >> 4) == 4 &&
+                          frame[l4_off + 6] == 0 && frame[l4_off + 7] == 0;
+        if(!udp_nocsum)
+        {
+            l4_checksum_fill(frame, size);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 读取帧的ECN码点（IP头TOS/流量类别的低2位）
+ * @param frame 以太网帧
+ * @param size 帧大小
+ * @return int 0=Not-ECT，1=ECT(1)，2=ECT(0)，3=CE，-1=不是IPv4/IPv6帧
+ */
+static int frame_ecn(const uint8_t *frame, uint32_t size)
+{
+    if(size < 14 + 20)
+    {
+        return -1;
+    }
+    uint16_t eth_type = (frame[12] << 8) | frame[13];
+    const uint8_t *ip = frame + 14;
+    if(eth_type == 0x0800 && (ip[0] >> 4) == 4)
+    {
+        return ip[1] & 0x03;
+    }
+    if(eth_type == 0x86dd && (ip[0] >> 4) == 6 && size >= 14 + 40)
+    {
+        return (ip[1] >> 4) & 0x03;
+    }
+    return -1;
+}
+
+/**
+ * @brief 把ECT帧改写为CE（调用者保证frame_ecn返回1或2）
+ * @param frame 以太网帧
+ * @details IPv4按RFC 1624增量更新头校验和：HC' = ~(~HC + ~m + m')，m为TOS所在的16位字；
+ *          IPv6没有头校验和。ECN位不在UDP/TCP伪首部中，L4校验和不变
+ */
+static void frame_set_ce(uint8_t *frame)
+{
+    uint8_t *ip = frame + 14;
+    if((ip[0] >> 4) == 4)
+    {
+        uint16_t old_word = (ip[0] << 8) | ip[1];
+        ip[1] |= 0x03;
+        uint16_t new_word = (ip[0] << 8) | ip[1];
+        uint32_t sum = static_cast<uint16_t>(~((ip[10] << 8) | ip[11]));
+        sum += static_cast<uint16_t>(~old_word);
+        sum += new_word;
+        sum = (sum & 0xffff) + (sum >> 16);
+        sum = (sum & 0xffff) + (sum >> 16);
+        uint16_t check = ~sum;
+        ip[10] = check >> 8;
+        ip[11] = check & 0xff;
+    }
+    else
+    {
+        ip[1] |= 0x30;
+    }
+}
+
+#ifndef TUN_F_USO4
+#define TUN_F_USO4 0x20
+#define TUN_F_USO6 0x40
+#endif
+
+/**
+ * @brief 计算GSO超帧的分段数
+ * @param frame 以太网帧
+ * @param size 帧大小
+ * @param vh 帧前的virtio_net_hdr
+ * @param hdr_len 输出：每个分段重复的协议头长度（以太网 + IP + TCP/UDP头）
+ * @return uint32_t 分段数（非GSO帧或无法解析时为1）
+ */
+static uint32_t gso_segments(const uint8_t *frame, uint32_t size, const struct virtio_net_hdr *vh, uint32_t *hdr_len)
+{
+    *hdr_len = 0;
+    uint32_t l4_off, l4_len;
+    uint8_t proto;
+    if(vh->gso_type == VIRTIO_NET_HDR_GSO_NONE || vh->gso_size == 0 ||
+       !l3l4_parse(frame, size, &l4_off, &l4_len, &proto))
+    {
+        return 1;
+    }
+    if(proto == IPPROTO_UDP)
+        *hdr_len = l4_off + 8;
+    else if(proto == IPPROTO_TCP && size >= l4_off + 20)
+        *hdr_len = l4_off + (frame[l4_off + 12] >> 4) * 4;
+    else
+        return 1;
+    if(size <= *hdr_len)
+    {
+        return 1;
+    }
+    return (size - *hdr_len + vh->gso_size - 1) / vh->gso_size;
+}
+
+// --------------- 编译期组合的转发流水线 ---------------
+/**
+ * @brief 各阶段的默认实现：入队不做处理，出队前不做处理，出队继续下一阶段
+ * @details 阶段按模板参数On编译期开关：关闭的阶段整段代码被编译器删除，不留下任何分支；
+ *          开启的阶段仍检查自己的参数（>0），保证在仿真线程刚修改参数、转发线程还未切换特化时行为正确。
+ *          阶段只通过L访问限速/损伤参数，TapInterface和基准测试的模拟链路共用同一份代码
+ */
+struct StageBase {
+    template<class L> static void admit(L&, AdmitCtx&) {}
+    template<class L> static void dequeue(L&, int64_t) {}
+    template<class L> static bool release(L&, ReleaseCtx&) { return true; }
+};
+
+/**
+ * @brief 分类：开启卸载时识别GSO超帧（按分段累计链路字节数，出队时交给emit_gso）
+ */
+template<bool On> struct ClassifyStage : StageBase {
+    template<class L> static void admit(L& l, AdmitCtx& c)
+    {
+        c.wire = On && l.offload ? l.wire_size(c.data, c.size) : c.size;
+    }
+    template<class L> static bool release(L& l, ReleaseCtx& c)
+    {
+        if(On && l.offload)
+        {
+            const struct virtio_net_hdr *vh =
+                reinterpret_cast<const struct virtio_net_hdr *>(c.node->data - l.vnet_hdr_len);
+            if(vh->gso_type != VIRTIO_NET_HDR_GSO_NONE)
+            {
+                ProfScope ps(l.prof, PROF_WRITE);
+                l.emit_gso(c.node); // GSO超帧：按分段判断丢包/损坏/重复
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief 从FIFO队首取一帧（瓶颈队列与DualQ的两个队列共用）
+ * @return ListNode::Node* 队首节点（队列空时nullptr）
+ */
+static inline ListNode::Node *fifo_pop(ListNode::Node *&head, ListNode::Node *&tail, uint64_t& bytes)
+{
+    ListNode::Node *node = head;
+    if(node == nullptr)
+    {
+        return nullptr;
+    }
+    head = node->next;
+    if(head == nullptr)
+    {
+        tail = nullptr;
+    }
+    node->next = nullptr;
+    bytes -= node->wire;
+    return node;
+}
+
+/**
+ * @brief 瓶颈队列的出队策略（On=ECN标记/DualQ，由链路的aqm_*函数实现；关闭时为单个FIFO，不做标记）
+ */
+template<> struct AqmQueue<false> {
+    template<class L> static bool busy(L&) { return false; }
+    template<class L> static void tick(L&, int64_t) {}
+    template<class L> static ListNode::Node *pop(L& l, bool& from_l)
+    {
+        from_l = false;
+        return fifo_pop(l.bq_head, l.bq_tail, l.bq_bytes);
+    }
+    template<class L> static bool dequeue(L&, ListNode::Node *, bool, int64_t) { return true; }
+};
+
+template<> struct AqmQueue<true> {
+    template<class L> static bool busy(L& l) { return l.lq_head != nullptr; }
+    template<class L> static void tick(L& l, int64_t now) { l.aqm_update(now); }
+    template<class L> static ListNode::Node *pop(L& l, bool& from_l) { return l.aqm_pop(from_l); }
+    template<class L> static bool dequeue(L& l, ListNode::Node *node, bool from_l, int64_t start)
+    {
+        return l.aqm_dequeue(node, from_l, start);
+    }
+};
+
+/**
+ * @brief 整形：入队时只决定是否进入瓶颈队列，传输时段在出队时按当时的带宽分配
+ * @details 限速或瓶颈队列非空（刚从限速切换到不限速）时进入瓶颈队列，保证不会超越排队中的帧；
+ *          否则发送时间即入队时间，直接进入时延线。Aqm=true时瓶颈由低时延/经典两个队列组成，出队时标记CE
+ */
+template<bool On, bool Aqm> struct ShapeStage : StageBase {
+    template<class L> static void admit(L& l, AdmitCtx& c)
+    {
+        c.bottleneck = (On && l.bandwidth > 0) || l.bq_head != nullptr || AqmQueue<Aqm>::busy(l);
+        c.send_time = c.now;
+    }
+    /**
+     * @brief 串行化：链路空闲时取队首帧，按当前带宽计算传输完成时间，叠加传播时延后移入时延线
+     * @details 每帧O(1)；只在链路空闲（pre_time <= now）时取下一帧，带宽变化立即作用于排队中的帧，
+     *          正在传输的帧按开始传输时的带宽完成。传输开始时间取链路空闲时间与到达本跳时间的较大者，
+     *          排队时延（开始传输时间 - 到达时间）交给AQM决定是否标记CE
+     */
+    template<class L> static void dequeue(L& l, int64_t now)
+    {
+        AqmQueue<Aqm>::tick(l, now);
+        while(l.pre_time <= now)
+        {
+            bool from_l;
+            ListNode::Node *node = AqmQueue<Aqm>::pop(l, from_l);
+            if(node == nullptr)
+            {
+                break;
+            }
+
+            int64_t bw = l.bandwidth;   // 只读一次：仿真线程可能同时修改
+            int64_t start = l.pre_time > node->arrival ? l.pre_time : node->arrival;
+            if(!AqmQueue<Aqm>::dequeue(l, node, from_l, start))
+            {
+                continue;   // 被AQM丢弃，链路仍空闲
+            }
+            // 带宽单位是Mbps，除以8转换为字节/微秒；不限速时传输耗时为0
+            l.pre_time = bw > 0 ? start + static_cast<int64_t>(node->wire*1.0/(bw*1.0/8.0)) : start;
+            node->sendtime = l.pre_time + (node->delay_pin >= 0 ? node->delay_pin : l.delay_ms);
+
+            l.tail->next = node;        // 进入时延线（头节点始终存在）
+            l.tail = node;
+        }
+    }
+};
+
+/**
+ * @brief 固定时延：不经过瓶颈队列的帧在入队时叠加单向传播时延（瓶颈队列中的帧在出队时叠加）
+ * @note 录制/回放时用入队时固定的时延（c.delay），不读链路当前时延
+ */
+struct DelayStage : StageBase {
+    template<class L> static void admit(L& l, AdmitCtx& c)
+    {
+        if(!c.bottleneck)
+        {
+            c.send_time += c.delay >= 0 ? c.delay : l.delay_ms;
+        }
+    }
+};
+
+/**
+ * @brief 随机丢包（节点已决定命运时按fate执行，不再抽签；损坏、重复阶段相同）
+ */
+template<bool On> struct LossStage : StageBase {
+    template<class L> static bool release(L& l, ReleaseCtx& c)
+    {
+        ProfScope ps(On ? l.prof : nullptr, PROF_LOSS);
+        uint8_t fate = c.node->fate;
+        if(On && (fate != 0 ? (fate & RR_DROP) != 0 : l.Bloss > 0 && l.chance_in_a_thousand(l.Bloss)))
+        {
+            stat_add(l.stats.drops, 1);
+            l.capture(c.node->data, c.node->size, c.node->timesample, c.node->sendtime, CAP_LOSS);
+            return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief 损坏：普通或隐蔽损坏二选一
+ */
+template<bool On> struct CorruptStage : StageBase {
+    template<class L> static bool release(L& l, ReleaseCtx& c)
+    {
+        if(!On)
+        {
+            return true;
+        }
+        ProfScope ps(l.prof, PROF_LOSS);
+        uint8_t fate = c.node->fate;
+        if(fate != 0 ? (fate & RR_CORRUPT) != 0 : l.Bcorrupt > 0 && l.chance_in_a_thousand(l.Bcorrupt))
+        {
+            if(l.corrupt(c.node->data, c.node->size, false))
+                c.reason = CAP_CORRUPT;
+        }
+        else if(fate != 0 ? (fate & RR_STEALTH) != 0 : l.Bstealth > 0 && l.chance_in_a_thousand(l.Bstealth))
+        {
+            if(l.corrupt(c.node->data, c.node->size, true))
+                c.reason = CAP_STEALTH;
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief 发送（On=开启重复：同一份缓冲区再发一次）
+ * @note 重复帧与原帧共用同一份缓冲区（在原地损坏时两份都带相同的损坏），不额外拷贝：
+ *       TAP模式写两次，PACKET模式填两个发送帧槽，io_uring模式排两个写请求（缓冲区引用计数各加一）
+ */
+template<bool On> struct EmitStage : StageBase {
+    template<class L> static bool release(L& l, ReleaseCtx& c)
+    {
+        ProfScope ps(l.prof, PROF_WRITE);
+        ListNode::Node *node = c.node;
+        bool sent = l.emit(node->data, node->size, node->block);
+        l.capture(node->data, node->size, node->timesample, node->sendtime, sent ? c.reason : (uint8_t)CAP_TX_FAIL);
+        if(sent && l.quic != nullptr)
+        {
+            l.quic->observe(node->data, node->size, node->sendtime);
+        }
+        if(On && (node->fate != 0 ? (node->fate & RR_DUP) != 0 : l.Bdup > 0 && l.chance_in_a_thousand(l.Bdup)))
+        {
+            stat_add(l.stats.dups, 1);
+            sent = l.emit(node->data, node->size, node->block);
+            l.capture(node->data, node->size, node->timesample, node->sendtime, sent ? CAP_DUP : CAP_TX_FAIL);
+        }
+        return true;
+    }
+};
+
+/**
+ * @brief 交给多跳路径的下一段（代替EmitStage；On=开启重复：复制一份随原帧之后交出）
+ * @note 节点连同缓冲区直接移入下一段，不拷贝；只有重复帧需要一份自己的堆内存
+ */
+template<bool On> struct HandoffStage : StageBase {
+    template<class L> static bool release(L& l, ReleaseCtx& c)
+    {
+        ListNode::Node *node = c.node;
+        c.node = nullptr;   // 节点已交出，出队循环不再释放
+        ListNode::Node *copy = On && l.Bdup > 0 && l.chance_in_a_thousand(l.Bdup) ? l.clone(node) : nullptr;
+        l.handoff(node);
+        if(copy != nullptr)
+        {
+            stat_add(l.stats.dups, 1);
+            l.handoff(copy);
+        }
+        return false;
+    }
+};
+
+/**
+ * @brief 阶段链：依次调用各阶段，出队时某一阶段返回false（已丢弃/已发送）则停止
+ */
+template<class... Stages> struct StageChain;
+
+template<> struct StageChain<> {
+    template<class L> static void admit(L&, AdmitCtx&) {}
+    template<class L> static void dequeue(L&, int64_t) {}
+    template<class L> static void release(L&, ReleaseCtx&) {}
+};
+
+template<class S, class... Rest> struct StageChain<S, Rest...> {
+    template<class L> static inline void admit(L& l, AdmitCtx& c)
+    {
+        S::admit(l, c);
+        StageChain<Rest...>::admit(l, c);
+    }
+    template<class L> static inline void dequeue(L& l, int64_t now)
+    {
+        S::dequeue(l, now);
+        StageChain<Rest...>::dequeue(l, now);
+    }
+    template<class L> static inline void release(L& l, ReleaseCtx& c)
+    {
+        if(S::release(l, c))
+        {
+            StageChain<Rest...>::release(l, c);
+        }
+    }
+};
+
+/**
+ * @brief 由阶段组合成的流水线：入队计算发送时间，出队先串行化瓶颈队列，再遍历到期节点并逐个走完各阶段
+ * @details 出队循环与ListNode::checkAndFreeNode相同，但各阶段在循环内联展开，不经过虚函数freeNode；
+ *          设置了发送合并窗口（tx_slack）时，最早到期的帧延后达到窗口才开始出队，这期间到期的帧在同一轮发送，
+ *          每帧的延后计入出队时间误差直方图；延后超过tx_slack + slo_us的帧说明转发线程跟不上，计入过载统计，
+ *          开启过载丢弃（--shed）时直接丢弃，不把仿真器自身的额外时延加到链路时延上；
+ *          以保留方式中断期间到期的帧（计划发送时间早于link_up_us）恢复后照常发出，不计入直方图和SLO
+ */
+template<class... Stages> struct Pipeline {
+    template<class L> static void admit(L& l, AdmitCtx& c)
+    {
+        StageChain<Stages...>::admit(l, c);
+    }
+    template<class L> static void drain(L& l, int64_t now)
+    {
+        if(l.head == nullptr)
+        {
+            return;
+        }
+        StageChain<Stages...>::dequeue(l, now);
+        ListNode::Node *prev = l.head;
+        ListNode::Node *cur = prev->next;
+        if(cur == nullptr || now < cur->sendtime + l.tx_slack)  // 未到期，或最早的帧延后未达到合并窗口
+        {
+            l.slo_update(now, 0);
+            return;
+        }
+        stat_add(l.stats.tx_batches, 1);
+        int64_t deadline = now - l.tx_slack - l.slo_us;    // 计划发送时间早于此的帧违反SLO
+        uint64_t overdue = 0;
+        while(cur != nullptr && now >= cur->sendtime) // 按发送时间有序：遇到未到期的节点即停止
+        {
+            if(cur == l.tail)
+            {
+                l.tail = prev;
+            }
+            prev->next = cur->next;
+            if(cur->data == nullptr)    // 背景流量虚拟帧只占用瓶颈时间，没有数据
+            {
+                l.release_node(cur);
+            }
+            else
+            {
+                // 以保留方式中断期间到期的帧按配置在恢复后才发出，不是仿真器的延后，不计入误差直方图和SLO
+                bool held = cur->sendtime < l.link_up_us;
+                if(!held)
+                {
+                    stat_add(l.stats.tx_late[tx_late_bucket(now - cur->sendtime)], 1);
+                }
+                bool late = !held && cur->sendtime < deadline;
+                overdue += late;
+                if(late && l.shed_late)
+                {
+                    l.drop_node(cur, CAP_SHED);
+                }
+                else
+                {
+                    ReleaseCtx c = {cur, CAP_FORWARD};
+                    StageChain<Stages...>::release(l, c);
+                    if(c.node != nullptr)
+                    {
+                        l.release_node(cur);
+                    }
+                }
+            }
+            cur = prev->next;
+        }
+        l.slo_update(now, overdue);
+    }
+};
+
+// 预先实例化的特化：常见的损伤组合各有一个去掉无关阶段的版本，其余组合使用通用版本
+typedef Pipeline<ClassifyStage<false>, ShapeStage<false, false>, DelayStage,
+                 LossStage<false>, CorruptStage<false>, EmitStage<false>> PipeDelay;
+typedef Pipeline<ClassifyStage<false>, ShapeStage<true, false>, DelayStage,
+                 LossStage<false>, CorruptStage<false>, EmitStage<false>> PipeShape;
+typedef Pipeline<ClassifyStage<false>, ShapeStage<false, false>, DelayStage,
+                 LossStage<true>, CorruptStage<false>, EmitStage<false>> PipeLoss;
+typedef Pipeline<ClassifyStage<false>, ShapeStage<true, false>, DelayStage,
+                 LossStage<true>, CorruptStage<false>, EmitStage<false>> PipeShapeLoss;
+typedef Pipeline<ClassifyStage<false>, ShapeStage<true, true>, DelayStage,
+                 LossStage<false>, CorruptStage<false>, EmitStage<false>> PipeShapeEcn;
+typedef Pipeline<ClassifyStage<true>, ShapeStage<true, true>, DelayStage,
+                 LossStage<true>, CorruptStage<true>, EmitStage<true>> PipeGeneric;
+
+// 多跳路径中间各段：没有分类（链路字节数在入口算好）和发送，最后交给下一段
+typedef Pipeline<ShapeStage<false, false>, DelayStage, LossStage<false>, CorruptStage<false>, HandoffStage<false>> HopDelay;
+typedef Pipeline<ShapeStage<true, false>, DelayStage, LossStage<false>, CorruptStage<false>, HandoffStage<false>> HopShape;
+typedef Pipeline<ShapeStage<false, false>, DelayStage, LossStage<true>, CorruptStage<false>, HandoffStage<false>> HopLoss;
+typedef Pipeline<ShapeStage<true, false>, DelayStage, LossStage<true>, CorruptStage<false>, HandoffStage<false>> HopShapeLoss;
+typedef Pipeline<ShapeStage<true, false>, DelayStage, LossStage<true>, CorruptStage<true>, HandoffStage<true>> HopGeneric;
+
+template<class L, class P> static PipelineOpsT<L> pipeline_ops(unsigned features, const char *name)
+{
+    PipelineOpsT<L> ops = {features, name, &P::template admit<L>, &P::template drain<L>};
+    return ops;
+}
+
+static const PipelineOps pipeline_table[] = {
+    pipeline_ops<TapInterface, PipeDelay>(0, "delay"),
+    pipeline_ops<TapInterface, PipeShape>(PF_SHAPE, "shape"),
+    pipeline_ops<TapInterface, PipeLoss>(PF_LOSS, "loss"),
+    pipeline_ops<TapInterface, PipeShapeLoss>(PF_SHAPE | PF_LOSS, "shape+loss"),
+    pipeline_ops<TapInterface, PipeShapeEcn>(PF_SHAPE | PF_ECN, "shape+ecn"),
+    pipeline_ops<TapInterface, PipeGeneric>(PF_ALL, "generic"),   // 必须放在最后
+};
+
+static const HopOps hop_pipeline_table[] = {
+    pipeline_ops<PathHop, HopDelay>(0, "hop-delay"),
+    pipeline_ops<PathHop, HopShape>(PF_SHAPE, "hop-shape"),
+    pipeline_ops<PathHop, HopLoss>(PF_LOSS, "hop-loss"),
+    pipeline_ops<PathHop, HopShapeLoss>(PF_SHAPE | PF_LOSS, "hop-shape+loss"),
+    pipeline_ops<PathHop, HopGeneric>(PF_ALL, "hop-generic"),     // 必须放在最后
+};
+
+/**
+ * @brief 按阶段集合选择特化：精确匹配的特化优先，否则使用通用版本（表中最后一项）
+ */
+template<class L, size_t N> static const PipelineOpsT<L> *pipeline_select(const PipelineOpsT<L> (&table)[N], unsigned features)
+{
+    for(size_t i = 0; i + 1 < N; i++)
+    {
+        if(table[i].features == features)
+        {
+            return &table[i];
+        }
+    }
+    return &table[N - 1];
+}
+
+/**
+ * @brief 损伤参数变化后重新选择流水线特化（只由转发线程调用）
+ * @details 设置函数修改参数后递增profile_gen（release），这里acquire读到新版本后再读参数，
+ *          保证切换后的特化包含新开启的阶段；版本未变时只有一次原子读。
+ *          关闭AQM后低时延队列中还有帧时保留ECN特化，直到它排空
+ */
+void TapInterface::sync_pipeline()
+{
+    uint32_t gen = profile_gen.load(std::memory_order_acquire);
+    if(gen == pipeline_gen && pipeline != nullptr &&
+       (lq_head == nullptr || (pipeline->features & PF_ECN) != 0))
+    {
+        return;
+    }
+    pipeline_gen = gen;
+    unsigned features = 0;
+    if(bandwidth > 0)
+        features |= PF_SHAPE;
+    if(Bloss > 0)
+        features |= PF_LOSS;
+    if(Bcorrupt > 0 || Bstealth > 0)
+        features |= PF_CORRUPT;
+    if(Bdup > 0)
+        features |= PF_DUP;
+    if(offload)
+        features |= PF_GSO;
+    if(rr != nullptr)
+        features |= PF_LOSS | PF_CORRUPT | PF_DUP;  // 录制/回放的帧在入队时已决定命运，出队须经过全部损伤阶段
+    if((bandwidth > 0 && aqm_mode != AQM_NONE) || lq_head != nullptr)
+        features |= PF_ECN;
+    pipeline = pipeline_select(pipeline_table, features);
+    LOGD(tap_name.c_str()) << "流水线特化: " << pipeline->name << "（features=" << features << "）";
+}
+
+/**
+ * @brief 从TAP接口读取数据包（epoll监听）
+ * @return int epoll_wait返回的事件数（-1=失败，0=无事件，>0=事件数）
+ * @details 1. 监听TAP接口可读事件 2. 读取数据包 3. 计算发送时间 4. 加入链表缓存
+ *          PACKET模式下直接检查接收环块状态，不经过epoll，返回本次处理的帧数
+ */
+int TapInterface::tap_read()
+{
+    sync_pipeline();
+    loop_us = get_us();
+    if(prof != nullptr)
+    {
+        prof->begin_loop(prof_work());
+    }
+    if(io_mode == IO_PACKET)
+    {
+        ProfScope ps(prof, PROF_READ);   // 接收环轮询与取帧
+        return packet_read();
+    }
+    if(io_mode == IO_URING)
+    {
+        return uring_read();
+    }
+    if(io_mode == IO_SHM)
+    {
+        ProfScope ps(prof, PROF_READ);   // tx环轮询与入队
+        return shm_read();
+    }
+
+    int timeout = 0;           // epoll_wait超时时间（0=非阻塞）
+    // 监听epoll事件：无超时（非阻塞）
+    int eNum;
+    {
+        ProfScope ps(prof, PROF_POLL);
+        eNum = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+    }
+    stat_add(stats.syscalls, 1);
+    if(eNum == -1)             // epoll_wait失败
+    {
+        LOGW(tap_name.c_str()) << "epoll wait: " << strerror(errno);
+        return -1;
+    }
+
+    // 遍历所有触发的事件
+    for(int i = 0; i < eNum; i++)
+    {
+        // 仅处理TAP接口的可读事件
+        if(events[i].data.fd == tap_fd)
+        {
+            if(events[i].events & EPOLLIN) // 可读事件
+            {
+                uint8_t *data = nullptr;
+                ssize_t size;
+                int64_t time_now = loop_us;
+                bool down = admit_closed(time_now);
+                ProfScope ps(prof, PROF_READ);
+                if(down)
+                {
+                    // 链路中断：读入暂存缓冲，由enqueue在入口丢弃，不分配内存
+                    size = read(tap_fd, rx_scratch.data(), rx_buf_size);
+                }
+                else if(offload)
+                {
+                    // 超帧先读入64KB暂存缓冲，再按实际大小分配（vnet头保存在帧前面）
+                    size = read(tap_fd, rx_scratch.data(), rx_buf_size);
+                    if(size > (ssize_t)vnet_hdr_len)
+                    {
+                        data = alloc_frame(size);
+                        memcpy(data, rx_scratch.data(), size);
+                    }
+                }
+                else
+                {
+                    data = alloc_frame(MAX_FRAME_SIZE);  // 分配数据包缓冲区（1522=以太网最大帧大小+VLAN标签）
+                    size = read(tap_fd, data, MAX_FRAME_SIZE);    // 从TAP接口读取数据
+                    if(size <= 0)
+                    {
+                        free_frame(data);
+                    }
+                }
+                stat_add(stats.syscalls, 1);
+                // 调试：打印数据包大小/内容
+                //cout << "size: " << size << endl;
+                //printData(data, size);
+                if(size <= (ssize_t)vnet_hdr_len) // 读取失败
+                {
+                    LOGW(tap_name.c_str()) << "Error reading from tap_fd";
+                    continue;
+                }
+
+                // 节点数据指向以太网帧，vnet头留在帧前面，发送时一并写出
+                if(down)
+                {
+                    admit_drop(rx_scratch.data() + vnet_hdr_len, size - vnet_hdr_len, time_now);
+                    continue;
+                }
+                if(!enqueue(data + vnet_hdr_len, size - vnet_hdr_len, time_now, -1))
+                {
+                    free_frame(data);
+                    return -1;
+                }
+            }
+        }
+    }
+    return eNum;
+}
+
+/**
+ * @brief 计算数据包发送时间并加入链表缓存（TAP/PACKET后端共用）
+ * @param data 帧数据（堆内存或接收环内存）
+ * @param size 帧大小
+ * @param time_now 接收时间戳（微秒）
+ * @param block 数据所在的接收环块号（-1=堆内存）
+ * @return bool true=已入队，false=缓存已满被丢弃（由调用者回收内存）
+ */
+bool TapInterface::enqueue(uint8_t *data, uint32_t size, int64_t time_now, int32_t block)
+{
+    ProfScope ps(prof, PROF_ENQUEUE);
+    if(admit_closed(time_now)) // 链路中断/入口关闭：入口丢弃，不入队
+    {
+        admit_drop(data, size, time_now);
+        return false;
+    }
+
+    if(!hops.empty())   // 多跳路径：先交给第一段，本接口的链路是最后一跳
+    {
+        uint32_t wire = offload ? wire_size(data, size) : size;
+        packet_cnt++;
+        stat_add(stats.rx_packets, 1);
+        stat_add(stats.rx_bytes, wire);
+        Node *node = new Node(data, time_now, dst_fd, size, time_now, ntohs(*reinterpret_cast<uint16_t*>(data + 12)), block);
+        node->wire = wire;
+        hops.front()->accept(node, time_now);
+        return true;
+    }
+
+    // --------------- 分类 + 带宽限制 + 时延计算 ---------------
+    AdmitCtx c = {data, size, size, time_now, 0, false};
+    uint8_t fate = rr != nullptr ? rr_decide(data, size, &c.delay) : 0;
+    {
+        ProfScope pace(prof, PROF_PACE);
+        pipeline->admit(*this, c);
+    }
+    int64_t send_time = c.send_time;    // 数据包计划发送时间（进入瓶颈队列的帧为入队时间，出队时确定）
+    packet_cnt++;
+    stat_add(stats.rx_packets, 1);
+    stat_add(stats.rx_bytes, c.wire);
+
+    // --------------- 解析MAC帧类型 ---------------
+    // MAC帧头部第12-13字节是帧类型（如0x0800=IP，0x0806=ARP）
+    uint16_t* mac_type_ptr = reinterpret_cast<uint16_t*>(data + 12);
+    uint16_t mac_type = ntohs(*mac_type_ptr); // 网络字节序转主机字节序
+
+    // --------------- 限流检查 ---------------
+    // 超过最大缓存数，或瓶颈缓冲已满（排队时延超过上限，尾部丢弃），丢弃数据包
+    if(NodeCount > MAX_PACKET_SIZE || (c.bottleneck && buffer_us > 0 && queue_delay(time_now) >= buffer_us))
+    {
+        stat_add(stats.drops, 1);
+        capture(data, size, time_now, send_time, CAP_QUEUE_FULL);
+        return false;
+    }
+    if(c.bottleneck)    // 进入瓶颈队列，等链路空闲时分配传输时段
+    {
+        Node *node = new Node(data, send_time, dst_fd, size, time_now, mac_type, block);
+        node->wire = c.wire;
+        node->fate = fate;
+        node->delay_pin = c.delay;
+        bq_push(node);
+        return true;
+    }
+    // 加入链表缓存（时延线）
+    addNode(data,send_time,dst_fd,size,time_now,mac_type,block);
+    tail->fate = fate;
+    return true;
+}
+
+/**
+ * @brief 最后一个路径段交来的帧进入本接口的链路（与enqueue相同的入队阶段，节点和缓冲区沿用上一段的）
+ * @param node 上一段到期的节点
+ * @param now 到达时间（上一段的计划发送时间）
+ * @note 以清空方式中断时直接丢弃；保留方式中断时照常排队，恢复后发送。入口关闭（排空）不影响已在路径上的帧
+ */
+void TapInterface::hop_arrive(Node *node, int64_t now)
+{
+    node->next = nullptr;
+    node->arrival = now;
+    if(outage_mode == OUTAGE_FLUSH && link_down(loop_us))
+    {
+        NodeCount++;    // drop_node按已入队的节点计数
+        drop_node(node, CAP_OUTAGE);
+        return;
+    }
+    AdmitCtx c = {node->data, node->size, node->wire, now, 0, false};
+    if(rr != nullptr)
+    {
+        node->fate = rr_decide(node->data, node->size, &c.delay);
+        node->delay_pin = c.delay;
+    }
+    pipeline->admit(*this, c);
+    node->sendtime = c.send_time;
+    if(NodeCount > MAX_PACKET_SIZE || (c.bottleneck && buffer_us > 0 && queue_delay(now) >= buffer_us))
+    {
+        NodeCount++;
+        drop_node(node, CAP_QUEUE_FULL);
+        return;
+    }
+    if(c.bottleneck)
+    {
+        bq_push(node);
+        return;
+    }
+    tail->next = node;  // 进入时延线（头节点始终存在）
+    tail = node;
+    NodeCount++;
+}
+
+/**
+ * @brief 加入瓶颈队列尾部（发送时间在出队时确定）
+ * @param node 真实帧或背景流量虚拟帧
+ */
+void TapInterface::bq_push(Node *node)
+{
+    if(aqm_mode == AQM_DUALQ && node->data != nullptr && (frame_ecn(node->data, node->size) & 1) == 1)
+    {
+        // ECT(1)/CE（L4S）进入低时延队列
+        if(lq_tail == nullptr)
+            lq_head = node;
+        else
+            lq_tail->next = node;
+        lq_tail = node;
+        lq_bytes += node->wire;
+        NodeCount++;
+        stat_add(stats.l_packets, 1);
+        return;
+    }
+    if(bq_tail == nullptr)
+    {
+        bq_head = node;
+    }
+    else
+    {
+        bq_tail->next = node;
+    }
+    bq_tail = node;
+    bq_bytes += node->wire;
+    NodeCount++;
+}
+
+/**
+ * @brief 瓶颈排队时延估计：正在传输的帧的剩余时间 + 队列中的字节按当前带宽发完的时间
+ * @param now 当前时间（微秒）
+ * @return int64_t 微秒（不限速时为0）
+ */
+int64_t TapInterface::queue_delay(int64_t now)
+{
+    int64_t bw = bandwidth;
+    if(bw <= 0)
+    {
+        return 0;
+    }
+    int64_t busy = pre_time > now ? pre_time - now : 0;
+    return busy + static_cast<int64_t>((bq_bytes + lq_bytes) * 8.0 / bw);
+}
+
+/**
+ * @brief 取下一个要传输的帧：DualQ按时间偏移FIFO在低时延/经典队列之间选择
+ * @param from_l 输出：true=取自低时延队列
+ * @return Node* 队首节点（两个队列都空时nullptr）
+ * @details 低时延队列队首的排队时间加上偏移（2倍PI2目标时延）不小于经典队列队首时选低时延队列，
+ *          经典流量不会被完全饿死（RFC 9332 4.2节）
+ */
+ListNode::Node *TapInterface::aqm_pop(bool& from_l)
+{
+    from_l = lq_head != nullptr &&
+             (bq_head == nullptr || bq_head->arrival + 2 * aqm_target_us >= lq_head->arrival);
+    if(from_l)
+    {
+        return fifo_pop(lq_head, lq_tail, lq_bytes);
+    }
+    return fifo_pop(bq_head, bq_tail, bq_bytes);
+}
+
+/**
+ * @brief 更新PI2基础概率p'（只在DualQ下、每PI2_TUPDATE_US一次）
+ * @param now 当前时间（微秒）
+ * @details p' += α(q - target) + β(q - q_prev)，q取两个队列队首排队时间的较大者（秒），限制在[0, 1]
+ */
+void TapInterface::aqm_update(int64_t now)
+{
+    if(aqm_mode != AQM_DUALQ || now - pi2_last_us < PI2_TUPDATE_US)
+    {
+        return;
+    }
+    pi2_last_us = now;
+    int64_t q = 0;
+    if(bq_head != nullptr)
+        q = now - bq_head->arrival;
+    if(lq_head != nullptr && now - lq_head->arrival > q)
+        q = now - lq_head->arrival;
+    double p = pi2_p + PI2_ALPHA * (q - aqm_target_us) / 1e6 + PI2_BETA * (q - pi2_prev_qdelay) / 1e6;
+    pi2_p = p < 0.0 ? 0.0 : (p > 1.0 ? 1.0 : p);
+    pi2_prev_qdelay = q;
+}
+
+/**
+ * @brief 出队时按排队时延标记CE或丢弃
+ * @param node 刚出队的帧
+ * @param from_l true=来自低时延队列
+ * @param start 开始传输的时间（排队时延 = start - arrival）
+ * @return bool false=帧已被丢弃并释放
+ * @details STEP：排队时延超过阈值的ECT帧打CE；
+ *          DualQ低时延队列：超过阶跃阈值或以min(1, k*p')的耦合概率打CE；
+ *          DualQ经典队列：以p'^2的概率对ECT(0)帧打CE，Not-ECT帧丢弃。背景流量虚拟帧不受影响
+ */
+bool TapInterface::aqm_dequeue(Node *node, bool from_l, int64_t start)
+{
+    if(node->data == nullptr || aqm_mode == AQM_NONE)
+    {
+        return true;
+    }
+    int ecn = frame_ecn(node->data, node->size);
+    int64_t sojourn = start - node->arrival;
+    bool congested;
+    if(aqm_mode == AQM_STEP)
+    {
+        congested = sojourn > ecn_thresh_us;
+    }
+    else if(from_l)
+    {
+        double p_cl = DUALQ_K * pi2_p;
+        congested = sojourn > ecn_thresh_us ||
+                    (p_cl > 0.0 && std::uniform_real_distribution<double>(0, 1)(rng) < p_cl);
+    }
+    else
+    {
+        congested = pi2_p > 0.0 && std::uniform_real_distribution<double>(0, 1)(rng) < pi2_p * pi2_p;
+    }
+    if(!congested || ecn == 3)
+    {
+        return true;    // 未拥塞，或到达时已是CE（不重复计数）
+    }
+    if(ecn == 1 || ecn == 2)
+    {
+        frame_set_ce(node->data);
+        stat_add(stats.ce_marks, 1);
+        EcnFlow *flow = ecn_flow(node->data, node->size);
+        if(flow != nullptr)
+            flow->ce.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    if(aqm_mode != AQM_DUALQ)
+    {
+        return true;    // 阶跃标记只作用于ECT帧
+    }
+    EcnFlow *flow = ecn_flow(node->data, node->size);
+    if(flow != nullptr)
+        flow->aqm_drops.fetch_add(1, std::memory_order_relaxed);
+    stat_add(stats.aqm_drops, 1);
+    drop_node(node, CAP_AQM);
+    return false;
+}
+
+/**
+ * @brief 查找帧所属流的计数槽，首次出现时占用一个空槽
+ * @param data 以太网帧
+ * @param size 帧大小
+ * @return EcnFlow* 计数槽（非IP帧或线性探测FLOW_PROBES次仍未找到时nullptr，计入ecn_flow_overflow）
+ * @note 只由转发线程调用；槽位一旦占用不再释放
+ */
+EcnFlow *TapInterface::ecn_flow(const uint8_t *data, uint32_t size)
+{
+    FlowKey key;
+    uint32_t l4_off, l4_len;
+    uint32_t h = flow_key_parse(data, size, &key, &l4_off, &l4_len);
+    EcnFlow *f = h != 0 ? flow_slot(ecn_flows.get(), ECN_FLOW_SLOTS, h, key, true) : nullptr;
+    if(f == nullptr)
+    {
+        ecn_flow_overflow.fetch_add(1, std::memory_order_relaxed);
+    }
+    return f;
+}
+
+/**
+ * @brief 重写释放节点函数（发送数据包 + 丢包/损坏/重复控制）
+ * @param node 待释放的节点
+ * @note 转发线程出队走pipeline->drain，不经过这里；发送经emit()，目标fd参数不再使用（通用特化）
+ */
+void TapInterface::freeNode(Node *node, int) 
+{
+    if(node->data != nullptr) 
+    {
+        ReleaseCtx c = {node, CAP_FORWARD};
+        StageChain<ClassifyStage<true>, LossStage<true>, CorruptStage<true>, EmitStage<true>>::release(*this, c);
+    }
+    release_node(node);
+}
+
+/**
+ * @brief 释放节点：堆内存直接释放（含帧前的vnet头），共享缓冲区递减引用
+ * @param node 待释放的节点（背景流量虚拟帧没有数据）
+ */
+void TapInterface::release_node(Node *node)
+{
+    release_data(node);
+    delete node;
+    NodeCount--;
+}
+
+/**
+ * @brief 只释放节点的缓冲区（节点本身由调用者释放）
+ * @param node 节点（背景流量虚拟帧没有数据）
+ */
+void TapInterface::release_data(Node *node)
+{
+    if(node->data != nullptr)
+    {
+        if(node->block >= 0)
+        {
+            release_block(node->block); // 数据在共享缓冲区中：递减引用
+        }
+        else
+        {
+            free_frame(node->data - vnet_hdr_len); // 释放数据包内存（含帧前的vnet头）
+        }
+    }
+}
+
+// --------------- 帧内存池 ---------------
+
+FramePool::~FramePool()
+{
+    if(base != nullptr)
+    {
+        munmap(base, map_size);
+    }
+}
+
+/**
+ * @brief 预留帧内存池：优先2MB大页，其次透明大页，最后普通页；预先写满每一页并mlock
+ * @param bytes 池大小（向上取整到2MB）
+ * @param numa_node >=0时把内存绑定到该NUMA节点（须在缺页前mbind）
+ * @return bool 是否成功（失败时保持未开启，调用者继续用堆内存）
+ */
+bool FramePool::reserve(size_t bytes, int numa_node)
+{
+    const size_t huge = 2u << 20;
+    size_t size = (bytes + huge - 1) / huge * huge;
+    if(base != nullptr || size == 0 || size / POOL_SLOT_SIZE > UINT32_MAX)
+    {
+        return false;
+    }
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+    if(p != MAP_FAILED)
+    {
+        backing = POOL_HUGETLB;
+        map_size = size;
+    }
+    else
+    {
+        // 没有预留大页：多映射2MB以便对齐，再请求透明大页
+        uint8_t *raw = (uint8_t *)mmap(nullptr, size + huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(raw == MAP_FAILED)
+        {
+            LOGE("pool") << "mmap " << (size >> 20) << "MB failed: " << strerror(errno);
+            return false;
+        }
+        uint8_t *aligned = (uint8_t *)(((uintptr_t)raw + huge - 1) & ~(uintptr_t)(huge - 1));
+        if(aligned > raw)
+        {
+            munmap(raw, aligned - raw);
+        }
+        munmap(aligned + size, raw + huge - aligned);
+        p = aligned;
+        map_size = size;
+        backing = madvise(p, size, MADV_HUGEPAGE) == 0 ? POOL_THP : POOL_4K;
+    }
+    base = (uint8_t *)p;
+    if(numa_node >= 0)
+    {
+        unsigned long mask[16] = {0};
+        if(numa_node >= (int)(sizeof(mask) * 8))
+        {
+            LOGW("pool") << "numa node " << numa_node << " out of range, not binding";
+        }
+        else
+        {
+            mask[numa_node / 64] = 1UL << (numa_node % 64);
+            // MPOL_BIND=2：只从该节点分配，nodemask按位，maxnode为位数
+            if(syscall(SYS_mbind, base, map_size, 2, mask, sizeof(mask) * 8, 0) == 0)
+            {
+                node = numa_node;
+            }
+            else
+            {
+                LOGW("pool") << "mbind node " << numa_node << " failed: " << strerror(errno);
+            }
+        }
+    }
+    // 预先缺页：转发中取到的帧槽都已有物理页
+    size_t page = backing == POOL_4K ? (size_t)sysconf(_SC_PAGESIZE) : huge;
+    for(size_t off = 0; off < map_size; off += page)
+    {
+        base[off] = 0;
+    }
+    if(backing != POOL_HUGETLB)
+    {
+        for(size_t off = 0; off < map_size; off += 4096)
+        {
+            base[off] = 0;  // 透明大页未合并时仍是4K页
+        }
+    }
+    locked = mlock(base, map_size) == 0;
+    if(!locked)
+    {
+        LOGW("pool") << "mlock " << (map_size >> 20) << "MB failed (" << strerror(errno) << "), pages may be swapped; raise ulimit -l";
+    }
+    slots = map_size / POOL_SLOT_SIZE;
+    free_slots.reserve(slots);
+    for(uint32_t i = slots; i > 0; i--)
+    {
+        free_slots.push_back(i - 1);    // 栈顶是0号帧槽，从低地址开始使用
+    }
+    return true;
+}
+
+/**
+ * @brief 池的描述（启动时打印）
+ */
+std::string FramePool::describe() const
+{
+    static const char *names[] = {"off", "hugetlb 2MB", "THP", "4K"};
+    std::ostringstream out;
+    out << (map_size >> 20) << "MB " << names[backing] << ", " << slots << " slots"
+        << (locked ? ", mlocked" : ", not locked");
+    if(node >= 0)
+    {
+        out << ", numa node " << node;
+    }
+    return out.str();
+}
+
+/**
+ * @brief 预留本方向的帧内存池（须在转发线程启动前调用）
+ * @param bytes 池大小（0=不开启）
+ * @param numa_node NUMA节点（-1=不绑定）
+ * @return bool 是否开启
+ */
+bool TapInterface::set_frame_pool(size_t bytes, int numa_node)
+{
+    if(bytes == 0 || !frame_pool.reserve(bytes, numa_node))
+    {
+        return false;
+    }
+    LOGI(tap_name.c_str()) << "frame pool: " << frame_pool.describe();
+    return true;
+}
+
+/**
+ * @brief 取帧缓冲：帧内存池用尽或帧大于帧槽（GSO超帧）时用堆内存
+ */
+uint8_t *TapInterface::alloc_frame(uint32_t size)
+{
+    uint8_t *buf = frame_pool.get(size);
+    if(buf != nullptr)
+    {
+        return buf;
+    }
+    if(frame_pool.enabled())
+    {
+        stat_add(stats.pool_miss, 1);
+    }
+    return new uint8_t[size];
+}
+
+void TapInterface::free_frame(uint8_t *buf)
+{
+    if(!frame_pool.put(buf))
+    {
+        delete[] buf;
+    }
+}
+
+/**
+ * @brief 采样本线程的缺页计数（getrusage本身约1µs，按FAULT_SAMPLE_US限频）
+ */
+void TapInterface::sample_faults(int64_t now)
+{
+    if(now - fault_sample_us < FAULT_SAMPLE_US)
+    {
+        return;
+    }
+    fault_sample_us = now;
+    struct rusage ru;
+    if(getrusage(RUSAGE_THREAD, &ru) == 0)
+    {
+        stats.minflt.store(ru.ru_minflt, std::memory_order_relaxed);
+        stats.majflt.store(ru.ru_majflt, std::memory_order_relaxed);
+    }
+    stats.pool_peak.store(frame_pool.get_peak(), std::memory_order_relaxed);
+}
+
+/**
+ * @brief 损坏一个帧（原地翻转一个比特）
+ * @param data 以太网帧（开启卸载时前面是vnet头）
+ * @param size 帧大小
+ * @param stealth true=隐蔽损坏（修正校验和）
+ * @return bool 是否损坏
+ */
+bool TapInterface::corrupt(uint8_t *data, uint32_t size, bool stealth)
+{
+    struct virtio_net_hdr *vh =
+        offload ? reinterpret_cast<struct virtio_net_hdr *>(data - vnet_hdr_len) : nullptr;
+    if(!frame_corrupt(data, size, stealth, vh, rng))
+    {
+        return false;
+    }
+    stat_add(stats.corrupted, 1);
+    return true;
+}
+
+/**
+ * @brief 按后端把帧发往对端
+ * @param data 帧数据
+ * @param size 帧大小
+ * @param block 数据所在的共享缓冲区号（-1=堆内存）
+ * @return bool false=发送失败（发送环满/写失败/提交队列满）
+ * @note TAP模式每帧一次write；PACKET模式只填充对端发送环，由tap_write统一提交；
+ *       io_uring模式只排队写请求，下一轮循环随读请求一起提交，发送统计在写完成时累加
+ */
+bool TapInterface::emit(const uint8_t *data, uint32_t size, int32_t block)
+{
+    if(io_mode == IO_PACKET)
+    {
+        if(!peer->packet_emit(data, size)) // 发送环满：先提交已填充的帧，再重试一次
+        {
+            stat_add(stats.syscalls, peer->packet_flush());
+            if(!peer->packet_emit(data, size))
+            {
+                stat_add(stats.drops, 1);
+                return false;
+            }
+        }
+    }
+    else if(io_mode == IO_URING && block >= 0)
+    {
+        return uring_emit(data, size, block);
+    }
+    else if(io_mode == IO_SHM)
+    {
+        if(!shm_emit(data, size, block))    // 对端rx环满（端点没有及时消费）或复制池用尽
+        {
+            stat_add(stats.drops, 1);
+            return false;
+        }
+    }
+    else
+    {
+        stat_add(stats.syscalls, 1);
+        if(write(dst_fd, data - vnet_hdr_len, size + vnet_hdr_len) < 0)
+        {
+            stat_add(stats.drops, 1);
+            return false;
+        }
+    }
+    stat_add(stats.tx_packets, 1);
+    stat_add(stats.tx_bytes, size);
+    return true;
+}
+
+/**
+ * @brief 把一条抓包描述符推入本方向的环（未开启抓包时直接返回）
+ * @param data 以太网帧
+ * @param size 帧大小
+ * @param timesample 入队时间
+ * @param sendtime 计划发送时间
+ * @param reason 处理结果（CaptureReason）
+ * @param segs GSO超帧分段数
+ * @param lost_segs 丢失的分段数
+ * @note 只拷贝不超过截断长度的字节；环满时丢弃记录（计入cap_lost），不阻塞转发
+ */
+void TapInterface::capture(const uint8_t *data, uint32_t size, int64_t timesample, int64_t sendtime,
+                           uint8_t reason, uint16_t segs, uint16_t lost_segs)
+{
+    if(capture_ring == nullptr)
+    {
+        return;
+    }
+    capture_ring->push(data, size, timesample, sendtime, loop_us, reason, segs, lost_segs);
+}
+
+/**
+ * @brief 帧在链路上的字节数
+ * @param data 以太网帧（前面是vnet头）
+ * @param size 帧大小
+ * @return uint32_t 非GSO帧为size；GSO超帧为各分段帧长之和（每段重复一份协议头）
+ */
+uint32_t TapInterface::wire_size(const uint8_t *data, uint32_t size)
+{
+    const struct virtio_net_hdr *vh = reinterpret_cast<const struct virtio_net_hdr *>(data - vnet_hdr_len);
+    uint32_t hdr_len, segs = gso_segments(data, size, vh, &hdr_len);
+    return size + (segs - 1) * hdr_len;
+}
+
+/**
+ * @brief GSO超帧的丢包与发送：逐段按丢包率判断，全部保留时整帧（仍为超帧）发给对端；
+ *        有分段丢失时，UDP超帧在软件中拆成单独的帧只发送保留的分段，TCP超帧整帧丢弃
+ * @param node 超帧节点
+ * @details 损坏与重复按超帧整体判断一次：
+ *          隐蔽损坏直接翻转超帧负载中的一个比特，分段校验和由对端内核计算；
+ *          普通损坏需要分段后的校验和不匹配，UDP超帧强制软件分段，在随机一段补全校验和后再翻转；
+ *          TCP超帧不拆分，普通损坏按隐蔽损坏处理；
+ *          重复时整帧再发一次，软件分段时各保留分段再发一次
+ */
+void TapInterface::emit_gso(Node *node)
+{
+    const struct virtio_net_hdr *vh =
+        reinterpret_cast<const struct virtio_net_hdr *>(node->data - vnet_hdr_len);
+    uint32_t hdr_len, segs = gso_segments(node->data, node->size, vh, &hdr_len);
+
+    if(gso_lost.size() < segs)
+    {
+        gso_lost.resize(segs);
+    }
+    uint32_t lost_cnt = 0;
+    for(uint32_t i = 0; i < segs; i++)
+    {
+        gso_lost[i] = Bloss > 0 && chance_in_a_thousand(Bloss);
+        lost_cnt += gso_lost[i];
+    }
+    bool is_udp = vh->gso_type == VIRTIO_NET_HDR_GSO_UDP_L4 && segs > 1;
+    int64_t corrupt_seg = -1;  // 软件分段后要损坏的分段号
+    uint8_t reason = CAP_FORWARD;
+    if(Bcorrupt > 0 && chance_in_a_thousand(Bcorrupt))
+    {
+        if(is_udp)
+        {
+            corrupt_seg = std::uniform_int_distribution<uint32_t>(0, segs - 1)(rng);
+        }
+        else if(corrupt(node->data, node->size, true))
+        {
+            reason = CAP_STEALTH;
+        }
+    }
+    else if(Bstealth > 0 && chance_in_a_thousand(Bstealth))
+    {
+        if(corrupt(node->data, node->size, true))
+            reason = CAP_STEALTH;
+    }
+    bool dup = Bdup > 0 && chance_in_a_thousand(Bdup);
+
+    if(lost_cnt == 0 && corrupt_seg < 0)
+    {
+        bool sent = emit(node->data, node->size, node->block);
+        capture(node->data, node->size, node->timesample, node->sendtime, sent ? reason : (uint8_t)CAP_TX_FAIL, segs);
+        if(sent && quic != nullptr && vh->gso_type == VIRTIO_NET_HDR_GSO_UDP_L4)
+        {
+            quic->observe_gso(node->data, node->size, hdr_len, vh->gso_size, node->sendtime);
+        }
+        if(dup)
+        {
+            stat_add(stats.dups, 1);
+            sent = emit(node->data, node->size, node->block);
+            capture(node->data, node->size, node->timesample, node->sendtime, sent ? CAP_DUP : CAP_TX_FAIL, segs);
+        }
+        return;
+    }
+    stat_add(stats.drops, lost_cnt);
+    // 抓包按超帧记录一次（软件分段前的原始内容），注释中带分段数和丢失数
+    capture(node->data, node->size, node->timesample, node->sendtime,
+            lost_cnt > 0 ? CAP_LOSS : CAP_CORRUPT, segs, is_udp ? lost_cnt : segs);
+    if(!is_udp)
+    {
+        return; // TCP超帧不拆分，整帧丢弃由对端重传
+    }
+
+    // 软件分段：每段 = 协议头 + gso_size负载，修正长度字段并重新计算校验和
+    uint32_t gso_size = vh->gso_size;
+    uint32_t l4_off, l4_len;
+    uint8_t proto;
+    l3l4_parse(node->data, node->size, &l4_off, &l4_len, &proto);
+    uint8_t *seg = rx_scratch.data();   // 与读路径在同一线程中串行使用
+    for(uint32_t i = 0; i < segs; i++)
+    {
+        if(gso_lost[i])
+        {
+            continue;
+        }
+        uint32_t off = hdr_len + i * gso_size;
+        uint32_t payload = node->size - off < gso_size ? node->size - off : gso_size;
+        memset(seg, 0, vnet_hdr_len);   // 分段为普通帧：无GSO、校验和已计算
+        uint8_t *frame = seg + vnet_hdr_len;
+        memcpy(frame, node->data, hdr_len);
+        memcpy(frame + hdr_len, node->data + off, payload);
+
+        uint8_t *ip = frame + 14;
+        uint32_t ip_total = hdr_len - 14 + payload;
+        if(ip[0] >> 4 == 4)
+        {
+            uint16_t id = ((ip[4] << 8) | ip[5]) + i;
+            ip[2] = ip_total >> 8;
+            ip[3] = ip_total & 0xff;
+            ip[4] = id >> 8;
+            ip[5] = id & 0xff;
+            ip[10] = 0;
+            ip[11] = 0;
+            uint16_t check = csum_fold(csum_add(0, ip, l4_off - 14));
+            ip[10] = check >> 8;
+            ip[11] = check & 0xff;
+        }
+        else
+        {
+            ip[4] = (ip_total - 40) >> 8;
+            ip[5] = (ip_total - 40) & 0xff;
+        }
+        uint8_t *udp = frame + l4_off;
+        uint32_t udp_len = 8 + payload;
+        udp[4] = udp_len >> 8;
+        udp[5] = udp_len & 0xff;
+        l4_checksum_fill(frame, hdr_len + payload);
+        if(i == corrupt_seg && frame_corrupt(frame, hdr_len + payload, false, nullptr, rng))
+        {
+            stat_add(stats.corrupted, 1);
+        }
+
+        for(int copy = 0; copy < (dup ? 2 : 1); copy++)
+        {
+            stat_add(stats.syscalls, 1);
+            if(write(dst_fd, seg, vnet_hdr_len + hdr_len + payload) < 0)
+            {
+                stat_add(stats.drops, 1);
+                break;
+            }
+            stat_add(stats.tx_packets, 1);
+            stat_add(stats.tx_bytes, hdr_len + payload);
+            if(copy == 0 && quic != nullptr)
+            {
+                quic->observe(frame, hdr_len + payload, node->sendtime);
+            }
+        }
+    }
+    if(dup)
+    {
+        stat_add(stats.dups, 1);
+    }
+}
+
+/**
+ * @brief 当前时刻链路是否处于中断中
+ * @param now 当前时间（微秒）
+ * @return bool 持续中断时恒为true；间歇中断时在每个周期开头的outage_len_us内为true
+ */
+bool TapInterface::link_down(int64_t now)
+{
+    if(outage_mode == OUTAGE_NONE)
+    {
+        return false;
+    }
+    int64_t period = outage_period_us;  // 只读一次：仿真线程可能同时修改
+    if(period <= 0)
+    {
+        return true;
+    }
+    int64_t phase = now - outage_start_us;
+    return phase >= 0 && phase % period < outage_len_us;
+}
+
+/**
+ * @brief 入口是否丢弃新到的帧
+ * @param now 当前时间（微秒）
+ * @return bool 链路中断，或守护进程排空队列时关闭了入口
+ */
+bool TapInterface::admit_closed(int64_t now)
+{
+    return !ingress_open.load(std::memory_order_relaxed) || link_down(now);
+}
+
+/**
+ * @brief 链路中断时在入口丢弃一帧：只计数和抓包，帧留在读缓冲/接收环中由调用者回收
+ */
+void TapInterface::admit_drop(const uint8_t *data, uint32_t size, int64_t now)
+{
+    stat_add(stats.rx_packets, 1);
+    stat_add(stats.rx_bytes, size);
+    stat_add(stats.drops, 1);
+    capture(data, size, now, now, CAP_OUTAGE);
+}
+
+/**
+ * @brief 不发送直接释放节点（计入丢弃并抓包）
+ * @param node 待释放的节点
+ * @param reason 丢弃原因（CaptureReason）
+ */
+void TapInterface::drop_node(Node *node, uint8_t reason)
+{
+    if(node->data == nullptr)   // 背景流量虚拟帧：没有数据，只计数
+    {
+        stat_add(stats.xt_drops, node->size);
+    }
+    else
+    {
+        stat_add(stats.drops, 1);
+        capture(node->data, node->size, node->timesample, node->sendtime, reason);
+    }
+    release_node(node);
+}
+
+/**
+ * @brief 每轮出队后更新过载状态
+ * @param now 本轮出队时间
+ * @param overdue 本轮出队延后超过SLO的帧数
+ * @details 出现违反SLO的帧即进入过载，连续OVERLOAD_HOLD_US没有再出现时清除；开启过载丢弃时这些帧已被丢弃
+ */
+void TapInterface::slo_update(int64_t now, uint64_t overdue)
+{
+    if(overdue == 0)
+    {
+        if(overload_last_us != 0 && now - overload_last_us > OVERLOAD_HOLD_US)
+        {
+            overloaded.store(false, std::memory_order_relaxed);
+            overload_last_us = 0;
+        }
+        return;
+    }
+    stat_add(stats.slo_late, overdue);
+    if(shed_late)
+    {
+        stat_add(stats.shed, overdue);
+    }
+    if(overdue > stats.overdue_peak.load(std::memory_order_relaxed))
+    {
+        stats.overdue_peak.store(overdue, std::memory_order_relaxed);
+    }
+    if(overload_last_us == 0)
+    {
+        stat_add(stats.overloads, 1);
+        overloaded.store(true, std::memory_order_relaxed);
+    }
+    overload_last_us = now;
+}
+
+/**
+ * @brief 丢弃瓶颈队列和时延线中全部待发送的帧（中断开始时调用，保留头节点）
+ */
+void TapInterface::flush_queue()
+{
+    while(bq_head != nullptr)   // 瓶颈队列中尚未传输的帧
+    {
+        Node *next = bq_head->next;
+        drop_node(bq_head, CAP_OUTAGE);
+        bq_head = next;
+    }
+    bq_tail = nullptr;
+    bq_bytes = 0;
+    while(lq_head != nullptr)   // DualQ低时延队列
+    {
+        Node *next = lq_head->next;
+        drop_node(lq_head, CAP_OUTAGE);
+        lq_head = next;
+    }
+    lq_tail = nullptr;
+    lq_bytes = 0;
+    Node *cur = head->next;
+    head->next = nullptr;
+    tail = head;
+    while(cur != nullptr)
+    {
+        Node *next = cur->next;
+        drop_node(cur, CAP_OUTAGE);
+        cur = next;
+    }
+}
+
+/**
+ * @brief 主动发送超时的数据包（由当前流水线特化出队）
+ * @details 核心逻辑：检查链表中达到发送时间的节点，释放（发送）它们
+ */
+void TapInterface::tap_write()
+{
+    sync_pipeline();
+    int64_t time = get_us();
+    loop_us = time;
+    bool down = link_down(time);
+    int pending = 0;
+    {
+        ProfScope ps(prof, PROF_SCAN);
+        if(down && !outage_was_down && outage_mode == OUTAGE_FLUSH)
+        {
+            flush_queue();  // 中断开始：清空队列
+        }
+        if(!down && outage_was_down)
+        {
+            link_up_us = time;  // 中断结束：保留的帧即将按原计划时间（已过期）发出
+        }
+        outage_was_down = down;
+        if(xt_model != XT_NONE || xt_cur_model != XT_NONE)
+        {
+            cross_traffic(time);
+        }
+        for(auto& hop : hops)   // 各路径段依次出队，同一轮中到期的帧可以连续穿过多段
+        {
+            hop->drain(time);
+            pending += hop->NodeCount;
+        }
+        if(!down)   // 中断期间（保留模式）队列中的帧不发送，恢复后按原计划时间（已过期）依次发出
+        {
+            pipeline->drain(*this, time);
+        }
+    }
+    backlog.store(NodeCount + pending, std::memory_order_relaxed);
+    sample_faults(time);
+    if(io_mode == IO_PACKET)
+    {
+        ProfScope ps(prof, PROF_WRITE);
+        stat_add(stats.syscalls, peer->packet_flush()); // 本轮到期的帧一次提交
+    }
+    else if(io_mode == IO_SHM)
+    {
+        ProfScope ps(prof, PROF_WRITE);
+        stat_add(stats.syscalls, shm_flush());
+    }
+    if(prof != nullptr)
+    {
+        prof->end_loop(prof_work());
+    }
+}
+
+/**
+ * @brief 设置目标TAP接口fd（转发目标）
+ * @param fd 目标TAP接口的文件描述符
+ */
+void TapInterface::set_dstap(int fd)
+{
+    this->dst_fd = fd; 
+}
+
+/**
+ * @brief 获取当前TAP接口的fd
+ * @return int TAP接口文件描述符
+ */
+int TapInterface::get_tap()
+{
+    return this->tap_fd;
+}
+
+/**
+ * @brief 创建并配置TAP接口
+ * @return int TAP接口fd（-1=失败，>0=成功）
+ * @details 1. 创建epoll实例 2. 打开TUN/TAP设备 3. 配置TAP接口 4. 创建桥接 5. 将TAP/物理网卡加入桥接
+ */
+int TapInterface::tap_open()
+{
+    int fd,err;
+
+    if(io_mode == IO_SHM)
+    {
+        if(offload)
+        {
+            cout << "共享内存后端不支持vnet头卸载，已忽略" << endl;
+            offload = false;
+        }
+        return shm_open();
+    }
+    if(io_mode == IO_PACKET)
+    {
+        if(offload)
+        {
+            cout << "PACKET后端不支持vnet头卸载，已忽略" << endl;
+            offload = false;
+        }
+        return packet_open();
+    }
+
+    // 1. 创建epoll实例（参数1：忽略，仅需大于0）
+    epoll_fd = epoll_create(1);
+    if(epoll_fd == -1)
+    {
+        cout << "Error creating epoll instance" << endl;
+        return -1;
+    }
+    event.events = EPOLLIN;    // 监听可读事件
+    event.data.fd = epoll_fd;  // 绑定epoll fd
+
+    // 2. 打开TUN/TAP设备（Linux内核虚拟网络设备）
+    struct ifreq ifr;          // 网络接口请求结构体
+    if ((fd = open("/dev/net/tun", O_RDWR)) < 0)
+    {
+        return fd;
+    }
+    memset(&ifr, 0, sizeof(ifr)); // 初始化结构体
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;    // 配置为TAP模式（二层以太网接口）+ 无数据包信息头（IFF_NO_PI）
+    if (offload)
+        ifr.ifr_flags |= IFF_VNET_HDR;      // 每帧前带virtio_net_hdr（GSO/校验和信息）
+    if ((err = ioctl(fd, TUNSETIFF, (void *) &ifr)) < 0)    // 设置TUN/TAP接口参数
+    {
+        close(fd);
+        return err;
+    }
+
+    // 2.1 卸载：接收64KB的TSO/USO超帧和未计算校验和的帧，原样交给对端TAP
+    if (offload)
+    {
+        int hdr_sz = sizeof(struct virtio_net_hdr);
+        unsigned int features = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6;
+        if (ioctl(fd, TUNSETVNETHDRSZ, &hdr_sz) < 0)
+        {
+            close(fd);
+            return -1;
+        }
+        if (ioctl(fd, TUNSETOFFLOAD, features | TUN_F_USO4 | TUN_F_USO6) < 0 &&  // USO需要6.2+内核
+            ioctl(fd, TUNSETOFFLOAD, features) < 0)
+            cout << "TUNSETOFFLOAD failed" << endl;
+        vnet_hdr_len = hdr_sz;
+        rx_buf_size = vnet_hdr_len + MAX_GSO_FRAME_SIZE;
+        rx_scratch.resize(rx_buf_size);
+    }
+
+    // 3. 设置非阻塞模式
+    if (fcntl (fd, F_SETFL, O_NDELAY) > 0)
+        cout << "fcntl problem" << endl;
+
+    // 4. 设置进程为fd的属主（接收信号）
+    if (fcntl (fd, F_SETOWN, getpid ()) > 0)
+        cout << "fcntl problem" << endl;
+
+    // 5. 配置成功：初始化TAP接口
+	if( fd > 0 ) 
+    {
+        tap_fd = fd;                              // 保存TAP fd
+        tap_name = ifr.ifr_name;                  // 保存TAP接口名（内核分配，如tap0）
+
+        // --------------- 配置桥接 ---------------
+        // 5.1 启用TAP接口
+        string iptables_cmd = "ip link set dev " + this->tap_name + " up"; 
+        cout << "iptables:: " << iptables_cmd << endl;
+        SYSTEM (iptables_cmd.c_str());    
+        iptables_cmd.clear();
+
+        // 5.2 创建桥接接口
+        iptables_cmd = "brctl addbr " + this->br_name;
+        cout << "iptables:: " << iptables_cmd << endl;
+        SYSTEM (iptables_cmd.c_str());    
+        iptables_cmd.clear();
+
+        // 5.3 将TAP接口加入桥接
         iptables_cmd = "brctl addif " + this->br_name + " " + this->tap_name;
         cout << "iptables:: " << iptables_cmd << endl;
         SYSTEM (iptables_cmd.c_str());    
         iptables_cmd.clear();
 
-        // 5.4 将物理网卡加入桥接
-        iptables_cmd = "brctl addif " + this->br_name + " " + this->eth_name;
-        cout << "iptables:: " << iptables_cmd << endl;
-        SYSTEM (iptables_cmd.c_str());    
-        iptables_cmd.clear();
+        // 5.4 将物理网卡加入桥接
+        iptables_cmd = "brctl addif " + this->br_name + " " + this->eth_name;
+        cout << "iptables:: " << iptables_cmd << endl;
+        SYSTEM (iptables_cmd.c_str());    
+        iptables_cmd.clear();
+
+        // 5.5 关闭桥接的STP（生成树协议，避免延迟）
+        iptables_cmd = "brctl stp " + this->br_name + " off";
+        cout << "iptables:: " << iptables_cmd << endl;
+        SYSTEM (iptables_cmd.c_str());    
+        iptables_cmd.clear();
+
+        // 5.6 启用桥接接口
+        iptables_cmd = "ifconfig " + this->br_name + " up";
+        cout << "iptables:: " << iptables_cmd << endl;
+        SYSTEM (iptables_cmd.c_str());    
+        iptables_cmd.clear();
+
+        // 6. 将TAP fd添加到epoll监听
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+        {
+            cout << "Error adding tap_fd to epoll" << endl;
+            close(fd);
+            close(epoll_fd);
+            return -1;
+        }
+
+        // 7. io_uring引擎：不可用时回退到TAP read/write
+        if(io_mode == IO_URING && uring_open() < 0)
+        {
+            cout << "io_uring不可用，" << tap_name << " 回退到TAP read/write" << endl;
+            io_mode = IO_TAP;
+        }
+        
+		return fd;
+	} 
+    else 
+    {
+		return -1;
+	}
+}
+
+// --------------- 合成背景流量 ---------------
+#define XT_TICK_US 1000         // 生成周期（微秒）
+#define XT_PKT_BYTES 1500       // 背景流量的包大小（攒够整包才入队）
+#define XT_CHUNK_BYTES 65536    // 单个虚拟节点最多聚合的字节数（与GSO超帧相同）
+#define XT_MAX_CATCHUP_US 100000 // 转发线程被长时间挂起后最多补生成100ms
+#define XT_PARETO_SHAPE 1.5     // Pareto形状参数
+#define XT_PARETO_MEAN_US 100000 // 开/关状态的平均时长
+
+/**
+ * @brief Pareto分布随机数（形状XT_PARETO_SHAPE）
+ * @param mean 均值
+ */
+double TapInterface::pareto(double mean)
+{
+    double xm = mean * (XT_PARETO_SHAPE - 1) / XT_PARETO_SHAPE;
+    std::uniform_real_distribution<double> u(1e-9, 1.0);
+    return xm * pow(u(rng), -1.0 / XT_PARETO_SHAPE);
+}
+
+/**
+ * @brief 按模型生成本周期的背景流量，以虚拟帧（data=nullptr）注入本方向的瓶颈队列
+ * @param now 当前时间（微秒）
+ * @details 每XT_TICK_US生成一次，按周期内的字节数聚合成至多XT_CHUNK_BYTES的虚拟节点，
+ *          节点数与速率/64KB成正比（10Gbps约2万个/秒），开销与每帧一个节点的真实流量相比可以忽略；
+ *          虚拟帧和真实帧在同一个瓶颈队列中排队、按出队时的带宽串行化，到期后直接释放，不写到对端；
+ *          瓶颈排队时延（queue_delay）超过xt_qlim_us时背景流量尾丢弃（真实帧不受此限制）
+ */
+void TapInterface::cross_traffic(int64_t now)
+{
+    int model = xt_model;
+    if(model != xt_cur_model)   // 仿真线程切换了模型：重置状态
+    {
+        xt_cur_model = model;
+        xt_last_us = now;
+        xt_credit = 0;
+        xt_on = true;
+        xt_phase_end_us = now + static_cast<int64_t>(pareto(XT_PARETO_MEAN_US));
+        xt_cwnd = xt_flows * 10.0 * XT_PKT_BYTES;   // 初始窗口每流10个包
+        xt_last_cut_us = now;
+    }
+    int64_t dt = now - xt_last_us;
+    if(dt < XT_TICK_US)
+    {
+        return;
+    }
+    xt_last_us = now;
+    if(model == XT_NONE || bandwidth <= 0)  // 不限速时没有瓶颈，背景流量没有意义
+    {
+        return;
+    }
+    if(dt > XT_MAX_CATCHUP_US)
+    {
+        dt = XT_MAX_CATCHUP_US;
+    }
+
+    double rate = xt_rate / 8.0;            // Mbps → 字节/微秒
+    int64_t qdelay = queue_delay(now);
+    switch(model)
+    {
+        case XT_CBR:
+            xt_credit += rate * dt;
+            break;
+        case XT_POISSON:
+        {
+            std::poisson_distribution<int64_t> arrivals(rate * dt / XT_PKT_BYTES);
+            xt_credit += arrivals(rng) * XT_PKT_BYTES;
+            break;
+        }
+        case XT_PARETO:
+        {
+            // 逐段走过本周期内的开/关状态，开状态下以2倍平均速率发送（开、关平均时长相同）
+            int64_t t = now - dt;
+            while(t < now)
+            {
+                int64_t end = xt_phase_end_us < now ? xt_phase_end_us : now;
+                if(xt_on && end > t)
+                {
+                    xt_credit += 2 * rate * (end - t);
+                }
+                t = end > t ? end : t;
+                if(t >= xt_phase_end_us)
+                {
+                    xt_on = !xt_on;
+                    xt_phase_end_us = t + static_cast<int64_t>(pareto(XT_PARETO_MEAN_US)) + 1;
+                }
+            }
+            break;
+        }
+        case XT_AIMD:
+        {
+            // 流体近似：每个RTT发送一个窗口，无拥塞时每流每RTT加一个包，缓冲溢出时每个RTT最多减半一次
+            double rtt = 2.0 * delay_ms + qdelay;
+            if(rtt < XT_TICK_US)
+            {
+                rtt = XT_TICK_US;
+            }
+            xt_credit += xt_cwnd * dt / rtt;
+            if(qdelay > xt_qlim_us)
+            {
+                if(now - xt_last_cut_us > rtt)
+                {
+                    xt_cwnd /= 2;
+                    xt_last_cut_us = now;
+                }
+            }
+            else
+            {
+                xt_cwnd += xt_flows * XT_PKT_BYTES * dt / rtt;
+            }
+            if(xt_cwnd < xt_flows * 2.0 * XT_PKT_BYTES)
+            {
+                xt_cwnd = xt_flows * 2.0 * XT_PKT_BYTES;
+            }
+            break;
+        }
+        default:
+            return;
+    }
+
+    // 攒够整包后按块入队
+    while(xt_credit >= XT_PKT_BYTES)
+    {
+        uint32_t chunk = static_cast<uint32_t>(xt_credit / XT_PKT_BYTES) * XT_PKT_BYTES;
+        if(chunk > XT_CHUNK_BYTES)
+        {
+            chunk = XT_CHUNK_BYTES / XT_PKT_BYTES * XT_PKT_BYTES;
+        }
+        xt_credit -= chunk;
+        if(queue_delay(now) > xt_qlim_us)   // 背景流量的缓冲已满：尾丢弃
+        {
+            stat_add(stats.xt_drops, chunk);
+            continue;
+        }
+        bq_push(new Node(nullptr, now, dst_fd, chunk, now, 0));
+        stat_add(stats.xt_bytes, chunk);
+    }
+}
+
+// --------------- io_uring 引擎 ---------------
+#define URING_SQ_ENTRIES 4096       // 提交队列深度
+#define URING_RX_DEPTH 64           // 常驻的读请求数
+#define URING_OP_READ 1ULL          // user_data高32位：读请求
+#define URING_OP_WRITE 2ULL         // user_data高32位：写请求
+
+/**
+ * @brief 创建io_uring实例，分配并注册缓冲池，TAP fd改为阻塞模式（由io_uring内部轮询可读）
+ * @return int 0=成功，-1=失败（调用者回退到TAP read/write）
+ * @details 缓冲池大小由ring_mb决定，每个缓冲区容纳一帧；帧在延迟线中原地保存，
+ *          写完成后缓冲区才放回空闲池
+ */
+int TapInterface::uring_open()
+{
+    // 普通帧2KB一个缓冲区；开启卸载时每个缓冲区须容纳vnet头 + 64KB超帧
+    uring_buf_size = offload ? ((rx_buf_size + 4095) & ~4095u) : 2048;
+    uint32_t buf_nr = ((size_t)ring_mb << 20) / uring_buf_size;
+    if(buf_nr == 0)
+    {
+        return -1;
+    }
+    uring_pool_size = (size_t)buf_nr * uring_buf_size;
+    void *pool = mmap(nullptr, uring_pool_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if(pool == MAP_FAILED)
+    {
+        return -1;
+    }
+    uring_pool = static_cast<uint8_t *>(pool);
+
+    // 完成队列须容纳全部在途读写（每个缓冲区至多一个在途请求 + 常驻读请求），且不小于提交队列
+    unsigned cq_entries = buf_nr * 2 > 65536 ? 65536 : buf_nr * 2;
+    if(cq_entries < URING_SQ_ENTRIES * 2)
+    {
+        cq_entries = URING_SQ_ENTRIES * 2;
+    }
+    if(uring.init(URING_SQ_ENTRIES, cq_entries) < 0 ||
+       uring.register_buffer(uring_pool, uring_pool_size) < 0)
+    {
+        uring.close_ring();
+        munmap(uring_pool, uring_pool_size);
+        uring_pool = nullptr;
+        return -1;
+    }
+
+    // 非阻塞fd上的读请求会直接返回-EAGAIN，改为阻塞后由io_uring等待可读
+    fcntl(tap_fd, F_SETFL, 0);
+
+    rx_refs.assign(buf_nr, 0);
+    uring_free.clear();
+    for(int32_t i = buf_nr - 1; i >= 0; i--)
+    {
+        uring_free.push_back(i);
+    }
+    uring_rx_posted = 0;
+    return 0;
+}
+
+/**
+ * @brief io_uring引擎的一轮收发：补足读请求，一次io_uring_enter提交（含上一轮排队的写请求），收割完成事件
+ * @return int 本轮入队的帧数
+ */
+int TapInterface::uring_read()
+{
+    // 1. 为空闲缓冲区补投读请求
+    while(uring_rx_posted < URING_RX_DEPTH && !uring_free.empty())
+    {
+        struct io_uring_sqe *sqe = uring.get_sqe();
+        if(sqe == nullptr)
+        {
+            break;
+        }
+        int32_t buf = uring_free.back();
+        uring_free.pop_back();
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->fd = tap_fd;
+        sqe->addr = reinterpret_cast<uint64_t>(uring_pool + (size_t)buf * uring_buf_size);
+        sqe->len = rx_buf_size;
+        sqe->buf_index = 0;
+        sqe->user_data = (URING_OP_READ << 32) | (uint32_t)buf;
+        uring_rx_posted++;
+    }
+
+    // 2. 每轮循环至多一次系统调用
+    {
+        ProfScope ps(prof, PROF_POLL);
+        stat_add(stats.syscalls, uring.submit());
+    }
+    ProfScope ps(prof, PROF_READ);
+
+    // 3. 收割完成事件（共享内存，无系统调用）
+    int frames = 0;
+    int64_t time_now = 0;
+    struct io_uring_cqe *cqe;
+    while((cqe = uring.peek_cqe()) != nullptr)
+    {
+        uint64_t op = cqe->user_data >> 32;
+        int32_t buf = static_cast<int32_t>(cqe->user_data & 0xffffffff);
+        int res = cqe->res;
+        uring.cqe_seen();
+
+        if(op == URING_OP_READ)
+        {
+            uring_rx_posted--;
+            if(res <= (int)vnet_hdr_len)
+            {
+                uring_free.push_back(buf);
+                continue;
+            }
+            if(time_now == 0)
+            {
+                time_now = get_us();    // 同一批完成的帧共用一个接收时间戳
+            }
+            rx_refs[buf] = 1;
+            if(!enqueue(uring_pool + (size_t)buf * uring_buf_size + vnet_hdr_len, res - vnet_hdr_len,
+                        time_now, buf))
+            {
+                release_block(buf);
+            }
+            frames++;
+        }
+        else
+        {
+            if(res < 0)
+            {
+                stat_add(stats.drops, 1);
+            }
+            else
+            {
+                stat_add(stats.tx_packets, 1);
+                stat_add(stats.tx_bytes, res - vnet_hdr_len);
+            }
+            release_block(buf);
+        }
+    }
+    return frames;
+}
+
+/**
+ * @brief 排队一个写请求（WRITE_FIXED，直接从注册缓冲区发往对端TAP），下一轮uring_read时提交
+ * @param data 帧数据（位于注册缓冲池内）
+ * @param size 帧大小
+ * @param block 注册缓冲区号（写完成前持有一个引用）
+ */
+bool TapInterface::uring_emit(const uint8_t *data, uint32_t size, int32_t block)
+{
+    struct io_uring_sqe *sqe = uring.get_sqe();
+    if(sqe == nullptr)
+    {
+        // 提交队列满：先把已排队的请求提交掉
+        stat_add(stats.syscalls, uring.submit());
+        sqe = uring.get_sqe();
+        if(sqe == nullptr)
+        {
+            stat_add(stats.drops, 1);
+            return false;
+        }
+    }
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = dst_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(data - vnet_hdr_len);   // vnet头在帧前面，一并写出
+    sqe->len = size + vnet_hdr_len;
+    sqe->buf_index = 0;
+    sqe->user_data = (URING_OP_WRITE << 32) | (uint32_t)block;
+    rx_refs[block]++;
+    return true;
+}
+
+// --------------- AF_PACKET TPACKET_V3 后端 ---------------
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif
+
+#define RX_BLOCK_SIZE (1 << 20)     // 接收块大小（1MB）
+#define RX_FRAME_SIZE 2048          // 接收帧槽大小（V3中仅用于校验）
+#define TX_BLOCK_SIZE (1 << 20)     // 发送块大小（1MB）
+#define TX_BLOCK_NR 8               // 发送块数量（共4096个帧槽）
+#define TX_FRAME_SIZE 2048          // 发送帧槽大小（可容纳MAX_FRAME_SIZE）
+#define TX_DATA_OFFSET TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) // 发送帧数据偏移
+
+/**
+ * @brief 打开AF_PACKET套接字，直接挂到eth_name（veth或网卡）上，不创建TAP和网桥
+ * @return int 套接字fd（-1=失败）
+ * @details 1. 创建套接字并切换到TPACKET_V3 2. 配置接收环/发送环并mmap 3. 绑定接口并开启混杂模式
+ *          接收环中的帧在延迟线中原地保存，直到块内所有帧都发出后才归还内核
+ */
+int TapInterface::packet_open()
+{
+    int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if(fd < 0)
+    {
+        cout << "Error creating AF_PACKET socket" << endl;
+        return -1;
+    }
+
+    int version = TPACKET_V3;
+    if(setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+    {
+        cout << "TPACKET_V3 not supported" << endl;
+        close(fd);
+        return -1;
+    }
+
+    // 不接收本套接字（及本机）发出的帧，避免发送环上的帧回环进接收环
+    int one = 1;
+    if(setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one)) < 0)
+        cout << "PACKET_IGNORE_OUTGOING not supported" << endl;
+    // 发送绕过qdisc，直接交给驱动
+    setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+
+    // 接收环：ring_mb个1MB的块，块满或超时1ms后交给用户态
+    struct tpacket_req3 rx_req;
+    memset(&rx_req, 0, sizeof(rx_req));
+    rx_req.tp_block_size = RX_BLOCK_SIZE;
+    rx_req.tp_block_nr = ring_mb;
+    rx_req.tp_frame_size = RX_FRAME_SIZE;
+    rx_req.tp_frame_nr = (RX_BLOCK_SIZE / RX_FRAME_SIZE) * ring_mb;
+    rx_req.tp_retire_blk_tov = 1;
+    if(setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &rx_req, sizeof(rx_req)) < 0)
+    {
+        cout << "Error setting PACKET_RX_RING" << endl;
+        close(fd);
+        return -1;
+    }
+
+    // 发送环：V3发送环要求超时/私有区/特性字段均为0
+    struct tpacket_req3 tx_req;
+    memset(&tx_req, 0, sizeof(tx_req));
+    tx_req.tp_block_size = TX_BLOCK_SIZE;
+    tx_req.tp_block_nr = TX_BLOCK_NR;
+    tx_req.tp_frame_size = TX_FRAME_SIZE;
+    tx_req.tp_frame_nr = (TX_BLOCK_SIZE / TX_FRAME_SIZE) * TX_BLOCK_NR;
+    if(setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &tx_req, sizeof(tx_req)) < 0)
+    {
+        cout << "Error setting PACKET_TX_RING" << endl;
+        close(fd);
+        return -1;
+    }
+
+    // 接收环和发送环映射到同一块内存：接收环在前，发送环在后
+    size_t rx_size = (size_t)rx_req.tp_block_size * rx_req.tp_block_nr;
+    size_t tx_size = (size_t)tx_req.tp_block_size * tx_req.tp_block_nr;
+    void *map = mmap(nullptr, rx_size + tx_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        cout << "Error mapping packet ring" << endl;
+        close(fd);
+        return -1;
+    }
+    ring = static_cast<uint8_t *>(map);
+    ring_size = rx_size + tx_size;
+    rx_block_size = rx_req.tp_block_size;
+    rx_block_nr = rx_req.tp_block_nr;
+    rx_cur = 0;
+    rx_refs.assign(rx_block_nr, 0);
+    rx_walked.assign(rx_block_nr, 0);
+    tx_ring = ring + rx_size;
+    tx_frame_size = tx_req.tp_frame_size;
+    tx_frame_nr = tx_req.tp_frame_nr;
+    tx_cur = 0;
+    tx_pending = 0;
+
+    // 绑定到物理/veth接口
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, eth_name.c_str(), IFNAMSIZ - 1);
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    if(ioctl(fd, SIOCGIFINDEX, &ifr) == 0)
+        sll.sll_ifindex = ifr.ifr_ifindex;
+    if(sll.sll_ifindex == 0 || bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0)
+    {
+        cout << "Error binding to " << eth_name << endl;
+        munmap(ring, ring_size);
+        ring = nullptr;
+        close(fd);
+        return -1;
+    }
+
+    // 混杂模式：接收发往对端主机MAC的帧
+    struct packet_mreq mr;
+    memset(&mr, 0, sizeof(mr));
+    mr.mr_ifindex = sll.sll_ifindex;
+    mr.mr_type = PACKET_MR_PROMISC;
+    if(setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mr, sizeof(mr)) < 0)
+        cout << "Error enabling promiscuous mode on " << eth_name << endl;
+
+    string iptables_cmd = "ip link set dev " + this->eth_name + " up";
+    cout << "iptables:: " << iptables_cmd << endl;
+    SYSTEM (iptables_cmd.c_str());
+
+    tap_fd = fd;
+    tap_name = eth_name;
+    return fd;
+}
+
+/**
+ * @brief 批量处理接收环中已交给用户态的块
+ * @return int 本次入队处理的帧数
+ * @details 块内每个入队的帧持有一个块引用，帧发出（或丢弃）后递减；遍历期间额外持有一个引用。
+ *          若下一个块已遍历但仍被延迟线占用，说明接收环已满，此时由内核丢帧
+ */
+int TapInterface::packet_read()
+{
+    int frames = 0;
+    while(true)
+    {
+        struct tpacket_block_desc *bd =
+            reinterpret_cast<struct tpacket_block_desc *>(ring + (size_t)rx_cur * rx_block_size);
+        if(!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+        {
+            break;  // 块仍属于内核
+        }
+        if(rx_walked[rx_cur])
+        {
+            break;  // 接收环已绕满一圈
+        }
+
+        uint32_t block = rx_cur;
+        uint32_t num = bd->hdr.bh1.num_pkts;
+        struct tpacket3_hdr *ppd = reinterpret_cast<struct tpacket3_hdr *>(
+            reinterpret_cast<uint8_t *>(bd) + bd->hdr.bh1.offset_to_first_pkt);
+        rx_walked[block] = 1;
+        rx_refs[block] = 1;
+        int64_t time_now = loop_us;     // 同一块内的帧共用一个接收时间戳
+        for(uint32_t i = 0; i < num; i++)
+        {
+            uint8_t *data = reinterpret_cast<uint8_t *>(ppd) + ppd->tp_mac;
+            if(ppd->tp_status & TP_STATUS_CSUMNOTREADY)
+            {
+                l4_checksum_fill(data, ppd->tp_snaplen);
+            }
+            rx_refs[block]++;
+            if(!enqueue(data, ppd->tp_snaplen, time_now, block))
+            {
+                rx_refs[block]--;
+            }
+            ppd = reinterpret_cast<struct tpacket3_hdr *>(
+                reinterpret_cast<uint8_t *>(ppd) + ppd->tp_next_offset);
+        }
+        frames += num;
+        rx_cur = (rx_cur + 1) % rx_block_nr;
+        release_block(block);
+    }
+    return frames;
+}
+
+/**
+ * @brief 递减接收块/注册缓冲区引用，归零时把块归还内核（PACKET）或放回空闲池（io_uring）
+ * @param block 接收块号/注册缓冲区号
+ */
+void TapInterface::release_block(int32_t block)
+{
+    if(--rx_refs[block] == 0)
+    {
+        if(io_mode == IO_URING)
+        {
+            uring_free.push_back(block);    // 放回空闲池，下一轮补投读请求
+            return;
+        }
+        if(io_mode == IO_SHM)
+        {
+            uint32_t first = shm_in->tx_slot, mask = shm_in->tx.mask;
+            if((uint32_t)block - first > mask)
+            {
+                shm_free.push_back(block);  // 复制池帧槽
+                return;
+            }
+            // tx环只能按顺序回收：从tail起跳过引用已归零的帧槽，端点随后可以重用它们
+            uint32_t tail = shm_tail;
+            while(tail != shm_rd && rx_refs[first + (tail & mask)] == 0)
+            {
+                tail++;
+            }
+            if(tail != shm_tail)
+            {
+                shm_tail = tail;
+                __atomic_store_n(&shm_in->tx.tail, tail, __ATOMIC_RELEASE);
+            }
+            return;
+        }
+        struct tpacket_block_desc *bd =
+            reinterpret_cast<struct tpacket_block_desc *>(ring + (size_t)block * rx_block_size);
+        rx_walked[block] = 0;
+        __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief 把帧复制到本接口发送环的下一个帧槽（由对端的转发线程调用）
+ * @param data 帧数据
+ * @param size 帧大小
+ * @return bool true=已填充，false=发送环满或帧过大
+ */
+bool TapInterface::packet_emit(const uint8_t *data, uint32_t size)
+{
+    if(size > tx_frame_size - TX_DATA_OFFSET)
+    {
+        return false;
+    }
+    uint8_t *frame = tx_ring + (size_t)tx_cur * tx_frame_size;
+    struct tpacket3_hdr *hdr = reinterpret_cast<struct tpacket3_hdr *>(frame);
+    uint32_t status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+    if(status != TP_STATUS_AVAILABLE && status != TP_STATUS_WRONG_FORMAT)
+    {
+        return false;   // 内核尚未发完该帧槽
+    }
+    memcpy(frame + TX_DATA_OFFSET, data, size);
+    hdr->tp_len = size;
+    hdr->tp_snaplen = size;
+    hdr->tp_next_offset = 0;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+    tx_cur = (tx_cur + 1) % tx_frame_nr;
+    tx_pending++;
+    return true;
+}
+
+/**
+ * @brief 一次send()提交发送环中所有待发帧
+ * @return int 本次使用的系统调用次数（无待发帧时为0）
+ */
+int TapInterface::packet_flush()
+{
+    if(tx_pending == 0)
+    {
+        return 0;
+    }
+    tx_pending = 0;
+    send(tap_fd, nullptr, 0, MSG_DONTWAIT);
+    return 1;
+}
+
+// --------------- 共享内存后端 ---------------
+ShmRegion::~ShmRegion()
+{
+    stopping = true;
+    if(acceptor.joinable())
+    {
+        acceptor.join();
+    }
+    if(listen_fd >= 0)
+    {
+        close(listen_fd);
+        unlink(sock_path.c_str());
+    }
+    if(base != nullptr)
+    {
+        munmap(base, size);
+    }
+    for(int n = 0; n < SHM_PORTS; n++)
+    {
+        if(efd[n] >= 0)
+        {
+            close(efd[n]);
+        }
+    }
+    if(memfd >= 0)
+    {
+        close(memfd);
+    }
+}
+
+/**
+ * @brief 创建共享区（memfd）和各端口的eventfd，监听接入套接字
+ * @param path 接入套接字路径（已存在的同名文件先删除）
+ * @param ring_slots 每个端口的环项数/发送帧槽数（向上取2的幂）
+ * @return bool 是否成功
+ * @details 布局：头部 | 各端口tx/rx描述符数组 | 帧槽（端口0发送帧槽、端口1发送帧槽、发往端口0/1的复制池）
+ */
+bool ShmRegion::create(const std::string& path, uint32_t ring_slots)
+{
+    uint32_t n = 64;
+    while(n < ring_slots && n < (1u << 20))
+    {
+        n <<= 1;
+    }
+    size_t desc_bytes = (size_t)n * sizeof(ShmDesc);
+    size_t off = (sizeof(ShmHeader) + 4095) & ~(size_t)4095;
+    size_t desc_off = off;
+    off += desc_bytes * 2 * SHM_PORTS;
+    off = (off + 4095) & ~(size_t)4095;
+    uint32_t slot_nr = SHM_PORTS * (n + SHM_POOL_SLOTS);
+    size = off + (size_t)slot_nr * SHM_SLOT_SIZE;
+
+    memfd = memfd_create("tc_quic_shm", MFD_CLOEXEC);
+    if(memfd < 0 || ftruncate(memfd, size) < 0)
+    {
+        LOGE("shm") << "创建共享区失败: " << strerror(errno);
+        return false;
+    }
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, memfd, 0);
+    if(map == MAP_FAILED)
+    {
+        LOGE("shm") << "映射共享区失败: " << strerror(errno);
+        return false;
+    }
+    base = static_cast<uint8_t *>(map);
+    ShmHeader *hdr = reinterpret_cast<ShmHeader *>(base);
+    hdr->version = SHM_VERSION;
+    hdr->slot_size = SHM_SLOT_SIZE;
+    hdr->slot_nr = slot_nr;
+    hdr->slots_off = off;
+    hdr->size = size;
+    for(int p = 0; p < SHM_PORTS; p++)
+    {
+        ShmPort& port = hdr->port[p];
+        port.tx.mask = port.rx.mask = n - 1;
+        port.tx.desc_off = desc_off + desc_bytes * (2 * p);
+        port.rx.desc_off = desc_off + desc_bytes * (2 * p + 1);
+        port.tx_slot = p * n;
+        port.pool_slot = SHM_PORTS * n + p * SHM_POOL_SLOTS;
+        port.pool_nr = SHM_POOL_SLOTS;
+        efd[p] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(efd[p] < 0)
+        {
+            LOGE("shm") << "创建eventfd失败: " << strerror(errno);
+            return false;
+        }
+    }
+    __atomic_store_n(&hdr->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+    struct sockaddr_un addr;
+    if(path.size() >= sizeof(addr.sun_path))
+    {
+        LOGE("shm") << "接入套接字路径过长: " << path;
+        return false;
+    }
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(path.c_str());
+    if(listen_fd < 0 || bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+       listen(listen_fd, 4) < 0)
+    {
+        LOGE("shm") << "监听接入套接字失败: " << strerror(errno);
+        return false;
+    }
+    sock_path = path;
+    acceptor = std::thread(&ShmRegion::serve, this);
+    LOGI("shm") << "共享内存端点: " << path << "（每端口" << n << "个帧槽，共享区"
+                << (size >> 20) << "MB）";
+    return true;
+}
+
+/**
+ * @brief 接入线程：每个连接读一个端口号，随应答用SCM_RIGHTS交出memfd和该端口的eventfd，然后关闭连接
+ * @note 不记录端口占用：同一端口同时只应有一个端点进程，端点重启后直接从共享区中的环索引继续
+ */
+void ShmRegion::serve()
+{
+    while(!stopping)
+    {
+        struct pollfd pfd = {listen_fd, POLLIN, 0};
+        if(poll(&pfd, 1, 200) <= 0)
+        {
+            continue;
+        }
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if(fd < 0)
+        {
+            continue;
+        }
+        struct timeval tv = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        uint32_t port_no = SHM_PORTS;
+        ShmHello hello = {SHM_MAGIC, 0};
+        if(read(fd, &port_no, sizeof(port_no)) != (ssize_t)sizeof(port_no) || port_no >= SHM_PORTS)
+        {
+            hello.status = EINVAL;
+            ssize_t w = write(fd, &hello, sizeof(hello));
+            (void)w;
+            close(fd);
+            continue;
+        }
+        int fds[2] = {memfd, efd[port_no]};
+        struct iovec iov = {&hello, sizeof(hello)};
+        char cbuf[CMSG_SPACE(sizeof(fds))];
+        memset(cbuf, 0, sizeof(cbuf));
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+        if(sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(hello))
+        {
+            LOGI("shm") << "端点已接入端口" << port_no;
+        }
+        close(fd);
+    }
+}
+
+/**
+ * @brief 绑定共享区中的端口：本方向消费端口shm_port的tx环，生产对端端口的rx环
+ * @return int 共享区memfd（-1=未设置共享区）
+ */
+int TapInterface::shm_open()
+{
+    if(shm == nullptr)
+    {
+        cout << "共享内存后端需要先创建共享区" << endl;
+        return -1;
+    }
+    shm_in = shm->port(shm_port);
+    shm_out = shm->port(1 - shm_port);
+    shm_in_desc = shm_desc(shm->get_base(), shm_in->tx);
+    shm_out_desc = shm_desc(shm->get_base(), shm_out->rx);
+    shm_rd = shm_tail = __atomic_load_n(&shm_in->tx.tail, __ATOMIC_ACQUIRE);
+    shm_reclaim = shm_out->rx.head;
+    rx_refs.assign(reinterpret_cast<ShmHeader *>(shm->get_base())->slot_nr, 0);
+    shm_free.clear();
+    for(uint32_t i = 0; i < shm_out->pool_nr; i++)
+    {
+        shm_free.push_back(shm_out->pool_slot + shm_out->pool_nr - 1 - i);
+    }
+    tap_name = "shm" + std::to_string(shm_port);
+    return shm->get_fd();
+}
+
+/**
+ * @brief 取出端点tx环中的全部新帧入队
+ * @return int 本次处理的帧数
+ * @details 帧留在端点的发送帧槽中，直到发出（对端消费）或丢弃后才回收；长度非法的帧直接回收
+ */
+int TapInterface::shm_read()
+{
+    uint32_t head = __atomic_load_n(&shm_in->tx.head, __ATOMIC_ACQUIRE);
+    if(head == shm_rd)
+    {
+        return 0;
+    }
+    uint8_t *base = shm->get_base();
+    uint32_t mask = shm_in->tx.mask;
+    int64_t time_now = loop_us;     // 同一批帧共用一个接收时间戳
+    int frames = 0;
+    for(; shm_rd != head; frames++)
+    {
+        int32_t slot = shm_in->tx_slot + (shm_rd & mask);
+        uint32_t len = shm_in_desc[shm_rd & mask].len;
+        shm_rd++;
+        rx_refs[slot] = 1;  // 遍历引用
+        if(len >= 14 && len <= SHM_SLOT_SIZE)
+        {
+            rx_refs[slot]++;
+            if(!enqueue(shm_slot(base, slot), len, time_now, slot))
+            {
+                rx_refs[slot]--;
+            }
+        }
+        else
+        {
+            stat_add(stats.drops, 1);
+        }
+        release_block(slot);
+    }
+    return frames;
+}
+
+/**
+ * @brief 把帧交给对端端点：共享区中的帧直接写帧槽号，堆内存中的帧先复制到复制池
+ * @param data 帧数据
+ * @param size 帧大小
+ * @param block 帧槽号（-1=堆内存）
+ * @return bool false=对端rx环满或复制池用尽
+ * @note 每个rx项持有帧槽的一个引用（重复帧两项引用同一帧槽），端点消费后由shm_flush回收
+ */
+bool TapInterface::shm_emit(const uint8_t *data, uint32_t size, int32_t block)
+{
+    uint32_t head = shm_out->rx.head;
+    if(head - shm_reclaim > shm_out->rx.mask)
+    {
+        stat_add(stats.syscalls, shm_flush());  // 先回收端点已消费的项
+        if(head - shm_reclaim > shm_out->rx.mask)
+        {
+            return false;
+        }
+    }
+    if(block < 0)
+    {
+        if(shm_free.empty() || size > SHM_SLOT_SIZE)
+        {
+            return false;
+        }
+        block = shm_free.back();
+        shm_free.pop_back();
+        memcpy(shm_slot(shm->get_base(), block), data, size);
+    }
+    rx_refs[block]++;
+    ShmDesc& d = shm_out_desc[head & shm_out->rx.mask];
+    d.slot = block;
+    d.len = size;
+    __atomic_store_n(&shm_out->rx.head, head + 1, __ATOMIC_RELEASE);
+    shm_posted++;
+    return true;
+}
+
+/**
+ * @brief 回收端点已消费的rx项，本轮有新帧且端点在等待时写eventfd唤醒
+ * @return int 本次使用的系统调用次数
+ */
+int TapInterface::shm_flush()
+{
+    uint32_t tail = __atomic_load_n(&shm_out->rx.tail, __ATOMIC_ACQUIRE);
+    while(shm_reclaim != tail)
+    {
+        release_block(shm_out_desc[shm_reclaim & shm_out->rx.mask].slot);
+        shm_reclaim++;
+    }
+    if(shm_posted == 0)
+    {
+        return 0;
+    }
+    shm_posted = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);    // 与端点的“置need_wakeup后再查head”配对
+    if(__atomic_load_n(&shm_out->rx.need_wakeup, __ATOMIC_RELAXED) == 0)
+    {
+        return 0;
+    }
+    uint64_t one = 1;
+    ssize_t w = write(shm->wake_fd(1 - shm_port), &one, sizeof(one));
+    (void)w;
+    return 1;
+}
+
+void TapInterface::set_io_mode(IoMode mode)
+{
+    this->io_mode = mode;
+}
+
+void TapInterface::set_ring_mb(int mb)
+{
+    this->ring_mb = mb;
+}
+
+void TapInterface::set_peer(TapInterface *peer)
+{
+    this->peer = peer;
+}
+
+void TapInterface::set_shm(ShmRegion *region, int port)
+{
+    this->shm = region;
+    this->shm_port = port;
+}
+
+void TapInterface::set_offload(bool on)
+{
+    this->offload = on;
+    profile_gen.fetch_add(1, std::memory_order_release);   // 转发线程据此重新选择流水线特化
+}
+
+/**
+ * @brief 打印转发统计：累计帧数/字节数、丢弃数、每帧系统调用数，以及距上次打印的吞吐率
+ */
+void TapInterface::print_stats()
+{
+    int64_t now = get_us();
+    uint64_t rx_pkts = stats.rx_packets.load(std::memory_order_relaxed);
+    uint64_t rx_bytes = stats.rx_bytes.load(std::memory_order_relaxed);
+    uint64_t tx_pkts = stats.tx_packets.load(std::memory_order_relaxed);
+    uint64_t tx_bytes = stats.tx_bytes.load(std::memory_order_relaxed);
+    uint64_t drops = stats.drops.load(std::memory_order_relaxed);
+    uint64_t syscalls = stats.syscalls.load(std::memory_order_relaxed);
+    uint64_t dups = stats.dups.load(std::memory_order_relaxed);
+    uint64_t corrupted = stats.corrupted.load(std::memory_order_relaxed);
+    uint64_t xt_bytes = stats.xt_bytes.load(std::memory_order_relaxed);
+
+    double rx_mbps = 0, tx_mbps = 0, xt_mbps = 0;
+    if(stats_last_us > 0 && now > stats_last_us)
+    {
+        rx_mbps = (rx_bytes - stats_last_rx) * 8.0 / (now - stats_last_us);
+        tx_mbps = (tx_bytes - stats_last_tx) * 8.0 / (now - stats_last_us);
+        xt_mbps = (xt_bytes - stats_last_xt) * 8.0 / (now - stats_last_us);
+    }
+    stats_last_us = now;
+    stats_last_rx = rx_bytes;
+    stats_last_tx = tx_bytes;
+    stats_last_xt = xt_bytes;
+
+    {
+        LogLine line(LL_INFO, tap_name.c_str());
+        line << "[" << tap_name << "] rx: " << rx_pkts << " pkts " << fixed << setprecision(1) << rx_mbps << " Mbps"
+             << ", tx: " << tx_pkts << " pkts " << tx_mbps << " Mbps"
+             << ", drop: " << drops;
+        if(dups > 0 || corrupted > 0)
+        {
+            line << ", dup: " << dups << ", corrupt: " << corrupted;
+        }
+        if(xt_bytes > 0)
+        {
+            line << ", xt: " << setprecision(1) << xt_mbps << " Mbps";
+        }
+        uint64_t ce_marks = stats.ce_marks.load(std::memory_order_relaxed);
+        uint64_t aqm_drops = stats.aqm_drops.load(std::memory_order_relaxed);
+        if(ce_marks > 0 || aqm_drops > 0)
+        {
+            line << ", ce: " << ce_marks << ", aqm_drop: " << aqm_drops;
+        }
+        if(capture_ring != nullptr && capture_ring->get_overruns() > 0)
+        {
+            line << ", cap_lost: " << capture_ring->get_overruns();
+        }
+        uint64_t slo_late = stats.slo_late.load(std::memory_order_relaxed);
+        if(slo_late > 0)
+        {
+            line << ", late: " << slo_late << ", shed: " << stats.shed.load(std::memory_order_relaxed);
+        }
+        if(is_overloaded())
+        {
+            line << ", OVERLOADED";
+        }
+        line << ", syscalls/pkt: " << setprecision(2)
+             << (rx_pkts + tx_pkts > 0 ? (double)syscalls / (rx_pkts + tx_pkts) : 0.0);
+        // 转发线程的缺页数（帧内存池预先缺页后，稳定运行时不应再增长）
+        line << ", pgfault: " << stats.minflt.load(std::memory_order_relaxed)
+             << "/" << stats.majflt.load(std::memory_order_relaxed);
+        if(rr != nullptr)
+        {
+            line << (rr->replaying() ? ", replay: " : ", record: ") << stats.rr_frames.load(std::memory_order_relaxed);
+            uint64_t rr_miss = stats.rr_miss.load(std::memory_order_relaxed);
+            uint64_t rr_skew = stats.rr_skew.load(std::memory_order_relaxed);
+            uint64_t rr_lost = stats.rr_lost.load(std::memory_order_relaxed);
+            uint64_t rr_evict = stats.rr_evict.load(std::memory_order_relaxed);
+            if(rr_miss > 0)
+                line << " miss " << rr_miss;
+            if(rr_evict > 0)
+                line << " evict " << rr_evict;
+            if(rr_skew > 0)
+                line << " skew " << rr_skew;
+            if(rr_lost > 0)
+                line << " lost " << rr_lost;
+        }
+        if(frame_pool.enabled())
+        {
+            line << ", pool: " << stats.pool_peak.load(std::memory_order_relaxed) << "/" << frame_pool.get_slots();
+            uint64_t pool_miss = stats.pool_miss.load(std::memory_order_relaxed);
+            if(pool_miss > 0)
+            {
+                line << " miss " << pool_miss;
+            }
+        }
+    }   // 本方向的统计行先输出，各路径段各占一行
+    for(auto& hop : hops)
+    {
+        hop->print_stats(tap_name);
+    }
+}
+
+/**
+ * @brief 出队时间误差直方图的分位数
+ * @param hist 各桶帧数
+ * @param total 总帧数（>0）
+ * @param permille 分位（千分比，如990=p99）
+ * @return int64_t 分位数所在桶的上界（微秒，桶0为0）
+ */
+static int64_t tx_late_quantile(const uint64_t *hist, uint64_t total, int permille)
+{
+    uint64_t acc = 0;
+    for(int k = 0; k < TX_LATE_BUCKETS; k++)
+    {
+        acc += hist[k];
+        if(acc * 1000 >= total * permille)
+        {
+            return k == 0 ? 0 : ((int64_t)1 << k);
+        }
+    }
+    return (int64_t)1 << (TX_LATE_BUCKETS - 1);
+}
+
+/**
+ * @brief 打印出队时间误差分布（帧实际出队时间相对计划发送时间的延后）
+ * @details 包含转发循环本身的调度抖动和发送合并窗口引入的延后，用于权衡计时精度与每帧开销
+ */
+void TapInterface::print_tx_timing()
+{
+    uint64_t hist[TX_LATE_BUCKETS];
+    uint64_t total = 0;
+    for(int k = 0; k < TX_LATE_BUCKETS; k++)
+    {
+        hist[k] = stats.tx_late[k].load(std::memory_order_relaxed);
+        total += hist[k];
+    }
+    if(total == 0)
+    {
+        return;
+    }
+    uint64_t batches = stats.tx_batches.load(std::memory_order_relaxed);
+    // 分位数按所在桶的上界报告
+    int64_t worst = 0;
+    for(int k = 0; k < TX_LATE_BUCKETS; k++)
+    {
+        if(hist[k] > 0)
+            worst = k == 0 ? 0 : ((int64_t)1 << (k == TX_LATE_BUCKETS - 1 ? k - 1 : k));
+    }
+    LogLine line(LL_INFO, tap_name.c_str());
+    line << "[" << tap_name << "] 出队时间误差(slack=" << tx_slack << "us): p50<=" << tx_late_quantile(hist, total, 500)
+         << "us, p99<=" << tx_late_quantile(hist, total, 990)
+         << "us, max" << (hist[TX_LATE_BUCKETS - 1] > 0 ? ">=" : "<=") << worst << "us"
+         << ", 每轮" << fixed << setprecision(1) << (batches > 0 ? (double)total / batches : 0.0) << "帧\n   ";
+    for(int k = 0; k < TX_LATE_BUCKETS; k++)
+    {
+        if(hist[k] == 0)
+            continue;
+        if(k == 0)
+            line << " 0us";
+        else if(k == TX_LATE_BUCKETS - 1)
+            line << " >=" << ((int64_t)1 << (k - 1)) << "us";
+        else
+            line << " " << ((int64_t)1 << (k - 1)) << "-" << ((int64_t)1 << k) << "us";
+        line << ":" << setprecision(1) << hist[k] * 100.0 / total << "%";
+    }
+}
+
+/**
+ * @brief 开启阶段剖析（须在转发线程启动前调用；perf事件组在转发线程第一次循环时打开）
+ * @param sample_every 每处理这么多帧，在一轮循环中采样一次硬件计数器（0=不开启）
+ */
+void TapInterface::set_prof(uint32_t sample_every)
+{
+    if(sample_every == 0)
+    {
+        return;
+    }
+    profiler.reset(new StageProfiler(sample_every));
+    prof = profiler.get();
+    for(auto& hop : hops)
+    {
+        hop->set_prof(prof);
+    }
+}
 
-        // 5.5 关闭桥接的STP（生成树协议，避免延迟）
-        iptables_cmd = "brctl stp " + this->br_name + " off";
-        cout << "iptables:: " << iptables_cmd << endl;
-        SYSTEM (iptables_cmd.c_str());    
-        iptables_cmd.clear();
+/**
+ * @brief 打印自上次以来本方向各阶段的每帧周期、IPC和cache miss
+ */
+void TapInterface::print_prof()
+{
+    if(prof != nullptr)
+    {
+        prof->report(tap_name, stats.rx_packets.load(std::memory_order_relaxed));
+    }
+}
 
-        // 5.6 启用桥接接口
-        iptables_cmd = "ifconfig " + this->br_name + " up";
-        cout << "iptables:: " << iptables_cmd << endl;
-        SYSTEM (iptables_cmd.c_str());    
-        iptables_cmd.clear();
+/**
+ * @brief 开启QUIC被动观测（须在转发线程启动前调用）
+ */
+void TapInterface::set_quic_obs()
+{
+    quic_obs.reset(new QuicObserver());
+    quic = quic_obs.get();
+}
 
-        // 6. 将TAP fd添加到epoll监听
-        event.events = EPOLLIN;
-        event.data.fd = fd;
-        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+/**
+ * @brief 录制/回放本方向的损伤决策（须在转发线程启动前调用）
+ * @param log 已打开的决策日志
+ * @param dir 方向（0=tap0→tap1，1=tap1→tap0）
+ * @note 只作用于本接口的链路（多跳路径的最后一跳），前面各路径段照常抽签
+ */
+void TapInterface::set_decision_log(DecisionLog *log, int dir)
+{
+    rr_track.reset(new DecisionTrack(log->get_ring(dir), log->replaying(), dir));
+    rr = rr_track.get();
+    profile_gen.fetch_add(1, std::memory_order_release);   // 切换到包含全部损伤阶段的特化
+}
+
+/**
+ * @brief 入队时决定帧的命运：录制时按当前参数抽签并写入日志，回放时取日志中同一（流, 帧序号）的决策
+ * @param data 以太网帧（开启卸载时前面是vnet头）
+ * @param size 帧大小
+ * @param delay 输出：固定的传播时延（微秒；没有决策时不改）
+ * @return uint8_t RrFate（0=没有决策，出队时照常抽签）
+ * @note 录制/回放与--offload互斥（参数解析时拒绝），不会遇到GSO超帧；流表已满时新流不录制/回放
+ */
+uint8_t TapInterface::rr_decide(const uint8_t *data, uint32_t size, int64_t *delay)
+{
+    RrRecord rec;
+    if(!rr->next(data, size, &rec))
+    {
+        stat_add(stats.rr_miss, 1);
+        return 0;
+    }
+    uint32_t version = profile_gen.load(std::memory_order_relaxed);
+    if(rr->replaying())
+    {
+        uint64_t evicted = 0;
+        bool found = rr->find(&rec, &evicted);
+        if(evicted > 0)
         {
-            cout << "Error adding tap_fd to epoll" << endl;
-            close(fd);
-            close(epoll_fd);
-            return -1;
+            stat_add(stats.rr_evict, evicted);
         }
-        
-		return fd;
-	} 
-    else 
+        if(!found)
+        {
+            stat_add(stats.rr_miss, 1);
+            return 0;
+        }
+        stat_add(stats.rr_frames, 1);
+        if(rec.version != version)
+        {
+            stat_add(stats.rr_skew, 1);
+        }
+        *delay = rec.delay_us;
+        return rec.fate;
+    }
+    uint8_t fate = RR_DECIDED;
+    if(Bloss > 0 && chance_in_a_thousand(Bloss))
+        fate |= RR_DROP;
+    if(Bcorrupt > 0 && chance_in_a_thousand(Bcorrupt))
+        fate |= RR_CORRUPT;
+    else if(Bstealth > 0 && chance_in_a_thousand(Bstealth))
+        fate |= RR_STEALTH;
+    if(Bdup > 0 && chance_in_a_thousand(Bdup))
+        fate |= RR_DUP;
+    *delay = delay_ms;
+    rec.fate = fate;
+    rec.delay_us = *delay;
+    rec.version = version;
+    stat_add(rr->record(rec) ? stats.rr_frames : stats.rr_lost, 1);
+    return fate;
+}
+
+/**
+ * @brief 打印本方向观测到的QUIC连接的自旋位RTT和丢包位（未开启时不输出）
+ */
+void TapInterface::print_quic()
+{
+    if(quic != nullptr)
+    {
+        quic->report(tap_name);
+    }
+}
+
+/**
+ * @brief 计时统计快照（运行开始时由仿真线程记录）
+ */
+SloSnapshot TapInterface::slo_snapshot() const
+{
+    SloSnapshot snap;
+    for(int k = 0; k < TX_LATE_BUCKETS; k++)
+    {
+        snap.late_hist[k] = stats.tx_late[k].load(std::memory_order_relaxed);
+    }
+    snap.slo_late = stats.slo_late.load(std::memory_order_relaxed);
+    snap.shed = stats.shed.load(std::memory_order_relaxed);
+    snap.overloads = stats.overloads.load(std::memory_order_relaxed);
+    return snap;
+}
+
+/**
+ * @brief 打印自快照以来本方向的仿真精度结论
+ * @param base 运行开始时的快照
+ * @return bool true=违反SLO的帧不超过SLO_BUDGET_PERMILLE，链路时延没有被仿真器自身的延后明显拉长
+ */
+bool TapInterface::print_slo_verdict(const SloSnapshot& base)
+{
+    SloSnapshot cur = slo_snapshot();
+    uint64_t hist[TX_LATE_BUCKETS];
+    uint64_t total = 0;
+    for(int k = 0; k < TX_LATE_BUCKETS; k++)
+    {
+        hist[k] = cur.late_hist[k] - base.late_hist[k];
+        total += hist[k];
+    }
+    uint64_t late = cur.slo_late - base.slo_late;
+    bool ok = late * 1000 <= total * SLO_BUDGET_PERMILLE;
+    LogLine line(LL_INFO, tap_name.c_str());
+    line << "[" << tap_name << "] " << (ok ? "在容差内" : "超出容差") << ": 出队延后超过"
+         << tx_slack + slo_us << "us的帧 " << late << "/" << total;
+    if(total > 0)
+    {
+        line << " (" << fixed << setprecision(2) << late * 1000.0 / total << "‰), p99<="
+             << tx_late_quantile(hist, total, 990) << "us";
+    }
+    line << ", 过载 " << cur.overloads - base.overloads << " 次";
+    if(shed_late)
+    {
+        line << ", 过载丢弃 " << cur.shed - base.shed;
+    }
+    return ok;
+}
+
+void TapInterface::set_delay_ms(int64_t delay_ms)
+{
+    this->delay_ms = delay_ms;
+}
+
+/**
+ * @brief 设置瓶颈缓冲：新帧到达时排队时延（含背景流量）已达到上限则尾部丢弃（抓包原因drop=queue_full）
+ * @param us 排队时延上限（微秒，0=不限，只受MAX_PACKET_SIZE限制）
+ */
+void TapInterface::set_buffer(int64_t us)
+{
+    this->buffer_us = us > 0 ? us : 0;
+}
+
+/**
+ * @brief 设置瓶颈队列的ECN标记方式（只在限速时生效；多跳路径中只作用于本接口自己的链路，即最后一跳）
+ * @param mode AqmMode
+ * @param thresh_us 阶跃标记阈值（排队时延，微秒）
+ * @param target_us DualQ经典队列的PI2目标排队时延（微秒）
+ */
+void TapInterface::set_aqm(int mode, int64_t thresh_us, int64_t target_us)
+{
+    this->ecn_thresh_us = thresh_us > 0 ? thresh_us : 0;
+    this->aqm_target_us = target_us > 0 ? target_us : 1;
+    this->aqm_mode = mode;
+    profile_gen.fetch_add(1, std::memory_order_release);
+}
+
+/**
+ * @brief 打印CE标记（和AQM丢弃）最多的ECN_TOP_FLOWS个流
+ */
+void TapInterface::print_ecn_flows()
+{
+    std::vector<std::pair<uint64_t, const EcnFlow *>> flows;
+    for(int i = 0; i < ECN_FLOW_SLOTS; i++)
+    {
+        const EcnFlow& f = ecn_flows[i];
+        if(f.hash.load(std::memory_order_acquire) == 0)
+            continue;
+        flows.push_back(std::make_pair(f.ce.load(std::memory_order_relaxed) +
+                                       f.aqm_drops.load(std::memory_order_relaxed), &f));
+    }
+    if(flows.empty())
+    {
+        return;
+    }
+    std::sort(flows.begin(), flows.end(),
+              [](const std::pair<uint64_t, const EcnFlow *>& a, const std::pair<uint64_t, const EcnFlow *>& b) {
+                  return a.first > b.first;
+              });
+    LogLine line(LL_INFO, tap_name.c_str());
+    line << "[" << tap_name << "] ECN: ce " << stats.ce_marks.load(std::memory_order_relaxed)
+         << ", aqm_drop " << stats.aqm_drops.load(std::memory_order_relaxed)
+         << ", L队列 " << stats.l_packets.load(std::memory_order_relaxed) << " pkts, " << flows.size() << "个流";
+    uint64_t overflow = ecn_flow_overflow.load(std::memory_order_relaxed);
+    if(overflow > 0)
+    {
+        line << "（" << overflow << "次未能按流统计）";
+    }
+    for(size_t i = 0; i < flows.size() && i < (size_t)ECN_TOP_FLOWS; i++)
+    {
+        const EcnFlow *f = flows[i].second;
+        line << "\n    " << flow_key_str(f->key) << "  ce: " << f->ce.load(std::memory_order_relaxed)
+             << ", aqm_drop: " << f->aqm_drops.load(std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief 在本方向路径末尾、本接口的链路之前加一段（须在转发线程启动前调用）
+ * @param name 段名
+ */
+void TapInterface::add_hop(const std::string& name)
+{
+    hops.emplace_back(new PathHop(this, name));
+    hops.back()->set_prof(prof);
+    if(hops.size() > 1)
+    {
+        hops[hops.size() - 2]->set_next(hops.back().get());
+    }
+}
+
+void TapInterface::set_bw(int64_t bandwidth)
+{
+    this->bandwidth = bandwidth;
+    profile_gen.fetch_add(1, std::memory_order_release);
+}
+
+void TapInterface::set_loss(int loss)
+{
+    this->Bloss = loss;
+    profile_gen.fetch_add(1, std::memory_order_release);
+}
+
+void TapInterface::request_stop()
+{
+    this->stopping = true;
+}
+
+void TapInterface::set_ingress(bool open)
+{
+    this->ingress_open = open;
+}
+
+void TapInterface::set_capture(CaptureRing *ring)
+{
+    this->capture_ring = ring;
+}
+
+void TapInterface::set_outage(int mode, int64_t period_us, int64_t len_us)
+{
+    this->outage_start_us = get_us();
+    this->outage_period_us = period_us;
+    this->outage_len_us = len_us;
+    this->outage_mode = mode;
+}
+
+/**
+ * @brief 设置出队延后SLO（须在转发线程启动前调用）
+ * @param us 在发送合并窗口之外允许的出队延后（微秒）
+ * @param shed true=违反SLO的帧直接丢弃（抓包原因drop=shed），false=照常发送，只计数
+ */
+void TapInterface::set_slo(int64_t us, bool shed)
+{
+    this->slo_us = us > 0 ? us : 0;
+    this->shed_late = shed;
+}
+
+/**
+ * @brief 设置发送合并窗口（须在转发线程启动前调用）
+ * @param us 最早到期的帧最多延后的时间（微秒，0=到期即发，保持精确计时）
+ */
+void TapInterface::set_tx_slack(int64_t us)
+{
+    this->tx_slack = us > 0 ? us : 0;
+}
+
+void TapInterface::set_cross_traffic(int model, int64_t rate, int flows, int64_t qlim_us)
+{
+    this->xt_rate = rate;
+    this->xt_flows = flows > 0 ? flows : 1;
+    this->xt_qlim_us = qlim_us;
+    this->xt_model = model;
+}
+
+void TapInterface::set_dup(int dup)
+{
+    this->Bdup = dup;
+    profile_gen.fetch_add(1, std::memory_order_release);
+}
+
+void TapInterface::set_corrupt(int corrupt)
+{
+    this->Bcorrupt = corrupt;
+    profile_gen.fetch_add(1, std::memory_order_release);
+}
+
+void TapInterface::set_stealth(int stealth)
+{
+    this->Bstealth = stealth;
+    profile_gen.fetch_add(1, std::memory_order_release);
+}
+
+// --------------- 多跳路径 ---------------
+/**
+ * @brief PathHop构造函数：参数初始为无限制，时延线带一个头节点（与TapInterface相同）
+ * @param owner 所属方向
+ * @param name 段名
+ */
+PathHop::PathHop(TapInterface *owner, const std::string& name)
+    : owner(owner), next(nullptr), name(name), delay_ms(0), bandwidth(0), pre_time(0),
+      Bloss(0), Bdup(0), Bcorrupt(0), Bstealth(0), buffer_us(0),
+      bq_head(nullptr), bq_tail(nullptr), bq_bytes(0), tx_slack(0), slo_us(INT64_MAX / 2), shed_late(false),
+      link_up_us(0), prof(nullptr), rng(std::random_device{}()), profile_gen(1), pipeline_gen(0), pipeline(nullptr)
+{
+    addNode(nullptr, 0, 0, 0, 0, 0);
+}
+
+/**
+ * @brief 释放本段中全部未交出的帧（在owner解除接收环映射之前调用）
+ */
+PathHop::~PathHop()
+{
+    while(bq_head != nullptr)
+    {
+        Node *next = bq_head->next;
+        release_node(bq_head);
+        bq_head = next;
+    }
+    while(head != nullptr)
+    {
+        Node *next = head->next;
+        release_node(head);
+        head = next;
+    }
+    tail = nullptr;
+}
+
+/**
+ * @brief 参数变化后重新选择流水线特化（与TapInterface::sync_pipeline相同，只由owner的转发线程调用）
+ */
+void PathHop::sync_pipeline()
+{
+    uint32_t gen = profile_gen.load(std::memory_order_acquire);
+    if(gen == pipeline_gen && pipeline != nullptr)
+    {
+        return;
+    }
+    pipeline_gen = gen;
+    unsigned features = 0;
+    if(bandwidth > 0)
+        features |= PF_SHAPE;
+    if(Bloss > 0)
+        features |= PF_LOSS;
+    if(Bcorrupt > 0 || Bstealth > 0)
+        features |= PF_CORRUPT;
+    if(Bdup > 0)
+        features |= PF_DUP;
+    pipeline = pipeline_select(hop_pipeline_table, features);
+    LOGD(name.c_str()) << "流水线特化: " << pipeline->name << "（features=" << features << "）";
+}
+
+/**
+ * @brief 帧到达本段：经过入队阶段后进入瓶颈队列或时延线
+ * @param node 上一段（或入口）交来的节点，链路字节数已在入口算好
+ * @param now 到达时间：入口为接收时间，其余为上一段的计划发送时间
+ * @note 超过MAX_PACKET_SIZE或瓶颈缓冲已满时尾部丢弃（drop=queue_full）
+ */
+void PathHop::accept(Node *node, int64_t now)
+{
+    sync_pipeline();
+    node->next = nullptr;
+    node->arrival = now;
+    stat_add(stats.rx_packets, 1);
+    stat_add(stats.rx_bytes, node->wire);
+    AdmitCtx c = {node->data, node->size, node->wire, now, 0, false};
+    pipeline->admit(*this, c);
+    node->sendtime = c.send_time;
+    if(NodeCount > MAX_PACKET_SIZE || (c.bottleneck && buffer_us > 0 && queue_delay(now) >= buffer_us))
+    {
+        NodeCount++;    // drop_node按已入队的节点计数
+        drop_node(node, CAP_QUEUE_FULL);
+        return;
+    }
+    if(c.bottleneck)
+    {
+        bq_push(node);
+        return;
+    }
+    tail->next = node;
+    tail = node;
+    NodeCount++;
+}
+
+/**
+ * @brief 串行化瓶颈队列并把到期的帧交给下一段
+ * @param now 本轮出队时间
+ */
+void PathHop::drain(int64_t now)
+{
+    sync_pipeline();
+    pipeline->drain(*this, now);
+}
+
+/**
+ * @brief 交给下一段：节点和缓冲区原样移交，以本段的计划发送时间作为到达时间
+ */
+void PathHop::handoff(Node *node)
+{
+    stat_add(stats.tx_packets, 1);
+    stat_add(stats.tx_bytes, node->wire);
+    NodeCount--;
+    int64_t t = node->sendtime;
+    if(next != nullptr)
+    {
+        next->accept(node, t);
+    }
+    else
+    {
+        owner->hop_arrive(node, t);
+    }
+}
+
+/**
+ * @brief 复制一个重复帧（含帧前的vnet头），复制品使用堆内存，与原帧互不影响
+ * @return Node* 新节点（计入本段，随原帧一起交出）
+ */
+ListNode::Node *PathHop::clone(const Node *node)
+{
+    uint32_t hdr = owner->vnet_hdr_len;
+    uint8_t *buf = owner->alloc_frame(hdr + node->size);
+    memcpy(buf, node->data - hdr, hdr + node->size);
+    Node *copy = new Node(buf + hdr, node->sendtime, node->sock, node->size, node->timesample, node->mac_type, -1);
+    copy->wire = node->wire;
+    NodeCount++;
+    return copy;
+}
+
+bool PathHop::chance_in_a_thousand(int chance)
+{
+    std::uniform_int_distribution<> distr(1, 1000);
+    return distr(rng) <= chance;
+}
+
+bool PathHop::corrupt(uint8_t *data, uint32_t size, bool stealth)
+{
+    struct virtio_net_hdr *vh =
+        owner->offload ? reinterpret_cast<struct virtio_net_hdr *>(data - owner->vnet_hdr_len) : nullptr;
+    if(!frame_corrupt(data, size, stealth, vh, rng))
+    {
+        return false;
+    }
+    stat_add(stats.corrupted, 1);
+    return true;
+}
+
+void PathHop::capture(const uint8_t *data, uint32_t size, int64_t timesample, int64_t sendtime, uint8_t reason)
+{
+    owner->capture(data, size, timesample, sendtime, reason);
+}
+
+void PathHop::bq_push(Node *node)
+{
+    if(bq_tail == nullptr)
+    {
+        bq_head = node;
+    }
+    else
+    {
+        bq_tail->next = node;
+    }
+    bq_tail = node;
+    bq_bytes += node->wire;
+    NodeCount++;
+}
+
+int64_t PathHop::queue_delay(int64_t now)
+{
+    int64_t bw = bandwidth;
+    if(bw <= 0)
+    {
+        return 0;
+    }
+    int64_t busy = pre_time > now ? pre_time - now : 0;
+    return busy + static_cast<int64_t>(bq_bytes * 8.0 / bw);
+}
+
+void PathHop::release_node(Node *node)
+{
+    owner->release_data(node);
+    delete node;
+    NodeCount--;
+}
+
+void PathHop::drop_node(Node *node, uint8_t reason)
+{
+    stat_add(stats.drops, 1);
+    capture(node->data, node->size, node->timesample, node->sendtime, reason);
+    release_node(node);
+}
+
+/**
+ * @brief 打印本段统计（到达/交出/丢弃/重复/损坏，以及当前排队的帧数）
+ * @param tap_name 所属方向
+ */
+void PathHop::print_stats(const std::string& tap_name)
+{
+    LogLine line(LL_INFO, name.c_str());
+    line << "  [" << tap_name << "/" << name << "] in: " << stats.rx_packets.load(std::memory_order_relaxed)
+         << ", out: " << stats.tx_packets.load(std::memory_order_relaxed)
+         << ", drop: " << stats.drops.load(std::memory_order_relaxed);
+    uint64_t dups = stats.dups.load(std::memory_order_relaxed);
+    uint64_t corrupted = stats.corrupted.load(std::memory_order_relaxed);
+    if(dups > 0 || corrupted > 0)
     {
-		return -1;
-	}
+        line << ", dup: " << dups << ", corrupt: " << corrupted;
+    }
 }
 
-void TapInterface::set_delay_ms(int64_t delay_ms)
+void PathHop::set_delay_ms(int64_t delay_us)
 {
-    this->delay_ms = delay_ms;
+    this->delay_ms = delay_us;
 }
 
-void TapInterface::set_bw(int64_t bandwidth)
+void PathHop::set_bw(int64_t bandwidth)
 {
     this->bandwidth = bandwidth;
+    profile_gen.fetch_add(1, std::memory_order_release);
 }
 
-void TapInterface::set_loss(int loss)
+void PathHop::set_loss(int loss)
 {
     this->Bloss = loss;
+    profile_gen.fetch_add(1, std::memory_order_release);
+}
+
+void PathHop::set_dup(int dup)
+{
+    this->Bdup = dup;
+    profile_gen.fetch_add(1, std::memory_order_release);
+}
+
+void PathHop::set_corrupt(int corrupt)
+{
+    this->Bcorrupt = corrupt;
+    profile_gen.fetch_add(1, std::memory_order_release);
+}
+
+void PathHop::set_stealth(int stealth)
+{
+    this->Bstealth = stealth;
+    profile_gen.fetch_add(1, std::memory_order_release);
+}
+
+void PathHop::set_buffer(int64_t us)
+{
+    this->buffer_us = us > 0 ? us : 0;
 }
 
 void printHelp() {
@@ -668,28 +7016,116 @@ void printHelp() {
     std::cout << "  --total_time=<ms>   Total simulation duration (ms), 0=interactive mode" << std::endl;
     std::cout << "  --script=<file>     Script file for network changes" << std::endl;
     std::cout << "  --demo              Run a built-in demo scenario" << std::endl;
+    std::cout << "  --model=<file>      Generate events at runtime from a Markov congestion model spec" << std::endl;
+    std::cout << "  --io=<tap|packet|uring|shm>" << std::endl;
+    std::cout << "                      I/O backend: TAP + bridge with read/write (default), AF_PACKET TPACKET_V3 rings" << std::endl;
+    std::cout << "                      bound directly to --srceth/--dsteth (no TAP, no bridge), TAP + io_uring" << std::endl;
+    std::cout << "                      with registered buffers (falls back to tap when io_uring is unavailable), or" << std::endl;
+    std::cout << "                      shared-memory endpoints (tc_shm.hh): two local processes exchange frames through" << std::endl;
+    std::cout << "                      SPSC rings in a memfd region, no kernel on the data path" << std::endl;
+    std::cout << "  --shm_sock=<path>   Unix socket where shm endpoints attach (default: /tmp/tc_quic_shm.sock);" << std::endl;
+    std::cout << "                      port 0 is the srctap side, port 1 the dsttap side; --ring_mb sizes each port's slots" << std::endl;
+    std::cout << "  --ring_mb=<value>   AF_PACKET RX ring / io_uring buffer pool size per interface in MB (default: 64)" << std::endl;
+    std::cout << "  --pool_mb=<value>   Frame pool per direction in MB, reserved at startup from 2MB huge pages (THP," << std::endl;
+    std::cout << "                      then 4K pages as fallback), pre-faulted and mlocked (default: sized from the script's" << std::endl;
+    std::cout << "                      peak bandwidth x (delay + buffer) / 64B frames with tap I/O, at most 512;" << std::endl;
+    std::cout << "                      64 when unknown; 0=off)" << std::endl;
+    std::cout << "  --numa=<node>       Bind the frame pool to this NUMA node and pin both forwarding threads to its CPUs" << std::endl;
+    std::cout << "  --offload           Enable TAP vnet header + TSO/USO/checksum offload: GSO super-frames up to 64KB" << std::endl;
+    std::cout << "                      are shaped/delayed as a whole and passed to the peer TAP still offloaded" << std::endl;
+    std::cout << "  --pcap=<file>       Capture both directions to pcapng, with per-packet comments: enqueue time," << std::endl;
+    std::cout << "                      scheduled send time, emit time and drop reason (written by a background thread)" << std::endl;
+    std::cout << "  --snaplen=<value>   Bytes kept per captured frame (default: 2048)" << std::endl;
+    std::cout << "  --pcap_rotate_mb=<value>  Start a new capture file (<file>.1, <file>.2, ...) every N MB (default: 0=off)" << std::endl;
+    std::cout << "  --tx_slack=<us>     Release slack: hold due frames until the oldest is this late, then send them" << std::endl;
+    std::cout << "                      together (e.g. 20-200); the timing error distribution is printed at the end" << std::endl;
+    std::cout << "                      (default: 0=release each frame exactly when due)" << std::endl;
+    std::cout << "  --slo_us=<us>       Release lateness SLO beyond --tx_slack (default: 1000); later frames mean the" << std::endl;
+    std::cout << "                      forwarding thread fell behind: counted, flagged as OVERLOADED, and each run" << std::endl;
+    std::cout << "                      ends with a within/outside tolerance verdict" << std::endl;
+    std::cout << "  --shed              Drop frames that miss the SLO (pcap reason drop=shed) instead of sending them late" << std::endl;
+    std::cout << "  --log=<file>        Also write the log to a file (JSON lines by default); console output is unchanged" << std::endl;
+    std::cout << "  --log_format=<json|bin>  Log file format: one JSON object per line, or binary records" << std::endl;
+    std::cout << "  --log_level=<debug|info|warn|error>  Minimum level for console and file (default: info;" << std::endl;
+    std::cout << "                      debug statements are compiled in only with -DTC_LOG_MIN_LEVEL=0)" << std::endl;
+    std::cout << "  --hop=[name:]<file> Add a path segment driven by its own scenario script (repeatable, listed from the" << std::endl;
+    std::cout << "                      srctap side); frames cross segments in memory before the main script's link" << std::endl;
+    std::cout << "  --prof=<N>          Per-stage profiling (poll/read/pace/enqueue/scan/loss/write): TSC cycles per packet," << std::endl;
+    std::cout << "                      plus IPC and cache misses from perf_event_open group reads every N packets" << std::endl;
+    std::cout << "  --quic_obs          Passively observe QUIC connections on egress: spin-bit RTT and, when negotiated," << std::endl;
+    std::cout << "                      Q/L loss bits, reported per connection (top " << QUIC_TOP_FLOWS << " by packets)" << std::endl;
+    std::cout << "  --record=<file>     Record every impairment decision on the last-hop link (drop/corrupt/dup, one-way" << std::endl;
+    std::cout << "                      delay, scenario profile version) per flow and per-flow packet index to a binary log" << std::endl;
+    std::cout << "  --replay=<file>     Apply the decisions from a --record log to this run's packets instead of drawing them;" << std::endl;
+    std::cout << "                      flows are matched by order of first appearance, queueing stays live" << std::endl;
+    std::cout << "                      (--record/--replay cannot be combined with --offload)" << std::endl;
+    std::cout << "  --clock=<monotonic|tsc>  Clock for all timing: CLOCK_MONOTONIC (default, immune to NTP steps) or" << std::endl;
+    std::cout << "                      calibrated invariant TSC (a few ns per read; falls back to monotonic if absent)" << std::endl;
+    std::cout << "  --bench             Run the checksum kernel / corruption fix-up / pipeline / clock micro benchmarks and exit" << std::endl;
+    std::cout << "  --daemon=<socket>   Stay resident: keep TAPs, bridges, threads and buffers alive and take scenarios" << std::endl;
+    std::cout << "                      over a unix socket (LOAD/MODEL/SCRIPT, START [ms] [at=|in=], STOP, DRAIN," << std::endl;
+    std::cout << "                      STATUS, SHUTDOWN; one reply line per command)" << std::endl;
     std::cout << "  -h, --help          Display this help message" << std::endl;
     std::cout << "\nInteractive mode commands (when total_time=0):" << std::endl;
     std::cout << "  b <value>  Set bandwidth (bps)" << std::endl;
     std::cout << "  r <value>  Set RTT (ms)" << std::endl;
     std::cout << "  l <value>  Set loss rate (‰)" << std::endl;
+    std::cout << "  d <value>  Set duplication rate (‰)" << std::endl;
+    std::cout << "  c <value>  Set bit corruption rate (‰), caught by the receiver's UDP/TCP checksum" << std::endl;
+    std::cout << "  x <value>  Set stealth corruption rate (‰), checksums fixed up so only QUIC AEAD can catch it" << std::endl;
+    std::cout << "  o <value>  Link outage: 0=restore, 1=down and flush queue, 2=down and hold queue" << std::endl;
     std::cout << "  q          Quit interactive mode" << std::endl;
 }
 
 /**
  * @brief 线程函数：循环读取并发送数据包
  * @param tap TapInterface对象指针
- * @details 无限循环：读取数据包 → 发送超时数据包
+ * @details 循环：读取数据包 → 发送超时数据包，直到request_stop
  */
 void thread_function(TapInterface *tap)
 {
-    while(true)
+    Logger::set_nonblocking();  // 转发线程不等待日志输出
+    while(!tap->stop_requested())
     {
         tap->tap_read();
         tap->tap_write();
     }
 }
 
+/**
+ * @brief 把转发线程绑定到NUMA节点的CPU上（与帧内存池同一节点）
+ * @param t 线程
+ * @param node NUMA节点（CPU列表取自/sys/devices/system/node/nodeN/cpulist，如"0-3,8-11"）
+ */
+static void pin_to_numa_node(std::thread &t, int node)
+{
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    string list;
+    if(!std::getline(in, list))
+    {
+        LOGW("main") << "numa node " << node << " not found, threads not pinned";
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    std::istringstream ranges(list);
+    string range;
+    while(std::getline(ranges, range, ','))
+    {
+        int lo = 0, hi = 0;
+        int n = sscanf(range.c_str(), "%d-%d", &lo, &hi);
+        for(int cpu = lo; n > 0 && cpu <= (n == 2 ? hi : lo) && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    int ret = pthread_setaffinity_np(t.native_handle(), sizeof(set), &set);
+    if(ret != 0)
+    {
+        LOGW("main") << "pin thread to numa node " << node << " failed: " << strerror(ret);
+    }
+}
+
 /**
  * @brief 解析输入字符串为整数（已注释：未实际使用）
  * @param line 输入字符串
@@ -760,6 +7196,324 @@ void createDemoScenario(NetworkSimulator& simulator, int64_t total_duration_ms)
     cout << "已创建演示脚本，包含10个网络事件" << endl;
 }
 
+// --------------- 微基准 ---------------
+/**
+ * @brief 构造一个IPv4/UDP以太网帧（校验和已填好），用于基准测试
+ */
+static void bench_build_udp(std::vector<uint8_t>& frame, uint32_t size)
+{
+    frame.assign(size, 0);
+    for(uint32_t i = 42; i < size; i++)
+    {
+        frame[i] = static_cast<uint8_t>(i * 131 + 7);
+    }
+    uint8_t *ip = frame.data() + 14;
+    uint8_t *udp = ip + 20;
+    frame[12] = 0x08;
+    ip[0] = 0x45;
+    ip[2] = (size - 14) >> 8;
+    ip[3] = (size - 14) & 0xff;
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    ip[12] = 10; ip[15] = 1;
+    ip[16] = 10; ip[19] = 2;
+    uint16_t check = csum_fold(csum_add(0, ip, 20));
+    ip[10] = check >> 8;
+    ip[11] = check & 0xff;
+    udp[1] = 0x35;
+    udp[3] = 0x35;
+    udp[4] = (size - 34) >> 8;
+    udp[5] = (size - 34) & 0xff;
+    l4_checksum_fill(frame.data(), size);
+}
+
+/**
+ * @brief 基准测试用的模拟链路：与TapInterface同名的参数和接口，发送只累加到计数器
+ * @note 流水线阶段以模板参数访问链路，基准测试与转发线程编译的是同一份阶段代码
+ */
+struct BenchLink : public ListNode {
+    bool offload = false;
+    uint32_t vnet_hdr_len = 0;
+    int64_t bandwidth = 0;
+    int64_t pre_time = 0;
+    int64_t delay_ms = 0;
+    Node *bq_head = nullptr, *bq_tail = nullptr;
+    uint64_t bq_bytes = 0;
+    Node *lq_head = nullptr;
+    StageProfiler *prof = nullptr;
+    QuicObserver *quic = nullptr;
+    int64_t tx_slack = 0;
+    int64_t slo_us = INT64_MAX / 2;
+    bool shed_late = false;
+    int64_t link_up_us = 0;
+    int Bloss = 0, Bdup = 0, Bcorrupt = 0, Bstealth = 0;
+    TapStats stats;
+    std::mt19937 rng{12345};
+    uint64_t sink = 0;
+
+    ~BenchLink()
+    {
+        while(head != nullptr)  // 头节点及残留节点
+        {
+            Node *next = head->next;
+            release_node(head);
+            head = next;
+        }
+    }
+
+    bool chance_in_a_thousand(int chance)
+    {
+        std::uniform_int_distribution<> distr(1, 1000);
+        return distr(rng) <= chance;
+    }
+    uint32_t wire_size(const uint8_t *, uint32_t size) { return size; }
+    void emit_gso(Node *node) { emit(node->data, node->size, node->block); }
+    bool corrupt(uint8_t *, uint32_t, bool) { return false; }
+    void capture(const uint8_t *, uint32_t, int64_t, int64_t, uint8_t) {}
+    bool emit(const uint8_t *data, uint32_t size, int32_t)
+    {
+        sink += data[size - 1];
+        stat_add(stats.tx_packets, 1);
+        return true;
+    }
+    void release_node(Node *node)
+    {
+        delete node;    // 帧数据由基准测试持有
+        NodeCount--;
+    }
+    void drop_node(Node *node, uint8_t) { release_node(node); }
+    void slo_update(int64_t, uint64_t) {}
+    Node *aqm_pop(bool& from_l)
+    {
+        from_l = false;
+        return fifo_pop(bq_head, bq_tail, bq_bytes);
+    }
+    bool aqm_dequeue(Node *, bool, int64_t) { return true; }
+    void aqm_update(int64_t) {}
+    void bq_push(Node *node)
+    {
+        if(bq_tail == nullptr)
+            bq_head = node;
+        else
+            bq_tail->next = node;
+        bq_tail = node;
+        bq_bytes += node->wire;
+        NodeCount++;
+    }
+};
+
+/**
+ * @brief 用一个流水线特化转发一批帧：入队（计算发送时间 + 加入链表）后全部出队
+ * @return double 每帧耗时（纳秒）
+ * @note 与转发线程一样经函数指针调用，区别只在特化中保留了哪些阶段
+ */
+template<class P> static double bench_pipeline(BenchLink& link, std::vector<uint8_t>& frame, uint32_t frames)
+{
+    void (*admit)(BenchLink&, AdmitCtx&) = &P::template admit<BenchLink>;
+    void (*drain)(BenchLink&, int64_t) = &P::template drain<BenchLink>;
+    const uint32_t batch = 32;
+    int64_t now = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < frames; i += batch)
+    {
+        for(uint32_t j = 0; j < batch; j++)
+        {
+            AdmitCtx c = {frame.data(), (uint32_t)frame.size(), (uint32_t)frame.size(), now, 0, false};
+            admit(link, c);
+            if(c.bottleneck)
+            {
+                link.bq_push(new ListNode::Node(frame.data(), c.send_time, 0, c.size, now, 0x0800));
+            }
+            else
+            {
+                link.addNode(frame.data(), c.send_time, 0, c.size, now, 0x0800);
+            }
+        }
+        now += 1000000;
+        link.pre_time = 0;
+        drain(link, INT64_MAX);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1e9 / frames;
+}
+
+/**
+ * @brief 一个时钟源每次读取的耗时
+ * @return double 纳秒/次
+ */
+static double bench_clock_read(int64_t (*read)())
+{
+    const uint32_t iters = 1u << 22;
+    uint64_t sink = 0;     // 无符号累加：时间戳之和会溢出int64_t
+    auto t0 = std::chrono::steady_clock::now();
+    for(uint32_t i = 0; i < iters; i++)
+    {
+        sink += (uint64_t)read();
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    volatile uint64_t keep = sink;
+    (void)keep;
+    return sec * 1e9 / iters;
+}
+
+/**
+ * @brief 时钟基准：旧的high_resolution_clock（墙上时间）、CLOCK_MONOTONIC、TSC的读取耗时，
+ *        以及TSC在200ms内相对CLOCK_MONOTONIC的最大偏差
+ */
+static void bench_clocks()
+{
+    int64_t (*wall)() = []() -> int64_t {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+    };
+    cout << "  clock      wall: " << fixed << setprecision(1) << bench_clock_read(wall) << " ns/次（原get_us，受NTP跳变影响）" << endl;
+    cout << "  clock monotonic: " << bench_clock_read(Clock::mono_us) << " ns/次" << endl;
+    if(!Clock::select(CLK_TSC))
+    {
+        cout << "  clock       tsc: 不可用（没有invariant TSC）" << endl;
+        return;
+    }
+    double read_ns = bench_clock_read(Clock::now_us);
+    // 每次比较用前后两次monotonic读数夹住TSC读数，间隔过大（被调度出去）的样本丢弃
+    auto sample = [](int64_t *c, int64_t *m) {
+        int64_t a = Clock::mono_us();
+        *c = Clock::now_us();
+        int64_t b = Clock::mono_us();
+        *m = (a + b) / 2;
+        return b - a <= 2;
+    };
+    int64_t c0 = 0, m0 = 0, c = 0, m = 0;
+    while(!sample(&c0, &m0))
+    {
+    }
+    int64_t worst = 0, dc = 0, dm = 0;
+    for(int i = 0; i < 200; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if(sample(&c, &m))
+        {
+            dc = c - c0;
+            dm = m - m0;
+            worst = std::max(worst, std::abs(dc - dm));
+        }
+    }
+    cout << "  clock       tsc: " << read_ns << " ns/次（" << setprecision(3) << Clock::tsc_ghz()
+         << " GHz），200ms内相对monotonic最大偏差 " << worst << " us，漂移 "
+         << setprecision(1) << (dm > 0 ? (dc - dm) * 1e6 / dm : 0.0) << " ppm" << endl;
+    Clock::select(CLK_MONOTONIC);
+}
+
+/**
+ * @brief 微基准：各反码和内核的吞吐（1500B/64KB）、隐蔽损坏修正（翻转 + 重新计算UDP校验和）的耗时，
+ *        转发流水线各特化与通用版本的每帧耗时，以及各时钟源的读取耗时和精度
+ * @return int 0=成功，1=内核结果与标量不一致
+ * @note 不创建TapInterface（其构造函数会执行brctl命令），可在任何机器上运行
+ */
+int runBenchmarks()
+{
+    struct Kernel { const char *name; CsumKernel fn; bool usable; };
+    std::vector<Kernel> kernels;
+    kernels.push_back({"scalar", csum_scalar, true});
+#if defined(__x86_64__) || defined(__i386__)
+    kernels.push_back({"sse2", csum_sse2, __builtin_cpu_supports("sse2") != 0});
+    kernels.push_back({"avx2", csum_avx2, __builtin_cpu_supports("avx2") != 0});
+#endif
+    const char *selected = nullptr;
+    csum_select(&selected);
+    cout << "校验和内核: " << selected << endl;
+
+    int ret = 0;
+    const uint32_t sizes[] = {1500, 65536};
+    std::vector<uint8_t> buf(65536 + 1);
+    for(size_t i = 0; i < buf.size(); i++)
+    {
+        buf[i] = static_cast<uint8_t>(i * 2654435761u >> 24);
+    }
+    for(uint32_t size : sizes)
+    {
+        uint32_t iters = (1u << 30) / size;  // 每个内核处理约1GB数据
+        uint32_t expect = csum_scalar(buf.data() + 1, size);
+        for(const Kernel& k : kernels)
+        {
+            if(!k.usable)
+            {
+                continue;
+            }
+            if(k.fn(buf.data() + 1, size) != expect || k.fn(buf.data(), size - 1) != csum_scalar(buf.data(), size - 1))
+            {
+                cerr << "  " << k.name << " 结果与标量不一致" << endl;
+                ret = 1;
+            }
+            volatile uint32_t sink = 0;
+            auto t0 = std::chrono::steady_clock::now();
+            for(uint32_t i = 0; i < iters; i++)
+            {
+                sink = sink + k.fn(buf.data() + (i & 1), size);
+            }
+            double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            cout << "  csum " << setw(6) << k.name << " " << setw(5) << size << "B: "
+                 << fixed << setprecision(2) << (double)iters * size / sec / 1e9 << " GB/s, "
+                 << setprecision(1) << sec * 1e9 / iters << " ns/次" << endl;
+        }
+    }
+
+    std::mt19937 rng(12345);
+    for(uint32_t size : sizes)
+    {
+        uint32_t frame_size = size < 65535 ? size : 65535;
+        std::vector<uint8_t> frame;
+        bench_build_udp(frame, frame_size);
+        uint32_t iters = (1u << 28) / frame_size;
+        auto t0 = std::chrono::steady_clock::now();
+        for(uint32_t i = 0; i < iters; i++)
+        {
+            frame_corrupt(frame.data(), frame_size, true, nullptr, rng);
+        }
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+        // 修正后的校验和必须仍然正确：对整个UDP报文（含伪首部）求和应为0
+        uint8_t *ip = frame.data() + 14;
+        uint32_t sum = csum_add(0, ip + 12, 8) + IPPROTO_UDP + (frame_size - 34);
+        if(csum_fold(csum_add(sum, ip + 20, frame_size - 34)) != 0)
+        {
+            cerr << "  隐蔽损坏后UDP校验和错误" << endl;
+            ret = 1;
+        }
+        cout << "  stealth fix-up " << setw(5) << frame_size << "B: "
+             << fixed << setprecision(1) << sec * 1e9 / iters << " ns/帧" << endl;
+    }
+
+    // 同一损伤配置下，去掉无关阶段的特化与通用特化（全部阶段在运行时判断）对比
+    struct Profile { const char *name; int64_t bandwidth; int loss; double (*spec)(BenchLink&, std::vector<uint8_t>&, uint32_t); };
+    const Profile profiles[] = {
+        {"delay", 0, 0, bench_pipeline<PipeDelay>},
+        {"shape", 100000, 0, bench_pipeline<PipeShape>},
+        {"shape+loss", 100000, 10, bench_pipeline<PipeShapeLoss>},
+    };
+    std::vector<uint8_t> frame;
+    bench_build_udp(frame, 1500);
+    const uint32_t frames = 1u << 21;
+    for(const Profile& p : profiles)
+    {
+        BenchLink link;
+        link.addNode(nullptr, 0, 0, 0, 0, 0);   // 头节点（与转发线程相同）
+        link.bandwidth = p.bandwidth;
+        link.delay_ms = 50000;
+        link.Bloss = p.loss;
+        p.spec(link, frame, frames / 8);        // 预热
+        double spec_ns = 1e9, generic_ns = 1e9;
+        for(int r = 0; r < 5; r++)              // 交替运行取最小值，减少调度噪声
+        {
+            spec_ns = std::min(spec_ns, p.spec(link, frame, frames));
+            generic_ns = std::min(generic_ns, bench_pipeline<PipeGeneric>(link, frame, frames));
+        }
+        cout << "  pipeline " << setw(10) << p.name << ": 特化 " << fixed << setprecision(1) << spec_ns
+             << " ns/帧, 通用 " << generic_ns << " ns/帧" << endl;
+    }
+
+    bench_clocks();
+    return ret;
+}
+
 // --------------- 主函数 ---------------
 /**
  * @brief 程序入口函数
@@ -776,7 +7530,30 @@ int main(int argc, char **argv)
     int delay_ms = 0;
     int64_t total_time_ms = 0;
     string script_file;
+    string model_file;
     bool demo_mode = false;
+    IoMode io_mode = IO_TAP;
+    int ring_mb = 64;
+    bool offload = false;
+    string pcap_file;
+    int snaplen = 2048;
+    int pcap_rotate_mb = 0;
+    string daemon_sock;
+    int64_t tx_slack_us = 0;
+    int64_t slo_us = 1000;
+    bool shed = false;
+    string log_file;
+    bool log_binary = false;
+    LogLevel log_level = LL_INFO;
+    ClockSource clock_source = CLK_MONOTONIC;
+    std::vector<string> hop_specs;  // 多跳路径各段（[段名:]脚本文件，按tap0→tap1的顺序）
+    int prof_every = 0;             // 阶段剖析：每多少帧采样一轮硬件计数器（0=不开启）
+    bool quic_obs = false;          // QUIC被动观测（自旋位RTT、Q/L丢包位）
+    string shm_sock = "/tmp/tc_quic_shm.sock"; // 共享内存端点的接入套接字（--io=shm）
+    int pool_mb = -1;               // 每个方向的帧内存池（MB，-1=按场景估算，0=不开启）
+    int numa_node = -1;             // 帧内存池与转发线程所在的NUMA节点（-1=不绑定）
+    string record_file;             // 录制损伤决策
+    string replay_file;             // 回放损伤决策
     
     // 长命令行参数定义（getopt_long使用）
     struct option long_option[] = 
@@ -790,13 +7567,37 @@ int main(int argc, char **argv)
         {"delay_ms",  required_argument, nullptr, 'g'},
         {"total_time",required_argument, nullptr, 't'},
         {"script",    required_argument, nullptr, 's'},
+        {"model",     required_argument, nullptr, 'M'},
         {"demo",      no_argument,       nullptr, 'm'},
+        {"io",        required_argument, nullptr, 'i'},
+        {"ring_mb",   required_argument, nullptr, 'r'},
+        {"offload",   no_argument,       nullptr, 'o'},
+        {"bench",     no_argument,       nullptr, 'B'},
+        {"pcap",      required_argument, nullptr, 'p'},
+        {"snaplen",   required_argument, nullptr, 'n'},
+        {"pcap_rotate_mb", required_argument, nullptr, 'R'},
+        {"daemon",    required_argument, nullptr, 'D'},
+        {"tx_slack",  required_argument, nullptr, 'S'},
+        {"slo_us",    required_argument, nullptr, 'U'},
+        {"shed",      no_argument,       nullptr, 'X'},
+        {"log",       required_argument, nullptr, 'L'},
+        {"log_format",required_argument, nullptr, 'F'},
+        {"log_level", required_argument, nullptr, 'V'},
+        {"clock",     required_argument, nullptr, 'K'},
+        {"hop",       required_argument, nullptr, 'H'},
+        {"prof",      required_argument, nullptr, 'P'},
+        {"quic_obs",  no_argument,       nullptr, 'Q'},
+        {"shm_sock",  required_argument, nullptr, 'E'},
+        {"pool_mb",   required_argument, nullptr, 'W'},
+        {"numa",      required_argument, nullptr, 'N'},
+        {"record",    required_argument, nullptr, 'A'},
+        {"replay",    required_argument, nullptr, 'Y'},
         {"help",      no_argument,       nullptr, 'h'},
         {nullptr,     0,                 nullptr, 0}
     };
 
     // 解析命令行参数
-    while((opt = getopt_long(argc, argv, "a:b:c:d:e:f:g:t:s:mh", long_option, nullptr)) != -1) 
+    while((opt = getopt_long(argc, argv, "a:b:c:d:e:f:g:t:s:M:mi:r:oBp:n:R:D:S:U:XL:F:V:K:H:P:QE:W:N:A:Y:h", long_option, nullptr)) != -1) 
     {
         switch(opt) 
         {
@@ -827,9 +7628,139 @@ int main(int argc, char **argv)
             case 's':
                 script_file = optarg;
                 break;
+            case 'M':
+                model_file = optarg;
+                break;
             case 'm':
                 demo_mode = true;
                 break;
+            case 'i':
+                if(string(optarg) == "packet")
+                    io_mode = IO_PACKET;
+                else if(string(optarg) == "uring")
+                    io_mode = IO_URING;
+                else if(string(optarg) == "tap")
+                    io_mode = IO_TAP;
+                else if(string(optarg) == "shm")
+                    io_mode = IO_SHM;
+                else
+                {
+                    cerr << "未知的I/O后端: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'r':
+                ring_mb = atoi(optarg);
+                break;
+            case 'o':
+                offload = true;
+                break;
+            case 'B':
+                return runBenchmarks();
+            case 'p':
+                pcap_file = optarg;
+                break;
+            case 'n':
+                snaplen = atoi(optarg);
+                break;
+            case 'R':
+                pcap_rotate_mb = atoi(optarg);
+                break;
+            case 'D':
+                daemon_sock = optarg;
+                break;
+            case 'S':
+                tx_slack_us = atoll(optarg);
+                if(tx_slack_us < 0)
+                {
+                    cerr << "发送合并窗口不能为负: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'U':
+                slo_us = atoll(optarg);
+                if(slo_us <= 0)
+                {
+                    cerr << "SLO必须大于0: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'X':
+                shed = true;
+                break;
+            case 'L':
+                log_file = optarg;
+                break;
+            case 'F':
+                if(string(optarg) == "bin")
+                    log_binary = true;
+                else if(string(optarg) == "json")
+                    log_binary = false;
+                else
+                {
+                    cerr << "未知的日志格式: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'V':
+            {
+                const char *names[] = {"debug", "info", "warn", "error"};
+                int i = 0;
+                while(i < 4 && string(optarg) != names[i])
+                    i++;
+                if(i == 4)
+                {
+                    cerr << "未知的日志等级: " << optarg << endl;
+                    return 1;
+                }
+                log_level = static_cast<LogLevel>(i);
+                break;
+            }
+            case 'K':
+                if(string(optarg) == "tsc")
+                    clock_source = CLK_TSC;
+                else if(string(optarg) == "monotonic")
+                    clock_source = CLK_MONOTONIC;
+                else
+                {
+                    cerr << "未知的时钟源: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'H':
+                hop_specs.push_back(optarg);
+                break;
+            case 'P':
+                prof_every = atoi(optarg);
+                break;
+            case 'Q':
+                quic_obs = true;
+                break;
+            case 'E':
+                shm_sock = optarg;
+                break;
+            case 'W':
+                pool_mb = atoi(optarg);
+                if(pool_mb < 0)
+                {
+                    cerr << "帧内存池大小不能为负: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'N':
+                numa_node = atoi(optarg);
+                if(numa_node < 0)
+                {
+                    cerr << "NUMA节点不能为负: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'A':
+                record_file = optarg;
+                break;
+            case 'Y':
+                replay_file = optarg;
+                break;
             case 'h':
                 printHelp();
                 return 0;
@@ -838,11 +7769,73 @@ int main(int argc, char **argv)
         }
     }
 
+    if (!record_file.empty() && !replay_file.empty()) {
+        cerr << "--record与--replay不能同时使用" << endl;
+        return 1;
+    }
+    if ((!record_file.empty() || !replay_file.empty()) && offload) {
+        // 超帧的分段方式取决于发送端每次的批量，两次运行中同一流的超帧边界不同，逐帧决策无法对齐
+        cerr << "--record/--replay不能与--offload同时使用：GSO超帧的边界在两次运行中不同，决策无法逐帧回放" << endl;
+        return 1;
+    }
+
+    // 时钟源须在任何线程读取时钟之前选定
+    if (!Clock::select(clock_source)) {
+        cout << "没有invariant TSC，时钟源使用CLOCK_MONOTONIC" << endl;
+    } else if (clock_source == CLK_TSC) {
+        cout << "时钟源: TSC（" << fixed << setprecision(3) << Clock::tsc_ghz() << " GHz）" << endl;
+    }
+
+    // 仿真/脚本/转发线程的日志由后台线程输出，main返回后Logger析构时写完剩余日志
+    if (!Logger::instance().start(log_level, log_file, log_binary)) {
+        return 1;
+    }
+
     // --------------- 初始化TAP接口 ---------------
     cout << "初始化TAP接口..." << endl;
+    ShmRegion shm_region;   // 先于两个接口构造：接口析构时释放的节点仍引用共享区中的帧槽
+    PcapWriter pcap;        // 同上：接口析构时释放的节点经过发送阶段，仍会写抓包环
+    DecisionLog rr_log;     // 同上：接口持有两个方向的决策环
     TapInterface tap0(srctap.c_str(), srcbr.c_str(), srceth.c_str(), 0, 100);
     TapInterface tap1(dsttap.c_str(), dstbr.c_str(), dsteth.c_str(), 100, 0);
+    tap0.set_io_mode(io_mode);
+    tap1.set_io_mode(io_mode);
+    tap0.set_ring_mb(ring_mb);
+    tap1.set_ring_mb(ring_mb);
+    tap0.set_offload(offload);
+    tap1.set_offload(offload);
+    tap0.set_tx_slack(tx_slack_us);
+    tap1.set_tx_slack(tx_slack_us);
+    tap0.set_slo(slo_us, shed);
+    tap1.set_slo(slo_us, shed);
+    if (prof_every > 0) {
+        tap0.set_prof(prof_every);
+        tap1.set_prof(prof_every);
+    }
+    if (quic_obs) {
+        tap0.set_quic_obs();
+        tap1.set_quic_obs();
+    }
+
+    // 多跳路径：各段按tap0→tap1的顺序给出，tap1→tap0方向按相反顺序经过；两个方向的最后一跳都是主脚本控制的链路
+    std::vector<string> hop_scripts;
+    for (size_t i = 0; i < hop_specs.size(); i++) {
+        size_t colon = hop_specs[i].find(':');
+        string name = colon == string::npos ? "hop" + std::to_string(i + 1) : hop_specs[i].substr(0, colon);
+        hop_scripts.push_back(colon == string::npos ? hop_specs[i] : hop_specs[i].substr(colon + 1));
+        tap0.add_hop(name);
+    }
+    for (size_t i = hop_specs.size(); i-- > 0;) {
+        tap1.add_hop(tap0.get_hop(i)->get_name());
+    }
     
+    if (io_mode == IO_SHM) {
+        if (!shm_region.create(shm_sock, ((uint32_t)ring_mb << 20) / SHM_SLOT_SIZE)) {
+            return 1;
+        }
+        tap0.set_shm(&shm_region, 0);
+        tap1.set_shm(&shm_region, 1);
+    }
     if (tap0.tap_open() < 0 || tap1.tap_open() < 0) {
         cerr << "无法打开TAP接口，请检查权限" << endl;
         return 1;
@@ -850,66 +7843,185 @@ int main(int argc, char **argv)
     
     tap0.set_dstap(tap1.get_tap());
     tap1.set_dstap(tap0.get_tap());
+    tap0.set_peer(&tap1);
+    tap1.set_peer(&tap0);
+
+    // 抓包：接口0为tap0收到、发往tap1的方向，接口1为反方向
+    if (!pcap_file.empty()) {
+        if (snaplen < 64 || snaplen > MAX_GSO_FRAME_SIZE) {
+            snaplen = snaplen < 64 ? 64 : MAX_GSO_FRAME_SIZE;
+        }
+        std::vector<std::string> if_names = {tap0.get_tap_name() + "->" + tap1.get_tap_name(),
+                                             tap1.get_tap_name() + "->" + tap0.get_tap_name()};
+        if (!pcap.open(pcap_file, snaplen, pcap_rotate_mb, if_names)) {
+            return 1;
+        }
+        tap0.set_capture(pcap.get_ring(0));
+        tap1.set_capture(pcap.get_ring(1));
+    }
+
+    // 损伤决策录制/回放：读写盘在后台线程，转发线程只访问两个方向的环
+    if (!record_file.empty() || !replay_file.empty()) {
+        if (!rr_log.open(replay_file.empty() ? record_file : replay_file, !replay_file.empty())) {
+            return 1;
+        }
+        tap0.set_decision_log(&rr_log, 0);
+        tap1.set_decision_log(&rr_log, 1);
+    }
 
     // 初始化链表
     tap0.addNode(nullptr, tap0.get_us(), tap1.get_tap(), 1522, tap0.get_us(), 0);
     tap1.addNode(nullptr, tap1.get_us(), tap0.get_tap(), 1522, tap1.get_us(), 0);
 
-    // --------------- 创建工作线程 ---------------
-    cout << "启动数据包处理线程..." << endl;
-    thread t1(thread_function, &tap0);
-    thread t2(thread_function, &tap1);
-    
-    // 给线程一点时间启动
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    // 各路径段的场景：单次运行时与主脚本在同一时刻开始、总时长相同；守护进程/交互模式下启动后立即运行一遍
+    std::vector<std::unique_ptr<NetworkSimulator>> hop_sims;
+    for (size_t i = 0; i < hop_scripts.size(); i++) {
+        std::unique_ptr<NetworkSimulator> sim(new NetworkSimulator(&tap0, &tap1, true, i));
+        if (!loadScriptFromFile(hop_scripts[i], *sim)) {
+            LOGE("main") << "路径段 " << tap0.get_hop(i)->get_name() << " 的脚本加载失败";
+            return 1;
+        }
+        sim->setTotalDuration(total_time_ms > 0 ? total_time_ms : sim->getScriptEnd());
+        hop_sims.push_back(std::move(sim));
+    }
 
-    if (total_time_ms > 0) {
-        // --------------- 脚本仿真模式 ---------------
-        NetworkSimulator simulator(&tap0, &tap1);
-        simulator.setTotalDuration(total_time_ms);
+    // 主脚本在启动转发线程前加载，帧内存池按场景的在途字节数预留
+    std::unique_ptr<NetworkSimulator> simulator;
+    if (daemon_sock.empty() && total_time_ms > 0) {
+        simulator.reset(new NetworkSimulator(&tap0, &tap1));
+        simulator->setTotalDuration(total_time_ms);
         
         if (demo_mode) {
             // 使用内置演示脚本
-            createDemoScenario(simulator, total_time_ms);
+            createDemoScenario(*simulator, total_time_ms);
+        } else if (!model_file.empty()) {
+            // 运行时由马尔可夫模型逐步生成事件
+            std::unique_ptr<ScenarioModel> model(new ScenarioModel());
+            if (model->loadFromFile(model_file)) {
+                simulator->setModel(std::move(model));
+            } else {
+                LOGW("main") << "模型加载失败，使用交互模式";
+                simulator.reset(); // 回退到交互模式
+            }
         } else if (!script_file.empty()) {
             // 从文件加载脚本
-            if (!loadScriptFromFile(script_file, simulator)) {
-                cerr << "脚本加载失败，使用交互模式" << endl;
-                total_time_ms = 0; // 回退到交互模式
+            if (!loadScriptFromFile(script_file, *simulator)) {
+                LOGW("main") << "脚本加载失败，使用交互模式";
+                simulator.reset(); // 回退到交互模式
             }
         } else {
             // 创建简单测试脚本
-            cout << "使用简单测试脚本..." << endl;
+            LOGI("main") << "使用简单测试脚本...";
             // 简单脚本：正常 -> 拥塞 -> 恢复
-            simulator.addEvent(0,      10000,  100, 50,  0,   "正常网络");
-            simulator.addEvent(10000,  10000,  20,  200, 50,  "网络拥塞");
-            simulator.addEvent(20000,  10000,  100, 50,  0,   "恢复网络");
+            simulator->addEvent(0,      10000,  100, 50,  0,   "正常网络");
+            simulator->addEvent(10000,  10000,  20,  200, 50,  "网络拥塞");
+            simulator->addEvent(20000,  10000,  100, 50,  0,   "恢复网络");
         }
-        
-        if (total_time_ms > 0) {
-            cout << "\n开始网络仿真，总时长: " << total_time_ms / 1000 << " s" << endl;
-            simulator.start();
-            
-            // 等待仿真结束
-            while (simulator.isRunning()) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    // --------------- 帧内存池 ---------------
+    // TAP后端每帧都要分配缓冲；其他后端的帧在预先映射的环中，只有路径段的重复帧用到，须用--pool_mb显式开启
+    size_t pool_bytes = 0;
+    if (pool_mb > 0) {
+        pool_bytes = (size_t)pool_mb << 20;
+    } else if (pool_mb < 0 && io_mode == IO_TAP) {
+        int64_t inflight = simulator ? simulator->getPeakInflight() : -1;
+        for (auto& sim : hop_sims) {
+            int64_t hop_inflight = sim->getPeakInflight();
+            inflight = inflight < 0 || hop_inflight < 0 ? -1 : inflight + hop_inflight;
+        }
+        if (inflight < 0) {
+            pool_bytes = (size_t)POOL_DEFAULT_MB << 20;
+        } else {
+            // 每帧不论大小占一个帧槽：按最小帧折算在途帧数（小帧/纯ACK流量时帧数最多）
+            size_t slots = std::max((size_t)inflight / POOL_MIN_FRAME, (size_t)POOL_MIN_SLOTS);
+            pool_bytes = slots * POOL_SLOT_SIZE;
+            if (pool_bytes > (size_t)POOL_MAX_MB << 20) {
+                pool_bytes = (size_t)POOL_MAX_MB << 20;
+                LOGW("main") << "按最小帧估算每个方向需要 " << slots << " 个帧槽，内存池限制为 " << POOL_MAX_MB
+                             << "MB（" << pool_bytes / POOL_SLOT_SIZE << " 个），超出时改用堆内存；可用--pool_mb指定";
             }
-            
-            cout << "仿真结束，等待线程退出..." << endl;
-            // 等待工作线程结束
-            t1.join();
-            t2.join();
-            
-            return 0;
         }
     }
+    if (pool_bytes > 0) {
+        tap0.set_frame_pool(pool_bytes, numa_node);
+        tap1.set_frame_pool(pool_bytes, numa_node);
+    }
+
+    // --------------- 创建工作线程 ---------------
+    cout << "启动数据包处理线程..." << endl;
+    thread t1(thread_function, &tap0);
+    thread t2(thread_function, &tap1);
+    if (numa_node >= 0) {
+        pin_to_numa_node(t1, numa_node);
+        pin_to_numa_node(t2, numa_node);
+    }
+    
+    // 给线程一点时间启动
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto start_hops = [&hop_sims](int64_t at_us) {
+        for (auto& sim : hop_sims) {
+            sim->setStartTime(at_us);
+            sim->start();
+        }
+    };
+
+    if (!daemon_sock.empty()) {
+        // --------------- 守护进程模式 ---------------
+        start_hops(0);
+        int ret = 0;
+        {
+            ScenarioDaemon daemon(&tap0, &tap1);
+            if (daemon.open(daemon_sock)) {
+                daemon.serve();
+            } else {
+                ret = 1;
+            }
+        }
+        tap0.request_stop();
+        tap1.request_stop();
+        t1.join();
+        t2.join();
+        return ret;
+    }
+
+    if (simulator) {
+        // --------------- 脚本仿真模式 ---------------
+        LOGI("main") << "\n开始网络仿真，总时长: " << total_time_ms / 1000 << " s";
+        if (!hop_sims.empty()) {
+            int64_t at_us = tap0.get_us() + 10000;  // 各路径段与最后一跳按同一时刻开始
+            simulator->setStartTime(at_us);
+            start_hops(at_us);
+        }
+        simulator->start();
+        
+        // 等待仿真结束
+        while (simulator->isRunning()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        
+        LOGI("main") << "仿真结束，等待线程退出...";
+        // 通知并等待工作线程结束
+        tap0.request_stop();
+        tap1.request_stop();
+        t1.join();
+        t2.join();
+        
+        return 0;
+    }
     
     // --------------- 交互式模式 ---------------
+    start_hops(0);
+    Logger::instance().flush();     // 交互提示直接写控制台，先输出之前的日志
     cout << "\n========== 交互模式 ==========" << endl;
     cout << "可用命令:" << endl;
     cout << "  b <value>  - 设置带宽 (bps)" << endl;
     cout << "  r <value>  - 设置RTT (ms)" << endl;
     cout << "  l <value>  - 设置丢包率 (‰)" << endl;
+    cout << "  d <value>  - 设置重复率 (‰)" << endl;
+    cout << "  c <value>  - 设置比特损坏率 (‰)" << endl;
+    cout << "  x <value>  - 设置隐蔽损坏率 (‰，修正校验和)" << endl;
+    cout << "  o <value>  - 链路中断 (0=恢复 1=断开并清空队列 2=断开并保留队列)" << endl;
     cout << "  q          - 退出程序" << endl;
     cout << "==============================" << endl;
     
@@ -924,7 +8036,7 @@ int main(int argc, char **argv)
         auto parsed = parseInput(line); // 解析输入
         if(parsed.second == -1) // 解析失败
         {
-            cout << "无效输入，格式应为: [b|r|l] <value>" << endl;
+            cout << "无效输入，格式应为: [b|r|l|d|c|x|o] <value>" << endl;
             continue;
         }
         else if(parsed.first == 'b') // 设置带宽（b + 数值）
@@ -946,9 +8058,41 @@ int main(int argc, char **argv)
             tap1.set_loss(parsed.second);
             cout << "丢包率已改为: " << parsed.second << "‰ (" << (parsed.second/10.0) << "%)" << endl;
         }
+        else if(parsed.first == 'd') // 设置重复率（d + 数值）
+        {
+            tap0.set_dup(parsed.second);
+            tap1.set_dup(parsed.second);
+            cout << "重复率已改为: " << parsed.second << "‰" << endl;
+        }
+        else if(parsed.first == 'c') // 设置比特损坏率（c + 数值）
+        {
+            tap0.set_corrupt(parsed.second);
+            tap1.set_corrupt(parsed.second);
+            cout << "比特损坏率已改为: " << parsed.second << "‰" << endl;
+        }
+        else if(parsed.first == 'x') // 设置隐蔽损坏率（x + 数值）
+        {
+            tap0.set_stealth(parsed.second);
+            tap1.set_stealth(parsed.second);
+            cout << "隐蔽损坏率已改为: " << parsed.second << "‰" << endl;
+        }
+        else if(parsed.first == 'o') // 链路中断（o + 方式）
+        {
+            if(parsed.second < OUTAGE_NONE || parsed.second > OUTAGE_HOLD)
+            {
+                cout << "中断方式应为 0/1/2" << endl;
+                continue;
+            }
+            tap0.set_outage(parsed.second);
+            tap1.set_outage(parsed.second);
+            const char *names[] = {"链路已恢复", "链路已断开（清空队列）", "链路已断开（保留队列）"};
+            cout << names[parsed.second] << endl;
+        }
     }
 
-    // 等待线程结束
+    // 通知并等待线程结束
+    tap0.request_stop();
+    tap1.request_stop();
     t1.join();
     t2.join();
 
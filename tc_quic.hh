@@ -7,7 +7,15 @@
 #include <atomic>
 #include <thread>
 #include <queue>
+#include <vector>
 #include <functional>
+#include <memory>
+#include <stdint.h>
+#include <linux/io_uring.h>
+#include <random>
+#include <stdio.h>
+#include <sstream>
+#include "tc_shm.hh"
 
 // --------------- 全局宏定义 ---------------
 /**
@@ -23,6 +31,885 @@
  */
 #define MAX_PACKET_SIZE 2048000
 
+/**
+ * @def MAX_FRAME_SIZE
+ * @brief 单个以太网帧的最大字节数（1518 + 4字节VLAN标签）
+ */
+#define MAX_FRAME_SIZE 1522
+
+/**
+ * @def MAX_GSO_FRAME_SIZE
+ * @brief 开启vnet头卸载后单个GSO超帧的最大字节数（64KB IP包 + 以太网头）
+ */
+#define MAX_GSO_FRAME_SIZE (65535 + 14)
+
+// --------------- 时钟 ---------------
+/**
+ * @enum ClockSource
+ * @brief 计时时钟源（全部计时使用同一个源，启动转发线程之前选择）
+ */
+enum ClockSource {
+    CLK_MONOTONIC = 0,  // clock_gettime(CLOCK_MONOTONIC)：不受NTP跳变影响（默认）
+    CLK_TSC             // 校准后的TSC：要求invariant TSC，每次读取只需几纳秒
+};
+
+/**
+ * @class Clock
+ * @brief 单调时钟：时间戳为进程启动时刻的epoch微秒加上单调流逝的时间，抓包/日志中仍可直接当作墙上时间
+ * @note 启动后系统时间被调整（NTP跳变）不会影响队列中帧的发送时间
+ */
+class Clock
+{
+public:
+    static bool select(ClockSource src);    // 选择时钟源（TSC不可用时返回false，保持CLOCK_MONOTONIC）
+    static int64_t now_us();                // 当前时间（微秒）
+    static int64_t from_epoch_us(int64_t epoch_us); // 按当前的墙上时间偏移把epoch微秒换算成时钟时间（守护进程的at=）
+    static int64_t mono_us();               // 直接读CLOCK_MONOTONIC（校准/基准测试用）
+    static bool tsc_invariant();            // CPU是否提供invariant TSC
+    static double tsc_ghz() { return tsc_hz / 1e9; }
+    static const char *name() { return source == CLK_TSC ? "tsc" : "monotonic"; }
+
+private:
+    static ClockSource source;
+    static int64_t mono_base_us;    // 起点的CLOCK_MONOTONIC时间
+    static int64_t epoch_base_us;   // 起点的epoch时间（所有时间戳从这里开始计）
+    static uint64_t tsc_base;       // 切换到TSC时的TSC读数
+    static int64_t tsc_base_us;     // 切换到TSC时的时钟时间
+    static uint64_t tsc_mult;       // 每个TSC周期的微秒数（定点，左移TSC_SHIFT位）
+    static double tsc_hz;           // 校准得到的TSC频率
+};
+
+// --------------- vnet头 ---------------
+/**
+ * @struct virtio_net_hdr
+ * @brief TAP开启IFF_VNET_HDR后每帧前附带的头（与linux/virtio_net.h一致，该头文件含C++关键字无法直接包含）
+ */
+struct virtio_net_hdr {
+    uint8_t flags;          // VIRTIO_NET_HDR_F_*
+    uint8_t gso_type;       // VIRTIO_NET_HDR_GSO_*
+    uint16_t hdr_len;       // 以太网 + IP + TCP/UDP头长度（内核填写，不一定可靠）
+    uint16_t gso_size;      // 每个分段的负载长度
+    uint16_t csum_start;    // 校验和计算起点
+    uint16_t csum_offset;   // 校验和字段相对csum_start的偏移
+};
+
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM 1   // 校验和未计算（由接收方按csum_start/csum_offset补全）
+#define VIRTIO_NET_HDR_GSO_NONE 0       // 非GSO帧
+#define VIRTIO_NET_HDR_GSO_TCPV4 1      // IPv4 TSO超帧
+#define VIRTIO_NET_HDR_GSO_TCPV6 4      // IPv6 TSO超帧
+#define VIRTIO_NET_HDR_GSO_UDP_L4 5     // USO（UDP GSO）超帧
+
+// --------------- I/O后端 ---------------
+/**
+ * @enum IoMode
+ * @brief 数据包收发后端
+ * @details IO_TAP：TAP接口 + 网桥（默认，每帧一次read/write）
+ *          IO_PACKET：AF_PACKET套接字直接挂在veth/网卡上，使用mmap的TPACKET_V3收发环，批量收发
+ *          IO_URING：TAP接口 + io_uring，注册缓冲区上常驻批量读请求，写请求每轮循环一次io_uring_enter提交
+ *          IO_SHM：不经过内核，两个端点通过共享内存中的SPSC环收发（tc_shm.hh），帧在端点的发送帧槽中原地转发
+ */
+enum IoMode {
+    IO_TAP = 0,
+    IO_PACKET = 1,
+    IO_URING = 2,
+    IO_SHM = 3
+};
+
+// --------------- io_uring 封装 ---------------
+/**
+ * @class IoUring
+ * @brief 直接基于io_uring系统调用的最小封装（不依赖liburing）
+ * @details 只由所属转发线程使用：get_sqe填充请求，submit一次系统调用提交，peek_cqe/cqe_seen在共享内存中收割完成事件
+ */
+class IoUring
+{
+public:
+    int ring_fd = -1;                   // io_uring实例fd
+    unsigned *sq_head = nullptr;        // 提交队列头（内核写）
+    unsigned *sq_tail = nullptr;        // 提交队列尾（用户写）
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;       // 提交队列索引数组
+    unsigned *cq_head = nullptr;        // 完成队列头（用户写）
+    unsigned *cq_tail = nullptr;        // 完成队列尾（内核写）
+    unsigned *cq_mask = nullptr;
+    struct io_uring_sqe *sqes = nullptr;
+    struct io_uring_cqe *cqes = nullptr;
+    unsigned sq_entries = 0;
+    unsigned to_submit = 0;             // 已填充未提交的请求数
+
+    ~IoUring() { close_ring(); }
+    int init(unsigned entries, unsigned cq_entries);   // 创建实例并映射队列（<0=失败）
+    void close_ring();
+    int register_buffer(void *addr, size_t len);       // 注册一块固定缓冲区（buf_index=0）
+    struct io_uring_sqe *get_sqe();                    // 取一个空闲SQE（队列满返回nullptr）
+    int submit();                                      // 提交全部待提交请求，返回系统调用次数
+    struct io_uring_cqe *peek_cqe();                   // 取一个完成事件（无则nullptr）
+    void cqe_seen();                                   // 释放已处理的完成事件
+
+private:
+    void *sq_ptr = nullptr;
+    void *cq_ptr = nullptr;
+    size_t sq_map_size = 0;
+    size_t cq_map_size = 0;
+    size_t sqes_map_size = 0;
+    unsigned sq_local_tail = 0;         // 本地提交队列尾（submit时发布给内核）
+};
+
+// --------------- 共享内存端点 ---------------
+const uint32_t SHM_POOL_SLOTS = 1024;   // 每个方向的复制池帧槽数（重复帧/背景流量等堆内存中的帧发往端点时复制到这里）
+
+/**
+ * @class ShmRegion
+ * @brief --io=shm的共享区：memfd + 每个端口一个eventfd，接入线程在unix套接字上把它们交给端点
+ * @details 布局见tc_shm.hh；两个方向的转发线程各自消费一个端口的tx环、生产另一个端口的rx环，互不共享可写状态
+ */
+class ShmRegion
+{
+public:
+    ShmRegion() {}
+    ~ShmRegion();
+    bool create(const std::string& sock_path, uint32_t ring_slots); // 创建共享区并开始接受端点连接
+    uint8_t *get_base() const { return base; }
+    ShmPort *port(int n) const { return &reinterpret_cast<ShmHeader *>(base)->port[n]; }
+    int wake_fd(int n) const { return efd[n]; }
+    int get_fd() const { return memfd; }
+
+private:
+    void serve();                       // 接入线程：每个连接读一个端口号，回复memfd和该端口的eventfd
+    uint8_t *base = nullptr;
+    size_t size = 0;
+    int memfd = -1;
+    int efd[SHM_PORTS] = {-1, -1};
+    int listen_fd = -1;
+    std::string sock_path;
+    std::thread acceptor;
+    std::atomic<bool> stopping{false};
+};
+
+// --------------- 帧内存池 ---------------
+const uint32_t POOL_SLOT_SIZE = 2048;       // 帧槽大小（MAX_FRAME_SIZE，开启卸载时含vnet头；更大的GSO超帧仍用堆内存）
+const uint32_t POOL_MIN_SLOTS = 4096;       // 自动估算时每个方向至少预留的帧槽数
+const uint32_t POOL_MIN_FRAME = 64;         // 自动估算时按最小以太网帧折算帧数（不论帧长，每帧占一个帧槽）
+const int POOL_MAX_MB = 512;                // 自动估算的上限（每个方向）：超出的在途帧改用堆内存，计入pool miss
+const int64_t POOL_QUEUE_ALLOW_MS = 100;    // 脚本未限制瓶颈缓冲时，按这么长的排队时延估算在途帧
+const int POOL_DEFAULT_MB = 64;             // 无法从场景估算（不限速/马尔可夫模型/守护进程）时每个方向的大小
+const int64_t FAULT_SAMPLE_US = 100000;     // 转发线程采样缺页计数的间隔
+
+/**
+ * @enum PoolBacking
+ * @brief 帧内存池的页类型
+ */
+enum PoolBacking {
+    POOL_OFF = 0,   // 未开启：每帧new/delete
+    POOL_HUGETLB,   // 预留的2MB大页（MAP_HUGETLB，需要vm.nr_hugepages）
+    POOL_THP,       // 2MB对齐 + MADV_HUGEPAGE（透明大页，由内核尽量合并）
+    POOL_4K         // 普通页
+};
+
+/**
+ * @class FramePool
+ * @brief 单方向的帧缓冲池：启动时一次预留、预先缺页并mlock，转发中取/还帧槽不再触发缺页
+ * @details 只由所属转发线程取还（路径段与最后一跳在同一线程），空闲帧槽为LIFO栈，刚释放的帧槽仍在cache中；
+ *          用尽时调用者回退到堆内存并计入pool_miss
+ */
+class FramePool
+{
+public:
+    ~FramePool();
+    bool reserve(size_t bytes, int numa_node);  // 预留bytes字节（numa_node>=0时mbind到该节点），失败时保持未开启
+    uint8_t *get(uint32_t size)                 // 取一个帧槽（nullptr=未开启/用尽/帧大于帧槽）
+    {
+        if(size > POOL_SLOT_SIZE || free_slots.empty())
+        {
+            return nullptr;
+        }
+        uint32_t slot = free_slots.back();
+        free_slots.pop_back();
+        if(slots - free_slots.size() > peak)
+        {
+            peak = slots - free_slots.size();
+        }
+        return base + (size_t)slot * POOL_SLOT_SIZE;
+    }
+    bool put(uint8_t *p)                        // 还回帧槽（false=不是本池的内存）
+    {
+        uintptr_t off = (uintptr_t)p - (uintptr_t)base;
+        if(off >= (uintptr_t)slots * POOL_SLOT_SIZE)
+        {
+            return false;
+        }
+        free_slots.push_back(off / POOL_SLOT_SIZE);
+        return true;
+    }
+    bool enabled() const { return backing != POOL_OFF; }
+    uint32_t get_slots() const { return slots; }
+    uint32_t get_peak() const { return peak; }
+    std::string describe() const;               // 页类型、大小、是否锁定、NUMA节点
+
+private:
+    uint8_t *base = nullptr;
+    size_t map_size = 0;
+    uint32_t slots = 0;
+    uint32_t peak = 0;                          // 同时占用的帧槽数峰值
+    PoolBacking backing = POOL_OFF;
+    bool locked = false;
+    int node = -1;
+    std::vector<uint32_t> free_slots;
+};
+
+/**
+ * @brief 出队时间误差直方图的桶数：桶0为0us，桶k为[2^(k-1), 2^k)us，最后一桶包含更大的误差
+ */
+const int TX_LATE_BUCKETS = 16;
+const int64_t OVERLOAD_HOLD_US = 100000;   // 连续这么久没有超出SLO的帧后清除过载标志（微秒）
+const int SLO_BUDGET_PERMILLE = 1;          // 一次运行中超出SLO的帧（含过载丢弃）不超过该千分比即视为在容差内
+
+/**
+ * @struct TapStats
+ * @brief 单方向转发统计（转发线程写，仿真/主线程读）
+ */
+struct TapStats {
+    std::atomic<uint64_t> rx_packets{0};   // 接收帧数
+    std::atomic<uint64_t> rx_bytes{0};     // 接收字节数
+    std::atomic<uint64_t> tx_packets{0};   // 发送帧数
+    std::atomic<uint64_t> tx_bytes{0};     // 发送字节数
+    std::atomic<uint64_t> drops{0};        // 丢弃帧数（丢包/缓存溢出/发送环满）
+    std::atomic<uint64_t> dups{0};         // 重复发送的帧数
+    std::atomic<uint64_t> corrupted{0};    // 损坏的帧数（含隐蔽损坏）
+    std::atomic<uint64_t> syscalls{0};     // 收发路径上的系统调用次数
+    std::atomic<uint64_t> xt_bytes{0};     // 注入瓶颈队列的背景流量字节数
+    std::atomic<uint64_t> xt_drops{0};     // 超过背景流量缓冲上限而丢弃的字节数
+    std::atomic<uint64_t> tx_batches{0};   // 有帧到期的出队轮数（每轮的帧一起发送）
+    std::atomic<uint64_t> tx_late[TX_LATE_BUCKETS] = {}; // 出队时间相对计划发送时间的延后（对数分桶）
+    std::atomic<uint64_t> slo_late{0};     // 出队延后超过SLO的帧数（转发线程跟不上，含过载丢弃的帧）
+    std::atomic<uint64_t> shed{0};         // 过载丢弃的帧数（同时计入drops）
+    std::atomic<uint64_t> overloads{0};    // 进入过载状态的次数
+    std::atomic<uint64_t> overdue_peak{0}; // 一轮出队中超过SLO的最大帧数（积压峰值）
+    std::atomic<uint64_t> ce_marks{0};     // AQM打上CE标记的帧数（到达时已是CE的不计）
+    std::atomic<uint64_t> aqm_drops{0};    // DualQ经典队列中不支持ECN而被AQM丢弃的帧数（同时计入drops）
+    std::atomic<uint64_t> l_packets{0};    // 经过DualQ低时延队列（ECT(1)/CE）的帧数
+    std::atomic<uint64_t> minflt{0};       // 转发线程的次缺页数（getrusage，约每100ms采样一次）
+    std::atomic<uint64_t> majflt{0};       // 转发线程的主缺页数
+    std::atomic<uint64_t> pool_miss{0};    // 帧内存池用尽（或帧大于帧槽）而改用堆内存的帧数
+    std::atomic<uint64_t> pool_peak{0};    // 帧内存池同时占用的帧槽数峰值
+    std::atomic<uint64_t> rr_frames{0};    // 录制：写入决策日志的帧数；回放：按日志决定命运的帧数
+    std::atomic<uint64_t> rr_miss{0};      // 回放：日志中没有对应决策、照常抽签的帧数
+    std::atomic<uint64_t> rr_skew{0};      // 回放：决策录制时的场景参数版本与当前版本不同的帧数
+    std::atomic<uint64_t> rr_lost{0};      // 录制：决策环满而未写入日志的帧数
+    std::atomic<uint64_t> rr_evict{0};     // 回放：所属流的窗口已满而被挤出的决策数（该流落后或提前结束）
+};
+
+/**
+ * @struct SloSnapshot
+ * @brief 一次运行开始时的计时统计快照，运行结束时与当前值相减得到本次运行的结论
+ */
+struct SloSnapshot {
+    uint64_t late_hist[TX_LATE_BUCKETS];
+    uint64_t slo_late;
+    uint64_t shed;
+    uint64_t overloads;
+};
+
+/**
+ * @brief 单写者计数器累加（只有转发线程写，避免lock前缀的原子加）
+ */
+inline void stat_add(std::atomic<uint64_t>& counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+ * @brief 出队时间误差（微秒）所在的直方图桶
+ */
+inline int tx_late_bucket(int64_t late_us)
+{
+    if(late_us <= 0)
+    {
+        return 0;
+    }
+    int k = 64 - __builtin_clzll((uint64_t)late_us);
+    return k < TX_LATE_BUCKETS ? k : TX_LATE_BUCKETS - 1;
+}
+
+// --------------- 阶段剖析 ---------------
+/**
+ * @enum ProfStage
+ * @brief 转发热路径上被计时的阶段（嵌套时各阶段只计自己的部分，如enqueue不含其中的pace）
+ */
+enum ProfStage {
+    PROF_POLL = 0,      // epoll_wait / io_uring提交
+    PROF_READ,          // read / 接收环取帧 / io_uring完成收割
+    PROF_PACE,          // 流水线入队：分类、整形、发送时间计算
+    PROF_ENQUEUE,       // 节点分配、限流检查、入队（含多跳路径的第一段）
+    PROF_SCAN,          // 出队：瓶颈串行化、到期扫描、各路径段出队
+    PROF_LOSS,          // 丢包/损坏判断
+    PROF_WRITE,         // 发送：write / 填发送环 / io_uring写请求，含PACKET批量提交
+    PROF_STAGES
+};
+
+const int PROF_COUNTERS = 3;    // 采样的硬件计数器：cycles、instructions、cache-misses（一个perf事件组）
+const int PROF_DEPTH = 8;       // 阶段嵌套的最大深度
+
+/**
+ * @class StageProfiler
+ * @brief 每方向一个的阶段剖析器（--prof=N开启）：每次阶段切换读一次TSC，把间隔计入当前阶段；
+ *        每N帧选一轮循环，在该轮的每次切换时额外读一次perf事件组，得到各阶段的IPC和cache miss
+ * @note enter/leave/begin_loop/end_loop只由本方向的转发线程调用（perf事件组也在该线程上打开，只统计该线程）；
+ *       report由仿真线程调用，只读原子累计值
+ */
+class StageProfiler
+{
+public:
+    explicit StageProfiler(uint32_t sample_every);
+    ~StageProfiler();
+    inline void enter(int stage);                   // 进入阶段（可嵌套）
+    inline void leave();                            // 离开当前阶段
+    void begin_loop(uint64_t work);                 // 一轮转发循环开始（work=本方向已处理的帧数，决定是否采样）
+    void end_loop(uint64_t work);                   // 一轮结束：有帧处理时才累计本轮（空转的轮询不计入每帧开销）
+    void report(const std::string& name, uint64_t rx_packets); // 打印自上次以来各阶段的每帧周期/IPC/cache miss
+    static const char *stage_name(int stage);
+
+private:
+    void open_counters();                           // 在转发线程上打开perf事件组（失败时只用TSC）
+    void read_counters(uint64_t v[PROF_COUNTERS]);  // 一次read读出整组
+    inline void charge(uint64_t t);                 // 把上次切换以来的时间（和计数器增量）计入栈顶阶段
+
+    uint32_t sample_every;      // 每多少帧采样一轮
+    int perf_fds[PROF_COUNTERS]; // perf事件组（[0]为leader，-1=未打开或不可用）
+    bool opened;
+    bool armed;                 // 本轮采样硬件计数器
+    uint64_t loop_work;         // 本轮开始时的帧数
+    uint64_t sample_mark;       // 上次采样时的帧数
+    int depth;
+    int stack[PROF_DEPTH + 1];  // stack[0]不对应任何阶段（两次转发循环之间）
+    uint64_t last_tsc;
+    uint64_t last_pmu[PROF_COUNTERS];
+    uint64_t pmu_cost[PROF_COUNTERS];  // 一次组读取本身的计数（打开时校准，每个间隔扣除一次）
+    // 本轮的累计（轮末有帧处理才并入下面的总计）
+    uint64_t iter_tsc[PROF_STAGES];
+    uint64_t iter_pmu_tsc[PROF_STAGES];
+    uint64_t iter_pmu[PROF_STAGES][PROF_COUNTERS];
+    // 总计（转发线程写，仿真线程读）
+    std::atomic<uint64_t> tsc[PROF_STAGES];
+    std::atomic<uint64_t> pmu_tsc[PROF_STAGES];     // 采样轮中各阶段的TSC周期（用于把采样计数折算到全部帧）
+    std::atomic<uint64_t> pmu[PROF_STAGES][PROF_COUNTERS];
+    std::atomic<uint64_t> samples;
+    std::atomic<bool> pmu_ok;
+    // 上次report时的快照（只由仿真线程访问）
+    uint64_t last_rx;
+    uint64_t snap_tsc[PROF_STAGES];
+    uint64_t snap_pmu_tsc[PROF_STAGES];
+    uint64_t snap_pmu[PROF_STAGES][PROF_COUNTERS];
+    uint64_t snap_samples;
+};
+
+/**
+ * @struct ProfScope
+ * @brief 阶段计时的作用域（剖析未开启时p为nullptr，只剩一次判空）
+ */
+struct ProfScope {
+    StageProfiler *p;
+    ProfScope(StageProfiler *p, int stage) : p(p)
+    {
+        if(p != nullptr)
+            p->enter(stage);
+    }
+    ~ProfScope()
+    {
+        if(p != nullptr)
+            p->leave();
+    }
+};
+
+// --------------- pcapng抓包 ---------------
+/**
+ * @enum CaptureReason
+ * @brief 抓包记录的处理结果（写入每个包的注释）
+ */
+enum CaptureReason {
+    CAP_FORWARD = 0,    // 正常转发
+    CAP_DUP,            // 重复发送的副本
+    CAP_CORRUPT,        // 比特损坏后转发
+    CAP_STEALTH,        // 隐蔽损坏后转发
+    CAP_LOSS,           // 按丢包率丢弃（GSO超帧部分分段丢失时也记为此项）
+    CAP_QUEUE_FULL,     // 缓存节点数超限，入队时丢弃
+    CAP_TX_FAIL,        // 发送失败（发送环满/写失败）
+    CAP_OUTAGE,         // 链路中断：入口丢弃或中断开始时清空队列
+    CAP_SHED,           // 仿真器过载：出队延后超过SLO，过载丢弃
+    CAP_AQM             // DualQ经典队列中不支持ECN的帧被AQM丢弃
+};
+
+/**
+ * @enum OutageMode
+ * @brief 链路中断方式（中断期间新到的帧一律在入口丢弃，不分配内存、不入队）
+ */
+enum OutageMode {
+    OUTAGE_NONE = 0,    // 链路正常
+    OUTAGE_FLUSH = 1,   // 中断开始时丢弃队列中已有的帧
+    OUTAGE_HOLD = 2     // 中断期间保留队列中已有的帧，恢复后再发送
+};
+
+/**
+ * @struct CaptureRecord
+ * @brief 抓包描述符：转发线程填写，写盘线程读取；帧数据紧跟在结构体后面
+ */
+struct CaptureRecord {
+    int64_t timesample;     // 入队时间（微秒）
+    int64_t sendtime;       // 计划发送时间（微秒）
+    int64_t emit_time;      // 实际发送/丢弃时间（微秒）
+    uint32_t orig_len;      // 帧原始长度
+    uint32_t cap_len;       // 拷贝到描述符中的长度（不超过截断长度）
+    uint16_t segs;          // GSO超帧分段数（普通帧为1）
+    uint16_t lost_segs;     // 丢失的分段数
+    uint8_t reason;         // CaptureReason
+};
+
+/**
+ * @class CaptureRing
+ * @brief 单生产者单消费者无锁环：转发线程push，写盘线程front/pop，环满时丢弃记录而不阻塞转发
+ */
+class CaptureRing
+{
+public:
+    bool init(uint32_t slots, uint32_t snaplen);
+    bool push(const uint8_t *data, uint32_t size, int64_t timesample, int64_t sendtime,
+              int64_t emit_time, uint8_t reason, uint16_t segs, uint16_t lost_segs);
+    const CaptureRecord *front();
+    void pop();
+    uint64_t get_overruns() const { return overruns.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<uint8_t> mem;           // slots个定长槽：CaptureRecord + snaplen字节
+    uint32_t mask = 0;
+    uint32_t stride = 0;
+    uint32_t snaplen = 0;
+    // 生产者与消费者各自的索引放在不同缓存行，避免伪共享
+    char pad0[64];
+    std::atomic<uint32_t> head{0};      // 生产者写
+    uint32_t cached_tail = 0;           // 生产者缓存的消费者位置
+    std::atomic<uint64_t> overruns{0};  // 环满丢弃的记录数（生产者写）
+    char pad1[64];
+    std::atomic<uint32_t> tail{0};      // 消费者写
+    uint32_t cached_head = 0;           // 消费者缓存的生产者位置
+    char pad2[64];
+};
+
+/**
+ * @class PcapWriter
+ * @brief 后台写盘线程：按时间顺序合并各方向的记录，批量写pcapng文件，按大小轮转
+ * @details 每个方向一个接口描述块（IDB），每个包一个增强包块（EPB），
+ *          EPB的时间戳为实际发送/丢弃时间，注释中记录入队时间、计划发送时间、发送时间和处理结果
+ */
+class PcapWriter
+{
+public:
+    PcapWriter();
+    ~PcapWriter();
+    bool open(const std::string& path, uint32_t snaplen, uint32_t rotate_mb,
+              const std::vector<std::string>& if_names);
+    void close();
+    CaptureRing *get_ring(int if_id) { return rings[if_id].get(); }
+
+private:
+    void writer_loop();
+    bool open_file();
+    void append_headers();
+    void append_record(int if_id, const CaptureRecord *rec);
+    void flush_batch();
+
+    std::vector<std::unique_ptr<CaptureRing>> rings;  // 每个方向一个环
+    std::vector<std::string> if_names;
+    std::string path;
+    uint32_t snaplen;
+    uint64_t rotate_bytes;      // 单个文件最大字节数（0=不轮转）
+    uint64_t file_bytes;        // 当前文件已写字节数
+    int file_index;             // 轮转序号（path, path.1, path.2, ...）
+    FILE *fp;
+    std::vector<uint8_t> batch; // 待写入的块
+    std::thread writer;
+    std::atomic<bool> running;
+};
+
+// --------------- 异步日志 ---------------
+/**
+ * @enum LogLevel
+ * @brief 日志等级
+ */
+enum LogLevel {
+    LL_DEBUG = 0,   // 调试（默认在编译期去掉）
+    LL_INFO,        // 运行过程（事件、进度、统计）
+    LL_WARN,        // 可恢复的错误（脚本格式错误、读失败等）
+    LL_ERROR        // 不可恢复的错误
+};
+
+/**
+ * @def TC_LOG_MIN_LEVEL
+ * @brief 编译期最低日志等级：低于该等级的日志语句整条去掉（编译时加-DTC_LOG_MIN_LEVEL=0保留调试日志）
+ */
+#ifndef TC_LOG_MIN_LEVEL
+#define TC_LOG_MIN_LEVEL 1
+#endif
+
+#define LOG_TEXT_MAX 1000       // 单条日志正文最大字节数（超出截断）
+#define LOG_RING_SLOTS 512      // 每个线程的日志槽数
+#define LOG_MAX_THREADS 64      // 最多同时注册的日志环（线程退出后环可被新线程复用）
+
+/**
+ * @struct LogRecord
+ * @brief 一条日志：产生日志的线程填写，写日志线程读取
+ */
+struct LogRecord {
+    int64_t time_us;            // 产生时间（epoch微秒）
+    uint16_t len;               // 正文长度
+    uint8_t level;              // LogLevel
+    uint8_t thread;             // 日志环编号（同一时刻唯一对应一个线程）
+    char src[12];               // 来源（sim/script/model/接口名）
+    char text[LOG_TEXT_MAX];    // 正文（可含换行，不以0结尾）
+};
+
+/**
+ * @class LogRing
+ * @brief 单生产者单消费者无锁日志环：所属线程push，写日志线程front/pop
+ * @note 线程退出时释放所有权（owner），环中剩余日志照常输出，之后由新线程接管
+ */
+class LogRing
+{
+public:
+    bool push(uint8_t level, const char *src, const char *text, size_t len, int64_t time_us);
+    const LogRecord *front();
+    void pop();
+    void drop();                        // 记一次环满丢弃
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+    uint64_t get_overruns() const { return overruns.load(std::memory_order_relaxed); }
+
+    std::atomic<bool> owner{false};     // 是否有线程正在使用
+    uint8_t id = 0;                     // 日志环编号
+
+private:
+    LogRecord slots[LOG_RING_SLOTS];
+    char pad0[64];
+    std::atomic<uint32_t> head{0};      // 生产者写
+    uint32_t cached_tail = 0;
+    std::atomic<uint64_t> overruns{0};  // 环满丢弃的日志数（生产者写）
+    char pad1[64];
+    std::atomic<uint32_t> tail{0};      // 消费者写
+    uint32_t cached_head = 0;
+    char pad2[64];
+};
+
+/**
+ * @class Logger
+ * @brief 异步日志：各线程写自己的无锁环，后台线程按时间合并后输出到控制台和文件（JSON行或二进制）
+ * @details 未启动（或已停止）时日志直接同步写控制台；控制台为人类可读格式（与原来的输出相同），
+ *          INFO/DEBUG写stdout，WARN/ERROR写stderr，每批只刷新一次，不再每行endl
+ */
+class Logger
+{
+public:
+    static Logger& instance();
+    bool start(LogLevel level, const std::string& path, bool binary); // 启动写日志线程（path为空时只输出控制台）
+    void stop();                // 输出剩余日志后停止写日志线程，关闭文件
+    void flush();               // 等待已提交的日志全部输出
+    bool enabled(LogLevel level) const { return level >= min_level.load(std::memory_order_relaxed); }
+    void submit(LogLevel level, const char *src, const std::string& text);
+    static void set_nonblocking();  // 当前线程环满时丢弃日志而不等待（转发线程）
+
+private:
+    Logger();
+    ~Logger();
+    LogRing *thread_ring();     // 当前线程的日志环（首次调用时注册或接管空闲的环）
+    void writer_loop();
+    void output(const LogRecord *rec);
+    void output_console(uint8_t level, const char *text, size_t len);
+
+    std::atomic<LogRing *> rings[LOG_MAX_THREADS];
+    std::atomic<int> ring_count;
+    std::atomic<int> min_level;         // 运行时最低等级（控制台和文件共用）
+    std::atomic<bool> running;
+    std::atomic<bool> idle;             // 写日志线程上一轮没有取到日志且已刷新输出
+    std::thread writer;
+    FILE *fp;                           // 日志文件（nullptr=只输出控制台）
+    bool binary;                        // 文件格式：false=JSON行，true=二进制记录
+};
+
+/**
+ * @class LogLine
+ * @brief 一条日志的流式拼接：在线程本地缓冲中格式化，析构时提交到本线程的日志环
+ */
+class LogLine
+{
+public:
+    LogLine(LogLevel level, const char *src);
+    ~LogLine();
+    template<class T> LogLine& operator<<(const T& value) { os << value; return *this; }
+
+private:
+    LogLevel level;
+    const char *src;
+    std::ostringstream& os;
+};
+
+// 低于TC_LOG_MIN_LEVEL的语句在编译期去掉，低于运行时等级的语句不做格式化
+#define TC_LOG(level, src) if((level) < TC_LOG_MIN_LEVEL || !Logger::instance().enabled(level)) {} else LogLine(level, src)
+#define LOGD(src) TC_LOG(LL_DEBUG, src)
+#define LOGI(src) TC_LOG(LL_INFO, src)
+#define LOGW(src) TC_LOG(LL_WARN, src)
+#define LOGE(src) TC_LOG(LL_ERROR, src)
+
+// --------------- 合成背景流量 ---------------
+/**
+ * @enum CrossTrafficModel
+ * @brief 背景流量模型：生成的虚拟帧占用瓶颈带宽和队列，但不会写到对端
+ */
+enum CrossTrafficModel {
+    XT_NONE = 0,        // 无背景流量
+    XT_CBR,             // 恒定速率
+    XT_POISSON,         // 泊松到达（1500B包）
+    XT_PARETO,          // 开/关Pareto（开、关时长均为Pareto分布，开期间以2倍平均速率发送）
+    XT_AIMD             // 类TCP的AIMD：按瓶颈排队时延调整窗口，超过缓冲上限时减半
+};
+
+// --------------- 按流统计 ---------------
+const int FLOW_PROBES = 8;              // 流表线性探测的最大槽数（超过时计入overflow，不按流统计）
+
+/**
+ * @struct FlowKey
+ * @brief 五元组（ECN按流计数与QUIC被动观测共用；整个结构参与比较，未用的字节为0）
+ */
+struct FlowKey {
+    uint8_t src[16], dst[16];           // IPv4只用前4字节
+    uint16_t sport, dport;              // 非UDP/TCP时为0
+    uint8_t family;                     // 4或6
+    uint8_t proto;                      // L4协议号
+    uint8_t pad[2];
+};
+
+// --------------- ECN / L4S ---------------
+/**
+ * @enum AqmMode
+ * @brief 瓶颈队列的ECN标记方式（只在限速时生效，作用于最后一跳）
+ */
+enum AqmMode {
+    AQM_NONE = 0,       // 不标记，只靠丢包表示拥塞
+    AQM_STEP,           // 单队列阶跃标记：排队时延超过阈值的ECT帧打CE
+    AQM_DUALQ           // RFC 9332式DualQ耦合AQM：ECT(1)/CE进入低时延队列（阶跃 + 耦合标记），其余进入经典队列（PI2，p_C=p'^2）
+};
+
+const int64_t PI2_TUPDATE_US = 16000;   // PI2基础概率的更新周期
+const double PI2_ALPHA = 0.16;          // PI2积分增益（Hz，排队时延以秒计）
+const double PI2_BETA = 3.2;            // PI2比例增益（Hz）
+const double DUALQ_K = 2.0;             // 耦合系数：低时延队列的耦合标记概率 = k * p'
+const int ECN_FLOW_SLOTS = 1024;        // 每方向按流统计CE标记的槽数（开放寻址，满时计入其他）
+const int ECN_TOP_FLOWS = 8;            // 运行结束时打印CE标记最多的流数
+
+/**
+ * @struct EcnFlow
+ * @brief 一个流（五元组）的CE标记计数（转发线程写，打印线程读）
+ * @note 转发线程先写五元组，再以release写入hash占用槽位；之后五元组不再改变
+ */
+struct EcnFlow {
+    std::atomic<uint32_t> hash{0};      // 0=空槽
+    FlowKey key;
+    std::atomic<uint64_t> ce{0};        // 被标记CE的帧数
+    std::atomic<uint64_t> aqm_drops{0}; // 被AQM丢弃的帧数
+};
+
+// --------------- QUIC被动观测 ---------------
+const int QUIC_FLOW_SLOTS = 256;        // 每方向跟踪的QUIC连接数（五元组，开放寻址，满时新连接不跟踪）
+const int QUIC_RTT_BUCKETS = 24;        // 自旋位RTT样本直方图：桶0为<1us，桶k为[2^(k-1), 2^k)us，最后一桶包含更大的值
+const int QUIC_SQUARE_PERIOD = 64;      // 丢包位Q（square bit）的半周期：发送端每64个包翻转一次
+const int QUIC_TOP_FLOWS = 8;           // 打印包数最多的连接数
+
+/**
+ * @struct QuicFlow
+ * @brief 一个QUIC连接在本方向上的被动观测（转发线程写，打印线程读）
+ * @details 自旋位：同一方向上相邻两次翻转的间隔即一个完整RTT（含两端的排队和ACK延迟，RFC 9312）；
+ *          Q位：发送端每QUIC_SQUARE_PERIOD个包翻转一次，一个完整半周期中少看到的包数即发送端到观测点的丢包；
+ *          L位：发送端每检测到一个丢包就在一个包上置位，累计即端到端丢包数（两者均需端点协商启用loss bits）
+ * @note 只有见过长头（握手）的五元组才会占用槽位，之后按短头观测
+ */
+struct QuicFlow {
+    std::atomic<uint32_t> hash{0};      // 0=空槽
+    FlowKey key;
+    // 观测状态（只由转发线程访问）
+    int64_t spin_edge_us = 0;           // 上次自旋位翻转的时间（0=尚未观测到短头）
+    uint8_t spin = 0;                   // 上一个短头包的自旋位
+    uint8_t q = 0;                      // 上一个短头包的Q位
+    bool q_started = false;             // 已经历过一次Q翻转（之后的半周期才是完整的）
+    uint32_t q_run = 0;                 // 当前半周期已看到的包数
+    // 累计（打印线程读）
+    std::atomic<uint64_t> packets{0};   // 短头包数
+    std::atomic<uint64_t> rtt_samples{0};
+    std::atomic<uint64_t> rtt_sum_us{0};
+    std::atomic<uint64_t> rtt_min_us{UINT64_MAX};
+    std::atomic<uint64_t> rtt_hist[QUIC_RTT_BUCKETS] = {};
+    std::atomic<uint64_t> q_periods{0}; // 完整的Q半周期数
+    std::atomic<uint64_t> q_seen{0};    // 完整半周期中看到的包数
+    std::atomic<uint64_t> q_lost{0};    // 完整半周期中缺少的包数（发送端到观测点）
+    std::atomic<uint64_t> l_marks{0};   // L位置位的包数（发送端报告的端到端丢包）
+};
+
+/**
+ * @class QuicObserver
+ * @brief 每方向一个的QUIC被动观测器（--quic_obs开启）：在发送阶段窥视UDP负载的第一个字节（短头）或长头版本号，
+ *        按连接累计自旋位RTT直方图与Q/L丢包位计数
+ * @note observe只由本方向的转发线程调用；观测点在仿真器出口（已经过丢包/时延），Q位丢包包含仿真链路的丢包
+ */
+class QuicObserver
+{
+public:
+    QuicObserver();
+    inline void observe(const uint8_t *frame, uint32_t size, int64_t now);  // 每个发出的帧调用一次
+    void observe_gso(const uint8_t *frame, uint32_t size, uint32_t hdr_len, uint32_t gso_size, int64_t now); // 整帧发出的UDP GSO超帧：逐段观测
+    void report(const std::string& name);   // 打印包数最多的连接（RTT样本分位数与丢包位统计）
+
+private:
+    inline void datagram(uint32_t h, const FlowKey& key, const uint8_t *quic, uint32_t len, int64_t now); // 观测一个UDP负载
+    std::unique_ptr<QuicFlow[]> flows;
+    std::atomic<uint64_t> overflow;     // 槽位用尽而未能跟踪的长头包数
+};
+
+// --------------- 损伤决策录制/回放 ---------------
+const uint32_t RR_RING_SLOTS = 65536;   // 每方向决策环的槽数（录制时转发线程→写盘线程，回放时读盘线程→转发线程）
+const int RR_FLOW_SLOTS = 1024;         // 每方向按首次出现顺序编号的流数（超出的流不录制/回放）
+const uint32_t RR_FLOW_WINDOW = 256;    // 回放时每个流预读的决策数（即流之间允许的先后偏差，以帧计，超出时挤出最早的决策）
+const uint32_t RR_PULL_MAX = 256;       // 回放时每帧最多从环中取出的决策数
+const uint32_t RR_BATCH = 4096;         // 读写盘批量（条）
+
+/**
+ * @enum RrFate
+ * @brief 一帧的命运（入队时决定，写入节点，出队各阶段据此执行而不再抽签）
+ */
+enum RrFate {
+    RR_DROP    = 0x01,  // 按丢包率丢弃
+    RR_CORRUPT = 0x02,  // 普通损坏
+    RR_STEALTH = 0x04,  // 隐蔽损坏
+    RR_DUP     = 0x08,  // 重复
+    RR_DECIDED = 0x80   // 已决定（节点的fate为0时出队照常抽签）
+};
+
+/**
+ * @struct RrRecord
+ * @brief 决策日志中的一条记录（16字节，文件中按此格式顺序存放，两个方向交错）
+ * @note 流按本方向首次出现的顺序编号（1开始，0=非IP帧），不按五元组：两次运行中客户端的临时端口通常不同
+ */
+struct RrRecord {
+    uint32_t idx;       // 该流的第几个帧（0开始）
+    uint16_t flow;      // 流编号
+    uint8_t dir;        // 方向（0=tap0→tap1，1=tap1→tap0）
+    uint8_t fate;       // RrFate
+    uint32_t delay_us;  // 施加的单向传播时延（微秒，排队时延不在其中，回放时由瓶颈队列照常产生）
+    uint32_t version;   // 入队时的场景参数版本（profile_gen）
+};
+
+/**
+ * @struct RrFileHeader
+ * @brief 决策日志文件头
+ */
+struct RrFileHeader {
+    char magic[8];          // "TCQRR\0\0\0"
+    uint32_t version;       // 文件格式版本（1）
+    uint32_t record_size;   // sizeof(RrRecord)
+};
+
+/**
+ * @class RrRing
+ * @brief 决策记录的单生产者单消费者无锁环（与CaptureRing相同的结构，槽为定长记录）
+ */
+class RrRing
+{
+public:
+    RrRing() : slots(new RrRecord[RR_RING_SLOTS]) {}
+    bool push(const RrRecord& rec);     // false=环满
+    const RrRecord *front();            // nullptr=环空
+    void pop();
+
+private:
+    std::unique_ptr<RrRecord[]> slots;
+    char pad0[64];
+    std::atomic<uint32_t> head{0};      // 生产者写
+    uint32_t cached_tail = 0;
+    char pad1[64];
+    std::atomic<uint32_t> tail{0};      // 消费者写
+    uint32_t cached_head = 0;
+    char pad2[64];
+};
+
+/**
+ * @class DecisionLog
+ * @brief 决策日志文件：录制时后台线程把两个方向的环批量写盘，回放时后台线程预读文件、按方向分发到两个环
+ * @details 转发线程只访问环，不做文件I/O；回放时两个方向各自从文件中读取本方向的记录，
+ *          一个方向的环满时只有该方向等待（预读量为RR_RING_SLOTS条），不影响另一个方向
+ */
+class DecisionLog
+{
+public:
+    DecisionLog();
+    ~DecisionLog();
+    bool open(const std::string& path, bool replay);    // 打开文件并启动后台线程（须在转发线程启动前调用）
+    void close();                                       // 停止后台线程（录制时先写完环中剩余的记录）
+    RrRing *get_ring(int dir) { return rings[dir].get(); }
+    bool replaying() const { return replay; }
+    bool is_open() const { return fp != nullptr; }
+
+private:
+    void writer_loop();
+    void reader_loop();
+
+    std::unique_ptr<RrRing> rings[2];   // 每个方向一个环
+    std::string path;
+    FILE *fp;
+    bool replay;
+    uint64_t records;                   // 已写入/已读出的记录数（后台线程）
+    std::thread worker;
+    std::atomic<bool> running;
+};
+
+/**
+ * @struct RrFlow
+ * @brief 录制/回放中的一个流：五元组 → 流编号与下一个帧序号（只由转发线程访问）
+ */
+struct RrFlow {
+    std::atomic<uint32_t> hash{0};      // 0=空槽（flow_slot使用）
+    FlowKey key;
+    uint16_t id = 0;                    // 流编号
+    uint32_t next_idx = 0;              // 下一个帧的序号
+};
+
+/**
+ * @class DecisionTrack
+ * @brief 一个方向的录制/回放状态：给每帧分配（流编号, 帧序号），回放时按流预读决策
+ * @note 只由本方向的转发线程调用
+ */
+class DecisionTrack
+{
+public:
+    DecisionTrack(RrRing *ring, bool replay, uint8_t dir);
+    bool next(const uint8_t *frame, uint32_t size, RrRecord *rec);  // 填写流编号和帧序号（false=流表已满）
+    bool find(RrRecord *rec, uint64_t *evicted);    // 回放：取rec中流编号/帧序号对应的决策（false=没有）
+    bool record(const RrRecord& rec) { return ring->push(rec); }    // 录制：false=环满
+    bool replaying() const { return replay; }
+
+private:
+    /**
+     * @struct Window
+     * @brief 回放时一个流预读的决策（按帧序号递增）
+     */
+    struct Window {
+        RrRecord rec[RR_FLOW_WINDOW];
+        uint32_t head = 0, tail = 0;
+    };
+    void pull(const RrRecord& want, uint64_t *evicted);    // 回放：从环中取出决策放入各流的窗口，直到取到want
+
+    RrRing *ring;
+    bool replay;
+    uint8_t dir;
+    std::unique_ptr<RrFlow[]> flows;        // 五元组 → 流编号（开放寻址）
+    uint16_t next_id;                       // 下一个新流的编号
+    uint32_t other_idx;                     // 非IP帧（流0）的下一个序号
+    std::unique_ptr<Window[]> windows;      // 回放：按流编号索引（RR_FLOW_SLOTS + 1个）
+};
+
 // --------------- 网络事件结构体 ---------------
 /**
  * @struct NetworkEvent
@@ -34,12 +921,32 @@ struct NetworkEvent {
     int64_t bandwidth;       // 带宽（Mbps）
     int64_t delay_ms;        // 延迟（毫秒）
     int loss;                // 丢包率（千分比）
+    int dup;                 // 重复率（千分比）
+    int corrupt;             // 比特损坏率（千分比，校验和不修正，由接收端UDP/TCP校验和发现）
+    int stealth;             // 隐蔽损坏率（千分比，重新计算IPv4/UDP校验和，只能由QUIC的AEAD发现）
+    int outage;              // 链路中断方式（OutageMode）
+    int64_t outage_period_ms; // 间歇中断周期（毫秒，0=整个事件期间持续中断）
+    int64_t outage_len_ms;   // 每个周期开头的中断时长（毫秒）
+    int xt_model;            // 背景流量模型（CrossTrafficModel）
+    int64_t xt_rate;         // 背景流量平均速率（Mbps，AIMD不使用）
+    int xt_flows;            // AIMD流数
+    int64_t xt_qlim_ms;      // 背景流量可占用的瓶颈缓冲（以排队时延计，毫秒）
+    int64_t buffer_ms;       // 瓶颈缓冲（排队时延上限，毫秒，0=不限）
+    int aqm;                 // ECN标记方式（AqmMode）
+    int64_t ecn_thresh_us;   // 阶跃标记阈值（单队列或DualQ低时延队列的排队时延，微秒）
+    int64_t aqm_target_ms;   // DualQ经典队列的PI2目标排队时延（毫秒）
     std::string description; // 事件描述
+    bool verbose;            // 是否打印事件开始/结束（模型生成的细粒度步进只在拥塞等级切换时打印）
     
     NetworkEvent(int64_t start = 0, int64_t dur = 0, int64_t bw = 0, 
-                 int64_t delay = 0, int loss_rate = 0, const std::string& desc = "")
+                 int64_t delay = 0, int loss_rate = 0, const std::string& desc = "",
+                 bool verbose = true)
         : start_time_ms(start), duration_ms(dur), bandwidth(bw), 
-          delay_ms(delay), loss(loss_rate), description(desc) {}
+          delay_ms(delay), loss(loss_rate), dup(0), corrupt(0), stealth(0),
+          outage(OUTAGE_NONE), outage_period_ms(0), outage_len_ms(0),
+          xt_model(XT_NONE), xt_rate(0), xt_flows(1), xt_qlim_ms(100), buffer_ms(0),
+          aqm(AQM_NONE), ecn_thresh_us(1000), aqm_target_ms(15),
+          description(desc), verbose(verbose) {}
     
     // 用于优先队列排序（按开始时间从小到大）
     bool operator>(const NetworkEvent& other) const {
@@ -47,6 +954,56 @@ struct NetworkEvent {
     }
 };
 
+// --------------- 随机场景模型 ---------------
+/**
+ * @struct CongestionLevel
+ * @brief 一个拥塞等级的参数范围（与Network_Scenario_Generator.py的CONGESTION_LEVELS一致）
+ */
+struct CongestionLevel {
+    std::string name;        // 等级名（如low）
+    std::string label;       // 显示名（如低拥塞）
+    double bw_min, bw_max;   // 带宽范围（Mbps）
+    double delay_min, delay_max; // 时延范围（ms）
+    double loss_min, loss_max;   // 丢包率范围（‰）
+    double fluctuation;      // 每步相对基准值的波动幅度
+    int64_t dwell_ms;        // 在该等级的平均停留时间（ms）
+};
+
+/**
+ * @class ScenarioModel
+ * @brief 马尔可夫拥塞模型：运行时逐步生成网络事件，代替离线生成的场景文件
+ * @details 每step_ms生成一个事件；进入某个等级时在范围内随机取基准值，之后每步在基准值附近波动；
+ *          每步以step_ms/dwell_ms的概率离开当前等级，按转移权重选择下一个等级。
+ *          状态只有当前等级、基准值和随机数生成器，内存占用与仿真时长无关
+ */
+class ScenarioModel {
+public:
+    ScenarioModel();
+    bool loadFromFile(const std::string& filename); // 加载模型描述文件
+    void reset();                                   // 回到起始状态（相同种子生成相同序列）
+    NetworkEvent next();                            // 生成下一个事件
+    int64_t getStepMs() const { return step_ms; }
+
+private:
+    std::vector<CongestionLevel> levels;            // 拥塞等级
+    std::vector<std::vector<double>> trans;         // 离开某等级时去往各等级的权重
+    bool default_trans;                             // 未指定trans：等概率去往其他等级
+    uint64_t seed;                                  // 随机种子
+    int64_t step_ms;                                // 步长（ms，最小1）
+    int start_level;                                // 起始等级
+
+    std::mt19937_64 rng;                            // 生成器状态
+    int cur_level;                                  // 当前等级
+    int64_t next_start_ms;                          // 下一个事件的开始时间
+    int64_t step_in_phase;                          // 当前等级内的步数
+    int phase_count;                                // 已进入的等级次数
+    double base_bw, base_delay, base_loss;          // 当前等级的基准值
+
+    int findLevel(const std::string& name) const;
+    void enterLevel(int level);
+    double fluctuate(double base, double lo, double hi, double fluctuation);
+};
+
 // --------------- 网络仿真控制器 ---------------
 class NetworkSimulator {
 private:
@@ -58,24 +1015,56 @@ private:
     int64_t total_duration_ms;
     std::priority_queue<NetworkEvent, std::vector<NetworkEvent>, 
                        std::greater<NetworkEvent>> event_queue;
+    std::unique_ptr<ScenarioModel> model;   // 随机场景模型（设置后代替事件队列）
     int64_t simulation_start_time;
+
+    // --------------- 守护进程：定时开始与无缝切换 ---------------
+    int64_t start_at_us;                    // 计划开始时间（epoch微秒，0=立即）
+    std::atomic<int64_t> handoff_us;        // 交接时间：到达后结束本次运行且不改动链路状态（0=不交接）
+    NetworkSimulator *predecessor;          // 被本次运行接替的运行（开始前等它退出）
+    bool keep_link;                         // 结束时恢复为无限制而不是断开链路（守护进程模式）
+    std::atomic<bool> begun;                // 已应用第一个事件
+    std::atomic<int> events_done;           // 已开始的事件数
+    std::atomic<int64_t> begin_us;          // 实际开始时间
+    std::atomic<int64_t> switch_us;         // 实际开始时间与计划时间之差（微秒）
+
+    // --------------- 多跳路径 ---------------
+    int segment;                            // -1=作用于两个方向的最后一跳（TapInterface自己的链路），>=0=路径中的第segment段
+    std::string tag;                        // 事件日志前缀（路径段为"[段名]"）
     
 public:
-    NetworkSimulator(class TapInterface* t0, class TapInterface* t1);
+    NetworkSimulator(class TapInterface* t0, class TapInterface* t1, bool reset_link = true, int segment = -1);
     ~NetworkSimulator();
     
     void addEvent(int64_t start_time_ms, int64_t duration_ms, int64_t bandwidth,
                   int64_t delay_ms, int loss_rate, const std::string& desc = "");
+    void addEvent(const NetworkEvent& ev);
     void setTotalDuration(int64_t duration_ms);
+    void setModel(std::unique_ptr<ScenarioModel> m); // 使用随机场景模型逐步生成事件
     void start();
     void pause();
     void resume();
     void stop();
     bool isRunning() const { return running; }
     bool isPaused() const { return paused; }
+    void setStartTime(int64_t start_us) { start_at_us = start_us; }     // 定时开始（epoch微秒）
+    void setHandoff(int64_t stop_us);                                   // 到达该时间后交给下一次运行
+    void setPredecessor(NetworkSimulator *p) { predecessor = p; }
+    void setKeepLink(bool keep) { keep_link = keep; }
+    bool hasBegun() const { return begun; }
+    int getEventCount() const { return events_done; }
+    int64_t getBeginUs() const { return begin_us; }
+    int64_t getSwitchUs() const { return switch_us; }
+    int64_t getTotalDuration() const { return total_duration_ms; }
+    int64_t getScriptEnd() const;                                       // 脚本中最后一个事件的结束时间（ms）
+    int64_t getPeakInflight() const;                                    // 每个方向在途字节数的峰值估计（-1=无法估计）
     
 private:
     void runSimulation();
+    void applyEvent(const NetworkEvent& ev); // 把事件参数设置到两个方向（默认构造的事件=无限制）
+    bool nextEvent(std::priority_queue<NetworkEvent, std::vector<NetworkEvent>,
+                   std::greater<NetworkEvent>>& events, NetworkEvent& ev); // 取下一个事件（模型或队列）
+    bool handedOff(int64_t now_us) const;   // 是否已到交接时间
 };
 
 // --------------- 链表节点类（缓存网络数据包） ---------------
@@ -96,14 +1085,19 @@ public:
         uint8_t *data;          // 数据包原始数据（二进制）
         int64_t sendtime;       // 数据包计划发送时间（微秒级时间戳）
         int64_t timesample;     // 数据包接收时间戳（微秒级）
+        int64_t arrival;        // 到达当前这一跳的时间（多跳路径中逐跳更新，瓶颈队列从此时起排队；单跳时等于timesample）
         uint32_t sock;          // 目标发送套接字（TAP接口fd）
         uint32_t size;          // 数据包字节大小
         uint16_t mac_type;      // MAC帧类型（如0x0800=IP协议）
+        uint8_t fate;           // 录制/回放时入队决定的命运（RrFate，0=出队时抽签）
+        int32_t block;          // 数据所在的共享缓冲区号（接收环块号/io_uring注册缓冲区号，-1=堆内存，由节点自己释放）
+        uint32_t wire;          // 链路上的字节数（GSO超帧按分段累计，出队整形时按此计算传输耗时）
+        int32_t delay_pin;      // 录制/回放时入队固定的传播时延（微秒，-1=出队时按链路当前时延）
         struct Node *next;      // 下一个节点指针（单链表）
         Node(uint8_t *data, int64_t time, uint32_t sock, uint32_t size, 
-             int64_t timesample, uint16_t mac_type):
-            data(data),sendtime(time),timesample(timesample),sock(sock),
-            size(size),next(nullptr),mac_type(mac_type){}
+             int64_t timesample, uint16_t mac_type, int32_t block = -1):
+            data(data),sendtime(time),timesample(timesample),arrival(timesample),sock(sock),
+            size(size),mac_type(mac_type),fate(0),block(block),wire(size),delay_pin(-1),next(nullptr){}
     };
     Node *head = nullptr;   // 链表头节点
     Node *tail = nullptr;   // 链表尾节点（优化尾插效率，无需遍历）
@@ -117,11 +1111,12 @@ public:
      * @param size 数据包大小
      * @param timesample 接收时间戳
      * @param mac_type MAC帧类型
+     * @param block 数据所在的共享缓冲区号（-1=堆内存）
      */
     void addNode(uint8_t *data, int64_t time, uint32_t sock, uint32_t size, 
-                 int64_t timesample, uint16_t mac_type)
+                 int64_t timesample, uint16_t mac_type, int32_t block = -1)
     {
-        Node * newnode = new Node(data, time, sock, size, timesample, mac_type);
+        Node * newnode = new Node(data, time, sock, size, timesample, mac_type, block);
         if(head == nullptr) // 空链表：头尾都指向新节点
         {
             head = newnode;
@@ -196,6 +1191,68 @@ public:
     }
 };
 
+// --------------- 编译期组合的转发流水线 ---------------
+/**
+ * @enum PipelineFeature
+ * @brief 当前损伤配置启用的阶段（位掩码），决定转发线程使用哪个流水线特化
+ */
+enum PipelineFeature {
+    PF_SHAPE   = 1,     // 带宽整形（bandwidth > 0）
+    PF_LOSS    = 2,     // 随机丢包
+    PF_CORRUPT = 4,     // 普通/隐蔽损坏
+    PF_DUP     = 8,     // 重复
+    PF_GSO     = 16,    // vnet头卸载（需要识别GSO超帧）
+    PF_ECN     = 32,    // ECN标记/DualQ（限速且设置了AQM，或低时延队列非空）
+    PF_ALL     = 63
+};
+
+/**
+ * @struct AdmitCtx
+ * @brief 入队阶段的上下文：帧 → 链路字节数 → 计划发送时间
+ */
+struct AdmitCtx {
+    const uint8_t *data;    // 以太网帧（背景流量为nullptr）
+    uint32_t size;          // 帧大小
+    uint32_t wire;          // 链路上的字节数（由分类阶段填写）
+    int64_t now;            // 入队时间
+    int64_t send_time;      // 计划发送时间（由时延阶段填写，进入瓶颈队列的帧在出队时才确定）
+    bool bottleneck;        // 由整形阶段填写：true=进入瓶颈队列，false=直接进入时延线
+    int64_t delay = -1;     // 录制/回放时固定的传播时延（微秒，-1=按链路当前时延）
+};
+
+/**
+ * @struct ReleaseCtx
+ * @brief 出队阶段的上下文
+ */
+struct ReleaseCtx {
+    ListNode::Node *node;   // 到期的节点（交给下一跳的阶段置为nullptr，出队循环不再释放）
+    uint8_t reason;         // 发送时记录的抓包原因（损坏阶段可能改写）
+};
+
+/**
+ * @struct PipelineOpsT
+ * @brief 一个预先实例化的流水线特化：入队与出队函数指针（L=TapInterface或多跳路径中的PathHop）
+ * @note 转发线程只在损伤配置的阶段集合变化时切换特化，每帧只有一次间接调用（每轮出队一次）
+ */
+template<class L> struct PipelineOpsT {
+    unsigned features;                                  // 该特化包含的阶段（PipelineFeature）
+    const char *name;                                   // 名称（基准测试和切换日志）
+    void (*admit)(L&, AdmitCtx&);                       // 计算链路字节数和发送时间
+    void (*drain)(L&, int64_t now);                     // 发送全部到期的节点
+};
+typedef PipelineOpsT<class TapInterface> PipelineOps;
+typedef PipelineOpsT<class PathHop> HopOps;
+
+template<class... Stages> struct Pipeline;
+template<bool On> struct ClassifyStage;
+template<bool On, bool Aqm> struct ShapeStage;
+template<bool On> struct AqmQueue;
+struct DelayStage;
+template<bool On> struct LossStage;
+template<bool On> struct CorruptStage;
+template<bool On> struct EmitStage;
+template<bool On> struct HandoffStage;
+
 /**
  * @class TapInterface
  * @brief TAP虚拟网络接口管理类（继承链表类，实现流量控制）
@@ -221,6 +1278,42 @@ public:
     int get_tap();                        // 获取TAP接口fd
     void set_dstap(int fd);               // 设置目标TAP接口fd（跨接口转发）
     void set_loss(int loss);              // 设置丢包率（千分比）
+    void set_dup(int dup);                // 设置重复率（千分比）
+    void set_corrupt(int corrupt);        // 设置比特损坏率（千分比，接收端校验和可发现）
+    void set_stealth(int stealth);        // 设置隐蔽损坏率（千分比，重新计算校验和）
+    void set_io_mode(IoMode mode);        // 选择收发后端（须在tap_open之前调用）
+    void set_ring_mb(int mb);             // 设置AF_PACKET接收环/io_uring注册缓冲池大小（MB）
+    void set_peer(TapInterface *peer);    // 设置对端接口（PACKET模式下帧写入对端发送环）
+    void set_shm(ShmRegion *region, int port); // 共享内存后端：本方向从端口port的tx环收帧，发往对端端口的rx环（须在tap_open之前调用）
+    void set_offload(bool on);            // 开启vnet头 + GSO/校验和卸载（须在tap_open之前调用，仅TAP/io_uring后端）
+    void set_capture(CaptureRing *ring);  // 开启抓包（本方向的描述符环，nullptr=关闭）
+    void set_outage(int mode, int64_t period_us = 0, int64_t len_us = 0); // 设置链路中断（OutageMode，周期>0时为间歇中断）
+    void set_cross_traffic(int model, int64_t rate, int flows, int64_t qlim_us); // 设置背景流量（CrossTrafficModel）
+    void set_tx_slack(int64_t us);        // 设置发送合并窗口（微秒，0=到期即发）
+    bool set_frame_pool(size_t bytes, int numa_node); // 预留帧内存池（须在转发线程启动前调用，失败时仍用堆内存）
+    void set_buffer(int64_t us);          // 设置瓶颈缓冲（排队时延超过该值的新帧尾部丢弃，微秒，0=不限）
+    void set_aqm(int mode, int64_t thresh_us, int64_t target_us); // 设置ECN标记方式（AqmMode）、阶跃阈值和PI2目标时延
+    void print_ecn_flows();               // 打印CE标记最多的流
+    void add_hop(const std::string& name); // 在本方向路径末尾、本接口的链路之前加一段（须在转发线程启动前调用）
+    PathHop *get_hop(int i) { return hops[i].get(); }
+    int hop_count() const { return static_cast<int>(hops.size()); }
+    void set_slo(int64_t us, bool shed);  // 设置出队延后SLO（微秒，在合并窗口之外）及超出时是否过载丢弃
+    bool is_overloaded() const { return overloaded.load(std::memory_order_relaxed); }
+    SloSnapshot slo_snapshot() const;     // 计时统计快照（运行开始时记录）
+    bool print_slo_verdict(const SloSnapshot& base); // 打印自快照以来的仿真精度结论（true=在容差内）
+    void request_stop();                  // 通知转发线程退出循环
+    bool stop_requested() const { return stopping.load(std::memory_order_relaxed); }
+    void set_ingress(bool open);          // 关闭入口：新到的帧在入口丢弃，队列中的帧照常发送（排空用）
+    int get_backlog() const { return backlog.load(std::memory_order_relaxed); } // 队列中的节点数（每轮循环更新）
+    IoMode get_io_mode() const { return io_mode; }
+    const TapStats& get_stats() const { return stats; }
+    void print_stats();                   // 打印转发统计
+    void print_tx_timing();               // 打印出队时间误差分布
+    void set_prof(uint32_t sample_every); // 开启阶段剖析（每sample_every帧采样一轮硬件计数器，须在转发线程启动前调用）
+    void print_prof();                    // 打印阶段剖析（未开启时不输出）
+    void set_quic_obs();                  // 开启QUIC被动观测（自旋位RTT、Q/L丢包位，须在转发线程启动前调用）
+    void print_quic();                    // 打印QUIC被动观测（未开启时不输出）
+    void set_decision_log(DecisionLog *log, int dir); // 录制/回放本方向的损伤决策（须在转发线程启动前调用）
     void printData(const unsigned char* data, size_t size); // 调试：打印数据包十六进制
     void freeNode(Node *node, int dst_fd)  override; // 重写释放节点（添加发送+丢包逻辑）
     bool chance_in_a_thousand(int chance); // 随机丢包判断（千分比概率）
@@ -229,6 +1322,17 @@ public:
     std::string get_tap_name() const { return tap_name; }
 
 private:
+    // 流水线各阶段直接读写限速/损伤参数（编译期组合，不经过虚函数）
+    template<class... Stages> friend struct Pipeline;
+    template<bool On> friend struct ClassifyStage;
+    template<bool On, bool Aqm> friend struct ShapeStage;
+    template<bool On> friend struct AqmQueue;
+    friend struct DelayStage;
+    template<bool On> friend struct LossStage;
+    template<bool On> friend struct CorruptStage;
+    template<bool On> friend struct EmitStage;
+    friend class PathHop;   // 路径段把帧交给最后一跳、丢弃时经本接口释放缓冲区和抓包
+
     std::string tap_name;   // TAP接口名（如tap0）
     std::string br_name;    // 桥接接口名（如aif）
     std::string eth_name;   // 物理网卡名（如eth2_h）
@@ -237,9 +1341,316 @@ private:
     int epoll_fd;           // epoll实例fd
     int64_t delay_ms;       // 数据包延迟时间（毫秒）
     int64_t bandwidth;      // 带宽限制（bps）
-    int64_t pre_time;       // 上一个数据包的计划发送时间（微秒，用于带宽计算）
+    int64_t pre_time;       // 瓶颈链路空闲时间：上一个数据包传输完成的时间（微秒）
     int64_t packet_cnt;     // 接收数据包计数（用于统计）
     int Bloss;              // 丢包率（千分比，如10=1%丢包）
+    int Bdup;               // 重复率（千分比）
+    int Bcorrupt;           // 比特损坏率（千分比）
+    int Bstealth;           // 隐蔽损坏率（千分比）
+    IoMode io_mode;         // 收发后端
+    TapInterface *peer;     // 对端接口（转发目标）
+    TapStats stats;         // 转发统计
+    std::mt19937 rng;       // 随机丢包用的随机数生成器（只在本方向转发线程中使用）
+    CaptureRing *capture_ring; // 抓包描述符环（nullptr=未开启抓包）
+    FramePool frame_pool;   // 帧内存池（TAP后端的帧、路径段的重复帧）
+    int64_t fault_sample_us; // 上次采样缺页计数的时间
+
+    // --------------- 链路中断 ---------------
+    int outage_mode;            // OutageMode（由仿真线程设置）
+    int64_t outage_period_us;   // 间歇中断周期（0=持续中断）
+    int64_t outage_len_us;      // 每个周期开头的中断时长
+    int64_t outage_start_us;    // 中断设置时间（间歇中断的相位起点）
+    bool outage_was_down;       // 上一轮转发循环时链路是否中断（只由转发线程使用，用于检测中断开始）
+    int64_t link_up_us;         // 链路最近一次从中断恢复的时间（计划发送时间早于此的帧是中断中保留的，不计入SLO）
+
+    // --------------- 合成背景流量 ---------------
+    int xt_model;               // 由仿真线程设置的模型
+    int64_t xt_rate;            // 平均速率（Mbps）
+    int xt_flows;               // AIMD流数
+    int64_t xt_qlim_us;         // 背景流量可占用的瓶颈缓冲（排队时延，微秒）
+    int xt_cur_model;           // 转发线程当前使用的模型（与xt_model不同时重置状态）
+    int64_t xt_last_us;         // 上次生成时间
+    double xt_credit;           // 已生成未入队的字节数
+    bool xt_on;                 // Pareto：当前是否处于开状态
+    int64_t xt_phase_end_us;    // Pareto：当前开/关状态的结束时间
+    double xt_cwnd;             // AIMD：总窗口（字节）
+    int64_t xt_last_cut_us;     // AIMD：上次减窗时间（每个RTT最多减一次）
+    uint64_t stats_last_xt;     // 上次打印时的背景流量字节数
+
+    // --------------- 出队整形：瓶颈队列 ---------------
+    // 帧先在瓶颈队列中排队（尚未确定发送时间），链路空闲时按当时的带宽取得传输时段，再进入固定时延的时延线（ListNode链表）
+    Node *bq_head;              // 瓶颈队列头
+    Node *bq_tail;              // 瓶颈队列尾（瓶颈队列中的节点同样计入NodeCount）
+    uint64_t bq_bytes;          // 瓶颈队列中的链路字节数（背景流量按此估计排队时延）
+    int64_t buffer_us;          // 瓶颈缓冲（排队时延上限，0=不限，只受MAX_PACKET_SIZE限制）
+
+    // --------------- ECN / DualQ ---------------
+    int aqm_mode;               // AqmMode（由仿真线程设置）
+    int64_t ecn_thresh_us;      // 阶跃标记阈值
+    int64_t aqm_target_us;      // PI2目标排队时延（时间偏移FIFO的偏移量取其2倍）
+    Node *lq_head;              // DualQ低时延队列（ECT(1)/CE），节点同样计入NodeCount
+    Node *lq_tail;
+    uint64_t lq_bytes;          // 低时延队列中的链路字节数
+    double pi2_p;               // PI2基础概率p'
+    int64_t pi2_prev_qdelay;    // 上次更新时的排队时延
+    int64_t pi2_last_us;        // 上次更新时间
+    std::unique_ptr<EcnFlow[]> ecn_flows;   // 每流CE计数（ECN_FLOW_SLOTS个槽）
+    std::atomic<uint64_t> ecn_flow_overflow; // 槽位用尽后未能按流统计的标记/丢弃数
+
+    // --------------- 多跳路径 ---------------
+    // 帧依次经过hops中的各段，最后进入本接口自己的链路（瓶颈队列 + 时延线）再写到对端；各段由本方向转发线程出队
+    std::vector<std::unique_ptr<PathHop>> hops;
+
+    int64_t loop_us;            // 本轮收/发开始时的时间（tap_read/tap_write各读一次时钟，同一批帧共用）
+
+    // --------------- 发送合并 ---------------
+    int64_t tx_slack;           // 最早到期的帧延后超过该值才出队，期间到期的帧一起发送（微秒，0=到期即发）
+
+    // --------------- 阶段剖析 ---------------
+    std::unique_ptr<StageProfiler> profiler;
+    StageProfiler *prof;        // profiler.get()，未开启时nullptr（各阶段只判空）
+    uint64_t prof_work() const  // 已处理的帧数（收 + 发 + 丢弃），剖析据此判断一轮循环是否处理了帧
+    {
+        return stats.rx_packets.load(std::memory_order_relaxed) + stats.tx_packets.load(std::memory_order_relaxed) +
+               stats.drops.load(std::memory_order_relaxed);
+    }
+
+    // --------------- QUIC被动观测 ---------------
+    std::unique_ptr<QuicObserver> quic_obs;
+    QuicObserver *quic;         // quic_obs.get()，未开启时nullptr（EmitStage只判空）
+
+    // --------------- 损伤决策录制/回放 ---------------
+    std::unique_ptr<DecisionTrack> rr_track;
+    DecisionTrack *rr;          // rr_track.get()，未开启时nullptr（入队只判空）
+    uint8_t rr_decide(const uint8_t *data, uint32_t size, int64_t *delay); // 入队时决定帧的命运
+
+    // --------------- 过载检测 ---------------
+    int64_t slo_us;             // 出队延后超过tx_slack + slo_us的帧违反SLO
+    bool shed_late;             // 违反SLO的帧直接丢弃（CAP_SHED），而不是带着额外时延发送
+    std::atomic<bool> overloaded;   // 仿真器过载标志（转发线程写，打印/控制线程读）
+    int64_t overload_last_us;   // 最近一次出现违反SLO的帧的时间
+
+    // --------------- 守护进程控制 ---------------
+    std::atomic<bool> stopping;         // 转发线程退出标志
+    std::atomic<bool> ingress_open;     // false=入口关闭（排空队列）
+    std::atomic<int> backlog;           // NodeCount的副本，供控制线程读取
+
+    // --------------- 转发流水线 ---------------
+    std::atomic<uint32_t> profile_gen;  // 损伤参数版本（设置函数每次修改时加一）
+    uint32_t pipeline_gen;              // 转发线程已应用的版本
+    const PipelineOps *pipeline;        // 当前使用的流水线特化（只由转发线程读写）
+
+    // --------------- vnet头卸载 ---------------
+    bool offload;                       // 是否开启IFF_VNET_HDR + TUNSETOFFLOAD
+    uint32_t vnet_hdr_len;              // 每帧前的virtio_net_hdr长度（未开启时为0）
+    uint32_t rx_buf_size;               // 单帧读缓冲大小（含vnet头）
+    std::vector<uint8_t> rx_scratch;    // 超帧读取/软件分段用的暂存缓冲
+    std::vector<uint8_t> gso_lost;      // emit_gso中各分段是否丢失（按超帧分段数增长）
+    int64_t stats_last_us;  // 上次打印统计的时间（用于计算速率，仅打印线程使用）
+    uint64_t stats_last_rx; // 上次打印时的接收字节数
+    uint64_t stats_last_tx; // 上次打印时的发送字节数
+
+    // --------------- AF_PACKET TPACKET_V3 收发环 ---------------
+    int ring_mb;                        // 接收环总大小（MB）
+    uint8_t *ring;                      // mmap映射的收发环（接收环在前，发送环在后）
+    size_t ring_size;                   // 映射总大小
+    uint32_t rx_block_size;             // 接收块大小
+    uint32_t rx_block_nr;               // 接收块数量
+    uint32_t rx_cur;                    // 下一个待处理的接收块
+    std::vector<uint32_t> rx_refs;      // 每个接收块/注册缓冲区的引用数（为0时归还内核/放回空闲池）
+    std::vector<uint8_t> rx_walked;     // 接收块是否已被遍历完
+    uint8_t *tx_ring;                   // 发送环起始地址
+    uint32_t tx_frame_size;             // 发送帧槽大小
+    uint32_t tx_frame_nr;               // 发送帧槽数量
+    uint32_t tx_cur;                    // 下一个可用的发送帧槽（只由对端转发线程写）
+    uint32_t tx_pending;                // 已填充但未提交的发送帧数
+
+    // --------------- io_uring 引擎 ---------------
+    IoUring uring;                      // 本方向的io_uring实例
+    uint8_t *uring_pool;                // 注册缓冲池（连续内存，按uring_buf_size切分）
+    uint32_t uring_buf_size;            // 单个注册缓冲区大小（开启卸载时为64KB超帧大小）
+    size_t uring_pool_size;             // 注册缓冲池大小
+    std::vector<int32_t> uring_free;    // 空闲注册缓冲区号
+    uint32_t uring_rx_posted;           // 已投递未完成的读请求数
+
+    int uring_open();                   // 创建io_uring并注册缓冲池（失败时回退到TAP读写）
+    int uring_read();                   // 补足读请求、一次io_uring_enter提交、收割完成事件
+    bool uring_emit(const uint8_t *data, uint32_t size, int32_t block); // 排队一个写请求（不立即提交，false=提交队列满）
+
+    int packet_open();                  // 打开AF_PACKET套接字并映射收发环
+    int packet_read();                  // 批量处理已就绪的接收块
+    bool packet_emit(const uint8_t *data, uint32_t size); // 帧写入发送环（false=发送环满）
+    int packet_flush();                 // 一次系统调用提交发送环中的全部帧，返回系统调用次数
+    void release_block(int32_t block);  // 节点释放时递减接收块/注册缓冲区/共享内存帧槽引用
+
+    // --------------- 共享内存端点 ---------------
+    ShmRegion *shm;                     // 共享区（IO_SHM，两个方向共用）
+    int shm_port;                       // 本方向收帧的端口（发往对端的端口 1 - shm_port）
+    ShmPort *shm_in;                    // 本方向消费其tx环
+    ShmPort *shm_out;                   // 本方向生产其rx环
+    ShmDesc *shm_in_desc, *shm_out_desc;
+    uint32_t shm_rd;                    // tx环中下一个待读的项（已读未回收的帧槽在延迟线中）
+    uint32_t shm_tail;                  // tx环已回收到的位置（发布给端点的tail）
+    uint32_t shm_reclaim;               // rx环中已被端点消费、尚未回收帧槽引用的位置
+    uint32_t shm_posted;                // 本轮循环发往rx环的帧数（用于决定是否唤醒端点）
+    std::vector<uint32_t> shm_free;     // 复制池中的空闲帧槽
+
+    int shm_open();                     // 绑定共享区中的端口
+    int shm_read();                     // 取出tx环中的全部新帧入队（帧留在帧槽中）
+    bool shm_emit(const uint8_t *data, uint32_t size, int32_t block); // 帧槽号写入对端rx环（堆内存中的帧先复制到复制池）
+    int shm_flush();                    // 回收端点已消费的rx项，端点等待时写eventfd唤醒，返回系统调用次数
+    bool enqueue(uint8_t *data, uint32_t size, int64_t time_now, int32_t block); // 计算发送时间并加入链表
+    bool emit(const uint8_t *data, uint32_t size, int32_t block); // 按后端把帧发往对端（false=发送失败）
+    uint32_t wire_size(const uint8_t *data, uint32_t size);      // 帧在链路上的字节数（GSO超帧按分段累计）
+    void emit_gso(Node *node);          // GSO超帧按分段判断丢包，必要时软件分段后发送
+    bool corrupt(uint8_t *data, uint32_t size, bool stealth); // 按后端取vnet头后损坏一个比特
+    bool link_down(int64_t now);        // 当前时刻链路是否处于中断中
+    bool admit_closed(int64_t now);     // 入口是否丢弃新到的帧（链路中断或入口关闭）
+    void admit_drop(const uint8_t *data, uint32_t size, int64_t now); // 链路中断时在入口丢弃（只计数，不分配）
+    void drop_node(Node *node, uint8_t reason); // 不发送直接释放节点（计入丢弃）
+    void flush_queue();                 // 丢弃队列中全部待发送的帧
+    void bq_push(Node *node);           // 加入瓶颈队列尾部（DualQ时ECT(1)/CE帧进入低时延队列）
+    Node *aqm_pop(bool& from_l);        // 按时间偏移FIFO从低时延/经典队列取下一帧
+    bool aqm_dequeue(Node *node, bool from_l, int64_t start); // 出队标记CE或丢弃（false=已丢弃）
+    void aqm_update(int64_t now);       // 每PI2_TUPDATE_US更新一次PI2基础概率
+    EcnFlow *ecn_flow(const uint8_t *data, uint32_t size); // 查找/占用帧所属流的计数槽（nullptr=槽位用尽）
+    int64_t queue_delay(int64_t now);   // 瓶颈排队时延估计（正在传输的剩余时间 + 队列字节/带宽）
+    void sync_pipeline();               // 损伤参数变化后按阶段集合重新选择流水线特化
+    void release_node(Node *node);      // 释放节点及其缓冲区（堆内存或共享缓冲区引用）
+    void release_data(Node *node);      // 只释放节点的缓冲区（路径段释放节点时使用）
+    uint8_t *alloc_frame(uint32_t size);  // 取帧缓冲：先取帧内存池，用尽时用堆内存
+    void free_frame(uint8_t *buf);      // 还帧缓冲（按地址区分帧内存池/堆内存）
+    void sample_faults(int64_t now);    // 每FAULT_SAMPLE_US读一次本线程的缺页计数
+    void hop_arrive(Node *node, int64_t now); // 最后一个路径段交来的帧进入本接口的链路
+    void slo_update(int64_t now, uint64_t overdue); // 每轮出队后更新过载标志和计数（overdue=本轮违反SLO的帧数）
+    void cross_traffic(int64_t now);    // 按模型生成本周期的背景流量并注入队列
+    double pareto(double mean);         // Pareto分布（形状1.5）随机数
+    void capture(const uint8_t *data, uint32_t size, int64_t timesample, int64_t sendtime,
+                 uint8_t reason, uint16_t segs = 1, uint16_t lost_segs = 0); // 把描述符推入抓包环（不阻塞）
+};
+
+// --------------- 多跳路径 ---------------
+/**
+ * @class PathHop
+ * @brief 路径中的一段（如接入链路、共享骨干、末端无线）：自己的瓶颈队列、缓冲、时延线、丢包/重复/损坏参数和场景脚本
+ * @details 一个方向的路径 = 若干PathHop + TapInterface自己的链路（最后一跳，写到对端）。
+ *          帧在内存中逐跳传递：本段到期的节点连同缓冲区直接移入下一段（不拷贝、不经过内核），
+ *          以计划发送时间作为到达下一段的时间，转发线程的调度抖动不会逐跳累积。
+ *          各段使用与TapInterface相同的编译期流水线阶段，最后的发送阶段换成HandoffStage；
+ *          链路中断和背景流量只在最后一跳上设置
+ */
+class PathHop : public ListNode
+{
+public:
+    PathHop(class TapInterface *owner, const std::string& name);
+    ~PathHop();
+    void set_next(PathHop *next) { this->next = next; } // 下一段（nullptr=交给owner自己的链路）
+    void set_delay_ms(int64_t delay_us);  // 单向传播时延（微秒）
+    void set_bw(int64_t bandwidth);       // 带宽（Mbps，0=不限速）
+    void set_loss(int loss);              // 丢包率（千分比）
+    void set_dup(int dup);                // 重复率（千分比）
+    void set_corrupt(int corrupt);        // 比特损坏率（千分比）
+    void set_stealth(int stealth);        // 隐蔽损坏率（千分比）
+    void set_buffer(int64_t us);          // 瓶颈缓冲（排队时延上限，微秒，0=不限）
+    void set_prof(StageProfiler *prof) { this->prof = prof; }
+    void accept(Node *node, int64_t now); // 帧到达本段（now=上一段的计划发送时间）
+    void drain(int64_t now);              // 本段到期的帧交给下一段（只由owner的转发线程调用）
+    void print_stats(const std::string& tap_name); // 打印本段统计
+    const std::string& get_name() const { return name; }
+    const TapStats& get_stats() const { return stats; }
+
+private:
+    template<class... Stages> friend struct Pipeline;
+    template<bool On, bool Aqm> friend struct ShapeStage;
+    template<bool On> friend struct AqmQueue;
+    friend struct DelayStage;
+    template<bool On> friend struct LossStage;
+    template<bool On> friend struct CorruptStage;
+    template<bool On> friend struct HandoffStage;
+
+    class TapInterface *owner;  // 所属方向（缓冲区归它的接收环/堆内存管理，抓包写入它的环）
+    PathHop *next;              // 下一段
+    std::string name;           // 段名（统计和日志）
+    int64_t delay_ms;           // 单向传播时延（微秒，与TapInterface同名）
+    int64_t bandwidth;          // 带宽（Mbps）
+    int64_t pre_time;           // 本段瓶颈链路空闲时间
+    int Bloss, Bdup, Bcorrupt, Bstealth;
+    int64_t buffer_us;          // 瓶颈缓冲（排队时延上限，0=不限）
+    Node *bq_head, *bq_tail;    // 瓶颈队列
+    uint64_t bq_bytes;          // 瓶颈队列中的链路字节数
+    int64_t tx_slack;           // 固定为0：各段到期即交出，合并只在最后一跳
+    int64_t slo_us;             // 不检查：各段出队的延后由最后一跳的SLO统计
+    bool shed_late;
+    int64_t link_up_us;         // 固定为0：各段没有链路中断
+    StageProfiler *prof;        // 所属方向的剖析器（各段由同一个转发线程出队，计入同一组阶段）
+    TapStats stats;             // 本段统计（rx=到达，tx=交给下一段）
+    std::mt19937 rng;
+    std::atomic<uint32_t> profile_gen;  // 参数版本（设置函数修改时加一）
+    uint32_t pipeline_gen;
+    const HopOps *pipeline;
+
+    bool chance_in_a_thousand(int chance);
+    bool corrupt(uint8_t *data, uint32_t size, bool stealth);
+    void capture(const uint8_t *data, uint32_t size, int64_t timesample, int64_t sendtime, uint8_t reason);
+    void bq_push(Node *node);
+    int64_t queue_delay(int64_t now);
+    void release_node(Node *node);
+    void drop_node(Node *node, uint8_t reason);
+    void slo_update(int64_t, uint64_t) {}
+    void handoff(Node *node);           // 交给下一段（或owner的链路）
+    Node *clone(const Node *node);      // 重复帧：复制一份独立的堆内存
+    void sync_pipeline();
+};
+
+// --------------- 守护进程 ---------------
+/**
+ * @class ScenarioDaemon
+ * @brief 常驻模式：TAP/网桥/转发线程/缓冲池只创建一次，通过本地unix套接字接收场景，按时开始
+ * @details 每行一条命令，每条命令回复一行（OK ... 或 ERR ...）：
+ *          LOAD <脚本文件> / MODEL <模型文件> / SCRIPT（随后逐行发送脚本，END结束）：预先加载下一次运行
+ *          START [总时长ms] [at=<epoch毫秒>|in=<毫秒>]：按时开始已加载的运行，正在运行时到点直接接替
+ *          STOP：结束当前运行，链路恢复为无限制
+ *          DRAIN [超时ms]：结束当前运行，关闭入口直到两个方向的队列排空
+ *          STATUS：运行状态、切换延迟和转发统计
+ *          SHUTDOWN：退出守护进程
+ *          多个控制连接同时接入，按poll就绪的顺序处理，空闲的连接不妨碍其他连接发送命令
+ */
+class ScenarioDaemon {
+public:
+    ScenarioDaemon(class TapInterface* t0, class TapInterface* t1);
+    ~ScenarioDaemon();
+    bool open(const std::string& path);     // 创建并监听unix套接字
+    void serve();                           // 处理所有连接上的命令，直到收到SHUTDOWN
+
+private:
+    /**
+     * @struct Client
+     * @brief 一个控制连接：未凑成整行的输入和正在接收的脚本
+     */
+    struct Client {
+        int fd;
+        std::string buf, script;
+        bool in_script;
+    };
+
+    class TapInterface* tap0;
+    class TapInterface* tap1;
+    int listen_fd;
+    std::string sock_path;
+    bool shutdown;
+    std::vector<Client> clients;
+    std::unique_ptr<NetworkSimulator> staged;   // 已加载、未开始的运行
+    std::unique_ptr<NetworkSimulator> current;  // 最近一次START的运行（可能还在等开始时间）
+    std::unique_ptr<NetworkSimulator> previous; // 被current接替的运行（current开始后释放）
+
+    bool serveClient(Client& c);            // 读取并执行一个连接上的命令（false=连接已关闭）
+    std::string handleCommand(const std::string& cmd, const std::string& args);
+    std::string stage(std::unique_ptr<NetworkSimulator> sim, bool ok);
+    std::string start(const std::string& args);
+    void stopRuns();
+    std::string drain(int64_t timeout_ms);
+    std::string status();
+    void reap();                            // 释放已被接替完毕的运行
 };
 
 // 线程函数声明
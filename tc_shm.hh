@@ -0,0 +1,446 @@
+#ifndef TC_SHM_HH_
+#define TC_SHM_HH_
+
+/**
+ * @file tc_shm.hh
+ * @brief 共享内存端点：同一主机上的两个QUIC端点不经过内核，直接把以太网帧交给tc_quic的转发流水线
+ * @details 只依赖libc的头文件库，tc_quic（--io=shm）与端点程序共用同一份内存布局：
+ *          tc_quic创建一块memfd共享区，内有两个端口，每个端口一对SPSC环：
+ *            tx：端点→仿真器，第i项固定使用本端口的第(i & mask)个发送帧槽，端点在帧槽中原地写帧
+ *            rx：仿真器→端点，描述符给出帧槽号；帧槽是对端端口的发送帧槽（零拷贝）或仿真器的复制池
+ *          帧槽在端点释放rx描述符之前一直有效；对端发送帧槽在仿真器回收之前不会被重用
+ *          端点忙轮询时收发都不需要系统调用；接收端要阻塞时先置need_wakeup，仿真器见到后写eventfd唤醒
+ *          端点通过unix套接字（--shm_sock）连接tc_quic，发送端口号，收到memfd和该端口的eventfd（SCM_RIGHTS）
+ * @note 每个端口同一时刻只能由一个进程使用（SPSC）；端点重启后从共享区中的环索引继续
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+
+// --------------- 共享区布局 ---------------
+#define SHM_MAGIC 0x53514354u   // "TCQS"
+#define SHM_VERSION 1
+#define SHM_PORTS 2             // 端口0接在srctap一侧，端口1接在dsttap一侧
+#define SHM_SLOT_SIZE 2048      // 帧槽大小（容纳MAX_FRAME_SIZE）
+
+/**
+ * @struct ShmDesc
+ * @brief 环中的一项：帧槽号 + 帧长度（tx环中slot由端点照填，仿真器按环位置确定帧槽）
+ */
+struct ShmDesc {
+    uint32_t slot;
+    uint32_t len;
+};
+
+/**
+ * @struct ShmRing
+ * @brief 单生产者单消费者环（索引单调递增，按mask取模；生产者与消费者的索引分属不同cache line）
+ */
+struct ShmRing {
+    alignas(64) uint32_t head;          // 生产者写：下一个待填的项
+    alignas(64) uint32_t tail;          // 消费者写：下一个待取的项
+    alignas(64) uint32_t need_wakeup;   // 消费者即将阻塞在eventfd上（生产者发布后检查并唤醒）
+    uint32_t mask;                      // 项数 - 1（项数为2的幂）
+    uint64_t desc_off;                  // 描述符数组相对共享区起始的偏移
+};
+
+/**
+ * @struct ShmPort
+ * @brief 一个端点的一对环
+ */
+struct ShmPort {
+    ShmRing tx;                         // 端点→仿真器
+    ShmRing rx;                         // 仿真器→端点
+    uint32_t tx_slot;                   // 本端口发送帧槽的起始号（共mask + 1个）
+    uint32_t pool_slot;                 // 仿真器发往本端口时复制帧（非共享内存中的帧）所用复制池的起始号
+    uint32_t pool_nr;                   // 复制池帧槽数
+    uint32_t pad;
+};
+
+/**
+ * @struct ShmHeader
+ * @brief 共享区头部（位于偏移0）
+ */
+struct ShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;                 // 帧槽大小
+    uint32_t slot_nr;                   // 帧槽总数
+    uint64_t slots_off;                 // 帧槽数组相对共享区起始的偏移
+    uint64_t size;                      // 共享区总大小
+    ShmPort port[SHM_PORTS];
+};
+
+/**
+ * @struct ShmHello
+ * @brief 接入应答（随SCM_RIGHTS附带memfd和端口的eventfd；status非0时不带fd）
+ */
+struct ShmHello {
+    uint32_t magic;
+    int32_t status;                     // 0=成功，否则为errno
+};
+
+inline ShmDesc *shm_desc(uint8_t *base, const ShmRing& ring)
+{
+    return reinterpret_cast<ShmDesc *>(base + ring.desc_off);
+}
+
+inline uint8_t *shm_slot(uint8_t *base, uint32_t slot)
+{
+    const ShmHeader *hdr = reinterpret_cast<const ShmHeader *>(base);
+    return base + hdr->slots_off + (size_t)slot * hdr->slot_size;
+}
+
+// --------------- 端点 ---------------
+/**
+ * @class ShmEndpoint
+ * @brief 端点一侧的收发接口（零拷贝：tx_alloc/tx_send原地写帧，rx_peek/rx_release原地读帧）
+ * @note 不是线程安全的：一个端点对象只由一个线程收发（或一个线程发、一个线程收）
+ */
+class ShmEndpoint
+{
+public:
+    ShmEndpoint() {}
+    ~ShmEndpoint() { detach(); }
+    ShmEndpoint(const ShmEndpoint&) = delete;
+    ShmEndpoint& operator=(const ShmEndpoint&) = delete;
+
+    /**
+     * @brief 连接tc_quic的接入套接字，映射共享区
+     * @param sock_path tc_quic的--shm_sock
+     * @param port_no 端口号（0=srctap一侧，1=dsttap一侧）
+     * @return int 0=成功，否则为errno
+     */
+    int attach(const char *sock_path, int port_no)
+    {
+        detach();
+        if(port_no < 0 || port_no >= SHM_PORTS)
+        {
+            return EINVAL;
+        }
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+        {
+            return errno;
+        }
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+        uint32_t req = port_no;
+        if(connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+           write(fd, &req, sizeof(req)) != (ssize_t)sizeof(req))
+        {
+            int err = errno;
+            close(fd);
+            return err;
+        }
+
+        ShmHello hello;
+        struct iovec iov = {&hello, sizeof(hello)};
+        char cbuf[CMSG_SPACE(2 * sizeof(int))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        int err = errno;
+        close(fd);
+        if(n != (ssize_t)sizeof(hello) || hello.magic != SHM_MAGIC)
+        {
+            return n < 0 ? err : EPROTO;
+        }
+        if(hello.status != 0)
+        {
+            return hello.status;
+        }
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        if(cm == nullptr || cm->cmsg_type != SCM_RIGHTS || cm->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+        {
+            return EPROTO;
+        }
+        int fds[2];
+        memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+        ShmHeader probe;
+        if(pread(fds[0], &probe, sizeof(probe), 0) != (ssize_t)sizeof(probe) ||
+           probe.magic != SHM_MAGIC || probe.version != SHM_VERSION)
+        {
+            close(fds[0]);
+            close(fds[1]);
+            return EPROTO;
+        }
+        void *map = mmap(nullptr, probe.size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fds[0], 0);
+        close(fds[0]);  // 映射保持共享区
+        if(map == MAP_FAILED)
+        {
+            err = errno;
+            close(fds[1]);
+            return err;
+        }
+        base = static_cast<uint8_t *>(map);
+        size = probe.size;
+        wake_fd = fds[1];
+        port = &reinterpret_cast<ShmHeader *>(base)->port[port_no];
+        tx_desc = shm_desc(base, port->tx);
+        rx_desc = shm_desc(base, port->rx);
+        return 0;
+    }
+
+    /**
+     * @brief 解除映射（未释放的rx帧随之失效）
+     */
+    void detach()
+    {
+        if(base != nullptr)
+        {
+            munmap(base, size);
+            base = nullptr;
+            port = nullptr;
+        }
+        if(wake_fd >= 0)
+        {
+            close(wake_fd);
+            wake_fd = -1;
+        }
+    }
+
+    bool attached() const { return base != nullptr; }
+    int fd() const { return wake_fd; }      // 可读表示rx环有帧（只在置了need_wakeup之后才会被写，见rx_wait）
+
+    /**
+     * @brief 取下一个发送帧槽（原地写帧，再调用tx_send发布）
+     * @return uint8_t* 帧槽（SHM_SLOT_SIZE字节，nullptr=tx环满：仿真器仍持有全部帧槽）
+     */
+    uint8_t *tx_alloc()
+    {
+        uint32_t head = port->tx.head;
+        if(head - __atomic_load_n(&port->tx.tail, __ATOMIC_ACQUIRE) > port->tx.mask)
+        {
+            return nullptr;
+        }
+        return shm_slot(base, port->tx_slot + (head & port->tx.mask));
+    }
+
+    /**
+     * @brief 发布tx_alloc取得的帧槽
+     * @param len 以太网帧长度（14..SHM_SLOT_SIZE）
+     */
+    void tx_send(uint32_t len)
+    {
+        uint32_t head = port->tx.head;
+        ShmDesc& d = tx_desc[head & port->tx.mask];
+        d.slot = port->tx_slot + (head & port->tx.mask);
+        d.len = len;
+        __atomic_store_n(&port->tx.head, head + 1, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief 拷贝发送一个以太网帧
+     * @return bool false=tx环满或帧过大
+     */
+    bool send(const void *frame, uint32_t len)
+    {
+        uint8_t *slot = len <= SHM_SLOT_SIZE ? tx_alloc() : nullptr;
+        if(slot == nullptr)
+        {
+            return false;
+        }
+        memcpy(slot, frame, len);
+        tx_send(len);
+        return true;
+    }
+
+    /**
+     * @brief 查看下一个收到的帧（不阻塞，不拷贝）
+     * @param len 输出：帧长度
+     * @return const uint8_t* 帧（nullptr=rx环空），rx_release之前有效
+     */
+    const uint8_t *rx_peek(uint32_t *len)
+    {
+        uint32_t tail = port->rx.tail;
+        if(__atomic_load_n(&port->rx.head, __ATOMIC_ACQUIRE) == tail)
+        {
+            return nullptr;
+        }
+        const ShmDesc& d = rx_desc[tail & port->rx.mask];
+        *len = d.len;
+        return shm_slot(base, d.slot);
+    }
+
+    /**
+     * @brief 释放rx_peek返回的帧（帧槽交还仿真器）
+     */
+    void rx_release()
+    {
+        __atomic_store_n(&port->rx.tail, port->rx.tail + 1, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief 等待下一个帧：先忙轮询spin次，仍没有帧时置need_wakeup并阻塞在eventfd上
+     * @param len 输出：帧长度
+     * @param timeout_ms 阻塞超时（-1=一直等）
+     * @param spin 阻塞前的轮询次数
+     * @return const uint8_t* 帧（nullptr=超时/被信号打断）
+     */
+    const uint8_t *rx_wait(uint32_t *len, int timeout_ms, int spin = 1000)
+    {
+        const uint8_t *frame;
+        for(int i = 0; i < spin; i++)
+        {
+            if((frame = rx_peek(len)) != nullptr)
+            {
+                return frame;
+            }
+        }
+        __atomic_store_n(&port->rx.need_wakeup, 1, __ATOMIC_SEQ_CST);
+        if((frame = rx_peek(len)) == nullptr)   // 置位之后再查一次，避免错过置位前发布的帧
+        {
+            struct pollfd pfd = {wake_fd, POLLIN, 0};
+            if(poll(&pfd, 1, timeout_ms) > 0)
+            {
+                uint64_t count;
+                ssize_t n = read(wake_fd, &count, sizeof(count));
+                (void)n;
+            }
+            frame = rx_peek(len);
+        }
+        __atomic_store_n(&port->rx.need_wakeup, 0, __ATOMIC_RELAXED);
+        return frame;
+    }
+
+private:
+    uint8_t *base = nullptr;
+    size_t size = 0;
+    int wake_fd = -1;
+    ShmPort *port = nullptr;
+    ShmDesc *tx_desc = nullptr;
+    ShmDesc *rx_desc = nullptr;
+};
+
+// --------------- UDP封装 ---------------
+/**
+ * @struct ShmUdpFlow
+ * @brief 端点发出的UDP/IPv4帧头模板（流水线按以太网/IP/UDP头分类、打ECN标记、观测QUIC）
+ */
+struct ShmUdpFlow {
+    uint8_t src_mac[6];
+    uint8_t dst_mac[6];
+    uint32_t src_ip;        // 网络字节序
+    uint32_t dst_ip;        // 网络字节序
+    uint16_t sport;         // 主机字节序
+    uint16_t dport;         // 主机字节序
+    uint8_t tos;            // DSCP + ECN（如0x01=ECT(1)）
+    uint8_t ttl;
+
+    /**
+     * @brief 在frame中写以太网/IPv4/UDP头和负载（计算IPv4头和UDP校验和）
+     * @param frame 帧缓冲（至少42 + len字节，通常为tx_alloc返回的帧槽）
+     * @param payload 负载（可以已经位于frame + 42处）
+     * @param len 负载长度
+     * @return uint32_t 帧长度（0=超过SHM_SLOT_SIZE）
+     */
+    uint32_t build(uint8_t *frame, const void *payload, uint32_t len) const
+    {
+        uint32_t total = 14 + 20 + 8 + len;
+        if(total > SHM_SLOT_SIZE)
+        {
+            return 0;
+        }
+        if(payload != frame + 42)
+        {
+            memmove(frame + 42, payload, len);
+        }
+        memcpy(frame, dst_mac, 6);
+        memcpy(frame + 6, src_mac, 6);
+        frame[12] = 0x08;
+        frame[13] = 0x00;
+        uint8_t *ip = frame + 14;
+        ip[0] = 0x45;
+        ip[1] = tos;
+        put16(ip + 2, 20 + 8 + len);
+        put16(ip + 4, 0);
+        put16(ip + 6, 0x4000);          // DF
+        ip[8] = ttl != 0 ? ttl : 64;
+        ip[9] = 17;
+        put16(ip + 10, 0);
+        memcpy(ip + 12, &src_ip, 4);
+        memcpy(ip + 16, &dst_ip, 4);
+        put16(ip + 10, fold(sum(ip, 20, 0)));
+        uint8_t *udp = ip + 20;
+        put16(udp, sport);
+        put16(udp + 2, dport);
+        put16(udp + 4, 8 + len);
+        put16(udp + 6, 0);
+        uint32_t pseudo = sum(ip + 12, 8, 0) + 17 + 8 + len;
+        uint16_t csum = fold(sum(udp, 8 + len, pseudo));
+        put16(udp + 6, csum != 0 ? csum : 0xffff);
+        return total;
+    }
+
+    /**
+     * @brief 取UDP/IPv4帧的负载
+     * @param frame 收到的帧
+     * @param len 帧长度
+     * @param payload_len 输出：负载长度
+     * @return const uint8_t* 负载（nullptr=不是UDP/IPv4帧）
+     */
+    static const uint8_t *payload(const uint8_t *frame, uint32_t len, uint32_t *payload_len)
+    {
+        if(len < 42 || frame[12] != 0x08 || frame[13] != 0x00 || (frame[14] >> 4) != 4 || frame[23] != 17)
+        {
+            return nullptr;
+        }
+        uint32_t ihl = (frame[14] & 0x0f) * 4;
+        if(ihl < 20 || 14 + ihl + 8 > len)
+        {
+            return nullptr;
+        }
+        const uint8_t *udp = frame + 14 + ihl;
+        uint32_t ulen = (udp[4] << 8) | udp[5];
+        if(ulen < 8 || 14 + ihl + ulen > len)
+        {
+            return nullptr;
+        }
+        *payload_len = ulen - 8;
+        return udp + 8;
+    }
+
+private:
+    static void put16(uint8_t *p, uint32_t v)
+    {
+        p[0] = v >> 8;
+        p[1] = v & 0xff;
+    }
+    static uint32_t sum(const uint8_t *p, uint32_t len, uint32_t acc)
+    {
+        for(uint32_t i = 0; i + 1 < len; i += 2)
+        {
+            acc += (p[i] << 8) | p[i + 1];
+        }
+        if(len & 1)
+        {
+            acc += p[len - 1] << 8;
+        }
+        return acc;
+    }
+    static uint16_t fold(uint32_t acc)
+    {
+        while(acc >> 16)
+        {
+            acc = (acc & 0xffff) + (acc >> 16);
+        }
+        return ~acc & 0xffff;
+    }
+};
+
+#endif